@@ -19,6 +19,7 @@
 #include <cassert>
 #include <vector>
 #include <bitset>
+#include <mutex>
 
 #include "bitboard.h"
 #include "types.h"
@@ -32,6 +33,9 @@ namespace {
   constexpr unsigned MAX_INDEX = 2*24*64*64; // stm * psq * wksq * bksq = 196608
 
   std::bitset<MAX_INDEX> KPKBitbase;
+  std::once_flag KPKSolved;
+
+  void solve();
 
   // A KPK bitbase index is an integer in [0, IndexMax] range
   //
@@ -72,33 +76,53 @@ bool Bitbases::probe(Square wksq, Square wpsq, Square bksq, Color stm) {
 
   assert(file_of(wpsq) <= FILE_D);
 
+  init();
+
   return KPKBitbase[index(stm, bksq, wksq, wpsq)];
 }
 
 
+/// Bitbases::init() solves the KPK bitbase the first time it is needed. The
+/// solve is the most expensive step of the engine startup and most games never
+/// reach KPK, so it runs on the first probe rather than at launch.
+
 void Bitbases::init() {
 
-  std::vector<KPKPosition> db(MAX_INDEX);
-  unsigned idx, repeat = 1;
+  std::call_once(KPKSolved, solve);
+}
+
 
-  // Initialize db with known win / draw positions
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      db[idx] = KPKPosition(idx);
+/// Bitbases::memory() returns the size of the KPK bitbase, allocated statically
+/// whether or not it has been solved.
 
-  // Iterate through the positions until none of the unknown positions can be
-  // changed to either wins or draws (15 cycles needed).
-  while (repeat)
-      for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
-          repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+size_t Bitbases::memory() {
 
-  // Fill the bitbase with the decisive results
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      if (db[idx] == WIN)
-          KPKBitbase.set(idx);
+  return sizeof(KPKBitbase);
 }
 
 namespace {
 
+  void solve() {
+
+    std::vector<KPKPosition> db(MAX_INDEX);
+    unsigned idx, repeat = 1;
+
+    // Initialize db with known win / draw positions
+    for (idx = 0; idx < MAX_INDEX; ++idx)
+        db[idx] = KPKPosition(idx);
+
+    // Iterate through the positions until none of the unknown positions can be
+    // changed to either wins or draws (15 cycles needed).
+    while (repeat)
+        for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
+            repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+
+    // Fill the bitbase with the decisive results
+    for (idx = 0; idx < MAX_INDEX; ++idx)
+        if (db[idx] == WIN)
+            KPKBitbase.set(idx);
+  }
+
   KPKPosition::KPKPosition(unsigned idx) {
 
     ksq[WHITE] = Square((idx >>  0) & 0x3F);
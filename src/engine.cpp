@@ -0,0 +1,172 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bitboard.h"
+#include "endgame.h"
+#include "engine.h"
+#include "experience.h"
+#include "misc.h"
+#include "polybook.h"
+#include "psqt.h"
+#include "thread.h"
+#include "tune.h"
+#include "uci.h"
+
+namespace Stockfish::Engine {
+
+/// init() sets the engine up, main() calls it before entering the UCI loop. It
+/// must be called once, before any other function of the API.
+
+void init(int argc, char* argv[]) {
+
+  Utility::init(argv[0]);
+  CommandLine::init(argc, argv);
+  UCI::init(Options);
+  Tune::init();
+  Startup::mark("options");
+  PSQT::init();
+  Startup::mark("psqt");
+  Bitboards::init();
+  Startup::mark("bitboards");
+  Position::init();
+  Startup::mark("position");
+  Endgames::init();
+  Startup::mark("endgames");
+  Experience::init();
+  Startup::mark("experience");
+  Threads.set(size_t(Options["Threads"]));
+  Startup::mark("threads");
+  polybook[0].init(Options["Book File"]);
+  Startup::mark("book");
+  Search::clear(); // After threads are up
+  Startup::mark("search clear");
+}
+
+
+/// shutdown() stops the search threads and releases the experience, main() calls
+/// it when the UCI loop returns.
+
+void shutdown() {
+
+  Threads.stop = true;
+  Threads.main()->wait_for_search_finished();
+  Experience::unload();
+  Threads.set(0);
+}
+
+
+/// set_option() is the "setoption" command. It returns false if there is no
+/// option with that name.
+
+bool set_option(const std::string& name, const std::string& value) {
+
+  Threads.main()->wait_for_search_finished();
+
+  if (!Options.count(name))
+      return false;
+
+  Options[name] = value;
+  return true;
+}
+
+
+/// new_game() is the "ucinewgame" command.
+
+void new_game() {
+
+  Threads.main()->wait_for_search_finished();
+  Search::clear();
+}
+
+
+/// stop() is the "stop" command. It may be called from any thread, and makes
+/// a running analyse() return as soon as possible.
+
+void stop() {
+
+  Threads.stop = true;
+}
+
+
+/// analyse() searches 'pos' with the given limits and blocks until the search
+/// is over. As with the "go" command, 'states' is handed over to the thread
+/// pool. Every PV line is passed to 'onInfo', if set, from the main search
+/// thread. An infinite or ponder search returns only after stop() is called.
+
+Result analyse(Position& pos, StateListPtr& states, Search::LimitsType limits,
+               const InfoCallback& onInfo) {
+
+  Result result;
+
+  limits.startTime = now();
+
+  Threads.main()->wait_for_search_finished();
+
+  Search::OnInfo = [&](const Search::Info& info) {
+
+      if (result.lines.size() < size_t(info.multiPV))
+          result.lines.resize(info.multiPV);
+
+      result.lines[info.multiPV - 1] = info;
+
+      if (onInfo)
+          onInfo(info);
+  };
+
+  Search::OnBestMove = [&](Move best, Move ponder) {
+      result.bestMove = best;
+      result.ponder = ponder;
+  };
+
+  Threads.start_thinking(pos, states, limits);
+  Threads.main()->wait_for_search_finished();
+
+  Search::OnInfo = nullptr;
+  Search::OnBestMove = nullptr;
+
+  return result;
+}
+
+
+/// analyse() overload for a position given as a FEN string and a list of moves
+/// in UCI notation, as in the "position" command. Parsing stops at the first
+/// illegal move.
+
+Result analyse(const std::string& fen, const std::vector<std::string>& moves,
+               const Search::LimitsType& limits, const InfoCallback& onInfo) {
+
+  StateListPtr states(new std::deque<StateInfo>(1));
+  Position pos;
+
+  pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
+
+  for (std::string m : moves)
+  {
+      Move move = UCI::to_move(pos, m);
+
+      if (move == MOVE_NONE)
+          break;
+
+      states->emplace_back();
+      pos.do_move(move, states->back());
+  }
+
+  return analyse(pos, states, limits, onInfo);
+}
+
+} // namespace Stockfish::Engine
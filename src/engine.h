@@ -0,0 +1,62 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ENGINE_H_INCLUDED
+#define ENGINE_H_INCLUDED
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "position.h"
+#include "search.h"
+#include "types.h"
+
+namespace Stockfish::Engine {
+
+/// The Engine namespace is the C++ API for embedding the engine in another
+/// program, linked against libhypnos.a ("make library"). It drives the same
+/// ThreadPool as the UCI loop but takes positions and limits as data and hands
+/// back the search results as Search::Info, so a caller running many short
+/// searches pays nothing for formatting and parsing UCI text.
+
+using InfoCallback = std::function<void(const Search::Info&)>;
+
+/// Result is what analyse() returns: the best move, the ponder move (MOVE_NONE
+/// if there is none), and the last Info received for each MultiPV line.
+
+struct Result {
+  Move bestMove = MOVE_NONE;
+  Move ponder = MOVE_NONE;
+  std::vector<Search::Info> lines;
+};
+
+void init(int argc, char* argv[]);
+void shutdown();
+bool set_option(const std::string& name, const std::string& value);
+void new_game();
+void stop();
+
+Result analyse(Position& pos, StateListPtr& states, Search::LimitsType limits,
+               const InfoCallback& onInfo = nullptr);
+Result analyse(const std::string& fen, const std::vector<std::string>& moves,
+               const Search::LimitsType& limits, const InfoCallback& onInfo = nullptr);
+
+} // namespace Stockfish::Engine
+
+#endif // #ifndef ENGINE_H_INCLUDED
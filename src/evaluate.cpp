@@ -26,6 +26,7 @@
 #include <iostream>
 #include <streambuf>
 #include <vector>
+#include <atomic>
 
 #include "bitboard.h"
 #include "evaluate.h"
@@ -35,6 +36,7 @@
 #include "thread.h"
 #include "timeman.h"
 #include "uci.h"
+#include "nnue/evaluate_nnue.h"
 
 
 
@@ -49,11 +51,41 @@ namespace Eval {
 //    Personality activePersonality;
 
 
+    int ClassicalBlend = 0;
+
     // Funzione per stampare un messaggio informativo sulla valutazione classica
     void print_classical_eval_message() {
         sync_cout << "info string classical evaluation enabled" << sync_endl;
     }
 
+    /// Cache::resize() sets the size of the cache in megabytes, rounded down
+    /// to a power of 2 number of entries, and clears it. Zero disables it.
+
+    void Cache::resize(size_t mbSize) {
+
+      size_t entries = mbSize * 1024 * 1024 / sizeof(Entry);
+
+      if (entries)
+          entries = size_t(1) << msb(entries);
+
+      if (entries != table.size())
+      {
+          table = std::vector<Entry>(entries);
+          table.shrink_to_fit();
+          mask = entries ? entries - 1 : 0;
+      }
+
+      clear();
+    }
+
+    /// Cache::clear() empties the cache and resets the hit counters
+
+    void Cache::clear() {
+
+      std::fill(table.begin(), table.end(), Entry{ 0, VALUE_NONE });
+      hits = probes = 0;
+    }
+
 }
 
 namespace Trace {
@@ -64,7 +96,8 @@ namespace Trace {
     MATERIAL = 8, IMBALANCE, MOBILITY, THREAT, PASSED, SPACE, WINNABLE, TOTAL, TERM_NB
   };
 
-  Score scores[TERM_NB][COLOR_NB];
+  // Each thread traces its own evaluations, see Eval::trace_batch()
+  thread_local Score scores[TERM_NB][COLOR_NB];
 
   static double to_cp(Value v) { return double(v) / PawnValueEg; }
 
@@ -971,8 +1004,29 @@ Value Eval::evaluate(const Position& pos) {
     // Simplified complexity calculation
     int complexity = 0; // Default complexity
 
-    // Calculate the initial evaluation
-    Value v = Evaluation<NO_TRACE>(pos).value();
+    // Calculate the initial evaluation, or take it from the thread's cache
+    auto classical = [&]() {
+        Value cv;
+        Eval::Cache& cache = pos.this_thread()->evalCache;
+        if (!cache.probe(pos.key(), cv))
+        {
+            cv = Evaluation<NO_TRACE>(pos).value();
+            cache.save(pos.key(), cv);
+        }
+        return cv;
+    };
+
+    Value v;
+    if (NNUE::enabled())
+    {
+        // Optionally blend in part of the classical evaluation
+        int blend = ClassicalBlend;
+        v = NNUE::evaluate(pos);
+        if (blend)
+            v = (v * (100 - blend) + classical() * blend) / 100;
+    }
+    else
+        v = classical();
 
     // Blend optimism with complexity and PSQ evaluation
     optimism += optimism * (complexity + abs(psq - v)) / 512;
@@ -1036,6 +1090,14 @@ ss << std::showpoint << std::noshowpos << std::fixed << std::setprecision(2)
 v = pos.side_to_move() == WHITE ? v : -v;
 ss << "\nClassical evaluation   " << to_cp(v) << " (white side)\n";
 
+if (NNUE::enabled())
+{
+    NNUE::refresh(pos);
+    v = NNUE::evaluate(pos);
+    v = pos.side_to_move() == WHITE ? v : -v;
+    ss << "NNUE evaluation        " << to_cp(v) << " (white side)\n";
+}
+
 v = evaluate(pos);
 v = pos.side_to_move() == WHITE ? v : -v;
 ss << "Final evaluation       " << to_cp(v) << " (white side)\n";
@@ -1043,4 +1105,173 @@ ss << "Final evaluation       " << to_cp(v) << " (white side)\n";
 return ss.str();
 }
 
+namespace {
+
+  // The terms of the trace table, in the same order. A batch row has the white
+  // and black middlegame and endgame values of each of them.
+  constexpr int TraceTerms[] = {
+    MATERIAL, IMBALANCE, PAWN, KNIGHT, BISHOP, ROOK, QUEEN,
+    MOBILITY, KING, THREAT, PASSED, SPACE, WINNABLE, TOTAL
+  };
+
+  constexpr const char* TraceNames[] = {
+    "material", "imbalance", "pawns", "knights", "bishops", "rooks", "queens",
+    "mobility", "king", "threats", "passed", "space", "winnable", "total"
+  };
+
+  constexpr size_t TraceTermCount = sizeof(TraceTerms) / sizeof(TraceTerms[0]);
+
+  // TraceRow is also the record of the binary output, little-endian int16 values.
+  // 'eval' is the classical evaluation from white's point of view, VALUE_NONE
+  // when the side to move is in check. Terms are zero for positions that have
+  // a specialized endgame evaluation.
+  struct TraceRow {
+    int16_t eval;
+    int16_t terms[TraceTermCount][COLOR_NB][PHASE_NB];
+  };
+
+  static_assert(sizeof(TraceRow) == 2 + TraceTermCount * 8, "Unexpected TraceRow size");
+
+  // TraceThread evaluates the positions [next, end) of the current block with
+  // Evaluation<TRACE>, taking them one by one from the counter shared with the
+  // other trace threads. See Eval::trace_batch().
+  struct TraceThread : public Thread {
+
+    TraceThread(size_t n) : Thread(n) { independent = true; }
+    void search() override;
+
+    const std::vector<std::string>* fens;
+    std::vector<TraceRow>* rows;
+    std::atomic<size_t>* next;
+    size_t begin, end;
+  };
+
+  void TraceThread::search() {
+
+    bestValue = VALUE_ZERO;
+
+    for (size_t i; (i = (*next)++) < end; )
+    {
+        StateInfo st;
+        Position pos;
+        TraceRow& row = (*rows)[i - begin];
+
+        pos.set((*fens)[i], Options["UCI_Chess960"], &st, this);
+        std::memset(&row, 0, sizeof(row));
+
+        if (pos.checkers())
+        {
+            row.eval = int16_t(VALUE_NONE);
+            continue;
+        }
+
+        std::memset(scores, 0, sizeof(scores));
+
+        Value v = Evaluation<TRACE>(pos).value();
+        row.eval = int16_t(pos.side_to_move() == WHITE ? v : -v);
+
+        for (size_t t = 0; t < TraceTermCount; ++t)
+            for (Color c : { WHITE, BLACK })
+            {
+                row.terms[t][c][MG] = int16_t(mg_value(scores[TraceTerms[t]][c]));
+                row.terms[t][c][EG] = int16_t(eg_value(scores[TraceTerms[t]][c]));
+            }
+    }
+  }
+
+} // namespace
+
+
+/// trace_batch() traces the classical evaluation of all the positions of 'fens'
+/// with several threads and writes one row per position to 'file', in the order
+/// of the list, either as CSV with a header line or as raw TraceRow records.
+/// Values are in internal units, the trace table divides them by PawnValueEg.
+
+void Eval::trace_batch(const std::vector<std::string>& fens, const std::string& file,
+                       bool binary, size_t workers) {
+
+  // Positions are evaluated and written in blocks, so the rows of a huge list
+  // are never all kept in memory
+  constexpr size_t BlockSize = 1 << 16;
+
+  std::ofstream out(file, binary ? std::ios::out | std::ios::binary : std::ios::out);
+  if (!out.is_open())
+  {
+      sync_cout << "info string Unable to open file " << file << sync_endl;
+      return;
+  }
+
+  if (!binary)
+  {
+      out << "fen,eval";
+      for (const char* name : TraceNames)
+          for (const char* side : { "white", "black" })
+              for (const char* phase : { "mg", "eg" })
+                  out << "," << name << "_" << side << "_" << phase;
+      out << "\n";
+  }
+
+  TimePoint start = now();
+  std::atomic<size_t> next(0);
+  std::vector<TraceRow> rows;
+  std::vector<TraceThread*> threads;
+
+  for (size_t i = 0; i < std::max(workers, size_t(1)); ++i)
+  {
+      TraceThread* th = new TraceThread(i);
+      th->clear();
+      th->fens = &fens;
+      th->rows = &rows;
+      th->next = &next;
+      threads.push_back(th);
+  }
+
+  for (size_t begin = 0; begin < fens.size(); begin += BlockSize)
+  {
+      size_t end = std::min(begin + BlockSize, fens.size());
+
+      rows.resize(end - begin);
+      next = begin;
+
+      for (TraceThread* th : threads)
+      {
+          th->begin = begin, th->end = end;
+          th->start_searching();
+      }
+
+      for (TraceThread* th : threads)
+          th->wait_for_search_finished();
+
+      if (binary)
+          out.write(reinterpret_cast<const char*>(rows.data()), std::streamsize(rows.size() * sizeof(TraceRow)));
+      else
+          for (size_t i = begin; i < end; ++i)
+          {
+              const TraceRow& row = rows[i - begin];
+              std::string fen = fens[i];
+              fen.erase(fen.find_last_not_of(' ') + 1);
+
+              out << fen << "," << row.eval;
+              for (size_t t = 0; t < TraceTermCount; ++t)
+                  for (Color c : { WHITE, BLACK })
+                      out << "," << row.terms[t][c][MG] << "," << row.terms[t][c][EG];
+              out << "\n";
+          }
+
+      if (end < fens.size())
+          sync_cout << "info string evaltrace " << end << " of " << fens.size() << " positions" << sync_endl;
+  }
+
+  for (TraceThread* th : threads)
+      delete th;
+
+  TimePoint elapsed = now() - start + 1;
+
+  sync_cout << "info string evaltrace positions " << fens.size()
+            << " workers " << threads.size()
+            << " time " << elapsed
+            << " positions/second " << fens.size() * 1000 / elapsed
+            << (out ? "" : ", write error on " + file) << sync_endl;
+}
+
 } // namespace Stockfish
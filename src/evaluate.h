@@ -20,6 +20,7 @@
 #define EVALUATE_H_INCLUDED
 
 #include <string>
+#include <vector>
 
 #include "types.h"
 
@@ -31,10 +32,64 @@ namespace Eval {
 
   void print_classical_eval_message();
   std::string trace(Position& pos);
+  void trace_batch(const std::vector<std::string>& fens, const std::string& file,
+                   bool binary, size_t workers);
 
 
   Value evaluate(const Position& pos);
 
+  // Percentage of the classical evaluation blended into the NNUE one, set by
+  // the "NNUE Classical Blend" option
+  extern int ClassicalBlend;
+
+  /// Cache keeps the classical evaluation of recently seen positions, before
+  /// optimism and rule50 damping are applied. Every thread has its own cache,
+  /// so entries are read and written without synchronization.
+
+  class Cache {
+
+    struct Entry {
+      uint32_t key32;
+      int32_t  value;
+    };
+
+    static_assert(sizeof(Entry) == 8, "Unexpected Entry size");
+
+  public:
+    void resize(size_t mbSize);
+    void clear();
+
+    bool probe(Key key, Value& v) {
+
+      if (table.empty())
+          return false;
+
+      ++probes;
+      const Entry& e = table[size_t(key) & mask];
+      if (e.key32 != uint32_t(key >> 32) || e.value == VALUE_NONE)
+          return false;
+
+      ++hits;
+      v = Value(e.value);
+      return true;
+    }
+
+    void save(Key key, Value v) {
+
+      if (!table.empty())
+          table[size_t(key) & mask] = { uint32_t(key >> 32), int32_t(v) };
+    }
+
+    size_t size() const { return table.size() * sizeof(Entry); }
+    size_t size_mb() const { return size() / (1024 * 1024); }
+
+    uint64_t hits = 0, probes = 0;
+
+  private:
+    std::vector<Entry> table;
+    size_t mask = 0;
+  };
+
 } // namespace Eval
 
 } // namespace Stockfish
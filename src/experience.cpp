@@ -23,14 +23,28 @@
 #include <sstream>
 #include <fstream>
 #include <vector>
+#include <cstring>
 #include <stdio.h> //For: remove()
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <thread>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <sys/file.h> //For: flock()
+#endif
+
 #include "misc.h"
 #include "uci.h"
 #include "position.h"
 #include "thread.h"
+#include "polybook.h"
 #include "experience.h"
 
 using namespace std;
@@ -93,6 +107,17 @@ using namespace Stockfish;
     template<typename tVal> using SugaRKeyMap = SugaRMap<Key, tVal>;
 #endif
 
+//Approximate heap size of a map: the dense map stores the pairs in its buckets,
+//the standard one allocates a node per element next to the bucket array
+template<typename tMap> size_t map_memory(const tMap& m)
+{
+#ifdef USE_GOOGLE_SPARSEHASH_DENSEMAP
+    return m.bucket_count() * sizeof(typename tMap::value_type);
+#else
+    return m.bucket_count() * sizeof(void*) + m.size() * (sizeof(typename tMap::value_type) + 2 * sizeof(void*));
+#endif
+}
+
 namespace Experience
 {
     class ExperienceReader
@@ -100,25 +125,36 @@ namespace Experience
     protected:
         bool        match;
         size_t      entriesCount;
+        size_t      dataOffset;
+        size_t      entryLength;
+        size_t      partialLength;   //Bytes of a record cut short at the end of the file
 
     public:
-        ExperienceReader() : match(false), entriesCount(0) {}
+        ExperienceReader() : match(false), entriesCount(0), dataOffset(0), entryLength(0), partialLength(0) {}
         virtual ~ExperienceReader() = default;
 
     protected:
-        bool check_signature_set_count(ifstream& input, size_t inputLength, const string &signature, size_t entrySize)
+        //With 'allowPartial', the format is one that entries are appended to, and a trailing
+        //part of an entry is what an append interrupted by a crash leaves behind. It is then
+        //ignored rather than making the whole file invalid, see 'partial_length'
+        bool check_signature_set_count(ifstream& input, size_t inputLength, const string &signature, size_t entrySize, bool allowPartial = false)
         {
             assert(input && input.is_open() && inputLength);
 
             //Check if data length contains full experience entries
             auto check_exp_count = [&]() -> bool
             {
+                if (inputLength < signature.length())
+                    return false;
+
                 size_t entriesDataLength = inputLength - signature.length();
                 entriesCount = entriesDataLength / entrySize;
+                partialLength = entriesDataLength - entriesCount * entrySize;
 
-                if (entriesCount * entrySize != entriesDataLength)
+                if (partialLength && !allowPartial)
                 {
                     entriesCount = 0;
+                    partialLength = 0;
                     return false;
                 }
 
@@ -162,6 +198,8 @@ namespace Experience
             };
 
             //Start fresh
+            dataOffset = signature.length();
+            entryLength = entrySize;
             match = check_exp_count() && check_signature();
                 
             //Restore file pointer if it is not a match
@@ -177,10 +215,23 @@ namespace Experience
             return entriesCount;
         }
 
+        size_t partial_length()
+        {
+            return partialLength;
+        }
+
     public:
         virtual int get_version() = 0;
         virtual bool check_signature(ifstream& input, size_t inputLength) = 0;
         virtual bool read(ifstream& input, Current::ExpEntry* exp) = 0;
+
+        //Positions the input so that the next 'read' returns entry #n. Entries of fixed size follow the signature
+        virtual bool seek(ifstream& input, size_t n)
+        {
+            assert(match && input.is_open() && n <= entriesCount);
+
+            return (bool)input.seekg(dataOffset + n * entryLength);
+        }
     };
 
     ////////////////////////////////////////////////////////////////
@@ -249,7 +300,7 @@ namespace Experience
 
             virtual bool check_signature(ifstream& input, size_t inputLength)
             {
-                return check_signature_set_count(input, inputLength, ExperienceSignature, sizeof(ExpEntry));
+                return check_signature_set_count(input, inputLength, ExperienceSignature, sizeof(ExpEntry), true);
             }
 
             virtual bool read(ifstream& input, Current::ExpEntry* exp)
@@ -264,17 +315,365 @@ namespace Experience
         };
     }
 
+    ////////////////////////////////////////////////////////////////
+    // V3
+    ////////////////////////////////////////////////////////////////
+    //Compact format written by 'defrag' and 'merge'. The positions are sorted by key and stored in
+    //blocks of up to 'BlockPositions' positions. The key of a position is stored once, as the
+    //difference to the previous key of the block, followed by the number of moves and the moves:
+    //
+    //  varint key delta, varint move count, { uint16 move, varint zigzag value, uint8 depth, varint count }...
+    //
+    //The index that follows the blocks holds the first key, offset and first entry number of each
+    //block. Entries saved to the file later on are appended behind the index as V2 entries (the tail)
+    //and compacted again by the next 'defrag'.
+    namespace V3
+    {
+        const string ExperienceSignature = "SugaR Experience version 3";
+        const int    ExperienceVersion = 3;
+
+        constexpr size_t BlockPositions = 256;
+
+        struct Header
+        {
+            char     signature[32];
+            uint64_t blocks;
+            uint64_t entries;       //Entries stored in the blocks
+            uint64_t indexOffset;
+            uint64_t tailOffset;
+        };
+
+        static_assert(sizeof(Header) == 64);
+
+        struct IndexEntry
+        {
+            Key      key;           //Key of the first position of the block
+            uint64_t offset;
+            uint64_t firstEntry;
+        };
+
+        static_assert(sizeof(IndexEntry) == 24);
+
+        inline void write_varint(vector<uint8_t>& out, uint64_t v)
+        {
+            while (v >= 0x80)
+            {
+                out.push_back(uint8_t(v) | 0x80);
+                v >>= 7;
+            }
+
+            out.push_back(uint8_t(v));
+        }
+
+        inline bool read_varint(const vector<uint8_t>& in, size_t& pos, uint64_t& v)
+        {
+            v = 0;
+            for (int shift = 0; shift < 64 && pos < in.size(); shift += 7)
+            {
+                uint8_t b = in[pos++];
+                v |= uint64_t(b & 0x7F) << shift;
+                if (!(b & 0x80))
+                    return true;
+            }
+
+            return false;
+        }
+
+        class ExperienceReader : public Experience::ExperienceReader
+        {
+        private:
+            Header             header;
+            vector<IndexEntry> index;
+            vector<uint8_t>    block;
+            size_t             nextBlock = 0;
+            size_t             pos = 0;         //Read position in 'block'
+            Key                key = 0;         //Key of the position being read
+            uint64_t           moves = 0;       //Moves of the position left to read
+            size_t             entry = 0;       //Number of the next entry
+            bool               inTail = false;
+
+            bool load_block(ifstream& input, size_t b)
+            {
+                if (b >= index.size())
+                    return false;
+
+                uint64_t end = b + 1 < index.size() ? index[b + 1].offset : header.indexOffset;
+                block.resize(end - index[b].offset);
+
+                input.seekg(index[b].offset);
+                if (!input.read((char*)block.data(), block.size()))
+                    return false;
+
+                nextBlock = b + 1;
+                pos = 0;
+                key = index[b].key;
+                moves = 0;
+
+                return true;
+            }
+
+        public:
+            explicit ExperienceReader() {}
+
+        public:
+            virtual int get_version()
+            {
+                return ExperienceVersion;
+            }
+
+            virtual bool check_signature(ifstream& input, size_t inputLength)
+            {
+                assert(input && input.is_open() && inputLength);
+
+                match = false;
+                entriesCount = 0;
+                partialLength = 0;
+
+                //The tail is appended to, a trailing partial entry is ignored as for V2 files
+                input.seekg(ios::beg);
+                if (   inputLength < sizeof(Header)
+                    || !input.read((char*)&header, sizeof(Header))
+                    || memcmp(header.signature, ExperienceSignature.c_str(), ExperienceSignature.length()) != 0
+                    || header.indexOffset < sizeof(Header)
+                    || header.tailOffset > inputLength
+                    || header.tailOffset - header.indexOffset != header.blocks * sizeof(IndexEntry))
+                {
+                    input.clear();
+                    input.seekg(ios::beg);
+                    return false;
+                }
+
+                index.resize(header.blocks);
+                input.seekg(header.indexOffset);
+                if (!input.read((char*)index.data(), index.size() * sizeof(IndexEntry)))
+                {
+                    sync_cout << "info string Failed to read the index of the experience file" << sync_endl;
+                    return false;
+                }
+
+                //Blocks must be in file order and cover the entries in order
+                for (size_t b = 0; b < index.size(); ++b)
+                    if (   index[b].offset < (b ? index[b - 1].offset : sizeof(Header))
+                        || index[b].offset >= header.indexOffset
+                        || index[b].firstEntry < (b ? index[b - 1].firstEntry : 0)
+                        || index[b].firstEntry > header.entries)
+                        return false;
+
+                entriesCount = header.entries + (inputLength - header.tailOffset) / sizeof(Current::ExpEntry);
+                partialLength = (inputLength - header.tailOffset) % sizeof(Current::ExpEntry);
+                match = true;
+
+                return seek(input, 0);
+            }
+
+            virtual bool read(ifstream& input, Current::ExpEntry* exp)
+            {
+                assert(match && input.is_open());
+
+                //Entries appended after the blocks
+                if (entry >= header.entries)
+                {
+                    if (!inTail)
+                    {
+                        input.seekg(header.tailOffset + (entry - header.entries) * sizeof(Current::ExpEntry));
+                        inTail = true;
+                    }
+
+                    if (!input.read((char*)exp, sizeof(Current::ExpEntry)))
+                        return false;
+
+                    entry++;
+                    return true;
+                }
+
+                while (!moves)
+                {
+                    if (pos >= block.size())
+                    {
+                        if (!load_block(input, nextBlock))
+                            return false;
+
+                        continue;
+                    }
+
+                    uint64_t delta;
+                    if (!read_varint(block, pos, delta) || !read_varint(block, pos, moves))
+                        return false;
+
+                    key += delta;
+                }
+
+                uint64_t value, count;
+                if (pos + 2 > block.size())
+                    return false;
+
+                uint16_t move16 = uint16_t(block[pos] | (block[pos + 1] << 8));
+                pos += 2;
+
+                if (!read_varint(block, pos, value) || pos >= block.size())
+                    return false;
+
+                uint8_t depth8 = block[pos++];
+
+                if (!read_varint(block, pos, count))
+                    return false;
+
+                exp->key   = key;
+                exp->move  = (Move)move16;
+                exp->value = (Value)(int64_t(value >> 1) ^ -int64_t(value & 1));
+                exp->depth = (Depth)depth8;
+                exp->count = (uint16_t)count;
+
+                moves--;
+                entry++;
+
+                return true;
+            }
+
+            //Decodes the block of entry #n up to it
+            virtual bool seek(ifstream& input, size_t n)
+            {
+                assert(match && input.is_open() && n <= entriesCount);
+
+                entry = n;
+                inTail = false;
+                block.clear();
+                pos = 0;
+                moves = 0;
+                nextBlock = 0;
+
+                if (n >= header.entries)
+                    return true;
+
+                auto it = upper_bound(index.begin(), index.end(), n, [](size_t e, const IndexEntry& ie) { return e < ie.firstEntry; });
+                size_t b = size_t(it - index.begin()) - 1;
+                if (!load_block(input, b))
+                    return false;
+
+                entry = index[b].firstEntry;
+
+                Current::ExpEntry tempExp((Key)0, MOVE_NONE, VALUE_NONE, DEPTH_NONE);
+                while (entry < n)
+                    if (!read(input, &tempExp))
+                        return false;
+
+                return true;
+            }
+        };
+
+        //Writes entries given in key order, with the entries of a position next to each other
+        class ExperienceWriter
+        {
+        private:
+            ostream&           out;
+            Header             header;
+            vector<IndexEntry> index;
+            vector<uint8_t>    block;
+            vector<uint8_t>    position;        //Encoded moves of the current position
+            uint64_t           offset = sizeof(Header);
+            Key                lastKey = 0;
+            Key                key = 0;
+            uint64_t           moves = 0;
+            size_t             blockPositions = 0;
+
+            bool end_position()
+            {
+                if (!moves)
+                    return true;
+
+                if (blockPositions == BlockPositions && !flush_block())
+                    return false;
+
+                if (!blockPositions)
+                {
+                    index.push_back(IndexEntry{ key, offset, header.entries });
+                    lastKey = key;
+                }
+
+                write_varint(block, key - lastKey);
+                write_varint(block, moves);
+                block.insert(block.end(), position.begin(), position.end());
+
+                header.entries += moves;
+                lastKey = key;
+                blockPositions++;
+                position.clear();
+                moves = 0;
+
+                return true;
+            }
+
+            bool flush_block()
+            {
+                if (!block.empty() && !out.write((const char*)block.data(), block.size()))
+                    return false;
+
+                offset += block.size();
+                block.clear();
+                blockPositions = 0;
+
+                return true;
+            }
+
+        public:
+            explicit ExperienceWriter(ostream& o) : out(o)
+            {
+                memset(&header, 0, sizeof(Header));
+                memcpy(header.signature, ExperienceSignature.c_str(), ExperienceSignature.length());
+            }
+
+            bool begin()
+            {
+                return (bool)out.write((const char*)&header, sizeof(Header));
+            }
+
+            bool write(const Current::ExpEntry& exp)
+            {
+                assert(!moves || exp.key >= key);
+
+                if (exp.key != key && !end_position())
+                    return false;
+
+                key = exp.key;
+                moves++;
+
+                int64_t v = exp.value;
+                position.push_back(uint8_t(exp.move));
+                position.push_back(uint8_t(exp.move >> 8));
+                write_varint(position, uint64_t(v < 0 ? ((-v - 1) << 1) | 1 : v << 1));
+                position.push_back((uint8_t)clamp((int)exp.depth, 0, (int)numeric_limits<uint8_t>::max()));
+                write_varint(position, exp.count);
+
+                return true;
+            }
+
+            bool end()
+            {
+                if (!end_position() || !flush_block())
+                    return false;
+
+                header.blocks = index.size();
+                header.indexOffset = offset;
+                header.tailOffset = offset + index.size() * sizeof(IndexEntry);
+
+                return    out.write((const char*)index.data(), index.size() * sizeof(IndexEntry))
+                       && out.seekp(0)
+                       && out.write((const char*)&header, sizeof(Header))
+                       && out.seekp(0, ios::end);
+            }
+        };
+    }
+
     ////////////////////////////////////////////////////////////////
     // Typedefs
     ////////////////////////////////////////////////////////////////
-    typedef SugaRKeyMap<ExpEntryEx*> ExpMap;
-    typedef SugaRKeyMap<ExpEntryEx*>::iterator ExpIterator;
-    typedef SugaRKeyMap<ExpEntryEx*>::const_iterator ExpConstIterator;
+    typedef SugaRKeyMap<uint32_t>::iterator MappedIterator;
+    typedef SugaRKeyMap<uint32_t>::const_iterator MappedConstIterator;
 
     ////////////////////////////////////////////////////////////////
-    // ExpEntryEx::quality
+    // ExpMove::quality
     ////////////////////////////////////////////////////////////////
-    pair<int, bool> ExpEntryEx::quality(Stockfish::Position& pos, int evalImportance) const
+    pair<int, bool> ExpMove::quality(Stockfish::Position& pos, int evalImportance) const
     {
         const int QualityExperienceMovesAhead = 10;
         const int QualityEvalImportanceMax = 10;
@@ -306,15 +705,15 @@ namespace Experience
 
             //Look ahead
             Color me = us;
-            const ExpEntryEx* lastExp[COLOR_NB] = { nullptr, nullptr };
-            const ExpEntryEx* temp1 = this;
+            const ExpMove* lastExp[COLOR_NB] = { nullptr, nullptr };
+            const ExpMove* temp1 = this;
             while (true)
             {
                 //To be used later
                 lastExp[me] = temp1;
 
                 //Do the move
-                moves.emplace_back(temp1->move);
+                moves.emplace_back(temp1->move());
                 pos.do_move(moves.back(), states[moves.size() - 1]);
                 me = ~me;
 
@@ -325,23 +724,19 @@ namespace Experience
                     break;
 
                 //Probe the new position
-                temp1 = probe(pos.key());
-                if (!temp1)
+                ExpMoves next = probe(pos.key());
+                if (next.empty())
                     break;
 
                 //Find best next experience move (shallow search)
-                const ExpEntryEx* temp2 = temp1 ? temp1->next : nullptr;
-                while (temp2)
-                {
-                    if (temp2->compare(temp1) > 0)
-                        temp1 = temp2;
-
-                    temp2 = temp2->next;
-                }
+                temp1 = next.begin();
+                for (const ExpMove& temp2 : next)
+                    if (temp2.compare(*temp1) > 0)
+                        temp1 = &temp2;
 
                 if (lastExp[me])
                 {
-                    sum[me] += (int64_t)(temp1->value - lastExp[me]->value);
+                    sum[me] += (int64_t)(temp1->value() - lastExp[me]->value());
                     ++weight[me];
                 }
             }
@@ -372,9 +767,9 @@ namespace Experience
         {
             //Shallow draw detection when 'evalImportance' is zero!
             StateInfo st;
-            pos.do_move(move, st);
+            pos.do_move(move(), st);
             maybeDraw = pos.is_draw(pos.game_ply());
-            pos.undo_move(move);
+            pos.undo_move(move());
         }
 
         return pair<int, bool>(q / QualityEvalImportanceMax, maybeDraw);
@@ -388,564 +783,2522 @@ namespace Experience
 #else
         constexpr size_t WriteBufferSize = 1024 * 1024 * 16;
 #endif
-        
-        class ExperienceData
+
+        //Blocked Bloom filter over position keys. Each key sets one bit in each word of a
+        //single 64-byte block, so rejecting a position that has no experience touches one cache line
+        class KeyFilter
         {
         private:
-            string              _filename;
+            struct alignas(64) Block
+            {
+                uint64_t words[8];
+            };
 
-            vector<ExpEntryEx*> _expData;
-            vector<ExpEntryEx*> _newPvExp;
-            vector<ExpEntryEx*> _newMultiPvExp;
-            vector<ExpEntryEx*> _oldExpData;
+            static constexpr size_t BitsPerKey = 16;
+            static constexpr size_t MinBlocks = 1024;
 
-            ExpMap              _mainExp;
+            vector<Block> _blocks;
 
-            bool                _loading;
-            atomic<bool>        _abortLoading;
-            atomic<bool>        _loadingResult;
-            thread              *_loaderThread;
-            condition_variable  _loadingCond;
-            mutex               _loaderMutex;
+            const Block& block(Key k) const
+            {
+                return _blocks[mul_hi64(k, _blocks.size())];
+            }
 
-        private:
-            void clear()
+            //Bits are taken from a remix of the key, the block index already uses its high bits
+            static uint64_t bits(Key k)
             {
-                //Make sure we are not loading an experience file
-                _abortLoading.store(true, memory_order_relaxed);
-                wait_for_load_finished();
-                assert(_loaderThread == nullptr);
+                return k * 0x9E3779B97F4A7C15ULL;
+            }
 
-                //Clear new exp (this will also flush all new experience data to '_oldExpData' which we will delete later in this function
-                clear_new_exp();
+        public:
+            void resize(size_t keys)
+            {
+                _blocks.assign(max(keys * BitsPerKey / (8 * sizeof(Block)) + 1, MinBlocks), Block{});
+            }
+
+            void clear()
+            {
+                _blocks.clear();
+                _blocks.shrink_to_fit();
+            }
 
-                //Free main exp data
-                for (ExpEntryEx *&p : _expData)
-                    free(p);
+            size_t memory() const
+            {
+                return _blocks.capacity() * sizeof(Block);
+            }
 
-                //Delete previous game experience data
-                for (ExpEntryEx*& p : _oldExpData)
-                    delete p;
+            void add(Key k)
+            {
+                if (_blocks.empty())
+                    return;
 
-                //Clear
-                _mainExp.clear();
-                _oldExpData.clear();
-                _expData.clear();
+                Block& b = const_cast<Block&>(block(k));
+                uint64_t h = bits(k);
+                for (int i = 0; i < 8; ++i)
+                    b.words[i] |= 1ULL << ((h >> (6 * i)) & 63);
             }
 
-            void clear_new_exp()
+            //An empty filter has not been built yet and can not reject anything
+            bool may_contain(Key k) const
             {
-                //Copy exp data to another buffer to be deleted when the whole object is destroyed or new exp file is loaded
-                for (auto& newExp : { _newPvExp, _newMultiPvExp })
-                    std::copy(newExp.begin(), newExp.end(), back_inserter(_oldExpData));
+                if (_blocks.empty())
+                    return true;
 
-                //Clear vectors
-                _newPvExp.clear();
-                _newMultiPvExp.clear();
+                const Block& b = block(k);
+                uint64_t h = bits(k);
+                uint64_t hit = 1;
+                for (int i = 0; i < 8; ++i)
+                    hit &= b.words[i] >> ((h >> (6 * i)) & 63);
+
+                return hit & 1;
             }
 
-            bool link_entry(ExpEntryEx* exp)
+            void prefetch(Key k) const
             {
-                ExpIterator itr = _mainExp.find(exp->key);
+                if (!_blocks.empty())
+                    Stockfish::prefetch(const_cast<Block*>(&block(k)));
+            }
+        };
+        
+        //Pool of experience moves, addressed by 32-bit offsets. Memory is allocated in fixed
+        //chunks that never move, so moves can be read while new ones are being allocated
+        class ExpPool
+        {
+        private:
+            static constexpr size_t ChunkBits = 16;
+            static constexpr size_t ChunkSize = size_t(1) << ChunkBits;
+            static constexpr size_t MaxChunks = (size_t(1) << (32 - ChunkBits)) - 1;
 
-                //If new entry: insert into map and continue
-                if (itr == _mainExp.end())
-                {
-                    _mainExp[exp->key] = exp;
-                    return true;
-                }
+            unique_ptr<unique_ptr<ExpMove[]>[]> _chunks;
+            size_t                              _chunkCount = 0;
+            size_t                              _next = 0;
 
-                //If existing entry and same move exists then merge
-                ExpEntryEx* exp2 = itr->second->find(exp->move);
-                if (exp2)
-                {
-                    exp2->merge(exp);
-                    return false;
-                }
+        public:
+            static constexpr uint32_t None = numeric_limits<uint32_t>::max();
+
+            //Runs of moves never cross a chunk boundary. A position has at most MAX_MOVES moves
+            uint32_t alloc(size_t n)
+            {
+                assert(n > 0 && n <= ChunkSize);
 
-                //If existing entry and different move then insert sorted based on pseudo-quality
-                exp2 = itr->second;
-                do
+                if (_next + n > _chunkCount * ChunkSize)
                 {
-                    if (exp->compare(exp2) > 0)
-                    {
-                        if (exp2 == itr->second)
-                        {
-                            itr->second = exp;
-                            exp->next = exp2;
-                        }
-                        else
-                        {
-                            exp->next = exp2->next;
-                            exp2->next = exp;
-                        }
+                    if (_chunkCount == MaxChunks)
+                        return None;
 
-                        return true;
-                    }
+                    if (!_chunks)
+                        _chunks.reset(new unique_ptr<ExpMove[]>[MaxChunks]);
 
-                    if (!exp2->next)
-                    {
-                        exp2->next = exp;
-                        return true;
-                    }
+                    _chunks[_chunkCount].reset(new ExpMove[ChunkSize]);
+                    _next = _chunkCount++ * ChunkSize;
+                }
 
-                    exp2 = exp2->next;
-                } while (true);
+                uint32_t offset = (uint32_t)_next;
+                _next += n;
 
-                //Should never reach here!
-                assert(false);
-                return true;
+                return offset;
             }
 
-            bool _load(string fn)
+            ExpMove* at(uint32_t offset) const
             {
-                ifstream in(Utility::map_path(fn), ios::in | ios::binary | ios::ate);
-                if (!in.is_open())
+                return _chunks[offset >> ChunkBits].get() + (offset & (ChunkSize - 1));
+            }
+
+            void clear()
+            {
+                _chunks.reset();
+                _chunkCount = _next = 0;
+            }
+
+            //Allocated chunks and the chunk directory, which is allocated whole on first use
+            size_t memory() const
+            {
+                return   _chunkCount * ChunkSize * sizeof(ExpMove)
+                       + (_chunks ? MaxChunks * sizeof(unique_ptr<ExpMove[]>) : 0);
+            }
+        };
+
+        //Open addressing table of positions. A slot holds the position key and the location of
+        //its moves in the pool, so a hit reads one slot and one contiguous run of moves.
+        //Slots are atomic so that positions can be inserted while the table is being probed,
+        //as long as it does not grow: readers see a position once its moves are stored.
+        class ExpTable
+        {
+        public:
+            struct Slot
+            {
+                atomic<Key>      key;
+                atomic<uint64_t> packed;    //Pool location of the moves, zero while there are none
+            };
+
+            static_assert(sizeof(Slot) == 16);
+
+        private:
+            //Key zero marks an empty slot, just like the empty key of the previous hash map
+            static constexpr Key EmptyKey = (Key)0;
+            static constexpr size_t MinSlots = 1024;
+
+            vector<Slot> _slots;
+            size_t       _count = 0;
+
+            size_t index(Key k) const
+            {
+                return (size_t)k & (_slots.size() - 1);
+            }
+
+            //Moves all slots to a new array, so it must not be called while the table is being probed
+            void grow(size_t slots)
+            {
+                vector<Slot> old(slots);
+                old.swap(_slots);
+
+                for (const Slot& s : old)
                 {
-                    sync_cout << "info string Could not open experience file: " << fn << sync_endl;
+                    Key key = s.key.load(memory_order_relaxed);
+                    if (key != EmptyKey)
+                    {
+                        size_t i = index(key);
+                        while (_slots[i].key.load(memory_order_relaxed) != EmptyKey)
+                            i = (i + 1) & (_slots.size() - 1);
+
+                        _slots[i].packed.store(s.packed.load(memory_order_relaxed), memory_order_relaxed);
+                        _slots[i].key.store(key, memory_order_relaxed);
+                    }
+                }
+            }
+
+        public:
+            size_t size() const
+            {
+                return _count;
+            }
+
+            size_t memory() const
+            {
+                return _slots.capacity() * sizeof(Slot);
+            }
+
+            //Keeps the load factor below 0.7 for the given number of positions. Inserting up to
+            //that many positions afterwards never grows the table.
+            void reserve(size_t positions)
+            {
+                size_t slots = max(_slots.size(), MinSlots);
+                while (positions * 10 >= slots * 7)
+                    slots *= 2;
+
+                if (slots != _slots.size())
+                    grow(slots);
+            }
+
+            void prefetch(Key k) const
+            {
+                if (!_slots.empty())
+                    Stockfish::prefetch(const_cast<Slot*>(&_slots[index(k)]));
+            }
+
+            const Slot* find(Key k) const
+            {
+                if (_slots.empty())
+                    return nullptr;
+
+                for (size_t i = index(k); ; i = (i + 1) & (_slots.size() - 1))
+                {
+                    Key key = _slots[i].key.load(memory_order_acquire);
+                    if (key == k)
+                        return &_slots[i];
+
+                    if (key == EmptyKey)
+                        return nullptr;
+                }
+            }
+
+            //Returns the slot of 'k', a new slot has no moves (packed == 0)
+            Slot& insert(Key k)
+            {
+                assert(k != EmptyKey);
+                reserve(_count + 1);
+
+                size_t i = index(k);
+                Key key;
+                while ((key = _slots[i].key.load(memory_order_relaxed)) != k && key != EmptyKey)
+                    i = (i + 1) & (_slots.size() - 1);
+
+                if (key == EmptyKey)
+                {
+                    _slots[i].key.store(k, memory_order_release);
+                    ++_count;
+                }
+
+                return _slots[i];
+            }
+
+            //Calls 'fn' for every position until it returns false
+            template<typename Fn> bool for_each(Fn fn) const
+            {
+                for (const Slot& s : _slots)
+                    if (s.key.load(memory_order_relaxed) != EmptyKey && !fn(s))
+                        return false;
+
+                return true;
+            }
+
+            void clear()
+            {
+                vector<Slot>().swap(_slots);
+                _count = 0;
+            }
+        };
+
+        //Adds 'exp' to the moves of a position, merging it if the same move already exists
+        bool add_move(vector<ExpMove>& moves, const ExpMove& exp)
+        {
+            for (ExpMove& exp2 : moves)
+                if (exp2.move16 == exp.move16)
+                {
+                    exp2.merge(exp);
                     return false;
                 }
 
-                size_t inSize = in.tellg();
-                if (inSize == 0)
+            moves.push_back(exp);
+            return true;
+        }
+
+        //Calls 'fn' with the file entry of every move of a position that is deep enough to be saved,
+        //after scaling the counts of the position down so that the highest one stays below 128.
+        //Stops and returns false as soon as 'fn' does.
+        template<typename Fn> bool for_each_saved_entry(Key k, const ExpMove* first, const ExpMove* last, Fn fn)
+        {
+            //Scale counts
+            uint16_t maxCount = numeric_limits<uint8_t>::min();
+            for (const ExpMove* exp = first; exp != last; ++exp)
+                maxCount = max(maxCount, exp->count);
+
+            uint16_t scale = 1 + maxCount / 128;
+
+            //Save
+            for (const ExpMove* exp = first; exp != last; ++exp)
+            {
+                if (exp->depth() < EXP_MIN_DEPTH)
+                    continue;
+
+                Current::ExpEntry entry(k, exp->move(), exp->value(), exp->depth(), (uint16_t)max(exp->count / scale, 1));
+                if (!fn(entry))
+                    return false;
+            }
+
+            return true;
+        }
+
+        //Orders the moves of a position by pseudo-quality, best first
+        void sort_moves(vector<ExpMove>& moves)
+        {
+            stable_sort(moves.begin(), moves.end(), [](const ExpMove& a, const ExpMove& b) { return a.compare(b) > 0; });
+        }
+
+        //Experience shared by all engine processes of a host that use the same file (see 'Experience Shared').
+        //
+        //The image is a file next to the experience file ('fn.shared') that every process maps read-write.
+        //It holds a read-only base table, built once by the first process from the experience file and its
+        //journal, followed by an append region. A process that learns a new entry writes the merged moves of
+        //its position to the append arena and swings the position's append slot to them with a CAS, so
+        //probing and appending are lock free and every process sees the new moves right away.
+        //
+        //Processes still save their own new entries to the experience file and account for them in the
+        //image. An image that does not match the size of the experience file (defragged, edited by another
+        //tool) is unlinked and rebuilt, processes that still map it keep using it until they reload.
+        class SharedExperience
+        {
+        private:
+            static constexpr char     Signature[] = "SugaR Shared Experience 1";
+            static constexpr uint64_t MinBaseSlots = 1024;
+            static constexpr uint64_t AppendSlots = uint64_t(1) << 21;
+            static constexpr uint64_t ArenaMoves = uint64_t(1) << 24;
+
+            static_assert(atomic<uint64_t>::is_always_lock_free);
+
+            struct Header
+            {
+                char             signature[32];
+                uint64_t         baseSlots;         //Power of two
+                uint64_t         baseMoves;
+                atomic<uint64_t> sourceSize;        //Expected size of the experience file and its journal
+                atomic<uint64_t> appendPositions;
+                atomic<uint64_t> arenaNext;
+                uint64_t         reserved[7];
+            };
+
+            static_assert(sizeof(Header) == 128);
+
+            //Same layout as the private table: the packed location is 'offset << 16 | size'
+            struct Slot
+            {
+                atomic<Key>      key;
+                atomic<uint64_t> packed;
+            };
+
+            static_assert(sizeof(Slot) == 16);
+
+            string         _filename;
+            int            _fd = -1;
+            unsigned char* _data = nullptr;
+            size_t         _size = 0;
+
+            Header*        _header = nullptr;
+            Slot*          _baseSlots = nullptr;
+            ExpMove*       _baseMoves = nullptr;
+            Slot*          _appendSlots = nullptr;
+            ExpMove*       _arena = nullptr;
+            atomic<bool>   _fullReported;
+
+            static size_t image_size(uint64_t baseSlots, uint64_t baseMoves)
+            {
+                return   sizeof(Header)
+                       + baseSlots * sizeof(Slot)
+                       + (baseMoves + baseMoves % 2) * sizeof(ExpMove)
+                       + AppendSlots * sizeof(Slot)
+                       + ArenaMoves * sizeof(ExpMove);
+            }
+
+            void set_pointers()
+            {
+                _header = reinterpret_cast<Header*>(_data);
+                _baseSlots = reinterpret_cast<Slot*>(_data + sizeof(Header));
+                _baseMoves = reinterpret_cast<ExpMove*>(_baseSlots + _header->baseSlots);
+                _appendSlots = reinterpret_cast<Slot*>(_baseMoves + _header->baseMoves + _header->baseMoves % 2);
+                _arena = reinterpret_cast<ExpMove*>(_appendSlots + AppendSlots);
+            }
+
+            static const Slot* find(const Slot* slots, uint64_t count, Key k)
+            {
+                for (uint64_t i = k & (count - 1); ; i = (i + 1) & (count - 1))
                 {
-                    sync_cout << "info string The experience file [" << fn << "] is empty" << sync_endl;
+                    Key key = slots[i].key.load(memory_order_acquire);
+                    if (key == k)
+                        return &slots[i];
+
+                    if (key == (Key)0)
+                        return nullptr;
+                }
+            }
+
+            //Returns the append slot of 'k', or nullptr if the append region has no room for a new position
+            Slot* insert(Key k)
+            {
+                for (uint64_t i = k & (AppendSlots - 1); ; i = (i + 1) & (AppendSlots - 1))
+                {
+                    Key key = _appendSlots[i].key.load(memory_order_acquire);
+                    if (key == k)
+                        return &_appendSlots[i];
+
+                    if (key != (Key)0)
+                        continue;
+
+                    if (_header->appendPositions.load(memory_order_relaxed) * 10 >= AppendSlots * 7)
+                        return nullptr;
+
+                    if (_appendSlots[i].key.compare_exchange_strong(key, k, memory_order_acq_rel))
+                    {
+                        _header->appendPositions.fetch_add(1, memory_order_relaxed);
+                        return &_appendSlots[i];
+                    }
+
+                    //Another process took the slot, possibly for the same position
+                    if (key == k)
+                        return &_appendSlots[i];
+                }
+            }
+
+            bool resize(size_t size)
+            {
+#ifndef _WIN32
+                return ftruncate(_fd, (off_t)size) == 0;
+#else
+                (void)size;
+                return false;
+#endif
+            }
+
+            bool map(size_t size)
+            {
+#ifndef _WIN32
+                void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+                if (data == MAP_FAILED)
                     return false;
+
+                _data = (unsigned char*)data;
+                _size = size;
+                return true;
+#else
+                (void)size;
+                return false;
+#endif
+            }
+
+            void unlock()
+            {
+#ifndef _WIN32
+                if (_fd != -1)
+                    flock(_fd, LOCK_UN);
+#endif
+            }
+
+        public:
+            SharedExperience()
+            {
+                _fullReported.store(false, memory_order_relaxed);
+            }
+
+            ~SharedExperience()
+            {
+                close();
+            }
+
+            bool attached() const
+            {
+                return _header != nullptr;
+            }
+
+            //Size of the mapped image, shared with the other engine processes
+            size_t memory() const
+            {
+                return attached() ? _size : 0;
+            }
+
+            //Combined size of the experience file 'fn' and its journal 'journalFn'
+            static uint64_t source_size(const string& fn, const string& journalFn)
+            {
+                uint64_t size = 0;
+                for (const string& f : { fn, journalFn })
+                    if (Utility::file_exists(Utility::map_path(f)))
+                        size += Utility::get_file_size(f);
+
+                return size;
+            }
+
+            //Maps the image of experience file 'fn' if it is up to date. Otherwise 'build' is set and
+            //the image stays locked, so that other processes wait until the caller has built it.
+            bool open(const string& fn, uint64_t sourceSize, bool& build)
+            {
+                build = false;
+
+#ifdef _WIN32
+                (void)fn;
+                (void)sourceSize;
+                sync_cout << "info string Shared experience is not supported on this platform" << sync_endl;
+                return false;
+#else
+                _filename = Utility::map_path(fn + ".shared");
+
+                for (;;)
+                {
+                    _fd = ::open(_filename.c_str(), O_RDWR | O_CREAT, 0644);
+                    if (_fd == -1)
+                    {
+                        sync_cout << "info string Could not open shared experience file: " << _filename << sync_endl;
+                        return false;
+                    }
+
+                    if (flock(_fd, LOCK_EX) == -1)
+                    {
+                        close();
+                        sync_cout << "info string Could not lock shared experience file: " << _filename << sync_endl;
+                        return false;
+                    }
+
+                    //The image may have been replaced while waiting for the lock
+                    struct stat fdStat, pathStat;
+                    if (   fstat(_fd, &fdStat) == -1
+                        || stat(_filename.c_str(), &pathStat) == -1
+                        || fdStat.st_ino != pathStat.st_ino
+                        || fdStat.st_dev != pathStat.st_dev)
+                    {
+                        close();
+                        continue;
+                    }
+
+                    //A new image
+                    if (fdStat.st_size == 0)
+                    {
+                        build = true;
+                        return true;
+                    }
+
+                    Header header;
+                    if (   (size_t)fdStat.st_size >= sizeof(Header)
+                        && pread(_fd, &header, sizeof(Header), 0) == (ssize_t)sizeof(Header)
+                        && memcmp(header.signature, Signature, sizeof(Signature)) == 0
+                        && (size_t)fdStat.st_size == image_size(header.baseSlots, header.baseMoves)
+                        && header.sourceSize.load(memory_order_relaxed) == sourceSize
+                        && map((size_t)fdStat.st_size))
+                    {
+                        set_pointers();
+                        unlock();
+                        return true;
+                    }
+
+                    //Out of date: processes that map it keep their copy, new ones use a new image
+                    remove(_filename.c_str());
+                    close();
                 }
+#endif
+            }
 
-                //Define readers
-                //Order should be from most recent to oldest
-                class ExpReaders
+            //Builds the image from the private data of the experience file and unlocks it
+            bool build(const ExpTable& table, const ExpPool& pool, uint64_t sourceSize)
+            {
+                assert(_fd != -1 && !_data);
+
+                uint64_t positions = table.size(), moves = 0;
+                table.for_each([&](const ExpTable::Slot& s) { moves += s.packed.load(memory_order_relaxed) & 0xFFFF; return true; });
+
+                uint64_t baseSlots = MinBaseSlots;
+                while (positions * 10 >= baseSlots * 7)
+                    baseSlots *= 2;
+
+                //The file is sparse, pages of the append region only take memory once they are used
+                size_t size = image_size(baseSlots, moves);
+                if (!resize(size) || !map(size))
                 {
-                public:
-                    vector<pair<const char*, ExperienceReader*>> readers;
+                    sync_cout << "info string Could not create shared experience file: " << _filename << sync_endl;
+                    remove(_filename.c_str());
+                    close();
+                    return false;
+                }
 
-                public:
-                    ExpReaders()
+                Header* header = new (_data) Header();
+                header->baseSlots = baseSlots;
+                header->baseMoves = moves;
+                header->sourceSize.store(sourceSize, memory_order_relaxed);
+                header->appendPositions.store(0, memory_order_relaxed);
+                header->arenaNext.store(0, memory_order_relaxed);
+                set_pointers();
+
+                uint64_t next = 0;
+                table.for_each([&](const ExpTable::Slot& s)
                     {
-                        readers.emplace_back("Experience (V2) reader", new V2::ExperienceReader());
-                        readers.emplace_back("Experience (V1) reader", new V1::ExperienceReader());
+                        Key key = s.key.load(memory_order_relaxed);
+                        uint64_t packed = s.packed.load(memory_order_relaxed);
+                        if (!packed)
+                            return true;
+
+                        uint64_t i = key & (baseSlots - 1);
+                        while (_baseSlots[i].key.load(memory_order_relaxed) != (Key)0)
+                            i = (i + 1) & (baseSlots - 1);
+
+                        std::copy(pool.at(uint32_t(packed >> 16)), pool.at(uint32_t(packed >> 16)) + (packed & 0xFFFF), _baseMoves + next);
+                        _baseSlots[i].packed.store((next << 16) | (packed & 0xFFFF), memory_order_relaxed);
+                        _baseSlots[i].key.store(key, memory_order_relaxed);
+                        next += packed & 0xFFFF;
+
+                        return true;
+                    });
+
+                //The signature goes last, an image left incomplete by a crash is rebuilt
+                memcpy(header->signature, Signature, sizeof(Signature));
+                unlock();
+
+                sync_cout
+                    << "info string Shared experience file " << _filename << " -> Total positions: " << positions
+                    << ". Total moves: " << moves
+                    << sync_endl;
+
+                return true;
+            }
+
+            void close()
+            {
+#ifndef _WIN32
+                if (_data)
+                    munmap(_data, _size);
+
+                if (_fd != -1)
+                    ::close(_fd);
+#endif
+                _fd = -1;
+                _data = nullptr;
+                _size = 0;
+                _header = nullptr;
+            }
+
+            //Positions are looked up in the append region first, then in the base slots
+            void prefetch(Key k) const
+            {
+                Stockfish::prefetch(&_appendSlots[k & (AppendSlots - 1)]);
+                Stockfish::prefetch(&_baseSlots[k & (_header->baseSlots - 1)]);
+            }
+
+            //Positions learned since the image was built come with all their moves
+            ExpMoves probe(Key k) const
+            {
+                const Slot* slot = find(_appendSlots, AppendSlots, k);
+                uint64_t packed = slot ? slot->packed.load(memory_order_acquire) : 0;
+                if (packed)
+                    return ExpMoves(_arena + (packed >> 16), size_t(packed & 0xFFFF));
+
+                slot = find(_baseSlots, _header->baseSlots, k);
+                packed = slot ? slot->packed.load(memory_order_relaxed) : 0;
+                return ExpMoves(_baseMoves + (packed >> 16), size_t(packed & 0xFFFF));
+            }
+
+            //Publishes the moves of position 'k' merged with 'exp'. Returns false if 'exp' merged with an
+            //existing move, or if the image is full ('full' is set).
+            bool add(Key k, const ExpMove& exp, bool& full)
+            {
+                full = true;
+
+                Slot* slot = insert(k);
+                if (!slot)
+                    return false;
+
+                vector<ExpMove> moves;
+                bool added;
+
+                uint64_t current = slot->packed.load(memory_order_acquire);
+                for (;;)
+                {
+                    ExpMoves old = current ? ExpMoves(_arena + (current >> 16), size_t(current & 0xFFFF)) : probe(k);
+                    moves.assign(old.begin(), old.end());
+                    added = add_move(moves, exp);
+                    sort_moves(moves);
+
+                    uint64_t offset = _header->arenaNext.fetch_add(moves.size(), memory_order_relaxed);
+                    if (offset + moves.size() > ArenaMoves)
+                        return false;
+
+                    std::copy(moves.begin(), moves.end(), _arena + offset);
+
+                    //Retry on top of the moves published meanwhile by another process
+                    if (slot->packed.compare_exchange_strong(current, (offset << 16) | moves.size(), memory_order_acq_rel))
+                        break;
+                }
+
+                full = false;
+                return added;
+            }
+
+            //Reports a full image once per process
+            bool report_full()
+            {
+                return !_fullReported.exchange(true, memory_order_relaxed);
+            }
+
+            //Accounts for entries that a sharing process saved to the experience file
+            void add_source_size(uint64_t bytes)
+            {
+                _header->sourceSize.fetch_add(bytes, memory_order_relaxed);
+            }
+
+            string filename() const
+            {
+                return _filename;
+            }
+        };
+
+        //A new experience entry waiting to be saved
+        struct NewExp
+        {
+            Key   key;
+            Move  move;
+            Value value;
+            Depth depth;
+        };
+
+        class ExperienceData
+        {
+        private:
+            string              _filename;
+
+            vector<NewExp>      _newPvExp;
+            vector<NewExp>      _newMultiPvExp;
+
+            ExpPool             _pool;
+            ExpTable            _table;
+
+            bool                _loading;
+            atomic<bool>        _abortLoading;
+            atomic<bool>        _loadingResult;
+            thread              *_loaderThread;
+            condition_variable  _loadingCond;
+            mutex               _loaderMutex;
+            mutex               _writerMutex;
+
+            //Memory mapped experience data (see 'Experience Mmap')
+            static constexpr uint32_t MappedNone = numeric_limits<uint32_t>::max();
+
+            bool                            _useMapping;
+            Utility::FileMapping            _mapping;
+            const unsigned char*            _mappedRecords;
+            SugaRKeyMap<uint32_t>           _mappedIndex;
+            vector<uint32_t>                _mappedFirst;
+            vector<uint32_t>                _mappedNext;
+            unique_ptr<atomic<uint64_t>[]>  _mappedExp;     //Packed pool location, zero until materialized
+
+            //Journals (see 'Experience Journal') whose entries have been loaded
+            vector<string>                  _loadedJournals;
+
+            //Image shared with the other engine processes (see 'Experience Shared')
+            bool                            _useSharing;
+            SharedExperience                _shared;
+
+            //Rejects most probes of positions without experience before they reach the table
+            KeyFilter                       _filter;
+
+            //Parts of the data that can be probed while the experience file is still loading.
+            //The table is published once it has been sized for the whole file, and its positions
+            //become visible one by one as they are stored. The file image, the filter and the
+            //shared image are published when loading has finished.
+            enum : int { PublishedTable = 1, PublishedMapping = 2, PublishedFilter = 4, PublishedShared = 8 };
+            atomic<int>                     _published;
+
+            //Entries added while loading would grow the table under the loader and the search
+            //threads, they are linked by the first writer after loading has finished
+            bool                            _deferLinks;
+            vector<pair<Key, ExpMove>>      _deferredExp;
+
+            //Saves requested by 'save_async', as file name and journal flag, written one after
+            //the other by the saver thread
+            thread                          _saverThread;
+            mutex                           _saverMutex;
+            condition_variable              _saverCond;
+            deque<pair<string, bool>>       _saveRequests;
+            bool                            _saverBusy;
+            bool                            _saverExit;
+
+        private:
+            static string journal_filename(const string& fn)
+            {
+                return fn + ".journal";
+            }
+
+            static uint64_t pack(uint32_t offset, size_t size)
+            {
+                return ((uint64_t)offset << 16) | (uint64_t)size;
+            }
+
+            ExpMoves unpack(uint64_t packed) const
+            {
+                return packed ? ExpMoves(_pool.at(uint32_t(packed >> 16)), size_t(packed & 0xFFFF)) : ExpMoves();
+            }
+
+            void clear()
+            {
+                //Make sure we are not loading an experience file
+                _abortLoading.store(true, memory_order_relaxed);
+                wait_for_load_finished();
+                assert(_loaderThread == nullptr);
+
+                //Clear
+                clear_new_exp();
+                _table.clear();
+                _pool.clear();
+
+                //Release file image
+                _mappedIndex.clear();
+                _mappedFirst.clear();
+                _mappedNext.clear();
+                _mappedExp.reset();
+                _mappedRecords = nullptr;
+                _mapping.unmap();
+
+                _loadedJournals.clear();
+                _filter.clear();
+                _shared.close();
+
+                _published.store(0, memory_order_relaxed);
+                _deferredExp.clear();
+            }
+
+            //Sized for the loaded positions, positions added later are still inserted but
+            //gradually raise the false positive rate until the next load
+            void build_filter()
+            {
+                _filter.resize(_table.size() + _mappedFirst.size());
+
+                _table.for_each([&](const ExpTable::Slot& s) { _filter.add(s.key.load(memory_order_relaxed)); return true; });
+
+                for (auto& x : _mappedIndex)
+                    _filter.add(x.first);
+            }
+
+            void clear_new_exp()
+            {
+                _newPvExp.clear();
+                _newMultiPvExp.clear();
+            }
+
+            //Sorts the moves of a position based on pseudo-quality and copies them to the pool.
+            //Returns the packed pool location, or zero if the pool is full.
+            uint64_t store_moves(vector<ExpMove>& moves)
+            {
+                assert(!moves.empty());
+
+                sort_moves(moves);
+
+                uint32_t offset = _pool.alloc(moves.size());
+                if (offset == ExpPool::None)
+                    return 0;
+
+                std::copy(moves.begin(), moves.end(), _pool.at(offset));
+                return pack(offset, moves.size());
+            }
+
+            //Replaces the moves of table position 'k'. A store that changes an existing position
+            //leaves its previous run of moves unused in the pool until the next load
+            bool set_moves(Key k, vector<ExpMove>& moves)
+            {
+                uint64_t packed = store_moves(moves);
+                if (!packed)
+                    return false;
+
+                ExpTable::Slot& slot = _table.insert(k);
+                if (!slot.packed.load(memory_order_relaxed))
+                    _filter.add(k);
+
+                slot.packed.store(packed, memory_order_release);
+
+                return true;
+            }
+
+            bool link_entry(Key k, const ExpMove& exp)
+            {
+                vector<ExpMove> moves;
+                bool added;
+
+                //New entries of a shared image are seen by all processes, they are still saved by this one
+                if (_published.load(memory_order_relaxed) & PublishedShared)
+                {
+                    bool full;
+                    added = _shared.add(k, exp, full);
+                    if (full && _shared.report_full())
+                        sync_cout << "info string Shared experience file is full, new entries are only saved to: " << _filename << sync_endl;
+
+                    return added;
+                }
+
+                //Entries of positions that are still in the file image are added to their materialized moves
+                if (_mapping.has_data())
+                {
+                    MappedConstIterator mitr = _mappedIndex.find(k);
+                    if (mitr != _mappedIndex.end())
+                    {
+                        ExpMoves current = unpack(materialize(mitr->second));
+                        moves.assign(current.begin(), current.end());
+                        added = add_move(moves, exp);
+
+                        uint64_t packed = store_moves(moves);
+                        if (packed)
+                            _mappedExp[mitr->second].store(packed, memory_order_release);
+
+                        return added;
+                    }
+                }
+
+                const ExpTable::Slot* slot = _table.find(k);
+                if (slot)
+                {
+                    ExpMoves current = unpack(slot->packed.load(memory_order_relaxed));
+                    moves.assign(current.begin(), current.end());
+                }
+
+                added = add_move(moves, exp);
+                set_moves(k, moves);
+
+                return added;
+            }
+
+            //Work left by the loader until no search is running: links the entries added while loading,
+            //and drops the private data a process loaded to build the shared image. Must be called with
+            //'_writerMutex' held.
+            void link_deferred()
+            {
+                if (_deferLinks)
+                    return;
+
+                if ((_published.load(memory_order_relaxed) & PublishedShared) && _table.size())
+                {
+                    _published.fetch_and(~(PublishedTable | PublishedFilter), memory_order_relaxed);
+                    _table.clear();
+                    _pool.clear();
+                    _filter.clear();
+                }
+
+                if (_deferredExp.empty())
+                    return;
+
+                if (!(_published.load(memory_order_relaxed) & PublishedShared))
+                    _table.reserve(_table.size() + _deferredExp.size());
+
+                for (const auto& x : _deferredExp)
+                    link_entry(x.first, x.second);
+
+                _deferredExp.clear();
+            }
+
+            //Builds the moves of a mapped position from its records in the file image.
+            //Must be called with '_writerMutex' held (or before search threads can probe).
+            uint64_t materialize(uint32_t slot)
+            {
+                uint64_t packed = _mappedExp[slot].load(memory_order_relaxed);
+                if (packed)
+                    return packed;
+
+                //Records are chained newest first, restore the file order so that merging gives the same results as a full load
+                vector<uint32_t> records;
+                for (uint32_t r = _mappedFirst[slot]; r != MappedNone; r = _mappedNext[r])
+                    records.push_back(r);
+
+                Current::ExpEntry tempExp((Key)0, MOVE_NONE, VALUE_NONE, DEPTH_NONE);
+                vector<ExpMove> moves;
+                for (auto it = records.rbegin(); it != records.rend(); ++it)
+                {
+                    memcpy((void*)&tempExp, _mappedRecords + size_t(*it) * sizeof(Current::ExpEntry), sizeof(Current::ExpEntry));
+                    add_move(moves, ExpMove(tempExp));
+                }
+
+                packed = store_moves(moves);
+                _mappedExp[slot].store(packed, memory_order_release);
+
+                return packed;
+            }
+
+            //Materializes all mapped positions into the table and releases the file image
+            void unmap()
+            {
+                if (!_mapping.has_data())
+                    return;
+
+                _table.reserve(_table.size() + _mappedIndex.size());
+                for (auto& x : _mappedIndex)
+                {
+                    uint64_t packed = materialize(x.second);
+                    if (packed)
+                        _table.insert(x.first).packed.store(packed, memory_order_release);
+                }
+
+                _mappedIndex.clear();
+                _mappedFirst.clear();
+                _mappedNext.clear();
+                _mappedExp.reset();
+                _mappedRecords = nullptr;
+                _mapping.unmap();
+            }
+
+            //Maps the experience file and indexes its records in place, without copying them.
+            //Only files in the current format can be mapped, 'fallback' is set for everything else.
+            bool _load_mapped(string fn, bool& fallback)
+            {
+                fallback = true;
+
+                string mapFilename = Utility::map_path(fn);
+                if (!Utility::file_exists(mapFilename) || !_mapping.map(mapFilename, true))
+                    return false;
+
+                const string& signature = Current::ExperienceSignature;
+                size_t dataSize = _mapping.data_size();
+                if (   dataSize < signature.length()
+                    || memcmp(_mapping.data(), signature.c_str(), signature.length()) != 0
+                    || (dataSize - signature.length()) % sizeof(Current::ExpEntry) != 0
+                    || (dataSize - signature.length()) / sizeof(Current::ExpEntry) >= MappedNone)
+                {
+                    _mapping.unmap();
+                    return false;
+                }
+
+                fallback = false;
+
+                size_t expCount = (dataSize - signature.length()) / sizeof(Current::ExpEntry);
+                _mappedRecords = _mapping.data() + signature.length();
+                _mappedNext.resize(expCount);
+
+                //Index: one slot per position, records of the same position are chained through '_mappedNext'
+                for (size_t i = 0; i < expCount; ++i)
+                {
+                    if (_abortLoading.load(memory_order_relaxed))
+                        return false;
+
+                    Key key;
+                    memcpy(&key, _mappedRecords + i * sizeof(Current::ExpEntry), sizeof(Key));
+
+                    MappedIterator itr = _mappedIndex.find(key);
+                    if (itr == _mappedIndex.end())
+                    {
+                        _mappedIndex[key] = (uint32_t)_mappedFirst.size();
+                        _mappedFirst.push_back((uint32_t)i);
+                        _mappedNext[i] = MappedNone;
+                    }
+                    else
+                    {
+                        _mappedNext[i] = _mappedFirst[itr->second];
+                        _mappedFirst[itr->second] = (uint32_t)i;
+                    }
+                }
+
+                _mappedExp.reset(new atomic<uint64_t>[_mappedFirst.size()]);
+                for (size_t i = 0; i < _mappedFirst.size(); ++i)
+                    _mappedExp[i].store(0, memory_order_relaxed);
+
+                sync_cout
+                    << "info string " << fn << " -> Total moves: " << expCount
+                    << ". Total positions: " << _mappedFirst.size()
+                    << ". Mapped: " << format_bytes(dataSize, 2)
+                    << sync_endl;
+
+                return true;
+            }
+
+            //'reserve' is the number of positions that will be loaded into the table later on,
+            //so that they can be inserted while the table is being probed
+            bool _load(string fn, bool allowMapping, size_t reserve)
+            {
+                if (_useMapping && allowMapping)
+                {
+                    bool fallback;
+                    if (_load_mapped(fn, fallback))
+                        return true;
+
+                    if (!fallback)
+                        return false;
+                }
+
+                ifstream in(Utility::map_path(fn), ios::in | ios::binary | ios::ate);
+                if (!in.is_open())
+                {
+                    sync_cout << "info string Could not open experience file: " << fn << sync_endl;
+                    return false;
+                }
+
+                size_t inSize = in.tellg();
+                if (inSize == 0)
+                {
+                    sync_cout << "info string The experience file [" << fn << "] is empty" << sync_endl;
+                    return false;
+                }
+
+                //Define readers
+                //Order should be from most recent to oldest
+                class ExpReaders
+                {
+                public:
+                    vector<pair<const char*, ExperienceReader*>> readers;
+
+                public:
+                    ExpReaders()
+                    {
+                        readers.emplace_back("Experience (V3) reader", new V3::ExperienceReader());
+                        readers.emplace_back("Experience (V2) reader", new V2::ExperienceReader());
+                        readers.emplace_back("Experience (V1) reader", new V1::ExperienceReader());
+
+#ifndef NDEBUG
+                        int latest = 0;
+                        for (auto& rp : readers)
+                            latest += rp.second->get_version() == Current::ExperienceVersion ? 1 : 0;
+
+                        assert(latest == 1);
+#endif
+                    }
+
+                    ~ExpReaders()
+                    {
+                        for (auto rp : readers)
+                            delete rp.second;
+                    }
+                }expReaders;
+
+                ExperienceReader *reader = nullptr;
+                for (auto &rp : expReaders.readers)
+                {
+                    if (!rp.second)
+                    {
+                        sync_cout << "info string Could not allocate memory for " << rp.first << sync_endl;
+                        continue;
+                    }
+
+                    if (rp.second->check_signature(in, inSize))
+                    {
+                        reader = rp.second;
+                        break;
+                    }
+                }
+
+                if (!reader)
+                {
+                    sync_cout << "info string The file [" << fn << "] is not a valid experience file" << sync_endl;
+                    return false;
+                }
+
+                if (reader->get_version() < Current::ExperienceVersion)
+                    sync_cout << "info string Importing experience version (" << reader->get_version() << ") from file [" << fn << "]" << sync_endl;
+
+                //An append cut short by a crash leaves part of an entry at the end. It is cut off once
+                //the file is read, so that the next save appends whole entries behind the ones read here
+                size_t partial = reader->partial_length();
+                if (partial)
+                    sync_cout << "info string Dropping a partial entry of " << partial
+                              << " byte(s) at the end of experience file [" << fn << "]" << sync_endl;
+
+                //Read all entries first, then group them by position so that the moves
+                //of each position are merged, sorted and stored in one go
+                struct ExpRecord
+                {
+                    Key     key;
+                    size_t  order;
+                    ExpMove exp;
+                };
+
+                size_t expCount = reader->entries_count();
+                vector<ExpRecord> records;
+                records.reserve(expCount);
+
+                Current::ExpEntry tempExp((Key)0, MOVE_NONE, VALUE_NONE, DEPTH_NONE);
+                for (size_t i = 0; i < expCount; ++i)
+                {
+                    if (_abortLoading.load(memory_order_relaxed))
+                        break;
+
+                    //Read
+                    if (!reader->read(in, &tempExp))
+                    {
+                        sync_cout << "info string Failed to read experience entry #" << i + 1 << " of " << expCount << sync_endl;
+                        return false;
+                    }
+
+                    //Key zero can not be stored (same as the empty key of the table)
+                    if (tempExp.key)
+                        records.push_back(ExpRecord{ tempExp.key, i, ExpMove(tempExp) });
+                }
+
+                //Close input file
+                in.close();
+
+                if (partial && !truncate_file(Utility::map_path(fn), inSize - partial))
+                    sync_cout << "info string Could not cut the partial entry off experience file [" << fn << "]" << sync_endl;
+
+                //Stop if aborted
+                if (_abortLoading.load(memory_order_relaxed))
+                    return false;
+
+                //Group by position, keeping the file order of each position's entries
+                sort(records.begin(), records.end(), [](const ExpRecord& a, const ExpRecord& b)
+                    {
+                        return a.key < b.key || (a.key == b.key && a.order < b.order);
+                    });
+
+                //Few variables to be used for statistical information
+                size_t prevPosCount = _table.size();
+
+                size_t positions = 0;
+                for (size_t i = 0; i < records.size(); ++i)
+                    positions += i == 0 || records[i].key != records[i - 1].key;
+
+                _table.reserve(_table.size() + positions + reserve);
+                _published.fetch_or(PublishedTable, memory_order_release);
+
+                //Load experience entries
+                size_t duplicateMoves = 0;
+                vector<ExpMove> moves;
+                for (size_t i = 0; i < records.size(); )
+                {
+                    Key key = records[i].key;
+                    size_t last = i;
+                    while (last < records.size() && records[last].key == key)
+                        ++last;
+
+                    //Positions that are still in the file image are merged entry by entry
+                    if (_mapping.has_data() && _mappedIndex.find(key) != _mappedIndex.end())
+                    {
+                        for (; i < last; ++i)
+                            if (!link_entry(key, records[i].exp))
+                                duplicateMoves++;
+
+                        continue;
+                    }
+
+                    moves.clear();
+                    if (const ExpTable::Slot* slot = _table.find(key))
+                    {
+                        ExpMoves current = unpack(slot->packed.load(memory_order_relaxed));
+                        moves.assign(current.begin(), current.end());
+                    }
+
+                    for (; i < last; ++i)
+                        if (!add_move(moves, records[i].exp))
+                            duplicateMoves++;
+
+                    if (!set_moves(key, moves))
+                    {
+                        sync_cout << "info string Experience data is full, stopped loading file [" << fn << "]" << sync_endl;
+                        return false;
+                    }
+                }
+
+                records.clear();
+                records.shrink_to_fit();
+
+                //Compact files stay compact, new entries are appended to their tail
+                if (reader->get_version() < Current::ExperienceVersion)
+                {
+                    sync_cout << "info string Upgrading experience file (" << fn << ") from version (" << reader->get_version() << ") to version (" << Current::ExperienceVersion << ")" << sync_endl;
+                    save(fn, true, true);
+                }
+
+                //Stop if aborted
+                if (_abortLoading.load(memory_order_relaxed))
+                    return false;
+
+                //Show some statistics
+                if (prevPosCount)
+                {
+                    sync_cout
+                        << "info string " << fn << " -> Total new moves: " << expCount
+                        << ". Total new positions: " << (_table.size() - prevPosCount)
+                        << ". Duplicate moves: " << duplicateMoves
+                        << sync_endl;
+                }
+                else
+                {
+                    sync_cout
+                        << "info string " << fn << " -> Total moves: " << expCount
+                        << ". Total positions: " << _table.size()
+                        << ". Duplicate moves: " << duplicateMoves
+                        << ". Fragmentation: " << setprecision(2) << fixed << 100.0 * (double)duplicateMoves / (double)expCount << "%"
+                        << sync_endl;
+                }
+
+                return true;
+            }
+
+            //Cuts the file back to 'length' bytes, dropping the part of a save that failed
+            static bool truncate_file(const string& path, size_t length)
+            {
+                error_code ec;
+                filesystem::resize_file(path, length, ec);
+                return !ec;
+            }
+
+            //Writes the data of the file to the disk before the save is reported done
+            static bool sync_file(const string& path)
+            {
+#ifndef _WIN32
+                int fd = ::open(path.c_str(), O_WRONLY);
+                if (fd == -1)
+                    return false;
+
+                bool synced = fsync(fd) == 0;
+                ::close(fd);
+                return synced;
+#else
+                (void)path;
+                return true;
+#endif
+            }
+
+            //The new entries are taken under '_writerMutex', so the search can add more while they are
+            //written. They are appended in place, so a save costs the size of the new entries only, and
+            //a save that fails is cut off the file again, which leaves it as it was. The entries of a
+            //failed save are then kept for the next one. This is not atomic: when the process dies in
+            //the middle of an append, the file ends in part of an entry, which the next load drops.
+            //A full save writes the whole file, which 'save' has moved to a backup first.
+            bool _save(string fn, bool saveAll)
+            {
+                vector<NewExp> newPvExp, newMultiPvExp;
+                if (!saveAll)
+                {
+                    lock_guard<mutex> lg(_writerMutex);
+                    newPvExp.swap(_newPvExp);
+                    newMultiPvExp.swap(_newMultiPvExp);
+                }
+
+                string path = Utility::map_path(fn);
+
+                //Length of the file before the save, known once it is open
+                fstream out;
+                size_t length = 0;
+                bool opened = false;
+
+                auto fail = [&](const string& message) {
+                    sync_cout << "info string " << message << " [" << fn << "]" << sync_endl;
+
+                    if (out.is_open())
+                        out.close();
+
+                    if (saveAll)
+                        return false;
+
+                    //Entries left on the disk must not be queued again, so keep them if the file can not be cut
+                    if (opened && !truncate_file(path, length))
+                    {
+                        sync_cout << "info string Could not remove a partial save from experience file [" << fn << "]" << sync_endl;
+                        return false;
+                    }
+
+                    lock_guard<mutex> lg(_writerMutex);
+                    _newPvExp.insert(_newPvExp.begin(), newPvExp.begin(), newPvExp.end());
+                    _newMultiPvExp.insert(_newMultiPvExp.begin(), newMultiPvExp.begin(), newMultiPvExp.end());
+                    return false;
+                };
+
+                out.open(path, ios::out | ios::binary | ios::app);
+                if (!out.is_open())
+                    return fail("Failed to open experience file for writing");
+
+                //If this is a new file then we need to write the signature first
+                out.seekg(0, out.end);
+                length = out.tellg();
+                out.seekg(0, out.beg);
+                opened = true;
+
+                //Bytes added to the file, see 'SharedExperience::add_source_size'
+                size_t written = 0;
+
+                if (length == 0)
+                {
+                    out.seekp(0, out.beg);
+
+                    out << Current::ExperienceSignature;
+                    written += Current::ExperienceSignature.length();
+                    if (!out)
+                        return fail("Failed to write signature to experience file");
+                }
+
+                //Reposition writing pointer to end of file
+                out.seekp(ios::end);
+
+                vector<char> writeBuffer;
+                writeBuffer.reserve(WriteBufferSize);
+
+                auto write_entry = [&](const Current::ExpEntry* exp, bool force) -> bool
+                {
+                    if (exp)
+                    {
+                        const char* data = reinterpret_cast<const char*>(exp);
+                        writeBuffer.insert(writeBuffer.end(), data, data + sizeof(Current::ExpEntry));
+                    }
+
+                    bool success = true;
+                    if (force || writeBuffer.size() >= WriteBufferSize)
+                    {
+                        out.write(writeBuffer.data(), writeBuffer.size());
+                        if (!out)
+                            success = false;
+
+                        written += writeBuffer.size();
+
+                        writeBuffer.clear();
+                    }
+
+                    return success;
+                };
+
+                size_t allMoves = 0;
+                size_t allPositions = 0;
+                if (saveAll)
+                {
+                    bool success = _table.for_each([&](const ExpTable::Slot& slot)
+                        {
+                            allPositions++;
+                            ExpMoves moves = unpack(slot.packed.load(memory_order_relaxed));
+
+                            return for_each_saved_entry(slot.key.load(memory_order_relaxed), moves.begin(), moves.end(), [&](const Current::ExpEntry& entry)
+                                {
+                                    allMoves++;
+                                    return write_entry(&entry, false);
+                                });
+                        });
+
+                    if (!success)
+                    {
+                        sync_cout << "info string Failed to save experience entry to experience file [" << fn << "]" << sync_endl;
+                        return false;
+                    }
+
+                    sync_cout << "info string Saved " << allPositions << " position(s) and " << allMoves << " moves to experience file: " << fn << sync_endl;
+                }
+                else
+                {
+                    for (auto newExp : { &newPvExp, &newMultiPvExp })
+                    {
+                        for (const NewExp& exp : *newExp)
+                        {
+                            if (exp.depth < EXP_MIN_DEPTH)
+                                continue;
+
+                            Current::ExpEntry entry(exp.key, exp.move, exp.value, exp.depth);
+                            if (!write_entry(&entry, false))
+                                return fail("Failed to save experience entry to experience file");
+                        }
+                    }
+                }
+
+                //Flush buffer
+                if (!write_entry(nullptr, true))
+                    return fail("Failed to save experience entry to experience file");
+
+                out.close();
+                if (out.fail() || !sync_file(path))
+                    return fail("Failed to save experience entry to experience file");
+
+                if (!saveAll)
+                    sync_cout << "info string Saved " << newPvExp.size() << " PV and " << newMultiPvExp.size() << " MultiPV entries to experience file: " << fn << sync_endl;
+
+                if (_shared.attached())
+                    _shared.add_source_size(written);
+
+                //Clear new moves. Entries added while loading are not in the table yet, so a full
+                //save done by the loader keeps them for the next save
+                if (saveAll && !_deferLinks)
+                    clear_new_exp();
+
+                return true;
+            }
+
+        public:
+            explicit ExperienceData(bool useMapping = false, bool useSharing = false)
+            {
+                _useMapping = useMapping;
+                _useSharing = useSharing;
+                _mappedRecords = nullptr;
+                _loading = false;
+                _abortLoading.store(false, memory_order_relaxed);
+                _loadingResult.store(false, memory_order_relaxed);
+                _loaderThread = nullptr;
+                _published.store(0, memory_order_relaxed);
+                _deferLinks = false;
+                _saverBusy = false;
+                _saverExit = false;
+            }
+
+            ~ExperienceData()
+            {
+                stop_saver();
+                clear();
+            }
+
+        public:
+
+            string filename() const
+            {
+                return _filename;
+            }
+
+            bool use_mapping() const
+            {
+                return _useMapping;
+            }
+
+            bool use_sharing() const
+            {
+                return _useSharing;
+            }
+
+            bool has_new_exp()
+            {
+                lock_guard<mutex> lg(_writerMutex);
+                return _newPvExp.size() || _newMultiPvExp.size();
+            }
+
+            vector<pair<string, size_t>> memory()
+            {
+                //The loader sizes the table and the index, wait until it is done with them
+                wait_for_load_finished();
+
+                lock_guard<mutex> lg(_writerMutex);
+
+                size_t index =   map_memory(_mappedIndex)
+                               + (_mappedFirst.capacity() + _mappedNext.capacity()) * sizeof(uint32_t)
+                               + (_mappedExp ? _mappedFirst.size() * sizeof(atomic<uint64_t>) : 0);
+
+                size_t pending =   (_newPvExp.capacity() + _newMultiPvExp.capacity()) * sizeof(NewExp)
+                                 + _deferredExp.capacity() * sizeof(pair<Key, ExpMove>);
+
+                return {
+                    { "table",   _table.memory() },
+                    { "moves",   _pool.memory() },
+                    { "filter",  _filter.memory() },
+                    { "index",   index },
+                    { "pending", pending },
+                    { "mapped",  _mapping.has_data() ? _mapping.data_size() : 0 },
+                    { "shared",  _shared.memory() }
+                };
+            }
+
+            bool load(string filename, bool synchronous)
+            {
+                //Make sure we are not already in the process of loading same/other experience file
+                wait_for_load_finished();
+
+                //Load requested experience file
+                _filename = filename;
+                _loadingResult.store(false, memory_order_relaxed);
+
+                //Block
+                {
+                    _loading = true;
+                    _deferLinks = true;
+                    lock_guard<mutex> lg1(_loaderMutex);
+                    _loaderThread = new thread(thread([this, filename]()
+                        {
+                            //The table is probed by all search threads, so its pages are
+                            //spread over the NUMA nodes rather than all put on this one
+                            WinProcGroup::interleave_memory();
+
+                            //Entries saved in journaled mode since the last defrag. The table is sized
+                            //up front as if each of them was a new position, so that it does not grow
+                            //while search threads probe it
+                            string journalFilename = journal_filename(filename);
+                            bool hasJournal = Utility::file_exists(Utility::map_path(journalFilename));
+                            size_t journalEntries = hasJournal ? Utility::get_file_size(journalFilename) / sizeof(Current::ExpEntry) : 0;
+
+                            //An up to date shared image replaces the private data. Otherwise this
+                            //process loads the file as usual and builds the image from it
+                            bool buildShared = false;
+                            if (   _useSharing
+                                && _shared.open(filename, SharedExperience::source_size(filename, journalFilename), buildShared)
+                                && !buildShared)
+                            {
+                                sync_cout << "info string Using shared experience file: " << _shared.filename() << sync_endl;
+
+                                if (hasJournal)
+                                    _loadedJournals.push_back(Utility::map_path(journalFilename));
+
+                                _published.fetch_or(PublishedShared, memory_order_release);
+                                _loadingResult.store(true, memory_order_relaxed);
+                            }
+                            else
+                            {
+                                //Load
+                                bool loadingResult = _load(filename, !buildShared, journalEntries);
+
+                                if (   !_abortLoading.load(memory_order_relaxed)
+                                    && hasJournal
+                                    && _load(journalFilename, false, 0))
+                                {
+                                    _loadedJournals.push_back(Utility::map_path(journalFilename));
+                                    loadingResult = true;
+                                }
+
+                                if (buildShared)
+                                {
+                                    if (   !_abortLoading.load(memory_order_relaxed)
+                                        && _shared.build(_table, _pool, SharedExperience::source_size(filename, journalFilename)))
+                                        _published.fetch_or(PublishedShared, memory_order_release);
+                                    else
+                                        _shared.close();
+                                }
+
+                                if (!_abortLoading.load(memory_order_relaxed) && !_shared.attached())
+                                    build_filter();
+
+                                _published.fetch_or(PublishedTable | PublishedFilter | (_mapping.has_data() ? PublishedMapping : 0), memory_order_release);
+                                _loadingResult.store(loadingResult, memory_order_relaxed);
+                            }
+
+                            {
+                                lock_guard<mutex> lg(_writerMutex);
+                                _deferLinks = false;
+                            }
+
+                            //Copy pointer of loader thread so that we can
+                            //clear the variable now and and deleted later.
+                            //It is read under '_loaderMutex', which load() holds
+                            //until the pointer is assigned, so that a quick load
+                            //can not see it still unset
+                            thread *t;
+
+                            //Notify
+                            {
+                                lock_guard<mutex> lg2(_loaderMutex);
+                                t = _loaderThread;
+                                _loaderThread = nullptr;
+                                _loading = false;
+                                _loadingCond.notify_one();
+                            }
+                            
+                            //Detach and delete loader thread
+                            t->detach();
+                            delete t;
+                        }));
+                }
+
+                return synchronous ? wait_for_load_finished() : true;
+            }
+
+            //Callers do not run concurrently with a search, so entries added while loading are linked here
+            bool wait_for_load_finished()
+            {
+                {
+                    unique_lock<mutex> ul(_loaderMutex);
+                    _loadingCond.wait(ul, [&] { return !_loading; });
+                }
+
+                lock_guard<mutex> lg(_writerMutex);
+                link_deferred();
+
+                return loading_result();
+            }
+
+            bool loading()
+            {
+                lock_guard<mutex> lg(_loaderMutex);
+                return _loading;
+            }
+
+            bool loading_result() const
+            {
+                return _loadingResult.load(memory_order_relaxed);
+            }
+
+            //With 'journal' set, new entries are appended to the journal next to 'fn' and the main
+            //file is left untouched. The journal is folded into the main file by a full save (defrag).
+            void save(string fn, bool saveAll, bool ignoreLoadingCheck, bool journal = false)
+            {
+                //Make sure we are not already in the process of loading same/other experience file
+                if(!ignoreLoadingCheck)
+                    wait_for_load_finished();
+
+                //A full save rewrites the file, so it can not stay mapped
+                if (saveAll)
+                {
+                    lock_guard<mutex> lg(_writerMutex);
+                    unmap();
+                }
+
+                if (!has_new_exp() && (!saveAll || _table.size() == 0))
+                    return;
+
+                //Step 1: Create backup only if 'saveAll' is 'true'
+                string expFilename = Utility::map_path(fn);
+                string backupExpFilename;
+                if (saveAll && Utility::file_exists(expFilename))
+                {
+                    backupExpFilename = expFilename + ".bak";
+
+                    //If backup file already exists then delete it
+                    if (Utility::file_exists(backupExpFilename))
+                    {
+                        if (remove(backupExpFilename.c_str()) != 0)
+                        {
+                            sync_cout << "info string Could not deleted existing backup file: " << backupExpFilename << sync_endl;
+
+                            //Clear backup filename
+                            backupExpFilename.clear();
+                        }
+                    }
+
+                    //Rename current experience file
+                    if (!backupExpFilename.empty())
+                    {
+                        if (rename(expFilename.c_str(), backupExpFilename.c_str()) != 0)
+                        {
+                            sync_cout << "info string Could not create backup of current experience file" << sync_endl;
+
+                            //Clear backup filename
+                            backupExpFilename.clear();
+                        }
+                    }
+                }
+
+                //Step 2: Save
+                if (!saveAll && journal)
+                {
+                    _save(journal_filename(fn), false);
+                }
+                else if (_save(fn, saveAll))
+                {
+                    //Step 2a: All journaled entries are now part of the main file
+                    string journalFilename = Utility::map_path(journal_filename(fn));
+                    if (saveAll && find(_loadedJournals.begin(), _loadedJournals.end(), journalFilename) != _loadedJournals.end())
+                    {
+                        if (remove(journalFilename.c_str()) != 0)
+                            sync_cout << "info string Could not delete compacted experience journal: " << journalFilename << sync_endl;
+
+                        _loadedJournals.erase(find(_loadedJournals.begin(), _loadedJournals.end(), journalFilename));
+                    }
+                }
+                else
+                {
+                    //Step 2b: Restore backup in case of failure while saving
+                    if (!backupExpFilename.empty())
+                    {
+                        if (rename(backupExpFilename.c_str(), expFilename.c_str()) != 0)
+                        {
+                            sync_cout << "info string Could not restore backup experience file: " << backupExpFilename << sync_endl;
+                        }
+                    }
+                }
+            }
+
+            //Saves the new entries like 'save(fn, false, false, journal)' but on the saver thread, so
+            //that the caller does not wait for loading to finish nor for the disk. The entries are
+            //taken when the save starts, the ones added later are left for the next save.
+            void save_async(string fn, bool journal)
+            {
+                {
+                    lock_guard<mutex> lg(_saverMutex);
+
+                    if (!_saverThread.joinable())
+                        _saverThread = thread(&ExperienceData::saver_loop, this);
+
+                    //A pending save of the same file will take all the new entries anyway
+                    if (find(_saveRequests.begin(), _saveRequests.end(), make_pair(fn, journal)) == _saveRequests.end())
+                        _saveRequests.emplace_back(fn, journal);
+                }
+
+                _saverCond.notify_all();
+            }
+
+            void wait_for_saves_finished()
+            {
+                unique_lock<mutex> ul(_saverMutex);
+                _saverCond.wait(ul, [&] { return _saveRequests.empty() && !_saverBusy; });
+            }
+
+        private:
+            void saver_loop()
+            {
+                unique_lock<mutex> ul(_saverMutex);
+
+                while (true)
+                {
+                    _saverCond.wait(ul, [&] { return _saverExit || !_saveRequests.empty(); });
+
+                    //Pending saves are written before exiting
+                    if (_saveRequests.empty())
+                        return;
+
+                    pair<string, bool> request = _saveRequests.front();
+                    _saveRequests.pop_front();
+                    _saverBusy = true;
+                    ul.unlock();
+
+                    save(request.first, false, false, request.second);
+
+                    ul.lock();
+                    _saverBusy = false;
+                    _saverCond.notify_all();
+                }
+            }
+
+            void stop_saver()
+            {
+                {
+                    lock_guard<mutex> lg(_saverMutex);
+                    _saverExit = true;
+                }
+
+                _saverCond.notify_all();
+
+                if (_saverThread.joinable())
+                    _saverThread.join();
+            }
+
+        public:
+            //Probing is lock free: search threads only read the table and the pool (mapped
+            //positions only take '_writerMutex' the first time their moves are built).
+            //New entries are added by the main thread after the helper threads have stopped,
+            //and writers are serialized by '_writerMutex', so the table never grows under a reader.
+            //While loading, only the parts published so far are probed and everything else misses.
+            //Preloads the cache line that probe() reads first for 'k': the filter block rejects
+            //most positions, so the table slot is only prefetched when there is no filter
+            void prefetch(Key k) const
+            {
+                int published = _published.load(memory_order_relaxed);
+
+                if (published & PublishedShared)
+                    _shared.prefetch(k);
+                else if (published & PublishedFilter)
+                    _filter.prefetch(k);
+                else if (published & PublishedTable)
+                    _table.prefetch(k);
+            }
+
+            ExpMoves probe(Key k)
+            {
+                int published = _published.load(memory_order_acquire);
+
+                if (published & PublishedShared)
+                    return _shared.probe(k);
+
+                if ((published & PublishedFilter) && !_filter.may_contain(k))
+                    return ExpMoves();
+
+                //Positions still in the file image get their moves built on first access
+                if (published & PublishedMapping)
+                {
+                    MappedConstIterator mitr = _mappedIndex.find(k);
+                    if (mitr != _mappedIndex.end())
+                    {
+                        uint64_t packed = _mappedExp[mitr->second].load(memory_order_acquire);
+                        if (!packed)
+                        {
+                            lock_guard<mutex> lg(_writerMutex);
+                            packed = materialize(mitr->second);
+                        }
+
+                        return unpack(packed);
+                    }
+                }
+
+                if (!(published & PublishedTable))
+                    return ExpMoves();
+
+                const ExpTable::Slot* slot = _table.find(k);
+                return slot ? unpack(slot->packed.load(memory_order_acquire)) : ExpMoves();
+            }
+
+            void add_pv_experience(Key k, Move m, Value v, Depth d)
+            {
+                if (!k)
+                    return;
+
+                lock_guard<mutex> lg(_writerMutex);
+
+                _newPvExp.push_back(NewExp{ k, m, v, d });
+                if (_deferLinks)
+                {
+                    _deferredExp.emplace_back(k, ExpMove(m, v, d, 1));
+                    return;
+                }
+
+                link_deferred();
+                link_entry(k, ExpMove(m, v, d, 1));
+            }
+
+            void add_multipv_experience(Key k, Move m, Value v, Depth d)
+            {
+                if (!k)
+                    return;
+
+                lock_guard<mutex> lg(_writerMutex);
+
+                _newMultiPvExp.push_back(NewExp{ k, m, v, d });
+                if (_deferLinks)
+                {
+                    _deferredExp.emplace_back(k, ExpMove(m, v, d, 1));
+                    return;
+                }
+
+                link_deferred();
+                link_entry(k, ExpMove(m, v, d, 1));
+            }
+        };
+
+        //Runs 'fn(i)' for every i in [0, n) on up to 'threads' threads. Returns false if any call failed
+        template<typename Fn> bool parallel_for(size_t threads, size_t n, Fn fn)
+        {
+            atomic<size_t> next(0);
+            atomic<bool>   success(true);
+
+            auto worker = [&]()
+            {
+                size_t i;
+                while ((i = next++) < n && success.load(memory_order_relaxed))
+                    if (!fn(i))
+                        success = false;
+            };
 
-#ifndef NDEBUG
-                        int latest = 0;
-                        for (auto& rp : readers)
-                            latest += rp.second->get_version() == Current::ExperienceVersion ? 1 : 0;
+            vector<thread> workers;
+            for (size_t t = 1; t < min(threads, n); ++t)
+                workers.emplace_back(worker);
 
-                        assert(latest == 1);
-#endif
-                    }
+            worker();
 
-                    ~ExpReaders()
-                    {
-                        for (auto rp : readers)
-                            delete rp.second;
-                    }
-                }expReaders;
+            for (thread& t : workers)
+                t.join();
 
-                ExperienceReader *reader = nullptr;
-                for (auto &rp : expReaders.readers)
-                {
-                    if (!rp.second)
-                    {
-                        sync_cout << "info string Could not allocate memory for " << rp.first << sync_endl;
-                        continue;
-                    }
+            return success;
+        }
 
-                    if (rp.second->check_signature(in, inSize))
-                    {
-                        reader = rp.second;
-                        break;
-                    }
-                }
+        //Streaming merge of experience files, used by the 'merge' and 'defrag' commands.
+        //
+        //The inputs are cut into chunks that are read and sorted by (key, file order) in parallel
+        //and written to temporary run files next to the target. Runs are then merged from disk:
+        //while there are more runs than can be open at once they are merged into longer runs, and
+        //the last pass splits the key space into one range per thread. Each thread combines the
+        //moves of every position of its range like a full load would and writes a part of the
+        //target, the parts are finally concatenated. Memory use is bounded by 'MemoryBudget'
+        //whatever the size of the inputs.
+        class ExperienceMerger
+        {
+        private:
+            static constexpr size_t MemoryBudget = size_t(1024) * 1024 * 1024;
+            static constexpr size_t MaxOpenRuns = 512;
+            static constexpr size_t MinReadBuffer = 256;
+            static constexpr size_t MaxReadBuffer = 64 * 1024;
+
+            //An entry on its way to the target. 'order' is its position across all inputs, so that
+            //duplicate moves are merged in the same order as when loading the files one by one
+            struct RunRecord
+            {
+                Key      key;
+                uint64_t order;
+                ExpMove  exp;
 
-                if (!reader)
+                bool operator<(const RunRecord& r) const
                 {
-                    sync_cout << "info string The file [" << fn << "] is not a valid experience file" << sync_endl;
-                    return false;
+                    return key < r.key || (key == r.key && order < r.order);
                 }
+            };
 
-                if (reader->get_version() != Current::ExperienceVersion)
-                    sync_cout << "info string Importing experience version (" << reader->get_version() << ") from file [" << fn << "]" << sync_endl;
+            static_assert(sizeof(RunRecord) == 24);
 
-                //Allocate buffer for ExpEntryEx data
-                size_t expCount = reader->entries_count();
-                ExpEntryEx* expData = (ExpEntryEx*)malloc(expCount * sizeof(ExpEntryEx));
-                if (!expData)
+            //A range of entries of one input file
+            struct Chunk
+            {
+                size_t   source;
+                size_t   first;
+                size_t   count;
+                uint64_t order;
+            };
+
+            struct Source
+            {
+                string filename;
+                int    version;
+                size_t entries;
+            };
+
+            //Sequential reader of a run, starting at the first record with a key of at least 'lo'
+            class RunReader
+            {
+            private:
+                ifstream          _in;
+                vector<RunRecord> _buffer;
+                size_t            _pos = 0;
+                size_t            _remaining = 0;
+
+                bool fill()
                 {
-                    sync_cout << "info string Failed to allocate " << expCount * sizeof(ExpEntryEx) << " bytes for experience data from file [" << fn << "]" << sync_endl;
-                    return false;
-                }
+                    size_t n = min(_remaining, _buffer.capacity());
+                    _buffer.resize(n);
+                    _pos = 0;
 
-                //Few variables to be used for statistical information
-                size_t prevPosCount = _mainExp.size();
+                    if (!n || !_in.read((char*)_buffer.data(), n * sizeof(RunRecord)))
+                        return false;
 
-                //Load experience entries
-                size_t duplicateMoves = 0;
-                ExpEntryEx *exp = expData;
-                for (size_t i = 0; i < expCount; ++i, ++exp)
+                    _remaining -= n;
+                    return true;
+                }
+
+            public:
+                bool open(const string& fn, Key lo, size_t bufferRecords)
                 {
-                    if (_abortLoading.load(memory_order_relaxed))
-                        break;
+                    _in.open(fn, ios::in | ios::binary | ios::ate);
+                    if (!_in.is_open())
+                        return false;
 
-                    //Prepare to read
-                    exp->next = nullptr;
+                    size_t records = size_t(_in.tellg()) / sizeof(RunRecord);
 
-                    //Read
-                    if (!reader->read(in, exp))
+                    //Binary search for the first record of the range
+                    size_t first = 0, last = records;
+                    while (lo && first < last)
                     {
-                        sync_cout << "info string Failed to read experience entry #" << i + 1 << " of " << expCount << sync_endl;
+                        size_t mid = first + (last - first) / 2;
+                        Key k;
+                        _in.seekg(mid * sizeof(RunRecord));
+                        if (!_in.read((char*)&k, sizeof(Key)))
+                            return false;
 
-                        delete expData;
-                        return false;
+                        if (k < lo)
+                            first = mid + 1;
+                        else
+                            last = mid;
                     }
 
-                    //Merge
-                    if (!link_entry(exp))
-                        duplicateMoves++;
+                    _in.seekg(first * sizeof(RunRecord));
+                    _remaining = records - first;
+                    _buffer.reserve(bufferRecords);
+
+                    fill();
+                    return true;
                 }
 
-                //Close input file
-                in.close();
+                bool done() const
+                {
+                    return _pos >= _buffer.size();
+                }
+
+                const RunRecord& top() const
+                {
+                    return _buffer[_pos];
+                }
 
-                //Add buffer to vector so that it will be released later
-                _expData.push_back(expData);
+                void pop()
+                {
+                    if (++_pos >= _buffer.size())
+                        fill();
+                }
+            };
 
-                //Stop if aborted
-                if (_abortLoading.load(memory_order_relaxed))
-                    return false;
+            //Buffered writer of fixed size records
+            class Writer
+            {
+            private:
+                ofstream     _out;
+                vector<char> _buffer;
+                bool         _ok = false;
 
-                if (reader->get_version() != Current::ExperienceVersion)
+            public:
+                bool open(const string& fn)
                 {
-                    sync_cout << "info string Upgrading experience file (" << fn << ") from version (" << reader->get_version() << ") to version (" << Current::ExperienceVersion << ")" << sync_endl;
-                    save(fn, true, true);
+                    _out.open(fn, ios::out | ios::binary | ios::trunc);
+                    _buffer.reserve(WriteBufferSize);
+                    _ok = _out.is_open();
+
+                    return _ok;
                 }
 
-                //Stop if aborted
-                if (_abortLoading.load(memory_order_relaxed))
-                    return false;
+                template<typename T> bool write(const T& rec)
+                {
+                    const char* data = reinterpret_cast<const char*>(&rec);
+                    _buffer.insert(_buffer.end(), data, data + sizeof(T));
 
-                //Show some statistics
-                if (prevPosCount)
+                    return _buffer.size() < WriteBufferSize || flush();
+                }
+
+                bool flush()
                 {
-                    sync_cout
-                        << "info string " << fn << " -> Total new moves: " << expCount
-                        << ". Total new positions: " << (_mainExp.size() - prevPosCount)
-                        << ". Duplicate moves: " << duplicateMoves
-                        << sync_endl;
+                    if (_buffer.size() && !_out.write(_buffer.data(), _buffer.size()))
+                        _ok = false;
+
+                    _buffer.clear();
+                    return _ok;
                 }
-                else
+
+                bool close()
                 {
-                    sync_cout
-                        << "info string " << fn << " -> Total moves: " << expCount
-                        << ". Total positions: " << _mainExp.size()
-                        << ". Duplicate moves: " << duplicateMoves
-                        << ". Fragmentation: " << setprecision(2) << fixed << 100.0 * (double)duplicateMoves / (double)expCount << "%"
-                        << sync_endl;
+                    flush();
+                    _out.close();
+
+                    return _ok;
                 }
+            };
 
-                return true;
+            string          _target;
+            int             _format;
+            size_t          _threads;
+            vector<Source>  _sources;
+            vector<string>  _inputJournals;
+            vector<string>  _runs;
+            size_t          _runCounter = 0;
+
+            static ExperienceReader* create_reader(int version)
+            {
+                if (version == V3::ExperienceVersion)
+                    return new V3::ExperienceReader();
+
+                if (version == V2::ExperienceVersion)
+                    return new V2::ExperienceReader();
+
+                return new V1::ExperienceReader();
             }
 
-            bool _save(string fn, bool saveAll)
+            string run_filename()
             {
-                fstream out;
-                out.open(Utility::map_path(fn), ios::out | ios::binary | ios::app);
-                if (!out.is_open())
+                return _target + ".run" + to_string(_runCounter++);
+            }
+
+            //Adds an input file, checking its format like a regular load would
+            bool add_source(const string& fn)
+            {
+                ifstream in(fn, ios::in | ios::binary | ios::ate);
+                if (!in.is_open())
                 {
-                    sync_cout << "info string Failed to open experience file [" << fn << "] for writing" << sync_endl;
+                    sync_cout << "info string Could not open experience file: " << fn << sync_endl;
                     return false;
                 }
 
-                //If this is a new file then we need to write the signature first
-                out.seekg(0, out.end);
-                size_t length = out.tellg();
-                out.seekg(0, out.beg);
-
-                if (length == 0)
+                size_t inSize = in.tellg();
+                if (inSize == 0)
                 {
-                    out.seekp(0, out.beg);
-
-                    out << Current::ExperienceSignature;
-                    if (!out)
-                    {
-                        sync_cout << "info string Failed to write signature to experience file [" << fn << "]" << sync_endl;
-                        return false;
-                    }
+                    sync_cout << "info string The experience file [" << fn << "] is empty" << sync_endl;
+                    return false;
                 }
 
-                //Reposition writing pointer to end of file
-                out.seekp(ios::end);
-
-                vector<char> writeBuffer;
-                writeBuffer.reserve(WriteBufferSize);
-
-                auto write_entry = [&](const Current::ExpEntry* exp, bool force) -> bool
+                for (int version : { V3::ExperienceVersion, V2::ExperienceVersion, V1::ExperienceVersion })
                 {
-                    if (exp)
+                    unique_ptr<ExperienceReader> reader(create_reader(version));
+                    if (reader->check_signature(in, inSize))
                     {
-                        const char* data = reinterpret_cast<const char*>(exp);
-                        writeBuffer.insert(writeBuffer.end(), data, data + sizeof(Current::ExpEntry));
-                    }
+                        _sources.push_back(Source{ fn, version, reader->entries_count() });
 
-                    bool success = true;
-                    if (force || writeBuffer.size() >= WriteBufferSize)
-                    {
-                        out.write(writeBuffer.data(), writeBuffer.size());
-                        if (!out)
-                            success = false;
+                        if (version < Current::ExperienceVersion)
+                            sync_cout << "info string Importing experience version (" << version << ") from file [" << fn << "]" << sync_endl;
 
-                        writeBuffer.clear();
+                        return true;
                     }
+                }
 
-                    return success;
-                };
+                sync_cout << "info string The file [" << fn << "] is not a valid experience file" << sync_endl;
+                return false;
+            }
 
-                size_t allMoves = 0;
-                size_t allPositions = 0;
-                if (saveAll)
+            //Step 1: Read, sort and write each chunk of the inputs as a run
+            bool create_runs()
+            {
+                size_t chunkEntries = max(MemoryBudget / _threads / sizeof(RunRecord), size_t(1));
+
+                vector<Chunk> chunks;
+                uint64_t order = 0;
+                for (size_t s = 0; s < _sources.size(); ++s)
                 {
-                    for (ExpEntryEx* expEx : _newPvExp)
-                        link_entry(expEx);
+                    for (size_t first = 0; first < _sources[s].entries; first += chunkEntries)
+                        chunks.push_back(Chunk{ s, first, min(chunkEntries, _sources[s].entries - first), order + first });
+
+                    order += _sources[s].entries;
+                }
 
-                    for (ExpEntryEx* expEx : _newMultiPvExp)
-                        link_entry(expEx);
+                _runs.clear();
+                for (size_t i = 0; i < chunks.size(); ++i)
+                    _runs.push_back(run_filename());
 
-                    ExpEntryEx* exp = nullptr;
-                    for (auto& x : _mainExp)
+                return parallel_for(_threads, chunks.size(), [&](size_t i)
                     {
-                        allPositions++;
-                        exp = x.second;
+                        const Chunk& chunk = chunks[i];
+                        const Source& source = _sources[chunk.source];
 
-                        //Scale counts
-                        uint16_t maxCount = numeric_limits<uint8_t>::min();
-                        ExpEntryEx* exp1 = exp;
-                        while (exp1)
-                        {
-                            maxCount = max(maxCount, exp1->count);
-                            exp1 = exp1->next;
-                        }
+                        ifstream in(source.filename, ios::in | ios::binary | ios::ate);
+                        unique_ptr<ExperienceReader> reader(create_reader(source.version));
+                        if (!in.is_open() || !reader->check_signature(in, size_t(in.tellg())) || !reader->seek(in, chunk.first))
+                            return false;
 
-                        //Scale down
-                        uint16_t scale = 1 + maxCount / 128;
-                        exp1 = exp;
-                        while (exp1)
-                        {
-                            exp1->count = max(exp1->count / scale, 1);
-                            exp1 = exp1->next;
-                        }
+                        vector<RunRecord> records;
+                        records.reserve(chunk.count);
 
-                        //Save
-                        while (exp)
+                        Current::ExpEntry tempExp((Key)0, MOVE_NONE, VALUE_NONE, DEPTH_NONE);
+                        for (size_t j = 0; j < chunk.count; ++j)
                         {
-                            if (exp->depth >= EXP_MIN_DEPTH)
+                            if (!reader->read(in, &tempExp))
                             {
-                                allMoves++;
-                                if (!write_entry(exp, false))
-                                {
-                                    sync_cout << "info string Failed to save experience entry to experience file [" << fn << "]" << sync_endl;
-                                    return false;
-                                }
+                                sync_cout << "info string Failed to read experience entry #" << chunk.first + j + 1 << " of " << source.entries << " from " << source.filename << sync_endl;
+                                return false;
                             }
 
-                            exp = exp->next;
+                            //Key zero can not be stored (same as the empty key of the table)
+                            if (tempExp.key)
+                                records.push_back(RunRecord{ tempExp.key, chunk.order + j, ExpMove(tempExp) });
                         }
-                    }
 
-                    sync_cout << "info string Saved " << allPositions << " position(s) and " << allMoves << " moves to experience file: " << fn << sync_endl;
-                }
-                else
-                {
-                    for (auto &newExp : { _newPvExp, _newMultiPvExp })
-                    {
-                        for (const ExpEntryEx* exp : newExp)
-                        {
-                            if (exp->depth < EXP_MIN_DEPTH)
-                                continue;
+                        sort(records.begin(), records.end());
 
-                            if (!write_entry(exp, false))
-                            {
-                                sync_cout << "info string Failed to save experience entry to experience file [" << fn << "]" << sync_endl;
+                        Writer out;
+                        if (!out.open(_runs[i]))
+                            return false;
+
+                        for (const RunRecord& r : records)
+                            if (!out.write(r))
                                 return false;
-                            }
-                        }
-                    }
 
-                    sync_cout << "info string Saved " << _newPvExp.size() << " PV and " << _newMultiPvExp.size() << " MultiPV entries to experience file: " << fn << sync_endl;
+                        return out.close();
+                    });
+            }
+
+            //Merges the records with keys in [lo, hi] of 'runs' in (key, order) order, calling 'fn' for each
+            template<typename Fn> bool merge_runs(const vector<string>& runs, Key lo, Key hi, size_t bufferRecords, Fn fn)
+            {
+                vector<unique_ptr<RunReader>> readers;
+                for (const string& fn2 : runs)
+                {
+                    readers.emplace_back(new RunReader());
+                    if (!readers.back()->open(fn2, lo, bufferRecords))
+                        return false;
                 }
 
-                //Flush buffer
-                write_entry(nullptr, true);
+                auto cmp = [&](size_t a, size_t b) { return readers[b]->top() < readers[a]->top(); };
+                vector<size_t> heap;
+                for (size_t i = 0; i < readers.size(); ++i)
+                    if (!readers[i]->done() && readers[i]->top().key <= hi)
+                        heap.push_back(i);
 
-                //Clear new moves
-                clear_new_exp();
+                make_heap(heap.begin(), heap.end(), cmp);
+
+                while (!heap.empty())
+                {
+                    pop_heap(heap.begin(), heap.end(), cmp);
+                    RunReader& r = *readers[heap.back()];
+
+                    if (!fn(r.top()))
+                        return false;
+
+                    r.pop();
+                    if (!r.done() && r.top().key <= hi)
+                        push_heap(heap.begin(), heap.end(), cmp);
+                    else
+                        heap.pop_back();
+                }
 
                 return true;
             }
 
-        public:
-            ExperienceData()
+            size_t buffer_records(size_t openRuns) const
             {
-                _loading = false;
-                _abortLoading.store(false, memory_order_relaxed);
-                _loadingResult.store(false, memory_order_relaxed);
-                _loaderThread = nullptr;
+                return clamp(MemoryBudget / sizeof(RunRecord) / max(openRuns, size_t(1)), MinReadBuffer, MaxReadBuffer);
             }
 
-            ~ExperienceData()
+            //Step 2: Merge groups of runs until the last pass can keep all of them open on every thread
+            bool reduce_runs()
             {
-                clear();
-            }
+                size_t fanIn = max(MaxOpenRuns / _threads, size_t(8));
 
-        public:
+                while (_runs.size() > fanIn)
+                {
+                    vector<vector<string>> groups;
+                    for (size_t i = 0; i < _runs.size(); i += fanIn)
+                        groups.emplace_back(_runs.begin() + i, _runs.begin() + min(i + fanIn, _runs.size()));
 
-            string filename() const
-            {
-                return _filename;
-            }
+                    vector<string> merged;
+                    for (size_t i = 0; i < groups.size(); ++i)
+                        merged.push_back(run_filename());
 
-            bool has_new_exp() const
-            {
-                return _newPvExp.size() || _newMultiPvExp.size();
+                    size_t bufferRecords = buffer_records(min(_threads, groups.size()) * fanIn);
+                    bool success = parallel_for(_threads, groups.size(), [&](size_t i)
+                        {
+                            Writer out;
+                            return    out.open(merged[i])
+                                   && merge_runs(groups[i], Key(0), numeric_limits<Key>::max(), bufferRecords, [&](const RunRecord& r) { return out.write(r); })
+                                   && out.close();
+                        });
+
+                    remove_files(_runs);
+                    _runs = merged;
+
+                    if (!success)
+                        return false;
+                }
+
+                return true;
             }
 
-            bool load(string filename, bool synchronous)
+            //Step 3: Combine the moves of each position and write the target in parts, one per key range
+            bool write_parts(const vector<string>& parts, size_t& positions, size_t& moves, size_t& duplicates)
             {
-                //Make sure we are not already in the process of loading same/other experience file
-                wait_for_load_finished();
+                atomic<size_t> allPositions(0), allMoves(0), allDuplicates(0);
+                size_t bufferRecords = buffer_records(parts.size() * _runs.size());
+                Key step = numeric_limits<Key>::max() / parts.size();
 
-                //Load requested experience file
-                _filename = filename;
-                _loadingResult.store(false, memory_order_relaxed);
+                bool success = parallel_for(_threads, parts.size(), [&](size_t i)
+                    {
+                        Key lo = step * i;
+                        Key hi = i + 1 == parts.size() ? numeric_limits<Key>::max() : step * (i + 1) - 1;
 
-                //Block
-                {
-                    _loading = true;
-                    lock_guard<mutex> lg1(_loaderMutex);
-                    _loaderThread = new thread(thread([this, filename]()
+                        Writer out;
+                        if (!out.open(parts[i]))
+                            return false;
+
+                        size_t partPositions = 0, partMoves = 0, partDuplicates = 0;
+                        vector<ExpMove> expMoves;
+                        Key key = 0;
+
+                        auto flush_position = [&]() -> bool
                         {
-                            //Load
-                            bool loadingResult = _load(filename);
-                            _loadingResult.store(loadingResult, memory_order_relaxed);
+                            if (expMoves.empty())
+                                return true;
 
-                            //Copy pointer of loader thread so that we can
-                            //clear the variable now and and deleted later
-                            thread *t = _loaderThread;
-                            _loaderThread = nullptr;
+                            stable_sort(expMoves.begin(), expMoves.end(), [](const ExpMove& a, const ExpMove& b) { return a.compare(b) > 0; });
 
-                            //Notify
+                            partPositions++;
+                            bool ok = for_each_saved_entry(key, expMoves.data(), expMoves.data() + expMoves.size(), [&](const Current::ExpEntry& entry)
+                                {
+                                    partMoves++;
+                                    return out.write(entry);
+                                });
+
+                            expMoves.clear();
+                            return ok;
+                        };
+
+                        bool ok = merge_runs(_runs, lo, hi, bufferRecords, [&](const RunRecord& r)
                             {
-                                lock_guard<mutex> lg2(_loaderMutex);
-                                _loading = false;
-                                _loadingCond.notify_one();
-                            }
-                            
-                            //Detach and delete loader thread
-                            t->detach();
-                            delete t;
-                        }));
-                }
+                                if (r.key != key && !flush_position())
+                                    return false;
 
-                return synchronous ? wait_for_load_finished() : true;
-            }
+                                key = r.key;
+                                if (!add_move(expMoves, r.exp))
+                                    partDuplicates++;
 
-            bool wait_for_load_finished()
-            {
-                unique_lock<mutex> ul(_loaderMutex);
-                _loadingCond.wait(ul, [&] { return !_loading; });
-                return loading_result();
+                                return true;
+                            });
+
+                        ok = ok && flush_position() && out.close();
+
+                        allPositions += partPositions;
+                        allMoves += partMoves;
+                        allDuplicates += partDuplicates;
+
+                        return ok;
+                    });
+
+                positions = allPositions;
+                moves = allMoves;
+                duplicates = allDuplicates;
+
+                return success;
             }
 
-            bool loading_result() const
+            //Copies the parts behind the signature
+            static bool concatenate_parts(ofstream& out, const vector<string>& parts)
             {
-                return _loadingResult.load(memory_order_relaxed);
+                if (!(out << Current::ExperienceSignature))
+                    return false;
+
+                vector<char> buffer(WriteBufferSize);
+                for (const string& part : parts)
+                {
+                    ifstream in(part, ios::in | ios::binary);
+                    while (in.read(buffer.data(), buffer.size()) || in.gcount())
+                        if (!out.write(buffer.data(), in.gcount()))
+                            return false;
+                }
+
+                return true;
             }
 
-            void save(string fn, bool saveAll, bool ignoreLoadingCheck)
+            //Encodes the entries of the parts, which are in key order, in the compact format
+            static bool compact_parts(ofstream& out, const vector<string>& parts)
             {
-                //Make sure we are not already in the process of loading same/other experience file
-                if(!ignoreLoadingCheck)
-                    wait_for_load_finished();
-
-                if (!has_new_exp() && (!saveAll || _mainExp.size() == 0))
-                    return;
+                V3::ExperienceWriter writer(out);
+                if (!writer.begin())
+                    return false;
 
-                //Step 1: Create backup only if 'saveAll' is 'true'
-                string expFilename = Utility::map_path(fn);
-                string backupExpFilename;
-                if (saveAll && Utility::file_exists(expFilename))
+                Current::ExpEntry tempExp((Key)0, MOVE_NONE, VALUE_NONE, DEPTH_NONE);
+                for (const string& part : parts)
                 {
-                    backupExpFilename = expFilename + ".bak";
+                    ifstream in(part, ios::in | ios::binary);
+                    while (in.read((char*)&tempExp, sizeof(Current::ExpEntry)))
+                        if (!writer.write(tempExp))
+                            return false;
+                }
 
-                    //If backup file already exists then delete it
-                    if (Utility::file_exists(backupExpFilename))
-                    {
-                        if (remove(backupExpFilename.c_str()) != 0)
-                        {
-                            sync_cout << "info string Could not deleted existing backup file: " << backupExpFilename << sync_endl;
+                return writer.end();
+            }
 
-                            //Clear backup filename
-                            backupExpFilename.clear();
-                        }
+            //Step 4: Write the parts to a new file in the target format and replace the target, keeping a backup
+            bool write_target(const vector<string>& parts)
+            {
+                string tempFilename = _target + ".tmp";
+                {
+                    ofstream out(tempFilename, ios::out | ios::binary | ios::trunc);
+                    if (!out.is_open())
+                    {
+                        sync_cout << "info string Failed to open experience file [" << tempFilename << "] for writing" << sync_endl;
+                        return false;
                     }
 
-                    //Rename current experience file
-                    if (!backupExpFilename.empty())
+                    if (!(_format == V3::ExperienceVersion ? compact_parts(out, parts) : concatenate_parts(out, parts)))
                     {
-                        if (rename(expFilename.c_str(), backupExpFilename.c_str()) != 0)
-                        {
-                            sync_cout << "info string Could not create backup of current experience file" << sync_endl;
-
-                            //Clear backup filename
-                            backupExpFilename.clear();
-                        }
+                        sync_cout << "info string Failed to save experience entry to experience file [" << tempFilename << "]" << sync_endl;
+                        out.close();
+                        remove(tempFilename.c_str());
+                        return false;
                     }
                 }
 
-                //Step 2: Save
-                if (!_save(fn, saveAll))
+                if (Utility::file_exists(_target))
                 {
-                    //Step 2a: Restore backup in case of failure while saving
-                    if (!backupExpFilename.empty())
+                    string backupFilename = _target + ".bak";
+                    if (Utility::file_exists(backupFilename) && remove(backupFilename.c_str()) != 0)
+                        sync_cout << "info string Could not deleted existing backup file: " << backupFilename << sync_endl;
+
+                    if (rename(_target.c_str(), backupFilename.c_str()) != 0)
                     {
-                        if (rename(backupExpFilename.c_str(), expFilename.c_str()) != 0)
+                        sync_cout << "info string Could not create backup of current experience file" << sync_endl;
+
+                        if (remove(_target.c_str()) != 0)
                         {
-                            sync_cout << "info string Could not restore backup experience file: " << backupExpFilename << sync_endl;
+                            remove(tempFilename.c_str());
+                            return false;
                         }
                     }
                 }
+
+                if (rename(tempFilename.c_str(), _target.c_str()) != 0)
+                {
+                    sync_cout << "info string Failed to replace experience file [" << _target << "]" << sync_endl;
+                    return false;
+                }
+
+                return true;
             }
 
-            const ExpEntryEx* probe(Key k) const
+            static void remove_files(const vector<string>& files)
             {
-                ExpConstIterator itr = _mainExp.find(k);
-                if (itr == _mainExp.end())
-                    return nullptr;
-
-                assert(itr->second->key == k);
+                for (const string& fn : files)
+                    remove(fn.c_str());
+            }
 
-                return itr->second;
+        public:
+            //'format' is the version of the target file, zero keeps the format of an existing compact target
+            explicit ExperienceMerger(const string& target, int format = 0) : _target(target), _format(format)
+            {
+                _threads = max(size_t(thread::hardware_concurrency()), size_t(1));
             }
 
-            void add_pv_experience(Key k, Move m, Value v, Depth d)
+            //Merges 'filenames' (and their journals, if any) into the target. The journal of the
+            //target is deleted once its entries are part of the target
+            bool merge(const vector<string>& filenames)
             {
-                ExpEntryEx* exp = new ExpEntryEx(k, m, v, d, 1);
+                TimePoint start = now();
 
-                if (exp)
+                for (const string& fn : filenames)
                 {
-                    _newPvExp.emplace_back(exp);
-                    link_entry(exp);
+                    if (Utility::file_exists(fn))
+                        add_source(fn);
+
+                    string journalFilename = fn + ".journal";
+                    if (Utility::file_exists(journalFilename) && add_source(journalFilename) && fn == _target)
+                        _inputJournals.push_back(journalFilename);
                 }
-            }
 
-            void add_multipv_experience(Key k, Move m, Value v, Depth d)
-            {
-                ExpEntryEx* exp = new ExpEntryEx(k, m, v, d, 1);
+                size_t entries = 0;
+                for (const Source& s : _sources)
+                    entries += s.entries;
+
+                if (!_format)
+                {
+                    _format = Current::ExperienceVersion;
+                    for (const Source& s : _sources)
+                        if (s.filename == _target && s.version == V3::ExperienceVersion)
+                            _format = V3::ExperienceVersion;
+                }
+
+                if (!entries)
+                {
+                    sync_cout << "info string No experience entries to merge into file [" << _target << "]" << sync_endl;
+                    return false;
+                }
+
+                vector<string> parts;
+                for (size_t i = 0; i < _threads; ++i)
+                    parts.push_back(_target + ".part" + to_string(i));
+
+                size_t positions = 0, moves = 0, duplicates = 0;
+                bool success =    create_runs()
+                               && reduce_runs()
+                               && write_parts(parts, positions, moves, duplicates)
+                               && positions
+                               && write_target(parts);
 
-                if (exp)
+                remove_files(_runs);
+                remove_files(parts);
+
+                if (!success)
                 {
-                    _newMultiPvExp.emplace_back(exp);
-                    link_entry(exp);
+                    sync_cout << "info string Failed to merge experience into file [" << _target << "]" << sync_endl;
+                    return false;
                 }
+
+                remove_files(_inputJournals);
+
+                sync_cout
+                    << "info string " << _target << " -> Total moves: " << entries
+                    << ". Total positions: " << positions
+                    << ". Duplicate moves: " << duplicates
+                    << ". Fragmentation: " << setprecision(2) << fixed << 100.0 * (double)duplicates / (double)entries << "%"
+                    << sync_endl;
+
+                sync_cout << "info string Saved " << positions << " position(s) and " << moves << " moves to experience file: " << _target
+                          << " (version " << _format << ", " << _threads << " threads, " << now() - start << " ms)" << sync_endl;
+
+                return true;
             }
         };
 
@@ -967,16 +3320,21 @@ namespace Experience
         }
 
         string filename = Options["Experience File"];
+        bool useMapping = Options["Experience Mmap"];
+        bool useSharing = Options["Experience Shared"];
         if (currentExperience)
         {
-            if (currentExperience->filename() == filename && currentExperience->loading_result())
+            if (   currentExperience->filename() == filename
+                && currentExperience->use_mapping() == useMapping
+                && currentExperience->use_sharing() == useSharing
+                && currentExperience->loading_result())
                 return;
 
             if (currentExperience)
                 unload();
         }
 
-        currentExperience = new ExperienceData();
+        currentExperience = new ExperienceData(useMapping, useSharing);
         currentExperience->load(filename, false);
     }
 
@@ -998,14 +3356,20 @@ namespace Experience
         if (!currentExperience || !currentExperience->has_new_exp() || (bool)Options["Experience Readonly"])
             return;
 
-        currentExperience->save(currentExperience->filename(), false, false);
+        currentExperience->save_async(currentExperience->filename(), (bool)Options["Experience Journal"]);
+    }
+
+    void prefetch(Key k)
+    {
+        if (currentExperience)
+            currentExperience->prefetch(k);
     }
 
-    const ExpEntryEx* probe(Key k)
+    ExpMoves probe(Key k)
     {
         assert(experienceEnabled);
         if (!currentExperience)
-            return nullptr;
+            return ExpMoves();
 
         return currentExperience->probe(k);
     }
@@ -1018,11 +3382,35 @@ namespace Experience
         currentExperience->wait_for_load_finished();
     }
 
+    void wait_for_saving_finished()
+    {
+        if (!currentExperience)
+            return;
+
+        currentExperience->wait_for_saves_finished();
+    }
+
+    bool loading()
+    {
+        return currentExperience && currentExperience->loading();
+    }
+
+    vector<pair<string, size_t>> memory()
+    {
+        if (!currentExperience)
+            return {};
+
+        return currentExperience->memory();
+    }
+
     //Defrag command:
-    //Format:  defrag [filename]
-    //Example: defrag C:\Path to\Experience\file.exp
+    //Format:  defrag [filename] [v2|v3]
+    //Example: defrag C:\Path to\Experience\file.exp v3
     //Note:    'filename' is optional. If omitted, then the default experience filename (SugaR.exp) will be used
     //         'filename' can contain spaces and can be a full path. If filename contains spaces, it is best to enclose it in quotations
+    //         The journal of 'filename' (filename.journal), if any, is compacted into 'filename' and deleted
+    //         'v3' writes the compact format and 'v2' the plain one, which can be memory mapped (see 'Experience Mmap').
+    //         If omitted, a compact file stays compact and any other file is written as 'v2'
     void defrag(int argc, char* argv[])
     {
         //Make sure experience has finished loading
@@ -1030,10 +3418,20 @@ namespace Experience
         //disturb the progress messages shown by this function
         wait_for_loading_finished();
 
-        if (argc != 1)
+        //The files may be the ones being saved in the background
+        wait_for_saving_finished();
+
+        int format = 0;
+        if (argc == 2)
+        {
+            string f = argv[1];
+            format = f == "v2" ? V2::ExperienceVersion : f == "v3" ? V3::ExperienceVersion : -1;
+        }
+
+        if ((argc != 1 && argc != 2) || format < 0)
         {
             sync_cout << "info string Error : Incorrect defrag command" << sync_endl;
-            sync_cout << "info string Syntax: defrag [filename]" << sync_endl;
+            sync_cout << "info string Syntax: defrag [filename] [v2|v3]" << sync_endl;
             return;
         }
 
@@ -1045,13 +3443,8 @@ namespace Experience
         //Map filename
         filename = Utility::map_path(filename);
 
-        //Load
-        ExperienceData exp;
-        if (!exp.load(filename, true))
-            return;
-
-        //Save
-        exp.save(filename, true, false);
+        //Merge the file with its journal
+        ExperienceMerger(filename, format).merge({ filename });
     }
 
     //Merge command:
@@ -1067,6 +3460,9 @@ namespace Experience
         //disturb the progress messages shown by this function
         wait_for_loading_finished();
 
+        //The files may be the ones being saved in the background
+        wait_for_saving_finished();
+
         //Step 1: Check
         if (argc < 2)
         {
@@ -1092,12 +3488,8 @@ namespace Experience
 
         cout << "\nTarget file: " << targetFilename << "\n" << sync_endl;
 
-        //Step 4: Load and merge
-        ExperienceData exp;
-        for (const string& fn : filenames)
-            exp.load(fn, true);
-
-        exp.save(targetFilename, true, false);
+        //Step 4: Merge
+        ExperienceMerger(targetFilename).merge(filenames);
     }
 
     ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1120,6 +3512,9 @@ namespace Experience
         //disturb the progress messages shown by this function
         wait_for_loading_finished();
 
+        //The files may be the ones being saved in the background
+        wait_for_saving_finished();
+
         if (argc < 2)
         {
             sync_cout << "Expecting at least 2 arguments, received: " << argc << sync_endl;
@@ -1145,8 +3540,9 @@ namespace Experience
                                                           << endl << sync_endl;
 
         //////////////////////////////////////////////////////////////////
-        //Conversion information
-        struct GLOBAL_COMPACT_PGN_CONVERSION_DATA
+        //Conversion statistics, kept per batch of games by the workers and
+        //added to the global ones in input order by the writer
+        struct COMPACT_PGN_CONVERSION_STATS
         {
             //Game statistics
             size_t numGames = 0;
@@ -1156,11 +3552,30 @@ namespace Experience
             //Move statistics
             size_t numMovesWithScores = 0;
             size_t numMovesWithScoresIgnored = 0;
-            size_t numMovesWithoutScores = 0;                        
+            size_t numMovesWithoutScores = 0;
 
             //WBD statistics
             size_t wbd[COLOR_NB + 1] = { 0, 0, 0 };
 
+            void add(const COMPACT_PGN_CONVERSION_STATS& st)
+            {
+                numGames += st.numGames;
+                numGamesWithErrors += st.numGamesWithErrors;
+                numGamesIgnored += st.numGamesIgnored;
+
+                numMovesWithScores += st.numMovesWithScores;
+                numMovesWithScoresIgnored += st.numMovesWithScoresIgnored;
+                numMovesWithoutScores += st.numMovesWithoutScores;
+
+                for (int i = 0; i <= COLOR_NB; ++i)
+                    wbd[i] += st.wbd[i];
+            }
+        };
+
+        //////////////////////////////////////////////////////////////////
+        //Conversion information
+        struct GLOBAL_COMPACT_PGN_CONVERSION_DATA : COMPACT_PGN_CONVERSION_STATS
+        {
             //Input stream
             fstream inputStream;
             size_t inputStreamSize = 0;
@@ -1174,7 +3589,7 @@ namespace Experience
         }globalConversionData;
 
         //////////////////////////////////////////////////////////////////
-        //Game conversion information
+        //Game conversion information, one per worker
         struct COMPACT_PGN_CONVERSION_DATA
         {
             Color detectedWinnerColor;
@@ -1183,6 +3598,10 @@ namespace Experience
 
             Position pos;
 
+            //Statistics and experience entries of the current batch
+            COMPACT_PGN_CONVERSION_STATS stats;
+            vector<char> buffer;
+
             COMPACT_PGN_CONVERSION_DATA()
             {
                 clear();
@@ -1194,7 +3613,7 @@ namespace Experience
                 drawDetected = false;
                 memset((void*)&resultWeight, 0, sizeof(resultWeight));
             }
-        }gameData;
+        };
 
         //////////////////////////////////////////////////////////////////////////
         //Input stream
@@ -1232,7 +3651,7 @@ namespace Experience
 
         //////////////////////////////////////////////////////////////////
         //Experience Data writing routine
-        auto write_data = [&](bool force)
+        auto write_data = [&](bool force, size_t inputStreamPos)
         {
             if (force || globalConversionData.buffer.size() >= WriteBufferSize)
             {
@@ -1240,11 +3659,6 @@ namespace Experience
                 globalConversionData.buffer.clear();
 
                 size_t numMoves = globalConversionData.numMovesWithScores + globalConversionData.numMovesWithScoresIgnored + globalConversionData.numMovesWithoutScores;
-                size_t inputStreamPos = globalConversionData.inputStream.tellg();
-
-                //Fix for end-of-input stream value of -1!
-                if (inputStreamPos == (size_t)-1)
-                    inputStreamPos = globalConversionData.inputStreamSize;
 
                 sync_cout
                     << fixed << setprecision(2) << setw(6) << setfill(' ') << ((double)inputStreamPos * 100.0 / (double)globalConversionData.inputStreamSize) << "% ->"
@@ -1272,7 +3686,7 @@ namespace Experience
 
         //////////////////////////////////////////////////////////////////
         //Conversion routine
-        auto convert_compact_pgn_to_exp = [&](const string &compactPgn) -> bool
+        auto convert_compact_pgn_to_exp = [&](COMPACT_PGN_CONVERSION_DATA& gameData, const string &compactPgn) -> bool
         {
             constexpr Value GOOD_SCORE = PawnValueEg * 3;
             constexpr Value OK_SCORE = GOOD_SCORE / 2;
@@ -1285,14 +3699,14 @@ namespace Experience
             gameData.clear();
 
             //Increment games counter
-            ++globalConversionData.numGames;
+            ++gameData.stats.numGames;
 
             //Split compact PGN into its main three parts
             vector<string> tokens = tokenize(compactPgn, ',');
 
             if (tokens.size() < 3)
             {
-                ++globalConversionData.numGamesWithErrors;
+                ++gameData.stats.numGamesWithErrors;
                 return false;
             }
 
@@ -1336,7 +3750,7 @@ namespace Experience
 
                 if (tok.size() >= 4)
                 {
-                    ++globalConversionData.numGamesWithErrors;
+                    ++gameData.stats.numGamesWithErrors;
                     return false;
                 }
 
@@ -1347,7 +3761,7 @@ namespace Experience
                 //Check if move is empty
                 if (_move.empty())
                 {
-                    ++globalConversionData.numGamesWithErrors;
+                    ++gameData.stats.numGamesWithErrors;
                     return false;
                 }
 
@@ -1355,7 +3769,7 @@ namespace Experience
                 Move move = UCI::to_move(gameData.pos, _move);
                 if (move == MOVE_NONE)
                 {
-                    ++globalConversionData.numGamesWithErrors;
+                    ++gameData.stats.numGamesWithErrors;
                     return false;
                 }
 
@@ -1366,7 +3780,7 @@ namespace Experience
                 {
                     if (depth >= minDepth && depth <= maxDepth && abs(score) <= maxValue)
                     {
-                        ++globalConversionData.numMovesWithScores;
+                        ++gameData.stats.numMovesWithScores;
 
                         //Assign to temporary experience
                         tempExp.key = gameData.pos.key();
@@ -1380,7 +3794,7 @@ namespace Experience
                     }
                     else
                     {
-                        ++globalConversionData.numMovesWithScoresIgnored;
+                        ++gameData.stats.numMovesWithScoresIgnored;
                     }
 
                     //////////////////////////////////////////////////////////////////
@@ -1393,13 +3807,13 @@ namespace Experience
                             gameData.detectedWinnerColor = winnerColorBasedOnThisMove;
                             if (gameData.detectedWinnerColor != winnerColor)
                             {
-                                ++globalConversionData.numGamesIgnored;
+                                ++gameData.stats.numGamesIgnored;
                                 return false;
                             }
                         }
                         else if (gameData.detectedWinnerColor != winnerColorBasedOnThisMove)
                         {
-                            ++globalConversionData.numGamesIgnored;
+                            ++gameData.stats.numGamesIgnored;
                             return false;
                         }
                     }
@@ -1436,7 +3850,7 @@ namespace Experience
                 }
                 else
                 {
-                    ++globalConversionData.numMovesWithoutScores;
+                    ++gameData.stats.numMovesWithoutScores;
                 }
 
                 //Do the move
@@ -1469,7 +3883,7 @@ namespace Experience
                 //If draw is detected but game result isn't draw then reject the game
                 if (gameData.drawDetected && gameData.detectedWinnerColor != COLOR_NB)
                 {
-                    ++globalConversionData.numGamesIgnored;
+                    ++gameData.stats.numGamesIgnored;
                     return false;
                 }
             }
@@ -1477,7 +3891,7 @@ namespace Experience
             //Does the game have enough moves?
             if (gamePly < MIN_PLY_PER_GAME)
             {
-                ++globalConversionData.numGamesIgnored;
+                ++gameData.stats.numGamesIgnored;
                 return false;
             }
 
@@ -1496,21 +3910,143 @@ namespace Experience
                 || (winnerColor != COLOR_NB && gameData.resultWeight[winnerColor] < MIN_WEIGHT_FOR_WIN)
                 || (winnerColor == COLOR_NB && !gameData.drawDetected && gameData.resultWeight[COLOR_NB] < MIN_WEIGHT_FOR_DRAW))
             {
-                ++globalConversionData.numGamesIgnored;
+                ++gameData.stats.numGamesIgnored;
                 return false;
             }
 
             //Update WBD stats
-            ++globalConversionData.wbd[winnerColor];
+            ++gameData.stats.wbd[winnerColor];
 
-            //Copy to global buffer
-            globalConversionData.buffer.insert(globalConversionData.buffer.end(), tempBuffer.begin(), tempBuffer.end());
+            //Copy to batch buffer
+            gameData.buffer.insert(gameData.buffer.end(), tempBuffer.begin(), tempBuffer.end());
 
             return true;
         };
 
+        //////////////////////////////////////////////////////////////////
+        //Pipeline: this thread reads batches of games ending at game boundaries,
+        //the workers replay them on their own position and the writer appends
+        //their experience entries and statistics in input order
+        struct COMPACT_PGN_BATCH
+        {
+            vector<string> games;
+            size_t endPos = 0;
+
+            COMPACT_PGN_CONVERSION_STATS stats;
+            vector<char> buffer;
+        };
+
+        constexpr size_t BatchGames = 1024;
+
+        const size_t numWorkers = max(size_t(thread::hardware_concurrency()), size_t(1));
+        const size_t maxBatchesInFlight = 4 * numWorkers;
+
+        mutex pipelineMutex;
+        condition_variable pipelineCond;
+        deque<pair<size_t, unique_ptr<COMPACT_PGN_BATCH>>> pendingBatches;
+        map<size_t, unique_ptr<COMPACT_PGN_BATCH>> convertedBatches;
+        size_t batchesRead = 0, batchesWritten = 0;
+        bool readingDone = false;
+
+        auto worker = [&]()
+        {
+            COMPACT_PGN_CONVERSION_DATA gameData;
+
+            while (true)
+            {
+                pair<size_t, unique_ptr<COMPACT_PGN_BATCH>> item;
+                {
+                    unique_lock<mutex> ul(pipelineMutex);
+                    pipelineCond.wait(ul, [&] { return !pendingBatches.empty() || readingDone; });
+
+                    if (pendingBatches.empty())
+                        return;
+
+                    item = std::move(pendingBatches.front());
+                    pendingBatches.pop_front();
+                }
+
+                for (const string& game : item.second->games)
+                    convert_compact_pgn_to_exp(gameData, game);
+
+                item.second->games.clear();
+                item.second->stats = gameData.stats;
+                item.second->buffer.swap(gameData.buffer);
+                gameData.stats = COMPACT_PGN_CONVERSION_STATS();
+                gameData.buffer.clear();
+
+                {
+                    lock_guard<mutex> lg(pipelineMutex);
+                    convertedBatches.emplace(item.first, std::move(item.second));
+                }
+
+                pipelineCond.notify_all();
+            }
+        };
+
+        auto writer = [&]()
+        {
+            while (true)
+            {
+                unique_ptr<COMPACT_PGN_BATCH> batch;
+                {
+                    unique_lock<mutex> ul(pipelineMutex);
+                    pipelineCond.wait(ul, [&]
+                        {
+                            return convertedBatches.count(batchesWritten) || (readingDone && batchesWritten == batchesRead);
+                        });
+
+                    auto it = convertedBatches.find(batchesWritten);
+                    if (it == convertedBatches.end())
+                        break;
+
+                    batch = std::move(it->second);
+                    convertedBatches.erase(it);
+                }
+
+                globalConversionData.add(batch->stats);
+                globalConversionData.buffer.insert(globalConversionData.buffer.end(), batch->buffer.begin(), batch->buffer.end());
+                write_data(false, batch->endPos);
+
+                {
+                    lock_guard<mutex> lg(pipelineMutex);
+                    ++batchesWritten;
+                }
+
+                pipelineCond.notify_all();
+            }
+
+            //Final commit
+            write_data(true, globalConversionData.inputStreamSize);
+        };
+
+        vector<thread> workers;
+        for (size_t i = 0; i < numWorkers; ++i)
+            workers.emplace_back(worker);
+
+        thread writerThread(writer);
+
+        //Hands a batch over to the workers, waiting while too many batches are in flight
+        auto push_batch = [&](unique_ptr<COMPACT_PGN_BATCH>& batch)
+        {
+            size_t inputStreamPos = globalConversionData.inputStream.tellg();
+
+            //Fix for end-of-input stream value of -1!
+            batch->endPos = inputStreamPos == (size_t)-1 ? globalConversionData.inputStreamSize : inputStreamPos;
+
+            {
+                unique_lock<mutex> ul(pipelineMutex);
+                pipelineCond.wait(ul, [&] { return batchesRead - batchesWritten < maxBatchesInFlight; });
+                pendingBatches.emplace_back(batchesRead++, std::move(batch));
+            }
+
+            pipelineCond.notify_all();
+            batch.reset(new COMPACT_PGN_BATCH());
+        };
+
         //////////////////////////////////////////////////////////////////
         //Loop
+        unique_ptr<COMPACT_PGN_BATCH> batch(new COMPACT_PGN_BATCH());
         string line;
         while (getline(globalConversionData.inputStream, line))
         {
@@ -1521,14 +4057,26 @@ namespace Experience
             if (line.front() != '{' || line.back() != '}')
                 continue;
 
-            line = line.substr(1, line.size() - 2);
+            batch->games.push_back(line.substr(1, line.size() - 2));
+
+            if (batch->games.size() >= BatchGames)
+                push_batch(batch);
+        }
+
+        if (!batch->games.empty())
+            push_batch(batch);
 
-            if (convert_compact_pgn_to_exp(line))
-                write_data(false);
+        {
+            lock_guard<mutex> lg(pipelineMutex);
+            readingDone = true;
         }
 
-        //Final commit
-        write_data(true);
+        pipelineCond.notify_all();
+
+        for (thread& th : workers)
+            th.join();
+
+        writerThread.join();
 
         //////////////////////////////////////////////////////////////////
         //Defragment outouf file
@@ -1539,12 +4087,7 @@ namespace Experience
 
             sync_cout << "Conversion complete" << endl << endl << "Defragmenting: " << outputPath << sync_endl;
 
-            ExperienceData exp;
-            if (!exp.load(outputPath, true))
-                return;
-
-            //Save
-            exp.save(outputPath, true, false);
+            ExperienceMerger(Utility::map_path(outputPath)).merge({ Utility::map_path(outputPath) });
         }
     }
 
@@ -1556,40 +4099,36 @@ namespace Experience
         sync_cout << pos << endl;
 
         cout << "Experience: ";
-        const ExpEntryEx* expEx = Experience::probe(pos.key());
-        if (!expEx)
+        ExpMoves expMoves = Experience::probe(pos.key());
+        if (expMoves.empty())
         {
             cout << "No experience data found for this position" << sync_endl;
             return;
         }
 
         int evalImportance = (int)Options["Experience Book Eval Importance"];
-        vector<pair<const ExpEntryEx*, int>> quality;
-        const ExpEntryEx* temp = expEx;
-        while (temp)
-        {
-            quality.emplace_back(temp, temp->quality(pos, evalImportance).first);
-            temp = temp->next;
-        }
+        vector<pair<const ExpMove*, int>> quality;
+        for (const ExpMove& exp : expMoves)
+            quality.emplace_back(&exp, exp.quality(pos, evalImportance).first);
 
         //Sort experience moves based on quality
         stable_sort(
             quality.begin(),
             quality.end(),
-            [](const pair<const ExpEntryEx*, int> &a, const pair<const ExpEntryEx*, int> &b)
+            [](const pair<const ExpMove*, int> &a, const pair<const ExpMove*, int> &b)
             {
                 return a.second > b.second;
             });
 
         cout << endl;
         int expCount = 0;
-        for(const pair<const ExpEntryEx*, int>& pr : quality)
+        for(const pair<const ExpMove*, int>& pr : quality)
         {
             cout
                 << setw(2)     << setfill(' ')            << left << ++expCount << ": "
-                << setw(5)     << setfill(' ')            << left << UCI::move(pr.first->move, pos.is_chess960())
-                << ", depth: " << setw(2) << setfill(' ') << left << pr.first->depth
-                << ", eval: "  << setw(6) << setfill(' ') << left << UCI::value(pr.first->value);
+                << setw(5)     << setfill(' ')            << left << UCI::move(pr.first->move(), pos.is_chess960())
+                << ", depth: " << setw(2) << setfill(' ') << left << pr.first->depth()
+                << ", eval: "  << setw(6) << setfill(' ') << left << UCI::value(pr.first->value());
 
             if (extended)
             {
@@ -1602,13 +4141,126 @@ namespace Experience
             }
 
             cout << endl;
-
-            expEx = expEx->next;
         }
 
         cout << sync_endl;
     }
 
+    //Export command:
+    //Format:  expbook <filename> [moves N] [threads T]
+    //Example: expbook C:\Books\experience.bin moves 20
+    //Note:    Writes the experience reachable from the current position to a PolyGlot book. Positions are
+    //         followed through their experience moves up to move N of the game ('Experience Book Max Moves'
+    //         by default). The moves are chosen and weighted by their quality like the experience book does
+    //         ('Experience Book Eval Importance', 'Experience Book Min Depth'), so that 'Book File' can serve
+    //         the result at the root without probing the experience
+    void export_book(Position& pos, istream& is)
+    {
+        wait_for_loading_finished();
+
+        string filename, token;
+        int maxMoves = (int)Options["Experience Book Max Moves"];
+        size_t threads = max(size_t(thread::hardware_concurrency()), size_t(1));
+
+        is >> filename;
+        while (is >> token)
+        {
+            if (token == "moves")        is >> maxMoves;
+            else if (token == "threads") is >> threads;
+        }
+
+        if (filename.empty() || !threads)
+        {
+            sync_cout << "info string Error : Incorrect expbook command" << sync_endl;
+            sync_cout << "info string Syntax: expbook <filename> [moves N] [threads T]" << sync_endl;
+            return;
+        }
+
+        if (!currentExperience)
+        {
+            sync_cout << "info string No experience loaded" << sync_endl;
+            return;
+        }
+
+        filename = Utility::map_path(Utility::unquote(filename));
+
+        TimePoint start = now();
+        int evalImportance = (int)Options["Experience Book Eval Importance"];
+        Depth minDepth = (Depth)Options["Experience Book Min Depth"];
+        bool chess960 = pos.is_chess960();
+
+        //Positions are expanded one ply at a time, every position of a ply on any thread
+        struct Expansion
+        {
+            vector<PolyHash>           entries;
+            vector<pair<Key, string>>  children;
+        };
+
+        vector<PolyHash> entries;
+        unordered_set<Key> visited{ pos.key() };
+        vector<string> frontier{ pos.fen() };
+        size_t positions = 0;
+
+        while (!frontier.empty())
+        {
+            vector<Expansion> expansions(frontier.size());
+            parallel_for(threads, frontier.size(), [&](size_t i)
+                {
+                    StateInfo st, st2;
+                    Position p;
+                    p.set(frontier[i], chess960, &st, Threads.main());
+
+                    if (p.game_ply() / 2 >= maxMoves)
+                        return true;
+
+                    for (const ExpMove& exp : probe(p.key()))
+                    {
+                        Move m = exp.move();
+                        if (exp.depth() < minDepth || !p.pseudo_legal(m) || !p.legal(m))
+                            continue;
+
+                        pair<int, bool> q = exp.quality(p, evalImportance);
+                        if (q.first <= 0 || q.second)
+                            continue;
+
+                        expansions[i].entries.push_back(PolyHash{ p.polyglot_key(), PolyBook::sf_move_to_pg_move(m), (uint16_t)min(q.first, 0xFFFF), 0 });
+
+                        p.do_move(m, st2);
+                        expansions[i].children.emplace_back(p.key(), p.fen());
+                        p.undo_move(m);
+                    }
+
+                    return true;
+                });
+
+            frontier.clear();
+            for (Expansion& e : expansions)
+            {
+                positions += !e.entries.empty();
+                entries.insert(entries.end(), e.entries.begin(), e.entries.end());
+
+                for (auto& child : e.children)
+                    if (visited.insert(child.first).second)
+                        frontier.push_back(move(child.second));
+            }
+        }
+
+        if (entries.empty())
+        {
+            sync_cout << "info string No experience moves to export from this position" << sync_endl;
+            return;
+        }
+
+        if (!PolyBook::write(filename, entries, threads))
+        {
+            sync_cout << "info string Failed to write book file: " << filename << sync_endl;
+            return;
+        }
+
+        sync_cout << "info string Exported " << positions << " position(s) and " << entries.size() << " moves to book file: " << filename
+                  << " (" << threads << " threads, " << now() - start << " ms)" << sync_endl;
+    }
+
     void pause_learning()
     {
         learningPaused = true;
@@ -19,7 +19,13 @@
 #ifndef __EXPERIENCE_H__
 #define __EXPERIENCE_H__
 
+#include <algorithm>
+#include <cassert>
+#include <istream>
 #include <limits>
+#include <string>
+#include <utility>
+#include <vector>
 #include "types.h"
 
 using namespace std;
@@ -152,52 +158,99 @@ namespace Experience
 
     namespace Current = V2;
 
-    //Experience structure
-    struct ExpEntryEx : public Current::ExpEntry
+    //Compact in-memory experience move (8 bytes). The position key is stored once
+    //per position by the experience store, which keeps the moves of each position
+    //contiguous and sorted based on pseudo-quality, best first
+    struct ExpMove
     {
-        ExpEntryEx* next = nullptr;
+        uint16_t move16;
+        int16_t  value16;
+        uint8_t  depth8;
+        uint8_t  padding;
+        uint16_t count;                     //A scaled version of count
 
-        ExpEntryEx() = delete;
-        ExpEntryEx(const ExpEntryEx& exp) = delete;
-        ExpEntryEx& operator =(const ExpEntryEx& exp) = delete;
+        ExpMove() = default;
 
-        explicit ExpEntryEx(Stockfish::Key k, Stockfish::Move m, Stockfish::Value v, Stockfish::Depth d, uint8_t c) : Current::ExpEntry(k, m, v, d, c) {}
-
-        ExpEntryEx* find(Stockfish::Move m) const
+        explicit ExpMove(Stockfish::Move m, Stockfish::Value v, Stockfish::Depth d, uint16_t c)
         {
-            ExpEntryEx* exp = const_cast<ExpEntryEx*>(this);
-            do
-            {
-                if (exp->move == m)
-                    return exp;
+            move16 = (uint16_t)m;
+            value16 = (int16_t)std::clamp((int)v, -(int)Stockfish::VALUE_NONE, (int)Stockfish::VALUE_NONE);
+            depth8 = (uint8_t)std::clamp((int)d, 0, (int)std::numeric_limits<uint8_t>::max());
+            padding = 0;
+            count = c;
+        }
 
-                exp = exp->next;
-            } while (exp);
+        explicit ExpMove(const Current::ExpEntry& exp) : ExpMove(exp.move, exp.value, exp.depth, exp.count) {}
 
-            return nullptr;
-        }
+        Stockfish::Move  move()  const { return (Stockfish::Move)move16; }
+        Stockfish::Value value() const { return (Stockfish::Value)value16; }
+        Stockfish::Depth depth() const { return (Stockfish::Depth)depth8; }
 
-        ExpEntryEx* find(Stockfish::Move mv, Stockfish::Depth minDepth) const
+        void merge(const ExpMove& exp)
         {
-            ExpEntryEx* temp = const_cast<ExpEntryEx*>(this);
-            do
+            assert(move16 == exp.move16);
+
+            //Merge the count
+            count = (uint16_t)std::min((uint32_t)count + (uint32_t)exp.count, (uint32_t)std::numeric_limits<uint16_t>::max());
+
+            //Merge value and depth if 'exp' is better or equal
+            if (depth8 > exp.depth8)
+                return;
+
+            if (depth8 == exp.depth8)
             {
-                if ((Stockfish::Move)temp->move == mv)
-                {
-                    if (temp->depth < minDepth)
-                        temp = nullptr;
+                value16 = (int16_t)((value16 + exp.value16) / 2);
+            }
+            else
+            {
+                value16 = exp.value16;
+                depth8 = exp.depth8;
+            }
+        }
 
-                    break;
-                }
+        int compare(const ExpMove& exp) const
+        {
+            int v = value() * std::max(depth() / 10, 1) * std::max(count / 3, 1) - exp.value() * std::max(exp.depth() / 10, 1) * std::max(exp.count / 3, 1);
+            if (v) return v;
 
-                temp = temp->next;
-            } while (temp);
+            v = count - exp.count;
+            if (v) return v;
 
-            return temp;
+            v = depth() - exp.depth();
+            return v;
         }
 
         std::pair<int, bool> quality(Stockfish::Position& pos, int evalImportance) const;
     };
+
+    static_assert(sizeof(ExpMove) == 8);
+
+    //View of all experience moves of a position, best first. It stays valid
+    //until the experience file is unloaded
+    class ExpMoves
+    {
+    private:
+        const ExpMove* first = nullptr;
+        size_t         count = 0;
+
+    public:
+        ExpMoves() = default;
+        ExpMoves(const ExpMove* f, size_t n) : first(f), count(n) {}
+
+        const ExpMove* begin() const { return first; }
+        const ExpMove* end()   const { return first + count; }
+        size_t size()  const { return count; }
+        bool   empty() const { return count == 0; }
+
+        const ExpMove* find(Stockfish::Move m) const
+        {
+            for (const ExpMove& exp : *this)
+                if (exp.move() == m)
+                    return &exp;
+
+            return nullptr;
+        }
+    };
 }
 
 namespace Experience
@@ -209,12 +262,21 @@ namespace Experience
     void save();
 
     void wait_for_loading_finished();
+    void wait_for_saving_finished();
+    bool loading();
+
+    //Bytes held by the loaded experience, by part, waiting for a load in progress.
+    //The mapped file and the shared image live in the page cache rather than in
+    //private memory
+    vector<pair<string, size_t>> memory();
 
-    const ExpEntryEx* probe(Stockfish::Key k);
+    void prefetch(Stockfish::Key k);
+    ExpMoves probe(Stockfish::Key k);
 
     void defrag(int argc, char* argv[]);
     void merge(int argc, char* argv[]);
     void show_exp(Stockfish::Position& pos, bool extended);
+    void export_book(Stockfish::Position& pos, std::istream& is);
     void convert_compact_pgn(int argc, char* argv[]);
 
     void pause_learning();
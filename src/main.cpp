@@ -19,31 +19,20 @@
 #include <iostream>
 #include<stdio.h>
 
-#include "bitboard.h"
-#include "endgame.h"
-
+#include "engine.h"
 #include "misc.h"
-#include "polybook.h"
-#include "position.h"
-#include "psqt.h"
-#include "search.h"
-#include "thread.h"
-#include "tt.h"
 #include "uci.h"
-#include "experience.h"
 
 using namespace Stockfish;
 
 int main(int argc, char* argv[]) {
 
-  Utility::init(argv[0]);
   SysInfo::init();
+  Startup::mark("sysinfo");
   show_logo();
 
   std::cout << engine_info() << std::endl;
 
-  CommandLine::init(argc, argv);
-
   std::cout
       << "Operating System (OS) : " << SysInfo::os_info() << std::endl
       << "CPU Brand             : " << SysInfo::processor_brand() << std::endl
@@ -53,22 +42,12 @@ int main(int argc, char* argv[]) {
       << "Hyper-Threading       : " << SysInfo::is_hyper_threading() << std::endl
       << "L1/L2/L3 cache size   : " << SysInfo::cache_info(0) << "/" << SysInfo::cache_info(1) << "/" << SysInfo::cache_info(2) << std::endl
       << "Memory installed (RAM): " << SysInfo::total_memory() << std::endl << std::endl;
+  Startup::mark("banner");
 
-  UCI::init(Options);
-  Tune::init();
-  PSQT::init();
-  Bitboards::init();
-  Position::init();
-  Bitbases::init();
-  Endgames::init();
-  Experience::init();
-  Threads.set(size_t(Options["Threads"]));
-  polybook[0].init(Options["Book File"]);
-  Search::clear(); // After threads are up
+  Engine::init(argc, argv);
 
   UCI::loop(argc, argv);
 
-  Experience::unload();
-  Threads.set(0);
+  Engine::shutdown();
   return 0;
 }
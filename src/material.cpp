@@ -16,6 +16,7 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <atomic>
 #include <cassert>
 #include <cstring>   // For std::memset
 
@@ -113,23 +114,56 @@ namespace {
     return bonus;
   }
 
+  // Material configurations that need no promoted piece are few enough to be
+  // indexed directly by their piece counts. Their entries live in one table
+  // shared by all the threads; each entry is computed by the first thread that
+  // needs it and then only read. The table is zero initialized, so its pages
+  // are backed by memory only for the configurations actually reached.
+  constexpr int MaxPieces[PIECE_TYPE_NB] = { 0, 8, 2, 2, 2, 1 }; // Pawns to queens
+  constexpr int SideConfigs = 9 * 3 * 3 * 3 * 2;
+
+  enum EntryState : uint8_t { Unset, Computing, Ready };
+
+  struct SharedEntry {
+    std::atomic<uint8_t> state;
+    Material::Entry entry;
+  };
+
+  SharedEntry SharedTable[SideConfigs * SideConfigs];
+
+  // shared_entry() returns the shared slot for the position's material, or
+  // nullptr if a side has more pieces of a type than at the start of a game.
+  SharedEntry* shared_entry(const Position& pos) {
+
+    int idx = 0;
+
+    for (Color c : { WHITE, BLACK })
+    {
+        const int count[PIECE_TYPE_NB] = { 0, pos.count<PAWN>(c), pos.count<KNIGHT>(c),
+            pos.count<BISHOP>(c), pos.count<ROOK>(c), pos.count<QUEEN>(c) };
+
+        for (PieceType pt = PAWN; pt <= QUEEN; ++pt)
+        {
+            if (count[pt] > MaxPieces[pt])
+                return nullptr;
+
+            idx = idx * (MaxPieces[pt] + 1) + count[pt];
+        }
+    }
+
+    return &SharedTable[idx];
+  }
+
 } // namespace
 
 namespace Material {
 
 
-/// Material::probe() looks up the current position's material configuration in
-/// the material hash table. It returns a pointer to the Entry if the position
-/// is found. Otherwise a new Entry is computed and stored there, so we don't
-/// have to recompute all when the same material configuration occurs again.
+/// init_entry() computes the Entry of the position's material configuration
 
-Entry* probe(const Position& pos) {
+static void init_entry(Entry* e, const Position& pos) {
 
   Key key = pos.material_key();
-  Entry* e = pos.this_thread()->materialTable[key];
-
-  if (e->key == key)
-      return e;
 
   std::memset(e, 0, sizeof(Entry));
   e->key = key;
@@ -146,13 +180,13 @@ Entry* probe(const Position& pos) {
   // material configuration. Firstly we look for a fixed configuration one, then
   // for a generic one if the previous search failed.
   if ((e->evaluationFunction = Endgames::probe<Value>(key)) != nullptr)
-      return e;
+      return;
 
   for (Color c : { WHITE, BLACK })
       if (is_KXK(pos, c))
       {
           e->evaluationFunction = &EvaluateKXK[c];
-          return e;
+          return;
       }
 
   // OK, we didn't find any special evaluation function for the current material
@@ -162,7 +196,7 @@ Entry* probe(const Position& pos) {
   if (sf)
   {
       e->scalingFunction[sf->strongSide] = sf; // Only strong color assigned
-      return e;
+      return;
   }
 
   // We didn't find any specialized scaling function, so fall back on generic
@@ -221,9 +255,64 @@ Entry* probe(const Position& pos) {
     pos.count<BISHOP>(BLACK)    , pos.count<ROOK>(BLACK), pos.count<QUEEN >(BLACK) } };
 
   e->score = (imbalance<WHITE>(pieceCount) - imbalance<BLACK>(pieceCount)) / 16;
+}
+
+
+/// Material::probe() returns the Entry of the position's material configuration.
+/// Configurations without promoted pieces come from the shared table. The others,
+/// and shared entries still being computed by another thread, are looked up in
+/// the thread's material hash table, where a new Entry is computed on a miss.
+
+Entry* probe(const Position& pos) {
+
+  SharedEntry* se = shared_entry(pos);
+
+  if (se)
+  {
+      uint8_t state = se->state.load(std::memory_order_acquire);
+
+      if (state == Ready)
+          return &se->entry;
+
+      if (   state == Unset
+          && se->state.compare_exchange_strong(state, Computing, std::memory_order_acquire))
+      {
+          init_entry(&se->entry, pos);
+          se->state.store(Ready, std::memory_order_release);
+          return &se->entry;
+      }
+  }
+
+  Key key = pos.material_key();
+  Entry* e = pos.this_thread()->materialTable[key];
+
+  if (e->key != key)
+      init_entry(e, pos);
+
   return e;
 }
 
+
+/// Material::prefetch() prefetches the Entry that probe() will return for the
+/// position, called by do_move() when a capture changes the material.
+
+void prefetch(const Position& pos) {
+
+  SharedEntry* se = shared_entry(pos);
+
+  Stockfish::prefetch(se ? (void*)se : (void*)pos.this_thread()->materialTable[pos.material_key()]);
+}
+
+
+/// Material::shared_size() returns the size of the table shared by all threads.
+/// Only the pages of the configurations reached are backed by memory.
+
+size_t shared_size() {
+
+  return sizeof(SharedTable);
+}
+
+
 } // namespace Material
 
 } // namespace Stockfish
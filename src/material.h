@@ -65,6 +65,8 @@ struct Entry {
 using Table = HashTable<Entry, 8192>;
 
 Entry* probe(const Position& pos);
+void prefetch(const Position& pos);
+size_t shared_size();
 
 } // namespace Stockfish::Material
 
@@ -46,14 +46,21 @@ using fun8_t = bool(*)(HANDLE, BOOL, PTOKEN_PRIVILEGES, DWORD, PTOKEN_PRIVILEGES
 }
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstring>
 #include <cstdlib>
 #include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string_view>
+#include <thread>
 #include <vector>
 #include <stdarg.h>
 #include <bitset>
@@ -68,6 +75,7 @@ using fun8_t = bool(*)(HANDLE, BOOL, PTOKEN_PRIVILEGES, DWORD, PTOKEN_PRIVILEGES
 #else
 #include <sys/types.h>
 #include <dirent.h>
+#include <strings.h> //for strcasecmp()
 #endif
 
 #if defined(__linux__) && !defined(__ANDROID__)
@@ -75,6 +83,14 @@ using fun8_t = bool(*)(HANDLE, BOOL, PTOKEN_PRIVILEGES, DWORD, PTOKEN_PRIVILEGES
 #include <sys/mman.h>
 #endif
 
+#if defined(__linux__)
+#include <map>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) || (defined(__GLIBCXX__) && !defined(_GLIBCXX_HAVE_ALIGNED_ALLOC) && !defined(_WIN32)) || defined(__e2k__)
 #define POSIXALIGNEDALLOC
 #include <stdlib.h>
@@ -100,36 +116,198 @@ bool LPMessage = false;
 /// can toggle the logging of std::cout and std:cin at runtime whilst preserving
 /// usual I/O functionality, all without changing a single line of code!
 /// Idea from http://groups.google.com/group/comp.lang.c++/msg/1d941c0f26ea0d81
+///
+/// The file is written by a background thread, so that logging does not slow
+/// down the UCI output. The Tie objects only collect whole lines and hand them
+/// over through a lock-free queue.
+
+/// LogQueue is a bounded lock-free queue of log lines, after the MPMC queue of
+/// Dmitry Vyukov. Any thread may push, only the writer thread pops.
+
+class LogQueue {
+
+  static constexpr size_t Size = 8192; // Must be a power of 2
+
+  struct Slot {
+    atomic<size_t> seq;
+    string line;
+  };
+
+  Slot slots[Size];
+  alignas(64) atomic<size_t> tail;
+  alignas(64) size_t head;
+
+public:
+  LogQueue() : tail(0), head(0) {
+    for (size_t i = 0; i < Size; ++i)
+        slots[i].seq.store(i, memory_order_relaxed);
+  }
+
+  // Returns false if the queue is full
+  bool push(string& line) {
+
+    size_t pos = tail.load(memory_order_relaxed);
+
+    while (true)
+    {
+        Slot& slot = slots[pos & (Size - 1)];
+        intptr_t diff = intptr_t(slot.seq.load(memory_order_acquire)) - intptr_t(pos);
+
+        if (diff == 0)
+        {
+            if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                slot.line.swap(line);
+                slot.seq.store(pos + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+            return false;
+        else
+            pos = tail.load(memory_order_relaxed);
+    }
+  }
+
+  // Swaps the oldest line into 'line'. Returns false if the queue is empty.
+  bool pop(string& line) {
+
+    Slot& slot = slots[head & (Size - 1)];
+
+    if (slot.seq.load(memory_order_acquire) != head + 1)
+        return false;
+
+    slot.line.swap(line);
+    slot.seq.store(head + Size, memory_order_release);
+    ++head;
+    return true;
+  }
+};
 
 struct Tie: public streambuf { // MSVC requires split streambuf for cin and cout
 
-  Tie(streambuf* b, streambuf* l) : buf(b), logBuf(l) {}
+  Tie(streambuf* b, const char* p, std::function<void(string&)> s) : buf(b), prefix(p), submit(s) {}
 
-  int sync() override { return logBuf->pubsync(), buf->pubsync(); }
-  int overflow(int c) override { return log(buf->sputc((char)c), "<< "); }
+  int sync() override { return buf->pubsync(); }
+  int overflow(int c) override { return log(buf->sputc((char)c)); }
   int underflow() override { return buf->sgetc(); }
-  int uflow() override { return log(buf->sbumpc(), ">> "); }
+  int uflow() override { return log(buf->sbumpc()); }
+
+  streambuf* buf;
+  const char* prefix;
+  std::function<void(string&)> submit;
+  string line;
 
-  streambuf *buf, *logBuf;
+  int log(int c) {
 
-  int log(int c, const char* prefix) {
+    if (c == EOF)
+        return c;
 
-    static int last = '\n'; // Single log file
+    if (line.empty())
+        line = prefix;
 
-    if (last == '\n')
-        logBuf->sputn(prefix, 3);
+    line += char(c);
 
-    return last = logBuf->sputc((char)c);
+    if (c == '\n')
+    {
+        submit(line);
+        line.clear();
+    }
+
+    return c;
   }
 };
 
 class Logger {
 
-  Logger() : in(cin.rdbuf(), file.rdbuf()), out(cout.rdbuf(), file.rdbuf()) {}
+  Logger() : in(cin.rdbuf(),  ">> ", [this](string& l) { push(l); }),
+             out(cout.rdbuf(), "<< ", [this](string& l) { push(l); }) {}
  ~Logger() { start(""); }
 
   ofstream file;
+  LogQueue queue;
   Tie in, out;
+  thread writer;
+  atomic<bool> stop, sleeping;
+  mutex sleepMutex;
+  condition_variable sleepCond;
+
+  static inline atomic<bool> timestamps = false;
+  static inline atomic<int> flushInterval = 0;
+
+  void push(string& line) {
+
+    if (timestamps.load(memory_order_relaxed))
+        line.insert(0, timestamp());
+
+    // Wait for the writer rather than drop lines, the queue is only full
+    // if the disk can not keep up for thousands of lines
+    while (!queue.push(line))
+        this_thread::yield();
+
+    if (sleeping.load(memory_order_relaxed))
+        sleepCond.notify_one();
+  }
+
+  static string timestamp() {
+
+    auto t = chrono::system_clock::now();
+    time_t secs = chrono::system_clock::to_time_t(t);
+    int ms = int(chrono::duration_cast<chrono::milliseconds>(t.time_since_epoch()).count() % 1000);
+    char buffer[32];
+    tm local;
+
+#if defined(_WIN32)
+    localtime_s(&local, &secs);
+#else
+    localtime_r(&secs, &local);
+#endif
+
+    strftime(buffer, sizeof(buffer), "%H:%M:%S", &local);
+    snprintf(buffer + strlen(buffer), 8, ".%03d ", ms);
+    return buffer;
+  }
+
+  // Writes the queued lines to the file. A line is flushed when the queue has
+  // been drained, or at most every 'Debug Log Flush' milliseconds.
+  void write_loop() {
+
+    string line;
+    bool pending = false;
+    TimePoint lastFlush = now();
+
+    while (true)
+    {
+        while (queue.pop(line))
+        {
+            file << line;
+            pending = true;
+        }
+
+        int interval = flushInterval.load(memory_order_relaxed);
+
+        if (pending && (interval == 0 || now() - lastFlush >= interval))
+        {
+            file.flush();
+            pending = false;
+            lastFlush = now();
+        }
+
+        if (stop.load(memory_order_acquire))
+        {
+            while (queue.pop(line))
+                file << line;
+            break;
+        }
+
+        // A push may slip in between the check and the wait, the timeout
+        // bounds the delay of such a line
+        unique_lock<mutex> lk(sleepMutex);
+        sleeping.store(true, memory_order_relaxed);
+        sleepCond.wait_for(lk, chrono::milliseconds(10));
+        sleeping.store(false, memory_order_relaxed);
+    }
+  }
 
 public:
   static void start(const std::string& fname) {
@@ -140,6 +318,10 @@ public:
     {
         cout.rdbuf(l.out.buf);
         cin.rdbuf(l.in.buf);
+
+        l.stop.store(true, memory_order_release);
+        l.sleepCond.notify_one();
+        l.writer.join();
         l.file.close();
     }
 
@@ -153,10 +335,19 @@ public:
             exit(EXIT_FAILURE);
         }
 
+        l.stop = false;
+        l.sleeping = false;
+        l.writer = thread(&Logger::write_loop, &l);
+
         cin.rdbuf(&l.in);
         cout.rdbuf(&l.out);
     }
   }
+
+  static void configure(bool stamps, int interval) {
+    timestamps = stamps;
+    flushInterval = interval;
+  }
 };
 
 } // namespace
@@ -1088,6 +1279,7 @@ std::ostream& operator<<(std::ostream& os, SyncCout sc) {
 
 /// Trampoline helper to avoid moving Logger to misc.h
 void start_logger(const std::string& fname) { Logger::start(fname); }
+void configure_logger(bool timestamps, int flushInterval) { Logger::configure(timestamps, flushInterval); }
 
 
 /// prefetch() preloads the given address in L1/L2 cache. This is a non-blocking
@@ -1252,8 +1444,56 @@ void* aligned_large_pages_alloc(size_t allocSize) {
 
 #else
 
+namespace {
+
+  LargePages::Mode largePagesMode = LargePages::Transparent;
+
+#if defined(__linux__) && defined(MAP_HUGETLB)
+
+  #ifndef MAP_HUGE_SHIFT
+  #define MAP_HUGE_SHIFT 26
+  #endif
+
+  // Explicit huge page mappings and the log2 of their page size. They are
+  // unmapped by aligned_large_pages_free() instead of freed.
+  struct HugeMapping { size_t size; int pageShift; };
+
+  std::mutex hugeMappingsMutex;
+  std::map<void*, HugeMapping> hugeMappings;
+
+  // Maps 'allocSize' bytes of pages of 2^pageShift bytes from the hugetlbfs
+  // pool, which the administrator must have reserved (see vm.nr_hugepages)
+  void* hugetlb_alloc(size_t allocSize, int pageShift) {
+
+    const size_t pageSize = size_t(1) << pageShift;
+    const size_t size = (allocSize + pageSize - 1) / pageSize * pageSize;
+
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (pageShift << MAP_HUGE_SHIFT), -1, 0);
+    if (mem == MAP_FAILED)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lk(hugeMappingsMutex);
+    hugeMappings[mem] = { size, pageShift };
+    return mem;
+  }
+
+#endif
+
+} // namespace
+
 void* aligned_large_pages_alloc(size_t allocSize) {
 
+#if defined(__linux__) && defined(MAP_HUGETLB)
+  // Explicit huge pages, 1GB pages only for blocks at least that large,
+  // falling back to smaller pages when the pool has none left
+  for (int pageShift : { 30, 21 })
+      if (   largePagesMode >= (pageShift == 30 ? LargePages::Huge1GB : LargePages::Huge2MB)
+          && allocSize >= (size_t(1) << pageShift))
+          if (void* mem = hugetlb_alloc(allocSize, pageShift))
+              return mem;
+#endif
+
 #if defined(__linux__)
   constexpr size_t alignment = 2 * 1024 * 1024; // assumed 2MB page size
 #else
@@ -1271,6 +1511,64 @@ void* aligned_large_pages_alloc(size_t allocSize) {
 
 #endif
 
+namespace LargePages {
+
+void set_mode([[maybe_unused]] Mode mode) {
+
+#if !defined(_WIN32)
+  largePagesMode = mode;
+#endif
+}
+
+/// report() tells which pages back the memory block at 'mem', as the kernel
+/// may grant fewer huge pages than requested. Transparent huge pages are only
+/// counted for the pages that have been touched already.
+
+std::string report([[maybe_unused]] void* mem, [[maybe_unused]] size_t size) {
+
+#if defined(__linux__)
+#if defined(MAP_HUGETLB)
+  {
+      std::lock_guard<std::mutex> lk(hugeMappingsMutex);
+      auto it = hugeMappings.find(mem);
+      if (it != hugeMappings.end())
+          return it->second.pageShift == 30 ? "1GB huge pages" : "2MB huge pages";
+  }
+#endif
+
+  std::string fallback = largePagesMode != Transparent ? " (no explicit huge pages available)" : "";
+
+  std::ifstream thp("/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string setting;
+  std::getline(thp, setting);
+  if (setting.find("[never]") != std::string::npos)
+      return "regular pages, transparent huge pages are disabled" + fallback;
+
+  // Sum the transparent huge pages of the mappings that overlap the block
+  const uintptr_t begin = uintptr_t(mem), end = begin + size;
+  std::ifstream smaps("/proc/self/smaps");
+  std::string line;
+  bool inBlock = false;
+  uint64_t hugeBytes = 0;
+
+  while (std::getline(smaps, line))
+  {
+      unsigned long lo, hi, kb;
+      if (sscanf(line.c_str(), "%lx-%lx ", &lo, &hi) == 2)
+          inBlock = lo < end && hi > begin;
+      else if (inBlock && sscanf(line.c_str(), "AnonHugePages: %lu kB", &kb) == 1)
+          hugeBytes += uint64_t(kb) * 1024;
+  }
+
+  return "transparent huge pages, " + Utility::format_bytes(std::min(hugeBytes, uint64_t(size)), 0)
+        + " of " + Utility::format_bytes(size, 0) + fallback;
+#else
+  return "";
+#endif
+}
+
+} // namespace LargePages
+
 
 /// aligned_large_pages_free() will free the previously allocated ttmem
 
@@ -1291,6 +1589,20 @@ void aligned_large_pages_free(void* mem) {
 #else
 
 void aligned_large_pages_free(void *mem) {
+
+#if defined(__linux__) && defined(MAP_HUGETLB)
+  {
+      std::lock_guard<std::mutex> lk(hugeMappingsMutex);
+      auto it = hugeMappings.find(mem);
+      if (it != hugeMappings.end())
+      {
+          munmap(mem, it->second.size);
+          hugeMappings.erase(it);
+          return;
+      }
+  }
+#endif
+
   std_aligned_free(mem);
 }
 
@@ -1299,12 +1611,184 @@ void aligned_large_pages_free(void *mem) {
 
 namespace WinProcGroup {
 
-#ifndef _WIN32
+#if defined(__linux__)
+
+namespace {
+
+  // A NUMA node of the host with its logical processors, and the number of
+  // physical cores among them
+  struct NumaNode {
+    int id;
+    std::vector<int> cpus;
+    int cores;
+  };
+
+  std::string read_first_line(const std::string& path) {
+
+    std::ifstream f(path);
+    std::string line;
+    std::getline(f, line);
+    return line;
+  }
+
+  // Parses a sysfs list like "0-15,32-47"
+  std::vector<int> parse_list(const std::string& list) {
+
+    std::vector<int> v;
+    std::stringstream ss(list);
+    std::string range;
+
+    while (std::getline(ss, range, ','))
+    {
+        int first, last;
+        int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (n == 1)
+            last = first;
+        if (n >= 1)
+            for (int i = first; i <= last; ++i)
+                v.push_back(i);
+    }
+    return v;
+  }
+
+  // The topology is read once from sysfs. Without sysfs, or on a single node
+  // host, the list is empty or has one node and threads are not bound.
+  const std::vector<NumaNode>& numa_nodes() {
+
+    static const std::vector<NumaNode> nodes = [] {
+
+        std::vector<NumaNode> v;
+
+        for (int id : parse_list(read_first_line("/sys/devices/system/node/online")))
+        {
+            NumaNode node { id, parse_list(read_first_line("/sys/devices/system/node/node"
+                                                            + std::to_string(id) + "/cpulist")), 0 };
+            std::vector<std::string> coreIds;
+
+            for (int cpu : node.cpus)
+            {
+                std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+                std::string core =  read_first_line(topology + "physical_package_id") + ":"
+                                  + read_first_line(topology + "core_id");
+
+                if (std::find(coreIds.begin(), coreIds.end(), core) == coreIds.end())
+                    coreIds.push_back(core);
+            }
+
+            node.cores = int(coreIds.size());
+
+            if (!node.cpus.empty())
+                v.push_back(node);
+        }
+        return v;
+    }();
+
+    return nodes;
+  }
+
+  /// best_node() returns the index in numa_nodes() of the best node for the
+  /// thread with index idx, filling the physical cores of one node after the
+  /// other and then spreading the remaining threads over the nodes, like the
+  /// Windows version below.
+
+  int best_node(size_t idx) {
+
+    const std::vector<NumaNode>& nodes = numa_nodes();
+
+    if (nodes.size() < 2)
+        return -1;
+
+    std::vector<int> groups;
+    int threads = 0, cores = 0;
+
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+        threads += int(nodes[n].cpus.size());
+        cores += nodes[n].cores;
+
+        for (int i = 0; i < nodes[n].cores; i++)
+            groups.push_back(int(n));
+    }
+
+    for (int t = 0; t < threads - cores; t++)
+        groups.push_back(t % int(nodes.size()));
+
+    return idx < groups.size() ? groups[idx] : -1;
+  }
+
+} // namespace
+
+/// bindThisThread() sets the affinity of the current thread to the logical
+/// processors of its node, so that it allocates from the memory of that node.
+
+void bindThisThread(size_t idx, bool report) {
+
+  int n = best_node(idx);
+
+  if (n == -1)
+      return;
+
+  const NumaNode& node = numa_nodes()[n];
+  cpu_set_t set;
+  CPU_ZERO(&set);
+
+  for (int cpu : node.cpus)
+      CPU_SET(cpu, &set);
+
+  if (!pthread_setaffinity_np(pthread_self(), sizeof(set), &set) && report)
+      sync_cout << "info string Binding thread " << idx << " to node " << node.id << sync_endl;
+}
+
+/// interleave_memory() makes the memory that the current thread touches first
+/// from now on be spread page by page over all the nodes. It is meant for the
+/// threads that fill data read by all search threads.
+
+void interleave_memory() {
+
+  const std::vector<NumaNode>& nodes = numa_nodes();
+
+  if (nodes.size() < 2)
+      return;
+
+  constexpr int MPOL_INTERLEAVE = 3;
+  constexpr size_t MaxNodes = 1024;
+  constexpr size_t Bits = 8 * sizeof(unsigned long);
+  unsigned long mask[MaxNodes / Bits] = {};
+
+  for (const NumaNode& node : nodes)
+      if (size_t(node.id) < MaxNodes)
+          mask[node.id / Bits] |= 1UL << (node.id % Bits);
+
+  syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, mask, MaxNodes);
+}
+
+/// topology() describes the nodes, for the 'numa' command
+
+std::string topology() {
 
-void bindThisThread(size_t) {}
+  const std::vector<NumaNode>& nodes = numa_nodes();
+  std::stringstream ss;
+
+  ss << "info string NUMA nodes: " << nodes.size();
+
+  for (const NumaNode& node : nodes)
+      ss << "\ninfo string Node " << node.id << ": " << node.cpus.size()
+         << " logical processors, " << node.cores << " cores";
+
+  return ss.str();
+}
+
+#elif !defined(_WIN32)
+
+void bindThisThread(size_t, bool) {}
+void interleave_memory() {}
+std::string topology() { return "info string NUMA topology is not available on this platform"; }
 
 #else
 
+void interleave_memory() {}
+std::string topology() { return "info string NUMA nodes are handled as processor groups on Windows"; }
+
 /// best_node() retrieves logical processor information using Windows specific
 /// API and returns the best node id for the thread with index idx. Original
 /// code from Texel by Peter Österlund.
@@ -1379,7 +1863,7 @@ static int best_node(size_t idx) {
 
 /// bindThisThread() set the group affinity of the current thread
 
-void bindThisThread(size_t idx) {
+void bindThisThread(size_t idx, bool report) {
 
   // Use only local variables to be thread-safe
   int node = best_node(idx);
@@ -1403,7 +1887,8 @@ void bindThisThread(size_t idx) {
       if (fun2(node, &affinity))                                                 // GetNumaNodeProcessorMaskEx
       {
           fun3(GetCurrentThread(), &affinity, nullptr);                          // SetThreadGroupAffinity
-          sync_cout << "info string Binding thread " << idx << " to node " << node << sync_endl;
+          if (report)
+              sync_cout << "info string Binding thread " << idx << " to node " << node << sync_endl;
       }
   }
   else
@@ -1431,6 +1916,45 @@ void bindThisThread(size_t idx) {
 #define GETCWD getcwd
 #endif
 
+namespace Startup {
+
+namespace {
+
+  using Clock = std::chrono::steady_clock;
+
+  const Clock::time_point Launch = Clock::now(); // Static initialization time
+  Clock::time_point Last = Launch;
+  std::vector<std::pair<std::string, int64_t>> Stages; // Name, microseconds
+}
+
+void mark(const char* stage) {
+
+  Clock::time_point t = Clock::now();
+  Stages.emplace_back(stage, std::chrono::duration_cast<std::chrono::microseconds>(t - Last).count());
+  Last = t;
+}
+
+void report() {
+
+  int64_t total = 0;
+
+  // Formatted in its own stream, the flags must not stick to std::cout
+  std::stringstream ss;
+  ss << "info string Startup stages (ms):" << std::fixed << std::setprecision(3);
+  for (const auto& s : Stages)
+  {
+      ss << "\ninfo string " << std::setw(20) << std::left << s.first
+         << std::right << std::setw(10) << s.second / 1000.0;
+      total += s.second;
+  }
+  ss << "\ninfo string " << std::setw(20) << std::left << "total"
+     << std::right << std::setw(10) << total / 1000.0;
+
+  sync_cout << ss.str() << sync_endl;
+}
+
+} // namespace Startup
+
 namespace CommandLine {
 
 string argv0;            // path+name of the executable binary, as given by argv[0]
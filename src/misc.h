@@ -57,6 +57,7 @@ std::string compiler_info();
 
 void prefetch(void* addr);
 void start_logger(const std::string& fname);
+void configure_logger(bool timestamps, int flushInterval); // flushInterval in ms, 0 flushes once the queue is drained
 void* std_aligned_alloc(size_t alignment, size_t size);
 void std_aligned_free(void* ptr);
 void* aligned_large_pages_alloc(size_t size); // memory aligned by page size, min alignment: 4096 bytes
@@ -78,6 +79,7 @@ inline TimePoint now() {
 template<class Entry, int Size>
 struct HashTable {
   Entry* operator[](Key key) { return &table[(uint32_t)key & (Size - 1)]; }
+  size_t size() const { return Size * sizeof(Entry); }
 
 private:
   std::vector<Entry> table = std::vector<Entry>(Size); // Allocate on the heap
@@ -179,8 +181,28 @@ inline uint64_t mul_hi64(uint64_t a, uint64_t b) {
 /// called to set group affinity for each thread. Original code from Texel by
 /// Peter Österlund.
 
+///
+/// Under Linux the NUMA topology is read from sysfs, each thread is bound to
+/// the logical processors of one node and memory that is shared by all the
+/// threads can be interleaved over the nodes. The binding is reported for the
+/// search threads, not for the helpers that fill the tables.
+
 namespace WinProcGroup {
-  void bindThisThread(size_t idx);
+  void bindThisThread(size_t idx, bool report = true);
+  void interleave_memory();
+  std::string topology();
+}
+
+/// LargePages selects the pages that aligned_large_pages_alloc() asks for on
+/// Linux. Transparent huge pages are advised with madvise(), 2MB and 1GB pages
+/// are explicit hugetlbfs pages, falling back to the smaller kind when the
+/// pool is empty.
+
+namespace LargePages {
+  enum Mode { Transparent, Huge2MB, Huge1GB };
+
+  void set_mode(Mode mode);
+  std::string report(void* mem, size_t size); // Empty where not supported
 }
 
 namespace CommandLine {
@@ -206,6 +228,14 @@ namespace SysInfo
     const std::string total_memory();
 }
 
+/// Startup records how long each initialization stage of main() takes, so
+/// the launch cost of the engine can be inspected with the 'startup' command.
+namespace Startup
+{
+    void mark(const char* stage); // Closes the stage started by the previous mark
+    void report();
+}
+
 class Position; //Needed by is_game_decided
 
 #define EMPTY   "<empty>"
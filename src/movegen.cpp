@@ -50,7 +50,7 @@ namespace {
   }
 
 
-  template<Color Us, GenType Type>
+  template<Color Us, GenType Type, bool Legal>
   ExtMove* generate_pawn_moves(const Position& pos, ExtMove* moveList, Bitboard target) {
 
     constexpr Color     Them     = ~Us;
@@ -64,13 +64,24 @@ namespace {
     const Bitboard enemies      =  Type == EVASIONS ? pos.checkers()
                                                     : pos.pieces(Them);
 
-    Bitboard pawnsOn7    = pos.pieces(Us, PAWN) &  TRank7BB;
-    Bitboard pawnsNotOn7 = pos.pieces(Us, PAWN) & ~TRank7BB;
+    // When generating legal moves, pinned pawns may only push along the file
+    // of the king and capture towards it; in check they cannot move at all.
+    const Square   ksq    = pos.square<KING>(Us);
+    const Bitboard pinned = Legal ? pos.blockers_for_king(Us) & pos.pieces(Us, PAWN) : 0;
+    const Bitboard pawns  = pos.pieces(Us, PAWN) & (Type == EVASIONS ? ~pinned : ~0ULL);
+    const Bitboard pushers = pawns & ~(pinned & ~file_bb(ksq));
+
+    auto legal_capture = [&](Square from, Square to) {
+        return !(pinned & from) || aligned(from, to, ksq);
+    };
+
+    Bitboard pawnsOn7    = pawns &  TRank7BB;
+    Bitboard pawnsNotOn7 = pawns & ~TRank7BB;
 
     // Single and double pawn pushes, no promotions
     if constexpr (Type != CAPTURES)
     {
-        Bitboard b1 = shift<Up>(pawnsNotOn7)   & emptySquares;
+        Bitboard b1 = shift<Up>(pawnsNotOn7 & pushers) & emptySquares;
         Bitboard b2 = shift<Up>(b1 & TRank3BB) & emptySquares;
 
         if constexpr (Type == EVASIONS) // Consider only blocking squares
@@ -84,10 +95,10 @@ namespace {
             // To make a quiet check, you either make a direct check by pushing a pawn
             // or push a blocker pawn that is not on the same file as the enemy king.
             // Discovered check promotion has been already generated amongst the captures.
-            Square ksq = pos.square<KING>(Them);
-            Bitboard dcCandidatePawns = pos.blockers_for_king(Them) & ~file_bb(ksq);
-            b1 &= pawn_attacks_bb(Them, ksq) | shift<   Up>(dcCandidatePawns);
-            b2 &= pawn_attacks_bb(Them, ksq) | shift<Up+Up>(dcCandidatePawns);
+            Square theirKsq = pos.square<KING>(Them);
+            Bitboard dcCandidatePawns = pos.blockers_for_king(Them) & ~file_bb(theirKsq);
+            b1 &= pawn_attacks_bb(Them, theirKsq) | shift<   Up>(dcCandidatePawns);
+            b2 &= pawn_attacks_bb(Them, theirKsq) | shift<Up+Up>(dcCandidatePawns);
         }
 
         while (b1)
@@ -108,16 +119,24 @@ namespace {
     {
         Bitboard b1 = shift<UpRight>(pawnsOn7) & enemies;
         Bitboard b2 = shift<UpLeft >(pawnsOn7) & enemies;
-        Bitboard b3 = shift<Up     >(pawnsOn7) & emptySquares;
+        Bitboard b3 = shift<Up     >(pawnsOn7 & pushers) & emptySquares;
 
         if constexpr (Type == EVASIONS)
             b3 &= target;
 
         while (b1)
-            moveList = make_promotions<Type, UpRight, true>(moveList, pop_lsb(b1));
+        {
+            Square to = pop_lsb(b1);
+            if (legal_capture(to - UpRight, to))
+                moveList = make_promotions<Type, UpRight, true>(moveList, to);
+        }
 
         while (b2)
-            moveList = make_promotions<Type, UpLeft, true>(moveList, pop_lsb(b2));
+        {
+            Square to = pop_lsb(b2);
+            if (legal_capture(to - UpLeft, to))
+                moveList = make_promotions<Type, UpLeft, true>(moveList, to);
+        }
 
         while (b3)
             moveList = make_promotions<Type, Up,    false>(moveList, pop_lsb(b3));
@@ -132,13 +151,15 @@ namespace {
         while (b1)
         {
             Square to = pop_lsb(b1);
-            *moveList++ = make_move(to - UpRight, to);
+            if (legal_capture(to - UpRight, to))
+                *moveList++ = make_move(to - UpRight, to);
         }
 
         while (b2)
         {
             Square to = pop_lsb(b2);
-            *moveList++ = make_move(to - UpLeft, to);
+            if (legal_capture(to - UpLeft, to))
+                *moveList++ = make_move(to - UpLeft, to);
         }
 
         if (pos.ep_square() != SQ_NONE)
@@ -154,7 +175,11 @@ namespace {
             assert(b1);
 
             while (b1)
-                *moveList++ = make<EN_PASSANT>(pop_lsb(b1), pos.ep_square());
+            {
+                Move m = make<EN_PASSANT>(pop_lsb(b1), pos.ep_square());
+                if (!Legal || pos.legal(m))
+                    *moveList++ = m;
+            }
         }
     }
 
@@ -162,18 +187,22 @@ namespace {
   }
 
 
-  template<Color Us, PieceType Pt, bool Checks>
-  ExtMove* generate_moves(const Position& pos, ExtMove* moveList, Bitboard target) {
+  template<Color Us, PieceType Pt, bool Checks, bool Legal>
+  ExtMove* generate_moves(const Position& pos, ExtMove* moveList, Bitboard target, Bitboard pinned) {
 
     static_assert(Pt != KING && Pt != PAWN, "Unsupported piece type in generate_moves()");
 
-    Bitboard bb = pos.pieces(Us, Pt);
+    // A pinned knight can never move, other pinned pieces only along the pin
+    Bitboard bb = pos.pieces(Us, Pt) & (Legal && Pt == KNIGHT ? ~pinned : ~0ULL);
 
     while (bb)
     {
         Square from = pop_lsb(bb);
         Bitboard b = attacks_bb<Pt>(from, pos.pieces()) & target;
 
+        if (Legal && (pinned & from))
+            b &= line_bb(pos.square<KING>(Us), from);
+
         // To check, you either move freely a blocker or make a direct check.
         if (Checks && (Pt == QUEEN || !(pos.blockers_for_king(~Us) & from)))
             b &= pos.check_squares(Pt);
@@ -186,7 +215,7 @@ namespace {
   }
 
 
-  template<Color Us, GenType Type>
+  template<Color Us, GenType Type, bool Legal>
   ExtMove* generate_all(const Position& pos, ExtMove* moveList) {
 
     static_assert(Type != LEGAL, "Unsupported type in generate_all()");
@@ -194,6 +223,7 @@ namespace {
     constexpr bool Checks = Type == QUIET_CHECKS; // Reduce template instantiations
     const Square ksq = pos.square<KING>(Us);
     Bitboard target;
+    const Bitboard pinned = Legal ? pos.blockers_for_king(Us) & pos.pieces(Us) : 0;
 
     // Skip generating non-king moves when in double check
     if (Type != EVASIONS || !more_than_one(pos.checkers()))
@@ -203,11 +233,11 @@ namespace {
                : Type == CAPTURES     ?  pos.pieces(~Us)
                                       : ~pos.pieces(   ); // QUIETS || QUIET_CHECKS
 
-        moveList = generate_pawn_moves<Us, Type>(pos, moveList, target);
-        moveList = generate_moves<Us, KNIGHT, Checks>(pos, moveList, target);
-        moveList = generate_moves<Us, BISHOP, Checks>(pos, moveList, target);
-        moveList = generate_moves<Us,   ROOK, Checks>(pos, moveList, target);
-        moveList = generate_moves<Us,  QUEEN, Checks>(pos, moveList, target);
+        moveList = generate_pawn_moves<Us, Type, Legal>(pos, moveList, target);
+        moveList = generate_moves<Us, KNIGHT, Checks, Legal>(pos, moveList, target, pinned);
+        moveList = generate_moves<Us, BISHOP, Checks, Legal>(pos, moveList, target, pinned);
+        moveList = generate_moves<Us,   ROOK, Checks, Legal>(pos, moveList, target, pinned);
+        moveList = generate_moves<Us,  QUEEN, Checks, Legal>(pos, moveList, target, pinned);
     }
 
     if (!Checks || pos.blockers_for_king(~Us) & ksq)
@@ -217,12 +247,23 @@ namespace {
             b &= ~attacks_bb<QUEEN>(pos.square<KING>(~Us));
 
         while (b)
-            *moveList++ = make_move(ksq, pop_lsb(b));
+        {
+            Square to = pop_lsb(b);
+
+            // The king must not step onto a square attacked with the king itself
+            // removed, so that it cannot retreat along the line of a slider check.
+            if (!Legal || !(pos.attackers_to(to, pos.pieces() ^ ksq) & pos.pieces(~Us)))
+                *moveList++ = make_move(ksq, to);
+        }
 
         if ((Type == QUIETS || Type == NON_EVASIONS) && pos.can_castle(Us & ANY_CASTLING))
             for (CastlingRights cr : { Us & KING_SIDE, Us & QUEEN_SIDE } )
                 if (!pos.castling_impeded(cr) && pos.can_castle(cr))
-                    *moveList++ = make<CASTLING>(ksq, pos.castling_rook_square(cr));
+                {
+                    Move m = make<CASTLING>(ksq, pos.castling_rook_square(cr));
+                    if (!Legal || pos.legal(m))
+                        *moveList++ = m;
+                }
     }
 
     return moveList;
@@ -247,8 +288,26 @@ ExtMove* generate(const Position& pos, ExtMove* moveList) {
 
   Color us = pos.side_to_move();
 
-  return us == WHITE ? generate_all<WHITE, Type>(pos, moveList)
-                     : generate_all<BLACK, Type>(pos, moveList);
+  return us == WHITE ? generate_all<WHITE, Type, false>(pos, moveList)
+                     : generate_all<BLACK, Type, false>(pos, moveList);
+}
+
+
+/// generate_legal() generates the same moves as generate() in the same order,
+/// but drops the illegal ones while generating: pinned pieces are restricted
+/// to the pin line and king moves to unattacked squares, so that callers can
+/// skip Position::legal() for every move in the list.
+
+template<GenType Type>
+ExtMove* generate_legal(const Position& pos, ExtMove* moveList) {
+
+  static_assert(Type != LEGAL, "Unsupported type in generate_legal()");
+  assert((Type == EVASIONS) == (bool)pos.checkers());
+
+  Color us = pos.side_to_move();
+
+  return us == WHITE ? generate_all<WHITE, Type, true>(pos, moveList)
+                     : generate_all<BLACK, Type, true>(pos, moveList);
 }
 
 // Explicit template instantiations
@@ -258,27 +317,20 @@ template ExtMove* generate<EVASIONS>(const Position&, ExtMove*);
 template ExtMove* generate<QUIET_CHECKS>(const Position&, ExtMove*);
 template ExtMove* generate<NON_EVASIONS>(const Position&, ExtMove*);
 
+template ExtMove* generate_legal<CAPTURES>(const Position&, ExtMove*);
+template ExtMove* generate_legal<QUIETS>(const Position&, ExtMove*);
+template ExtMove* generate_legal<EVASIONS>(const Position&, ExtMove*);
+template ExtMove* generate_legal<QUIET_CHECKS>(const Position&, ExtMove*);
+template ExtMove* generate_legal<NON_EVASIONS>(const Position&, ExtMove*);
+
 
 /// generate<LEGAL> generates all the legal moves in the given position
 
 template<>
 ExtMove* generate<LEGAL>(const Position& pos, ExtMove* moveList) {
 
-  Color us = pos.side_to_move();
-  Bitboard pinned = pos.blockers_for_king(us) & pos.pieces(us);
-  Square ksq = pos.square<KING>(us);
-  ExtMove* cur = moveList;
-
-  moveList = pos.checkers() ? generate<EVASIONS    >(pos, moveList)
-                            : generate<NON_EVASIONS>(pos, moveList);
-  while (cur != moveList)
-      if (  ((pinned & from_sq(*cur)) || from_sq(*cur) == ksq || type_of(*cur) == EN_PASSANT)
-          && !pos.legal(*cur))
-          *cur = (--moveList)->move;
-      else
-          ++cur;
-
-  return moveList;
+  return pos.checkers() ? generate_legal<EVASIONS    >(pos, moveList)
+                        : generate_legal<NON_EVASIONS>(pos, moveList);
 }
 
 } // namespace Stockfish
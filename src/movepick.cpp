@@ -32,6 +32,8 @@ namespace {
     QSEARCH_TT, QCAPTURE_INIT, QCAPTURE, QCHECK_INIT, QCHECK
   };
 
+  static_assert(QCHECK + 1 == MovePicker::STAGE_NB, "STAGE_NB must match the number of stages");
+
   // partial_insertion_sort() sorts moves in descending order up to and including
   // a given limit. The order of moves smaller than the limit is left unspecified.
   void partial_insertion_sort(ExtMove* begin, ExtMove* end, int limit) {
@@ -68,7 +70,7 @@ MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHist
   assert(d > 0);
 
   stage = (pos.checkers() ? EVASION_TT : MAIN_TT) +
-          !(ttm && pos.pseudo_legal(ttm));
+          !(ttm && pos.pseudo_legal(ttm) && pos.legal(ttm));
 }
 
 /// MovePicker constructor for quiescence search
@@ -82,7 +84,8 @@ MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHist
 
   stage = (pos.checkers() ? EVASION_TT : QSEARCH_TT) +
           !(   ttm
-            && pos.pseudo_legal(ttm));
+            && pos.pseudo_legal(ttm)
+            && pos.legal(ttm));
 }
 
 /// MovePicker constructor for ProbCut: we generate captures with SEE greater
@@ -94,30 +97,23 @@ MovePicker::MovePicker(const Position& p, Move ttm, Value th, const CapturePiece
 
   stage = PROBCUT_TT + !(ttm && pos.capture_stage(ttm)
                              && pos.pseudo_legal(ttm)
+                             && pos.legal(ttm)
                              && pos.see_ge(ttm, threshold));
 }
 
 /// MovePicker::score() assigns a numerical value to each move in a list, used
 /// for sorting. Captures are ordered by Most Valuable Victim (MVV), preferring
-/// captures with a good history. Quiets moves are ordered using the history tables.
+/// captures with a good history. Quiets moves are ordered using the history tables,
+/// see score_quiets().
 template<GenType Type>
 void MovePicker::score() {
 
   static_assert(Type == CAPTURES || Type == QUIETS || Type == EVASIONS, "Wrong type");
 
-  [[maybe_unused]] Bitboard threatenedByPawn, threatenedByMinor, threatenedByRook, threatenedPieces;
   if constexpr (Type == QUIETS)
   {
-      Color us = pos.side_to_move();
-
-      threatenedByPawn  = pos.attacks_by<PAWN>(~us);
-      threatenedByMinor = pos.attacks_by<KNIGHT>(~us) | pos.attacks_by<BISHOP>(~us) | threatenedByPawn;
-      threatenedByRook  = pos.attacks_by<ROOK>(~us) | threatenedByMinor;
-
-      // Pieces threatened by pieces of lesser material value
-      threatenedPieces = (pos.pieces(us, QUEEN) & threatenedByRook)
-                       | (pos.pieces(us, ROOK)  & threatenedByMinor)
-                       | (pos.pieces(us, KNIGHT, BISHOP) & threatenedByPawn);
+      score_quiets();
+      return;
   }
 
   for (auto& m : *this)
@@ -125,19 +121,6 @@ void MovePicker::score() {
           m.value =  (7 * int(PieceValue[MG][pos.piece_on(to_sq(m))])
                    +     (*captureHistory)[pos.moved_piece(m)][to_sq(m)][type_of(pos.piece_on(to_sq(m)))]) / 16;
 
-      else if constexpr (Type == QUIETS)
-          m.value =  2 * (*mainHistory)[pos.side_to_move()][from_to(m)]
-                   + 2 * (*continuationHistory[0])[pos.moved_piece(m)][to_sq(m)]
-                   +     (*continuationHistory[1])[pos.moved_piece(m)][to_sq(m)]
-                   +     (*continuationHistory[3])[pos.moved_piece(m)][to_sq(m)]
-                   +     (*continuationHistory[5])[pos.moved_piece(m)][to_sq(m)]
-                   +     (threatenedPieces & from_sq(m) ?
-                           (type_of(pos.moved_piece(m)) == QUEEN && !(to_sq(m) & threatenedByRook)  ? 50000
-                          : type_of(pos.moved_piece(m)) == ROOK  && !(to_sq(m) & threatenedByMinor) ? 25000
-                          :                                         !(to_sq(m) & threatenedByPawn)  ? 15000
-                          :                                                                           0)
-                          :                                                                           0)
-                   +     bool(pos.check_squares(type_of(pos.moved_piece(m))) & to_sq(m)) * 16384;
       else // Type == EVASIONS
       {
           if (pos.capture_stage(m))
@@ -150,6 +133,48 @@ void MovePicker::score() {
       }
 }
 
+/// MovePicker::score_quiets() scores the quiet moves. The history tables are
+/// looked up once per move, and the moved piece is read from the board only once.
+void MovePicker::score_quiets() {
+
+  const Color us = pos.side_to_move();
+
+  Bitboard threatenedByPawn  = pos.attacks_by<PAWN>(~us);
+  Bitboard threatenedByMinor = pos.attacks_by<KNIGHT>(~us) | pos.attacks_by<BISHOP>(~us) | threatenedByPawn;
+  Bitboard threatenedByRook  = pos.attacks_by<ROOK>(~us) | threatenedByMinor;
+
+  // Pieces threatened by pieces of lesser material value
+  Bitboard threatenedPieces = (pos.pieces(us, QUEEN) & threatenedByRook)
+                            | (pos.pieces(us, ROOK)  & threatenedByMinor)
+                            | (pos.pieces(us, KNIGHT, BISHOP) & threatenedByPawn);
+
+  const auto& mh = (*mainHistory)[us];
+  const PieceToHistory& ch0 = *continuationHistory[0];
+  const PieceToHistory& ch1 = *continuationHistory[1];
+  const PieceToHistory& ch3 = *continuationHistory[3];
+  const PieceToHistory& ch5 = *continuationHistory[5];
+
+  for (auto& m : *this)
+  {
+      Piece pc = pos.moved_piece(m);
+      PieceType pt = type_of(pc);
+      Square from = from_sq(m), to = to_sq(m);
+
+      m.value =  2 * mh[from_to(m)]
+               + 2 * ch0[pc][to]
+               +     ch1[pc][to]
+               +     ch3[pc][to]
+               +     ch5[pc][to]
+               +     (threatenedPieces & from ?
+                       (pt == QUEEN && !(to & threatenedByRook)  ? 50000
+                      : pt == ROOK  && !(to & threatenedByMinor) ? 25000
+                      :                !(to & threatenedByPawn)  ? 15000
+                      :                                            0)
+                      :                                            0)
+               +     bool(pos.check_squares(pt) & to) * 16384;
+  }
+}
+
 /// MovePicker::select() returns the next move satisfying a predicate function.
 /// It never returns the TT move.
 template<MovePicker::PickType T, typename Pred>
@@ -168,9 +193,37 @@ Move MovePicker::select(Pred filter) {
   return MOVE_NONE;
 }
 
+/// MovePicker::see_ge() answers Position::see_ge() for a move of the node,
+/// without recomputing the exchange when the last SEE test of the same move
+/// already decides it: SEE >= threshold holds for any threshold below one that
+/// passed, and fails for any threshold above one that failed. The captures
+/// tested by the good captures stage are known this way, and so is a move the
+/// search tests more than once. The overload with 'occupied' is only answered
+/// from the cache when the test passes, since the callers read 'occupied'
+/// only when it fails.
+bool MovePicker::see_ge(Move m, Value th) {
+
+  if (m == seeMove && (seePassed ? th <= seeThreshold : th >= seeThreshold))
+      return seePassed;
+
+  seeMove = m, seeThreshold = th, seePassed = pos.see_ge(m, th);
+  return seePassed;
+}
+
+bool MovePicker::see_ge(Move m, Bitboard& occupied, Value th) {
+
+  if (m == seeMove && seePassed && th <= seeThreshold)
+      return true;
+
+  seeMove = m, seeThreshold = th, seePassed = pos.see_ge(m, occupied, th);
+  return seePassed;
+}
+
 /// MovePicker::next_move() is the most important method of the MovePicker class. It
-/// returns a new pseudo-legal move every time it is called until there are no more
-/// moves left, picking the move with the highest score from a list of generated moves.
+/// returns a new legal move every time it is called until there are no more moves
+/// left, picking the move with the highest score from a list of generated moves.
+/// The lists are legal by construction, only the TT move and the refutations need
+/// an explicit Position::legal() check.
 Move MovePicker::next_move(bool skipQuiets) {
 
 top:
@@ -187,7 +240,7 @@ top:
   case PROBCUT_INIT:
   case QCAPTURE_INIT:
       cur = endBadCaptures = moves;
-      endMoves = generate<CAPTURES>(pos, cur);
+      endMoves = generate_legal<CAPTURES>(pos, cur);
 
       score<CAPTURES>();
       partial_insertion_sort(cur, endMoves, std::numeric_limits<int>::min());
@@ -199,7 +252,10 @@ top:
                        return pos.see_ge(*cur, Value(-cur->value)) ?
                               // Move losing capture to endBadCaptures to be tried later
                               true : (*endBadCaptures++ = *cur, false); }))
+      {
+          seeMove = *(cur - 1), seeThreshold = Value(-(cur - 1)->value), seePassed = true;
           return *(cur - 1);
+      }
 
       // Prepare the pointers to loop over the refutations array
       cur = std::begin(refutations);
@@ -216,7 +272,8 @@ top:
   case REFUTATION:
       if (select<Next>([&](){ return    *cur != MOVE_NONE
                                     && !pos.capture_stage(*cur)
-                                    &&  pos.pseudo_legal(*cur); }))
+                                    &&  pos.pseudo_legal(*cur)
+                                    &&  pos.legal(*cur); }))
           return *(cur - 1);
       ++stage;
       [[fallthrough]];
@@ -225,7 +282,7 @@ top:
       if (!skipQuiets)
       {
           cur = endBadCaptures;
-          endMoves = generate<QUIETS>(pos, cur);
+          endMoves = generate_legal<QUIETS>(pos, cur);
 
           score<QUIETS>();
           partial_insertion_sort(cur, endMoves, -3000 * depth);
@@ -249,11 +306,17 @@ top:
       [[fallthrough]];
 
   case BAD_CAPTURE:
-      return select<Next>([](){ return true; });
+      if (select<Next>([](){ return true; }))
+      {
+          // Bad captures keep their score, so we know the threshold they failed
+          seeMove = *(cur - 1), seeThreshold = Value(-(cur - 1)->value), seePassed = false;
+          return *(cur - 1);
+      }
+      return MOVE_NONE;
 
   case EVASION_INIT:
       cur = moves;
-      endMoves = generate<EVASIONS>(pos, cur);
+      endMoves = generate_legal<EVASIONS>(pos, cur);
 
       score<EVASIONS>();
       ++stage;
@@ -279,7 +342,7 @@ top:
 
   case QCHECK_INIT:
       cur = moves;
-      endMoves = generate<QUIET_CHECKS>(pos, cur);
+      endMoves = generate_legal<QUIET_CHECKS>(pos, cur);
 
       ++stage;
       [[fallthrough]];
@@ -73,6 +73,17 @@ struct Stats : public std::array<Stats<T, D, Sizes...>, Size>
     entry* p = reinterpret_cast<entry*>(this);
     std::fill(p, p + sizeof(*this) / sizeof(entry), v);
   }
+
+  // Brings every value 'percent' of the way from 'v' back to where it was
+  void scale(int percent, const T& v) {
+
+    assert(std::is_standard_layout<stats>::value);
+
+    using entry = StatsEntry<T, D>;
+    entry* p = reinterpret_cast<entry*>(this);
+    for (entry* e = p; e < p + sizeof(*this) / sizeof(entry); ++e)
+        *e = T(v + (*e - v) * percent / 100);
+  }
 };
 
 template <typename T, int D, int Size>
@@ -106,9 +117,9 @@ using PieceToHistory = Stats<int16_t, 29952, PIECE_NB, SQUARE_NB>;
 using ContinuationHistory = Stats<PieceToHistory, NOT_USED, PIECE_NB, SQUARE_NB>;
 
 
-/// MovePicker class is used to pick one pseudo-legal move at a time from the
+/// MovePicker class is used to pick one legal move at a time from the
 /// current position. The most important method is next_move(), which returns a
-/// new pseudo-legal move each time it is called, until there are no moves left,
+/// new legal move each time it is called, until there are no moves left,
 /// when MOVE_NONE is returned. In order to improve the efficiency of the
 /// alpha-beta algorithm, MovePicker attempts to return the moves which are most
 /// likely to get a cut-off first.
@@ -130,10 +141,16 @@ public:
                                            Square);
   MovePicker(const Position&, Move, Value, const CapturePieceToHistory*);
   Move next_move(bool skipQuiets = false);
+  bool see_ge(Move m, Value threshold);
+  bool see_ge(Move m, Bitboard& occupied, Value threshold);
+  int stage_reached() const { return stage; }
+
+  static constexpr int STAGE_NB = 18;
 
 private:
   template<PickType T, typename Pred> Move select(Pred);
   template<GenType> void score();
+  void score_quiets();
   ExtMove* begin() { return cur; }
   ExtMove* end() { return endMoves; }
 
@@ -147,6 +164,9 @@ private:
   Square recaptureSquare;
   Value threshold;
   Depth depth;
+  Move seeMove = MOVE_NONE;
+  Value seeThreshold;
+  bool seePassed;
   ExtMove moves[MAX_MOVES];
 };
 
@@ -0,0 +1,390 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Code for calculating NNUE evaluation function
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#if defined(USE_AVX2) || defined(USE_SSE2)
+#include <immintrin.h>
+#elif defined(USE_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "../misc.h"
+#include "../position.h"
+#include "../uci.h"
+
+#include "evaluate_nnue.h"
+
+namespace Stockfish::Eval::NNUE {
+
+namespace {
+
+  // Network file layout, all values little-endian:
+  //   uint32 NetMagic, uint32 HiddenSize,
+  //   int16  ftWeights[InputSize][HiddenSize], int16 ftBiases[HiddenSize],
+  //   int16  outWeights[2 * HiddenSize], int32 outBias
+  constexpr std::uint32_t NetMagic = 0x314E4D48; // "HMN1"
+  constexpr int InputSize = 2 * 6 * SQUARE_NB;
+
+  // Quantization of the hidden layer (QA) and of the output weights (QB).
+  // The output is in centipawns after multiplying by Scale / (QA * QB).
+  constexpr int QA = 255, QB = 64, Scale = 400;
+
+  struct Network {
+    alignas(64) std::int16_t ftWeights[InputSize][HiddenSize];
+    alignas(64) std::int16_t ftBiases[HiddenSize];
+    alignas(64) std::int16_t outWeights[2 * HiddenSize];
+    std::int32_t outBias;
+  };
+
+  Network network;
+  bool useNNUE, loaded;
+  std::string loadedFile;
+
+  // Vector helpers. Each vector holds VecSize int16 values, madd multiplies
+  // adjacent pairs of int16 and sums them into int32 lanes.
+
+#if defined(USE_AVX512)
+  using vec_t = __m512i;
+  constexpr int VecSize = 32;
+  inline vec_t vec_zero() { return _mm512_setzero_si512(); }
+  inline vec_t vec_set_16(int a) { return _mm512_set1_epi16(short(a)); }
+  inline vec_t vec_add_16(vec_t a, vec_t b) { return _mm512_add_epi16(a, b); }
+  inline vec_t vec_sub_16(vec_t a, vec_t b) { return _mm512_sub_epi16(a, b); }
+  inline vec_t vec_clamp_16(vec_t a, vec_t hi) { return _mm512_min_epi16(_mm512_max_epi16(a, vec_zero()), hi); }
+  inline vec_t vec_madd_16(vec_t a, vec_t b) { return _mm512_madd_epi16(a, b); }
+  inline vec_t vec_add_32(vec_t a, vec_t b) { return _mm512_add_epi32(a, b); }
+  inline int vec_hsum_32(vec_t a) { return _mm512_reduce_add_epi32(a); }
+  #define VECTOR
+
+#elif defined(USE_AVX2)
+  using vec_t = __m256i;
+  constexpr int VecSize = 16;
+  inline vec_t vec_zero() { return _mm256_setzero_si256(); }
+  inline vec_t vec_set_16(int a) { return _mm256_set1_epi16(short(a)); }
+  inline vec_t vec_add_16(vec_t a, vec_t b) { return _mm256_add_epi16(a, b); }
+  inline vec_t vec_sub_16(vec_t a, vec_t b) { return _mm256_sub_epi16(a, b); }
+  inline vec_t vec_clamp_16(vec_t a, vec_t hi) { return _mm256_min_epi16(_mm256_max_epi16(a, vec_zero()), hi); }
+  inline vec_t vec_madd_16(vec_t a, vec_t b) { return _mm256_madd_epi16(a, b); }
+  inline vec_t vec_add_32(vec_t a, vec_t b) { return _mm256_add_epi32(a, b); }
+  inline int vec_hsum_32(vec_t a) {
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+  }
+  #define VECTOR
+
+#elif defined(USE_SSE2)
+  using vec_t = __m128i;
+  constexpr int VecSize = 8;
+  inline vec_t vec_zero() { return _mm_setzero_si128(); }
+  inline vec_t vec_set_16(int a) { return _mm_set1_epi16(short(a)); }
+  inline vec_t vec_add_16(vec_t a, vec_t b) { return _mm_add_epi16(a, b); }
+  inline vec_t vec_sub_16(vec_t a, vec_t b) { return _mm_sub_epi16(a, b); }
+  inline vec_t vec_clamp_16(vec_t a, vec_t hi) { return _mm_min_epi16(_mm_max_epi16(a, vec_zero()), hi); }
+  inline vec_t vec_madd_16(vec_t a, vec_t b) { return _mm_madd_epi16(a, b); }
+  inline vec_t vec_add_32(vec_t a, vec_t b) { return _mm_add_epi32(a, b); }
+  inline int vec_hsum_32(vec_t a) {
+    a = _mm_add_epi32(a, _mm_shuffle_epi32(a, 0x4E));
+    a = _mm_add_epi32(a, _mm_shuffle_epi32(a, 0xB1));
+    return _mm_cvtsi128_si32(a);
+  }
+  #define VECTOR
+
+#elif defined(USE_NEON) && USE_NEON >= 8
+  using vec_t = int16x8_t;
+  constexpr int VecSize = 8;
+  inline vec_t vec_zero() { return vdupq_n_s16(0); }
+  inline vec_t vec_set_16(int a) { return vdupq_n_s16(short(a)); }
+  inline vec_t vec_add_16(vec_t a, vec_t b) { return vaddq_s16(a, b); }
+  inline vec_t vec_sub_16(vec_t a, vec_t b) { return vsubq_s16(a, b); }
+  inline vec_t vec_clamp_16(vec_t a, vec_t hi) { return vminq_s16(vmaxq_s16(a, vec_zero()), hi); }
+  // NEON has no int16 pair multiply-add, the 32 bit lanes are reinterpreted
+  inline vec_t vec_madd_16(vec_t a, vec_t b) {
+    int32x4_t lo = vmull_s16(vget_low_s16(a), vget_low_s16(b));
+    int32x4_t hi = vmull_high_s16(a, b);
+    return vreinterpretq_s16_s32(vpaddq_s32(lo, hi));
+  }
+  inline vec_t vec_add_32(vec_t a, vec_t b) {
+    return vreinterpretq_s16_s32(vaddq_s32(vreinterpretq_s32_s16(a), vreinterpretq_s32_s16(b)));
+  }
+  inline int vec_hsum_32(vec_t a) { return vaddvq_s32(vreinterpretq_s32_s16(a)); }
+  #define VECTOR
+#endif
+
+#ifdef VECTOR
+  static_assert(HiddenSize % VecSize == 0, "HiddenSize must be a multiple of the vector size");
+  constexpr int NumChunks = HiddenSize / VecSize;
+#endif
+
+  // Index of the input for piece pc on square s, seen from perspective. The
+  // board is mirrored vertically for black, so both sides share the weights.
+  inline int feature_index(Color perspective, Square s, Piece pc) {
+    return   (color_of(pc) != perspective) * 6 * SQUARE_NB
+           + (type_of(pc) - 1) * SQUARE_NB
+           + (perspective == WHITE ? s : flip_rank(s));
+  }
+
+  // Computes out = in + sum of added rows - sum of removed rows
+  void update_values(std::int16_t* out, const std::int16_t* in,
+                     const int* added, int addedCount, const int* removed, int removedCount) {
+
+#ifdef VECTOR
+    const vec_t* inVec = reinterpret_cast<const vec_t*>(in);
+    vec_t* outVec = reinterpret_cast<vec_t*>(out);
+
+    for (int j = 0; j < NumChunks; ++j)
+    {
+        vec_t acc = inVec[j];
+
+        for (int k = 0; k < removedCount; ++k)
+            acc = vec_sub_16(acc, reinterpret_cast<const vec_t*>(network.ftWeights[removed[k]])[j]);
+
+        for (int k = 0; k < addedCount; ++k)
+            acc = vec_add_16(acc, reinterpret_cast<const vec_t*>(network.ftWeights[added[k]])[j]);
+
+        outVec[j] = acc;
+    }
+#else
+    for (int i = 0; i < HiddenSize; ++i)
+    {
+        int acc = in[i];
+
+        for (int k = 0; k < removedCount; ++k)
+            acc -= network.ftWeights[removed[k]][i];
+
+        for (int k = 0; k < addedCount; ++k)
+            acc += network.ftWeights[added[k]][i];
+
+        out[i] = std::int16_t(acc);
+    }
+#endif
+  }
+
+  // Recomputes the accumulator of the current position from scratch
+  void refresh_accumulator(const Position& pos, Color perspective) {
+
+    Accumulator& acc = pos.state()->accumulator;
+    std::int16_t* values = acc.values[perspective];
+
+    std::memcpy(values, network.ftBiases, sizeof(network.ftBiases));
+
+    int added[4];
+    int count = 0;
+
+    for (Bitboard b = pos.pieces(); b; )
+    {
+        Square s = pop_lsb(b);
+        added[count++] = feature_index(perspective, s, pos.piece_on(s));
+
+        if (count == 4 || !b)
+        {
+            update_values(values, values, added, count, nullptr, 0);
+            count = 0;
+        }
+    }
+
+    acc.computed[perspective] = true;
+  }
+
+  // Brings the accumulator of the current position up to date, starting
+  // from the closest earlier position that has one, or from scratch when
+  // replaying the moves in between would cost more than a refresh
+  void update_accumulator(const Position& pos, Color perspective) {
+
+    constexpr int MaxReplay = 32;
+
+    StateInfo* states[MaxReplay];
+    int count = 0;
+    int budget = popcount(pos.pieces());
+
+    StateInfo* st = pos.state();
+    while (!st->accumulator.computed[perspective])
+    {
+        budget -= st->dirtyPiece.dirty_num + 1;
+
+        if (!st->previous || budget < 0 || count == MaxReplay)
+        {
+            refresh_accumulator(pos, perspective);
+            return;
+        }
+
+        states[count++] = st;
+        st = st->previous;
+    }
+
+    // Replay the changes from the oldest state to the current one
+    while (count--)
+    {
+        StateInfo* next = states[count];
+        const DirtyPiece& dp = next->dirtyPiece;
+
+        int added[3], removed[3];
+        int addedCount = 0, removedCount = 0;
+
+        for (int k = 0; k < dp.dirty_num; ++k)
+        {
+            if (dp.from[k] != SQ_NONE)
+                removed[removedCount++] = feature_index(perspective, dp.from[k], dp.piece[k]);
+
+            if (dp.to[k] != SQ_NONE)
+                added[addedCount++] = feature_index(perspective, dp.to[k], dp.piece[k]);
+        }
+
+        update_values(next->accumulator.values[perspective], next->previous->accumulator.values[perspective],
+                      added, addedCount, removed, removedCount);
+
+        next->accumulator.computed[perspective] = true;
+    }
+  }
+
+  // Output neuron: clipped ReLU of both halves of the hidden layer, side to
+  // move first, dotted with the output weights
+  std::int32_t propagate(const std::int16_t* us, const std::int16_t* them) {
+
+#ifdef VECTOR
+    const vec_t* usVec      = reinterpret_cast<const vec_t*>(us);
+    const vec_t* themVec    = reinterpret_cast<const vec_t*>(them);
+    const vec_t* weightsVec = reinterpret_cast<const vec_t*>(network.outWeights);
+    const vec_t  hi         = vec_set_16(QA);
+
+    vec_t sum = vec_zero();
+
+    for (int j = 0; j < NumChunks; ++j)
+        sum = vec_add_32(sum, vec_madd_16(vec_clamp_16(usVec[j], hi), weightsVec[j]));
+
+    for (int j = 0; j < NumChunks; ++j)
+        sum = vec_add_32(sum, vec_madd_16(vec_clamp_16(themVec[j], hi), weightsVec[NumChunks + j]));
+
+    return vec_hsum_32(sum);
+#else
+    std::int32_t sum = 0;
+
+    for (int i = 0; i < HiddenSize; ++i)
+        sum += std::clamp(int(us[i]), 0, QA) * network.outWeights[i];
+
+    for (int i = 0; i < HiddenSize; ++i)
+        sum += std::clamp(int(them[i]), 0, QA) * network.outWeights[HiddenSize + i];
+
+    return sum;
+#endif
+  }
+
+  bool load(const std::string& filename) {
+
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in)
+        return false;
+
+    const std::streamoff expected = 2 * sizeof(std::uint32_t)
+                                  + sizeof(network.ftWeights) + sizeof(network.ftBiases)
+                                  + sizeof(network.outWeights) + sizeof(network.outBias);
+    if (in.tellg() != expected || !IsLittleEndian)
+        return false;
+
+    in.seekg(0);
+
+    std::uint32_t header[2];
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (header[0] != NetMagic || header[1] != std::uint32_t(HiddenSize))
+        return false;
+
+    in.read(reinterpret_cast<char*>(network.ftWeights), sizeof(network.ftWeights));
+    in.read(reinterpret_cast<char*>(network.ftBiases), sizeof(network.ftBiases));
+    in.read(reinterpret_cast<char*>(network.outWeights), sizeof(network.outWeights));
+    in.read(reinterpret_cast<char*>(&network.outBias), sizeof(network.outBias));
+
+    return bool(in);
+  }
+
+} // namespace
+
+
+/// init() reads the "Use NNUE" and "EvalFile" options and loads the network
+/// if it is enabled and not loaded yet
+
+void init() {
+
+  useNNUE = bool(Options["Use NNUE"]);
+  if (!useNNUE)
+      return;
+
+  std::string filename = Utility::map_path(std::string(Options["EvalFile"]));
+  if (loaded && filename == loadedFile)
+      return;
+
+  loaded = !Utility::is_empty_filename(filename) && load(filename);
+  loadedFile = loaded ? filename : "";
+
+  if (loaded)
+      sync_cout << "info string NNUE evaluation using " << filename << sync_endl;
+  else
+      sync_cout << "info string Could not load NNUE network: " << filename
+                << ". Classical evaluation is used." << sync_endl;
+}
+
+
+/// enabled() is true when evaluate() may be called
+
+bool enabled() {
+  return useNNUE && loaded;
+}
+
+
+/// refresh() computes the accumulator of the current position from scratch.
+/// Called on the root of every search, so that incremental updates never
+/// need to go back to states shared with other threads.
+
+void refresh(const Position& pos) {
+
+  for (Color perspective : { WHITE, BLACK })
+      refresh_accumulator(pos, perspective);
+}
+
+
+/// evaluate() returns the network output for the side to move
+
+Value evaluate(const Position& pos) {
+
+  update_accumulator(pos, WHITE);
+  update_accumulator(pos, BLACK);
+
+  const Accumulator& acc = pos.state()->accumulator;
+  const Color stm = pos.side_to_move();
+
+  std::int64_t output = propagate(acc.values[stm], acc.values[~stm]) + network.outBias;
+  int cp = int(output * Scale / (QA * QB));
+
+  return Value(cp * PawnValueEg / 100);
+}
+
+
+/// memory() returns the size of the network weights, which are statically
+/// allocated whether the network is used or not
+
+size_t memory() {
+  return sizeof(network);
+}
+
+} // namespace Stockfish::Eval::NNUE
@@ -0,0 +1,47 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// header used in NNUE evaluation function
+
+#ifndef NNUE_EVALUATE_NNUE_H_INCLUDED
+#define NNUE_EVALUATE_NNUE_H_INCLUDED
+
+#include "../types.h"
+
+namespace Stockfish {
+
+class Position;
+
+namespace Eval::NNUE {
+
+  /// The network is a single hidden layer of HiddenSize neurons for each
+  /// side, fed by 768 piece-square inputs and followed by a clipped ReLU and
+  /// one output neuron. The hidden layer is kept in StateInfo and updated
+  /// incrementally from the pieces changed by each move.
+
+  void init();
+  bool enabled();
+  void refresh(const Position& pos);
+  Value evaluate(const Position& pos);
+  size_t memory();
+
+} // namespace Eval::NNUE
+
+} // namespace Stockfish
+
+#endif // #ifndef NNUE_EVALUATE_NNUE_H_INCLUDED
@@ -0,0 +1,54 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Class for difference calculation of NNUE evaluation function
+
+#ifndef NNUE_ACCUMULATOR_H_INCLUDED
+#define NNUE_ACCUMULATOR_H_INCLUDED
+
+#include <cstdint>
+
+#include "../types.h"
+
+namespace Stockfish::Eval::NNUE {
+
+  // Number of neurons of the hidden layer, for each perspective
+  constexpr int HiddenSize = 256;
+
+  /// DirtyPiece records the pieces changed by the last move: the moving
+  /// piece, a captured piece and a promoted piece, or king and rook when
+  /// castling. SQ_NONE as origin or destination means off the board.
+
+  struct DirtyPiece {
+    int    dirty_num;
+    Piece  piece[3];
+    Square from[3];
+    Square to[3];
+  };
+
+  /// Accumulator holds the hidden layer of the network before activation,
+  /// from the point of view of each side
+
+  struct alignas(64) Accumulator {
+    std::int16_t values[COLOR_NB][HiddenSize];
+    bool computed[COLOR_NB];
+  };
+
+} // namespace Stockfish::Eval::NNUE
+
+#endif // #ifndef NNUE_ACCUMULATOR_H_INCLUDED
@@ -17,6 +17,7 @@
 */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 
 #include "bitboard.h"
@@ -197,33 +198,188 @@ namespace {
     return score;
   }
 
+
+  // SharedEntry holds the pawn structure part of an Entry in the table shared
+  // by all threads; pawn attacks are recomputed from the position and the king
+  // safety fields are cached per thread only. Entries are written and read
+  // without locks: 'check' is the key xor-ed with the data words, so a read
+  // that races with a write fails the key verification instead of returning
+  // a mix of two entries.
+  struct alignas(64) SharedEntry {
+    std::atomic<uint64_t> check;
+    std::atomic<uint64_t> data[6];
+  };
+
+  static_assert(sizeof(SharedEntry) == 64, "SharedEntry must fill a cache line");
+
+  std::vector<SharedEntry> SharedTable;
+  size_t SharedMask;
+
+  void pack(const Pawns::Entry* e, uint64_t data[6]) {
+
+    data[0] = uint32_t(e->scores[WHITE]) | uint64_t(uint32_t(e->scores[BLACK])) << 32;
+    data[1] = e->passedPawns[WHITE];
+    data[2] = e->passedPawns[BLACK];
+    data[3] = e->pawnAttacksSpan[WHITE];
+    data[4] = e->pawnAttacksSpan[BLACK];
+    data[5] = uint64_t(e->blockedCount);
+  }
+
+  void unpack(const Position& pos, Pawns::Entry* e, const uint64_t data[6]) {
+
+    e->key = pos.pawn_key();
+    e->scores[WHITE] = Score(int32_t(uint32_t(data[0])));
+    e->scores[BLACK] = Score(int32_t(uint32_t(data[0] >> 32)));
+    e->passedPawns[WHITE] = data[1];
+    e->passedPawns[BLACK] = data[2];
+    e->pawnAttacks[WHITE] = pawn_attacks_bb<WHITE>(pos.pieces(WHITE, PAWN));
+    e->pawnAttacks[BLACK] = pawn_attacks_bb<BLACK>(pos.pieces(BLACK, PAWN));
+    e->pawnAttacksSpan[WHITE] = data[3];
+    e->pawnAttacksSpan[BLACK] = data[4];
+    e->blockedCount = int(data[5]);
+    e->kingSquares[WHITE] = e->kingSquares[BLACK] = SQ_NONE;
+  }
+
+  bool probe_shared(const Position& pos, Pawns::Entry* e) {
+
+    if (SharedTable.empty())
+        return false;
+
+    Key key = pos.pawn_key();
+    SharedEntry& se = SharedTable[size_t(key) & SharedMask];
+    uint64_t data[6];
+    uint64_t check = se.check.load(std::memory_order_relaxed);
+
+    for (int i = 0; i < 6; ++i)
+        check ^= data[i] = se.data[i].load(std::memory_order_relaxed);
+
+    if (check != key)
+        return false;
+
+    unpack(pos, e, data);
+    return true;
+  }
+
+  void save_shared(const Pawns::Entry* e) {
+
+    if (SharedTable.empty())
+        return;
+
+    SharedEntry& se = SharedTable[size_t(e->key) & SharedMask];
+    uint64_t data[6];
+    uint64_t check = e->key;
+
+    pack(e, data);
+
+    for (int i = 0; i < 6; ++i)
+    {
+        se.data[i].store(data[i], std::memory_order_relaxed);
+        check ^= data[i];
+    }
+
+    se.check.store(check, std::memory_order_relaxed);
+  }
+
 } // namespace
 
 namespace Pawns {
 
 
+/// Table::resize() sets the size of the table in megabytes, rounded down to a
+/// power of 2 number of entries, and resets the counters. Entries only depend
+/// on the pawn structure, so a table that keeps its size is not cleared.
+
+void Table::resize(size_t mbSize) {
+
+  size_t entries = std::max(mbSize * 1024 * 1024 / sizeof(Entry), size_t(1));
+  entries = size_t(1) << msb(entries);
+
+  if (entries != table.size())
+  {
+      table = std::vector<Entry>(entries);
+      table.shrink_to_fit();
+      mask = entries - 1;
+  }
+
+  probes = hits = sharedHits = 0;
+}
+
+
+/// Pawns::resize_shared() sets the size of the shared table in megabytes,
+/// rounded down to a power of 2 number of entries. Zero disables it. It must
+/// not be called while searching.
+
+void resize_shared(size_t mbSize) {
+
+  size_t entries = mbSize * 1024 * 1024 / sizeof(SharedEntry);
+
+  if (entries)
+      entries = size_t(1) << msb(entries);
+
+  if (entries != SharedTable.size())
+  {
+      std::vector<SharedEntry>(entries).swap(SharedTable);
+      SharedMask = entries ? entries - 1 : 0;
+  }
+}
+
+size_t shared_size() {
+
+  return SharedTable.size() * sizeof(SharedEntry);
+}
+
+
 /// Pawns::probe() looks up the current position's pawns configuration in
-/// the pawns hash table. It returns a pointer to the Entry if the position
-/// is found. Otherwise a new Entry is computed and stored there, so we don't
-/// have to recompute all when the same pawns configuration occurs again.
+/// the pawns hash table of the thread, then in the shared one if enabled. It
+/// returns a pointer to the thread's Entry. If the configuration is found in
+/// neither, a new Entry is computed and stored in both, so we don't have to
+/// recompute all when the same pawns configuration occurs again.
 
 Entry* probe(const Position& pos) {
 
   Key key = pos.pawn_key();
-  Entry* e = pos.this_thread()->pawnsTable[key];
+  Table& table = pos.this_thread()->pawnsTable;
+  Entry* e = table[key];
+
+  ++table.probes;
 
   if (e->key == key)
+  {
+      ++table.hits;
+      return e;
+  }
+
+  if (probe_shared(pos, e))
+  {
+      ++table.sharedHits;
       return e;
+  }
 
   e->key = key;
   e->blockedCount = 0;
   e->scores[WHITE] = evaluate<WHITE>(pos, e);
   e->scores[BLACK] = evaluate<BLACK>(pos, e);
 
+  save_shared(e);
+
   return e;
 }
 
 
+/// Pawns::prefetch() prefetches the Entry that probe() will look at for the
+/// position, called by do_move() when a move changes the pawn structure.
+
+void prefetch(const Position& pos) {
+
+  Key key = pos.pawn_key();
+
+  Stockfish::prefetch(pos.this_thread()->pawnsTable[key]);
+
+  if (!SharedTable.empty())
+      Stockfish::prefetch(&SharedTable[size_t(key) & SharedMask]);
+}
+
+
 /// Entry::evaluate_shelter() calculates the shelter bonus and the storm
 /// penalty for a king, looking at the king file and the two closest files.
 
@@ -19,6 +19,8 @@
 #ifndef PAWNS_H_INCLUDED
 #define PAWNS_H_INCLUDED
 
+#include <vector>
+
 #include "misc.h"
 #include "position.h"
 #include "types.h"
@@ -61,9 +63,29 @@ struct Entry {
   int blockedCount;
 };
 
-using Table = HashTable<Entry, 131072>;
+/// Pawns::Table is the pawn hash table of a thread. Its size is set by the
+/// "Pawn Hash" option and the counters give its hit rate, together with the
+/// misses served by the optional shared table ("Pawn Hash Shared").
+
+class Table {
+
+public:
+  void resize(size_t mbSize);
+  Entry* operator[](Key key) { return &table[size_t(key) & mask]; }
+  size_t size() const { return table.size() * sizeof(Entry); }
+
+  uint64_t probes = 0, hits = 0, sharedHits = 0;
+
+private:
+  std::vector<Entry> table;
+  size_t mask = 0;
+};
 
 Entry* probe(const Position& pos);
+void prefetch(const Position& pos);
+
+void resize_shared(size_t mbSize);
+size_t shared_size();
 
 } // namespace Stockfish::Pawns
 
@@ -20,7 +20,10 @@
 #include "uci.h"
 #include "movegen.h"
 #include "thread.h"
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include "misc.h"
 #include <sys/timeb.h>
 
@@ -30,6 +33,14 @@ using namespace Stockfish;
 PolyBook polybook[2];
 PRNG rng(time(NULL));
 
+namespace Stockfish::Polyglot {
+
+  Key psq[PIECE_NB][SQUARE_NB];
+  Key enpassant[FILE_NB];
+  Key castling[CASTLING_RIGHT_NB];
+  Key turn;
+}
+
 namespace
 {
     // Random numbers from PolyGlot, used to compute book hash keys
@@ -331,20 +342,6 @@ namespace
         return a;
     }
 
-    uint32_t swap_uint32(uint32_t d)
-    {
-        uint32_t a;
-        uint8_t* dst = (uint8_t*)&a;
-        uint8_t* src = (uint8_t*)&d;
-
-        dst[0] = src[3];
-        dst[1] = src[2];
-        dst[2] = src[1];
-        dst[3] = src[0];
-
-        return a;
-    }
-
     uint64_t swap_uint64(uint64_t d)
     {
         uint64_t a;
@@ -363,15 +360,15 @@ namespace
         return a;
     }
 
-    void byteswap_polyhash(PolyHash* ph)
+    // Order of the entries of a book: by key, then by decreasing weight
+    bool entry_before(const PolyHash& a, const PolyHash& b)
     {
-        if (is_little_endian())
-        {
-            ph->key = swap_uint64(ph->key);
-            ph->move = swap_uint16(ph->move);
-            ph->weight = swap_uint16(ph->weight);
-            ph->learn = swap_uint32(ph->learn);
-        }
+        return a.key != b.key ? a.key < b.key : a.weight != b.weight ? a.weight > b.weight : a.move < b.move;
+    }
+
+    bool is_number(const std::string& s)
+    {
+        return !s.empty() && s.size() < 6 && std::all_of(s.begin(), s.end(), [](char c) { return c >= '0' && c <= '9'; });
     }
 }
 
@@ -380,104 +377,350 @@ PolyBook::PolyBook()
     keycount = 0;
     polyhash = NULL;
     enabled = false;
+    maxDepth = 0;
+    defaultDepth = true;
 
     index_first = index_best = index_rand = 0;
     index_count = index_weight_count = 0;
+
+    pendingLoads = 0;
+    lastRequest = 0;
 }
 
 PolyBook::~PolyBook()
 {
-    if (polyhash != NULL)
-        delete[]polyhash;
+    // Joining the last loader also joins all the ones it superseded
+    if (loader.joinable())
+        loader.join();
 }
 
 void PolyBook::init(const std::string& bookfile)
 {
+    uint64_t request;
+    {
+        std::lock_guard<std::mutex> lk(loaderMutex);
+        ++pendingLoads;
+        request = ++lastRequest;
+    }
+
+    std::thread previous = std::move(loader);
+    loader = std::thread([this, bookfile, request, previous = std::move(previous)]() mutable
+    {
+        if (previous.joinable())
+            previous.join();
+
+        bool superseded;
+        {
+            std::lock_guard<std::mutex> lk(loaderMutex);
+            superseded = request != lastRequest;
+        }
+
+        if (!superseded)
+            load(bookfile);
+
+        std::lock_guard<std::mutex> lk(loaderMutex);
+        --pendingLoads;
+        loaderCond.notify_all();
+    });
+}
+
+// parse_sources() splits a list of books. The optional weight and depth are
+// only read from numeric suffixes, so that a colon in a path is kept.
+std::vector<PolyBook::Source> PolyBook::parse_sources(const std::string& bookfiles)
+{
+    std::vector<Source> sources;
+    std::stringstream ss(bookfiles);
+    std::string item;
+
+    while (std::getline(ss, item, ';'))
+    {
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+
+        std::vector<int> values;
+        size_t colon;
+        while (   values.size() < 2
+               && (colon = item.rfind(':')) != std::string::npos
+               && is_number(item.substr(colon + 1)))
+        {
+            values.insert(values.begin(), std::stoi(item.substr(colon + 1)));
+            item.erase(colon);
+        }
+
+        if (item.empty() || item == "<empty>")
+            continue;
+
+        sources.push_back({ item, values.size() > 0 ? values[0] : 100, values.size() > 1 ? values[1] : 0 });
+    }
+
+    return sources;
+}
+
+void PolyBook::load(const std::string& bookfiles)
+{
+    std::lock_guard<std::mutex> lk(mutex);
+
     enabled = false;
+    keycount = 0;
+    polyhash = NULL;
+    indexKeys.clear();
+    indexBlocks.clear();
+    mapping.unmap();
+    merged.clear();
+    merged.shrink_to_fit();
+    maxDepth = 0;
+    defaultDepth = true;
+
+    std::vector<Source> sources = parse_sources(bookfiles);
 
-    if (bookfile.empty() || bookfile == "<empty>")
+    if (sources.empty())
     {
         sync_cout << "info string Polyglot book disabled (no file provided)" << sync_endl;
         return;
     }
 
-    sync_cout << "info string Loading Polyglot book: " << bookfile << sync_endl;
-
-    FILE *fpt = fopen(bookfile.c_str(), "rb");
-    if (fpt == NULL)
+    if (sources.size() > 1 || sources[0].weight != 100 || sources[0].depth)
     {
-        sync_cout << "info string Could not open book file: " << bookfile << sync_endl;
+        merge(sources);
         return;
     }
 
-    if (polyhash)
+    const std::string& bookfile = sources[0].file;
+
+    sync_cout << "info string Loading Polyglot book: " << bookfile << sync_endl;
+
+    // The book is mapped read-only and left big-endian, so loading costs no
+    // private memory and the page cache copy is shared between processes
+    if (!mapping.map(bookfile, false))
     {
-        free(polyhash);
-        polyhash = NULL;
+        sync_cout << "info string Could not open book file: " << bookfile << sync_endl;
+        return;
     }
 
-    fseek(fpt, 0L, SEEK_END);
-    size_t filesize = (size_t)ftell(fpt);
-    fseek(fpt, 0L, SEEK_SET);
-
+    size_t filesize = mapping.data_size();
     if (filesize % sizeof(PolyHash) != 0)
     {
         sync_cout << "info string Invalid Polyglot book file: size mismatch" << sync_endl;
-        fclose(fpt);
+        mapping.unmap();
         return;
     }
 
-    keycount = filesize / sizeof(PolyHash);
-    polyhash = (PolyHash *)malloc(filesize);
-    if (!polyhash)
+    keycount = int(filesize / sizeof(PolyHash));
+    polyhash = (const PolyHash *)mapping.data();
+
+    // Sampling the keys touches every page of the book, so it is done here
+    // rather than by the first probe
+    build_index();
+
+    sync_cout << "info string Book loaded successfully: " << bookfile 
+              << " (" << keycount << " entries)" << sync_endl;
+
+    enabled = true;
+}
+
+// merge() reads the entries of all the books into one book sorted like a
+// PolyGlot file, so that a position is found with a single lookup however
+// many books there are. A move given by several books with the same depth
+// becomes one entry with the sum of the weights. Entries of books with
+// different depths are kept apart, probe() adds up the ones still in use.
+void PolyBook::merge(const std::vector<Source>& sources)
+{
+    std::vector<PolyHash> entries;
+    defaultDepth = false;
+
+    for (const Source& source : sources)
     {
-        sync_cout << "info string Memory allocation failed for " << bookfile << sync_endl;
-        fclose(fpt);
-        return;
+        sync_cout << "info string Loading Polyglot book: " << source.file
+                  << " (weight " << source.weight << "%, depth "
+                  << (source.depth ? std::to_string(source.depth) : std::string("default")) << ")" << sync_endl;
+
+        Utility::FileMapping book;
+        if (!book.map(source.file, false) || book.data_size() % sizeof(PolyHash) != 0)
+        {
+            sync_cout << "info string Could not open book file: " << source.file << sync_endl;
+            continue;
+        }
+
+        const PolyHash* data = (const PolyHash*)book.data();
+        size_t count = book.data_size() / sizeof(PolyHash);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            PolyHash e = data[i];
+            if (is_little_endian())
+            {
+                e.key = swap_uint64(e.key);
+                e.move = swap_uint16(e.move);
+                e.weight = swap_uint16(e.weight);
+            }
+
+            // Zero weight moves are never played, but still count as book moves
+            e.weight = uint16_t(std::min(uint64_t(e.weight) * source.weight / 100, uint64_t(0xFFFF)));
+            e.learn = uint32_t(source.depth);
+            entries.push_back(e);
+        }
+
+        maxDepth = std::max(maxDepth, source.depth);
+        defaultDepth |= !source.depth;
     }
 
-    size_t readSize = fread(polyhash, 1, filesize, fpt);
-    fclose(fpt);
+    std::sort(entries.begin(), entries.end(), [](const PolyHash& a, const PolyHash& b) {
+        return a.key != b.key ? a.key < b.key : a.move != b.move ? a.move < b.move : a.learn < b.learn;
+    });
+
+    size_t n = 0;
+    for (size_t i = 0; i < entries.size(); ++i)
+        if (   n
+            && entries[n - 1].key == entries[i].key
+            && entries[n - 1].move == entries[i].move
+            && entries[n - 1].learn == entries[i].learn)
+            entries[n - 1].weight = uint16_t(std::min(entries[n - 1].weight + entries[i].weight, 0xFFFF));
+        else
+            entries[n++] = entries[i];
 
-    if (readSize != filesize)
-    {
-        free(polyhash);
-        polyhash = NULL;
+    entries.resize(n);
+    std::sort(entries.begin(), entries.end(), entry_before);
+
+    for (PolyHash& e : entries)
+        if (is_little_endian())
+        {
+            e.key = swap_uint64(e.key);
+            e.move = swap_uint16(e.move);
+            e.weight = swap_uint16(e.weight);
+        }
+
+    merged = std::move(entries);
+    merged.shrink_to_fit();
 
-        sync_cout << "info string Could not read entire book file: " << bookfile << sync_endl;
+    if (merged.empty())
+    {
+        sync_cout << "info string Polyglot book disabled (no entries)" << sync_endl;
         return;
     }
 
-    for (int i = 0; i < keycount; i++)
-        byteswap_polyhash(&polyhash[i]);
+    keycount = int(merged.size());
+    polyhash = merged.data();
+    build_index();
 
-    sync_cout << "info string Book loaded successfully: " << bookfile 
-              << " (" << keycount << " entries)" << sync_endl;
+    sync_cout << "info string Books merged successfully: " << sources.size()
+              << " books (" << keycount << " entries)" << sync_endl;
 
     enabled = true;
 }
 
-Move PolyBook::probe(Position& pos, int bookWidth) {
+std::pair<size_t, size_t> PolyBook::memory()
+{
+    std::lock_guard<std::mutex> lk(mutex);
+
+    size_t index = indexKeys.capacity() * sizeof(uint64_t) + indexBlocks.capacity() * sizeof(uint32_t);
+
+    if (!merged.empty())
+        return { 0, index + merged.capacity() * sizeof(PolyHash) };
+
+    return { size_t(keycount) * sizeof(PolyHash), index };
+}
+
+uint64_t PolyBook::entry_key(int i) const
+{
+    return is_little_endian() ? swap_uint64(polyhash[i].key) : polyhash[i].key;
+}
+
+uint16_t PolyBook::entry_move(int i) const
+{
+    return is_little_endian() ? swap_uint16(polyhash[i].move) : polyhash[i].move;
+}
+
+uint16_t PolyBook::entry_weight(int i) const
+{
+    return is_little_endian() ? swap_uint16(polyhash[i].weight) : polyhash[i].weight;
+}
+
+int PolyBook::entry_depth(int i) const
+{
+    return merged.empty() ? 0 : int(polyhash[i].learn);
+}
+
+// build_index() samples the key of every IndexStride-th entry and stores the
+// samples in Eytzinger order, where the children of node k are 2k and 2k+1.
+// The top levels of the implicit tree share a few cache lines, so a lookup
+// touches far fewer lines than a binary search over the whole book.
+void PolyBook::build_index()
+{
+    size_t samples = (keycount + IndexStride - 1) / IndexStride;
+
+    indexKeys.assign(samples + 1, 0);
+    indexBlocks.assign(samples + 1, 0);
+
+    // In-order traversal of the implicit tree visits the samples in sorted order
+    size_t block = 0;
+    std::vector<size_t> stack;
+    size_t k = 1;
+    while (k <= samples || !stack.empty())
+    {
+        if (k <= samples)
+        {
+            stack.push_back(k);
+            k = 2 * k;
+            continue;
+        }
+
+        k = stack.back();
+        stack.pop_back();
+
+        indexKeys[k] = entry_key(int(block * IndexStride));
+        indexBlocks[k] = uint32_t(block++);
+        k = 2 * k + 1;
+    }
+}
+
+Move PolyBook::probe(Position& pos, int bookWidth, int bookDepth) {
+    {
+        std::unique_lock<std::mutex> ul(loaderMutex);
+        loaderCond.wait(ul, [&] { return !pendingLoads; });
+    }
+
+    std::lock_guard<std::mutex> lk(mutex);
+
     if (!enabled)
         return MOVE_NONE;
 
-    Key key = polyglot_key(pos);
+    // Books are used for a number of moves, either their own or 'bookDepth'
+    int moves = pos.game_ply() / 2;
+    if (moves >= std::max(maxDepth, defaultDepth ? bookDepth : 0))
+        return MOVE_NONE;
+
+    Key key = pos.polyglot_key();
     int n = find_first_key(key); // Trova quante mosse esistono per questa posizione
     if (n < 1)
         return MOVE_NONE;
 
-    // Determina quante mosse considerare, massimo `bookWidth`
-    int width = std::min(bookWidth, index_count);
-    std::vector<int> indices(width);
-
-    // Seleziona i primi `width` indici
-    for (int i = 0; i < width; ++i) {
-        indices[i] = index_first + i;
+    // Collect the moves of the books still in use, in book order. Merged books
+    // can give a move more than once, with different depths.
+    std::vector<std::pair<uint16_t, int>> candidates;
+    for (int i = index_first; i < index_first + index_count; ++i)
+    {
+        int depth = entry_depth(i) ? entry_depth(i) : bookDepth;
+        if (moves >= depth)
+            continue;
+
+        auto it = std::find_if(candidates.begin(), candidates.end(),
+                               [&](const std::pair<uint16_t, int>& c) { return c.first == entry_move(i); });
+        if (it != candidates.end())
+            it->second += entry_weight(i);
+        else
+            candidates.emplace_back(entry_move(i), entry_weight(i));
     }
 
-    // Scegli una mossa casuale tra quelle selezionate
-    int idx = indices[rng.rand<uint32_t>() % indices.size()];
-    Move m = pg_move_to_sf_move(pos, polyhash[idx].move);
+    if (candidates.empty())
+        return MOVE_NONE;
+
+    if (!merged.empty())
+        std::stable_sort(candidates.begin(), candidates.end(),
+                         [](const std::pair<uint16_t, int>& a, const std::pair<uint16_t, int>& b) { return a.second > b.second; });
+
+    // Scegli una mossa casuale tra le prime `bookWidth`
+    int width = std::min(bookWidth, int(candidates.size()));
+    Move m = pg_move_to_sf_move(pos, candidates[rng.rand<uint32_t>() % width].first);
 
     // Verifica che la mossa non porti a uno stallo
     if (!check_draw(pos, m))
@@ -486,32 +729,30 @@ Move PolyBook::probe(Position& pos, int bookWidth) {
     return MOVE_NONE; // Nessuna mossa valida trovata
 }
 
-Key PolyBook::polyglot_key(const Position & pos)
+/// Polyglot::init() rearranges the PolyGlot random numbers into the tables
+/// used by Position to maintain the book key
+
+void Polyglot::init()
 {
-    Key key = 0;
-    Bitboard b = pos.pieces();
+    for (Piece pc : { W_PAWN, W_KNIGHT, W_BISHOP, W_ROOK, W_QUEEN, W_KING,
+                      B_PAWN, B_KNIGHT, B_BISHOP, B_ROOK, B_QUEEN, B_KING })
+        for (Square s = SQ_A1; s <= SQ_H8; ++s)
+            // PolyGlot pieces are: BP = 0, WP = 1, BN = 2, ... BK = 10, WK = 11
+            psq[pc][s] = PG.Zobrist.psq[2 * (type_of(pc) - 1) + (color_of(pc) == WHITE)][s];
 
-    while (b)
-    {
-        Square s = pop_lsb(b);
-        Piece p = pos.piece_on(s);
+    for (File f = FILE_A; f <= FILE_H; ++f)
+        enpassant[f] = PG.Zobrist.enpassant[f];
 
-        // PolyGlot pieces are: BP = 0, WP = 1, BN = 2, ... BK = 10, WK = 11
-        key ^= PG.Zobrist.psq[2 * (type_of(p) - 1) + (color_of(p) == WHITE)][s];
+    // PolyGlot castle keys are in the same order as our castling right bits
+    for (int cr = NO_CASTLING; cr <= ANY_CASTLING; ++cr)
+    {
+        castling[cr] = 0;
+        for (int i = 0; i < 4; ++i)
+            if (cr & (1 << i))
+                castling[cr] ^= PG.Zobrist.castle[i];
     }
 
-    if (pos.can_castle(WHITE_OO))  key ^= PG.Zobrist.castle[0];
-    if (pos.can_castle(WHITE_OOO)) key ^= PG.Zobrist.castle[1];
-    if (pos.can_castle(BLACK_OO))  key ^= PG.Zobrist.castle[2];
-    if (pos.can_castle(BLACK_OOO)) key ^= PG.Zobrist.castle[3];
-    
-    if (pos.ep_square() != SQ_NONE)
-        key ^= PG.Zobrist.enpassant[file_of(pos.ep_square())];
-
-    if (pos.side_to_move() == WHITE)
-        key ^= PG.Zobrist.turn;
-
-    return key;
+    turn = PG.Zobrist.turn;
 }
 
 // A PolyGlot book move is encoded as follows:
@@ -548,45 +789,120 @@ Move PolyBook::pg_move_to_sf_move(const Position & pos, unsigned short pg_move)
     return MOVE_NONE;
 }
 
-int PolyBook::find_first_key(uint64_t key)
+// The inverse of pg_move_to_sf_move(). Castling is king takes rook in both
+// encodings, so only the promotion piece needs to be translated.
+uint16_t PolyBook::sf_move_to_pg_move(Move m)
 {
-    index_first = -1;
-    index_count = 0;
-    index_weight_count = 0;
-    index_best = -1;
-    index_rand = -1;
+    uint16_t pg_move = uint16_t(int(from_sq(m)) << 6 | int(to_sq(m)));
+
+    if (type_of(m) == PROMOTION)
+        pg_move |= uint16_t((promotion_type(m) - 1) << 12);
+
+    return pg_move;
+}
 
-    int start = 0;
-    int end = keycount;
+// write() sorts the ranges of the threads in parallel and merges them pairwise,
+// each round halving the number of ranges. The entries are then swapped to
+// big-endian a buffer at a time while streaming them to the file.
+bool PolyBook::write(const std::string& bookfile, std::vector<PolyHash>& entries, size_t threads)
+{
+    size_t ranges = std::max(std::min(threads, entries.size() / 1024), size_t(1));
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= ranges; ++i)
+        bounds.push_back(entries.size() * i / ranges);
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < ranges; ++i)
+        workers.emplace_back([&, i]() {
+            std::sort(entries.begin() + bounds[i], entries.begin() + bounds[i + 1], entry_before);
+        });
+
+    for (std::thread& t : workers)
+        t.join();
 
-    for (;;)
+    for (size_t width = 1; width < ranges; width *= 2)
     {
-        int mid = (end + start) / 2;
+        workers.clear();
+        for (size_t i = 0; i + width < ranges; i += 2 * width)
+            workers.emplace_back([&, i, width]() {
+                std::inplace_merge(entries.begin() + bounds[i],
+                                   entries.begin() + bounds[i + width],
+                                   entries.begin() + bounds[std::min(i + 2 * width, ranges)], entry_before);
+            });
+
+        for (std::thread& t : workers)
+            t.join();
+    }
 
-        if (polyhash[mid].key < key)
-            start = mid;
-        else
+    std::ofstream out(bookfile, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+        return false;
+
+    constexpr size_t BufferEntries = 64 * 1024;
+    std::vector<PolyHash> buffer;
+    buffer.reserve(BufferEntries);
+
+    for (size_t i = 0; i < entries.size(); i += BufferEntries)
+    {
+        buffer.clear();
+        for (size_t j = i; j < std::min(i + BufferEntries, entries.size()); ++j)
         {
-            if (polyhash[mid].key > key)
-                end = mid;
-            else
+            PolyHash e = entries[j];
+            if (is_little_endian())
             {
-                start = max(mid - 4, 0);
-                end = min(mid + 4, keycount);
+                e.key = swap_uint64(e.key);
+                e.move = swap_uint16(e.move);
+                e.weight = swap_uint16(e.weight);
+                e.learn = uint32_t(swap_uint16(uint16_t(e.learn >> 16))) | uint32_t(swap_uint16(uint16_t(e.learn))) << 16;
             }
+            buffer.push_back(e);
         }
 
-        if (end - start < 9)
-            break;
+        if (!out.write((const char*)buffer.data(), buffer.size() * sizeof(PolyHash)))
+            return false;
     }
 
+    out.close();
+    return !out.fail();
+}
+
+int PolyBook::find_first_key(uint64_t key)
+{
+    index_first = -1;
+    index_count = 0;
+    index_weight_count = 0;
+    index_best = -1;
+    index_rand = -1;
+
+    if (indexKeys.empty())
+        build_index();
+
+    // Descend to the first sample that is not less than 'key'. The path bits
+    // record the turns, the trailing right turns are undone at the end.
+    size_t samples = indexKeys.size() - 1;
+    size_t k = 1;
+    while (k <= samples)
+        k = 2 * k + (indexKeys[k] < key);
+
+    k >>= int(lsb(~Bitboard(k))) + 1;
+
+    // The first entry with 'key' is after the previous sample and at most at
+    // the found one. If all samples are smaller, it can only be in the last block.
+    size_t block = k ? indexBlocks[k] : samples;
+    int start = int(block > 0 ? (block - 1) * IndexStride : 0);
+    int end = int(std::min(block * IndexStride + 1, size_t(keycount)));
+    if (!k)
+        end = keycount;
+
     for (int i = start; i < end; i++)
     {
-        if (key == polyhash[i].key)
+        uint64_t entryKey = entry_key(i);
+        if (entryKey > key)
+            break;
+
+        if (entryKey == key)
         {
             index_first = i;
-            while ((index_first>0) && (key == polyhash[index_first - 1].key))
-                index_first--;
             return get_key_data();
         }
     }
@@ -596,39 +912,39 @@ int PolyBook::find_first_key(uint64_t key)
 
 int PolyBook::get_key_data()
 {
-    int best_weight = polyhash[index_first].weight;
+    int best_weight = entry_weight(index_first);
     index_weight_count = best_weight;
-    uint64_t key = polyhash[index_first].key;
+    uint64_t key = entry_key(index_first);
 
     index_count = 1;
     index_best = index_first;
 
     for (int i = index_first + 1; i<keycount; i++)
     {
-        if (polyhash[i].key != key)
+        if (entry_key(i) != key)
             break;
 
         index_count++;
-        index_weight_count += polyhash[i].weight;
-        if (polyhash[i].weight > best_weight)
+        index_weight_count += entry_weight(i);
+        if (entry_weight(i) > best_weight)
         {
-            best_weight = polyhash[i].weight;
+            best_weight = entry_weight(i);
             index_best = i;
         }
     }
 
-    int rand_pos = (rng.rand<uint32_t>() % index_weight_count);
+    int rand_pos = index_weight_count ? (rng.rand<uint32_t>() % index_weight_count) : 0;
     int weight_count = 0;
     index_rand = index_best;
 
     for (int i = index_first; i < index_first + index_count; i++)
     {
-        if ((rand_pos >= weight_count) && (rand_pos < weight_count + polyhash[i].weight))
+        if ((rand_pos >= weight_count) && (rand_pos < weight_count + entry_weight(i)))
         {
             index_rand = i;
             break;
         }
-        weight_count += polyhash[i].weight;
+        weight_count += entry_weight(i);
     }
 
     return index_count;
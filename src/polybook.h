@@ -19,10 +19,31 @@
 #ifndef POLYBOOK_H_INCLUDED
 #define POLYBOOK_H_INCLUDED
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "bitboard.h"
+#include "misc.h"
 #include "position.h"
 #include "string.h"
 
+namespace Stockfish::Polyglot {
+
+// Book hash keys of the PolyGlot format, indexed like Zobrist keys by our own
+// piece and castling rights encoding, so that Position can update them
+// incrementally next to its own key
+extern Key psq[PIECE_NB][SQUARE_NB];
+extern Key enpassant[FILE_NB];
+extern Key castling[CASTLING_RIGHT_NB];
+extern Key turn;
+
+void init();
+
+} // namespace Stockfish::Polyglot
+
 typedef struct {
     uint64_t key;
     uint16_t move;
@@ -37,23 +58,84 @@ public:
     PolyBook();
     ~PolyBook();
 
-    void init(const std::string& bookfile);
-    Stockfish::Move probe(Stockfish::Position& pos, int bookWidth);
+    // 'bookfiles' is a list of books separated by ';', each one given as
+    // file[:weight[:depth]]. The weight scales the weights of its moves in
+    // percent (100 by default), and the depth is the number of moves the book
+    // is used for, 'bookDepth' of probe() when not given. A single book with
+    // neither is probed from its mapped file, several books are merged into
+    // one private book at load.
+    void init(const std::string& bookfiles);
+    Stockfish::Move probe(Stockfish::Position& pos, int bookWidth, int bookDepth = Stockfish::MAX_PLY);
+
+    // Bytes of the mapped book file and of the private key index
+    std::pair<size_t, size_t> memory();
+
+    // Sorts 'entries' (in host byte order) by key and weight on 'threads' threads
+    // and writes them to 'bookfile' in the PolyGlot format
+    static bool write(const std::string& bookfile, std::vector<PolyHash>& entries, size_t threads);
+
+    static uint16_t sf_move_to_pg_move(Stockfish::Move m);
 
 private:
 
-    Stockfish::Key polyglot_key(const Stockfish::Position& pos);
+    struct Source
+    {
+        std::string file;
+        int weight;
+        int depth;
+    };
+
+    static std::vector<Source> parse_sources(const std::string& bookfiles);
+
+    void load(const std::string& bookfiles);
+    void merge(const std::vector<Source>& sources);
+
     Stockfish::Move pg_move_to_sf_move(const Stockfish::Position & pos, unsigned short pg_move);
 
+    // Book entries stay big-endian in the mapped file, fields are swapped when read
+    uint64_t entry_key(int i) const;
+    uint16_t entry_move(int i) const;
+    uint16_t entry_weight(int i) const;
+    int entry_depth(int i) const;
+
+    void build_index();
     int find_first_key(uint64_t key);
     int get_key_data();
 
     bool check_draw(Stockfish::Position& pos, Stockfish::Move m);
 
     int keycount;
-    PolyHash *polyhash;
+    const PolyHash *polyhash;
     bool enabled;
 
+    Stockfish::Utility::FileMapping mapping;
+
+    // Entries of merged books, big-endian like a mapped file. The 'learn' field
+    // holds the depth of the book in host order, zero for the default depth.
+    std::vector<PolyHash> merged;
+    int maxDepth;
+    bool defaultDepth;
+
+    // Every IndexStride-th book key in Eytzinger (BFS) order, 1-based, together
+    // with its block number. Built on the first probe.
+    static constexpr int IndexStride = 16;
+    std::vector<uint64_t> indexKeys;
+    std::vector<uint32_t> indexBlocks;
+
+    // Guards the book data, the index_* probe state and the shared PRNG, so
+    // that probing never races with another probe or with a book reload
+    std::mutex mutex;
+
+    // init() hands the loading to a background thread, so that neither startup
+    // nor a 'setoption' waits for the mapping and the index. Each loader joins
+    // the one before it and skips its file if a newer one was requested in the
+    // meantime. probe() waits until no load is pending.
+    std::thread loader;
+    std::mutex loaderMutex;
+    std::condition_variable loaderCond;
+    int pendingLoads;
+    uint64_t lastRequest;
+
     int index_first;
     int index_best;
     int index_rand;
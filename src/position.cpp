@@ -25,8 +25,11 @@
 #include <string_view>
 
 #include "bitboard.h"
+#include "material.h"
 #include "misc.h"
 #include "movegen.h"
+#include "pawns.h"
+#include "polybook.h"
 #include "position.h"
 #include "thread.h"
 #include "tt.h"
@@ -889,6 +892,8 @@ void Position::init() {
     Zobrist::side         = 4906379431808431525ULL;
     Zobrist::noPawns      = 895963052000028445ULL;
 
+    Polyglot::init();
+
   // Prepare the cuckoo tables
   std::memset(cuckoo, 0, sizeof(cuckoo));
   std::memset(cuckooMove, 0, sizeof(cuckooMove));
@@ -1097,7 +1102,7 @@ void Position::set_check_info() const {
 
 void Position::set_state() const {
 
-  st->key = st->materialKey = 0;
+  st->key = st->materialKey = st->polyKey = 0;
   st->pawnKey = Zobrist::noPawns;
   st->nonPawnMaterial[WHITE] = st->nonPawnMaterial[BLACK] = VALUE_ZERO;
   st->checkersBB = attackers_to(square<KING>(sideToMove)) & pieces(~sideToMove);
@@ -1109,6 +1114,7 @@ void Position::set_state() const {
       Square s = pop_lsb(b);
       Piece pc = piece_on(s);
       st->key ^= Zobrist::psq[pc][s];
+      st->polyKey ^= Polyglot::psq[pc][s];
 
       if (type_of(pc) == PAWN)
           st->pawnKey ^= Zobrist::psq[pc][s];
@@ -1118,12 +1124,18 @@ void Position::set_state() const {
   }
 
   if (st->epSquare != SQ_NONE)
+  {
       st->key ^= Zobrist::enpassant[file_of(st->epSquare)];
+      st->polyKey ^= Polyglot::enpassant[file_of(st->epSquare)];
+  }
 
   if (sideToMove == BLACK)
       st->key ^= Zobrist::side;
+  else
+      st->polyKey ^= Polyglot::turn;
 
   st->key ^= Zobrist::castling[st->castlingRights];
+  st->polyKey ^= Polyglot::castling[st->castlingRights];
 
   for (Piece pc : Pieces)
       for (int cnt = 0; cnt < pieceCount[pc]; ++cnt)
@@ -1446,6 +1458,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
   thisThread->nodes.fetch_add(1, std::memory_order_relaxed);
   Key k = st->key ^ Zobrist::side;
+  Key pk = st->polyKey ^ Polyglot::turn;
 
   // Copy some fields of the old state to our new StateInfo object except the
   // ones which are going to be recalculated from scratch anyway and then switch
@@ -1453,6 +1466,10 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   std::memcpy(&newSt, st, offsetof(StateInfo, key));
   newSt.previous = st;
   st = &newSt;
+  st->accumulator.computed[WHITE] = false;
+  st->accumulator.computed[BLACK] = false;
+  auto& dp = st->dirtyPiece;
+  dp.dirty_num = 1;
 
   // Increment ply counters. In particular, rule50 will be reset to zero later on
   // in case of a capture or a pawn move.
@@ -1479,7 +1496,16 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       Square rfrom, rto;
       do_castling<true>(us, from, to, rfrom, rto);
 
+      dp.dirty_num = 2; // King and rook
+      dp.piece[0] = pc;
+      dp.from[0] = from;
+      dp.to[0] = to;
+      dp.piece[1] = captured;
+      dp.from[1] = rfrom;
+      dp.to[1] = rto;
+
       k ^= Zobrist::psq[captured][rfrom] ^ Zobrist::psq[captured][rto];
+      pk ^= Polyglot::psq[captured][rfrom] ^ Polyglot::psq[captured][rto];
       captured = NO_PIECE;
   }
 
@@ -1507,13 +1533,19 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       else
           st->nonPawnMaterial[them] -= PieceValue[MG][captured];
 
+      dp.dirty_num = 2; // 1 piece moved, 1 piece captured
+      dp.piece[1] = captured;
+      dp.from[1] = capsq;
+      dp.to[1] = SQ_NONE;
+
       // Update board and piece lists
       remove_piece(capsq);
 
-      // Update material hash key and prefetch access to materialTable
+      // Update material hash key and prefetch access to the material entry
       k ^= Zobrist::psq[captured][capsq];
+      pk ^= Polyglot::psq[captured][capsq];
       st->materialKey ^= Zobrist::psq[captured][pieceCount[captured]];
-      prefetch(thisThread->materialTable[st->materialKey]);
+      Material::prefetch(*this);
 
       // Reset rule 50 counter
       st->rule50 = 0;
@@ -1521,11 +1553,13 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
   // Update hash key
   k ^= Zobrist::psq[pc][from] ^ Zobrist::psq[pc][to];
+  pk ^= Polyglot::psq[pc][from] ^ Polyglot::psq[pc][to];
 
   // Reset en passant square
   if (st->epSquare != SQ_NONE)
   {
       k ^= Zobrist::enpassant[file_of(st->epSquare)];
+      pk ^= Polyglot::enpassant[file_of(st->epSquare)];
       st->epSquare = SQ_NONE;
   }
 
@@ -1533,13 +1567,19 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 if (st->castlingRights && (castlingRightsMask[from] | castlingRightsMask[to]))
 {
     k ^= Zobrist::castling[st->castlingRights];
+    pk ^= Polyglot::castling[st->castlingRights];
     st->castlingRights &= ~(castlingRightsMask[from] | castlingRightsMask[to]);
     k ^= Zobrist::castling[st->castlingRights];
+    pk ^= Polyglot::castling[st->castlingRights];
 }
 
 // Move the piece. The tricky Chess960 castling is handled earlier
 if (type_of(m) != CASTLING)
 {
+    dp.piece[0] = pc;
+    dp.from[0] = from;
+    dp.to[0] = to;
+
     move_piece(from, to);
 }
 
@@ -1552,6 +1592,7 @@ if (type_of(m) != CASTLING)
       {
           st->epSquare = to - pawn_push(us);
           k ^= Zobrist::enpassant[file_of(st->epSquare)];
+          pk ^= Polyglot::enpassant[file_of(st->epSquare)];
       }
 
       else if (type_of(m) == PROMOTION)
@@ -1564,8 +1605,16 @@ if (type_of(m) != CASTLING)
           remove_piece(to);
           put_piece(promotion, to);
 
+          // Promoting pawn to SQ_NONE, promoted piece from SQ_NONE
+          dp.to[0] = SQ_NONE;
+          dp.piece[dp.dirty_num] = promotion;
+          dp.from[dp.dirty_num] = SQ_NONE;
+          dp.to[dp.dirty_num] = to;
+          dp.dirty_num++;
+
           // Update hash keys
           k ^= Zobrist::psq[pc][to] ^ Zobrist::psq[promotion][to];
+          pk ^= Polyglot::psq[pc][to] ^ Polyglot::psq[promotion][to];
           st->pawnKey ^= Zobrist::psq[pc][to];
           st->materialKey ^=  Zobrist::psq[promotion][pieceCount[promotion]-1]
                             ^ Zobrist::psq[pc][pieceCount[pc]];
@@ -1581,11 +1630,16 @@ if (type_of(m) != CASTLING)
       st->rule50 = 0;
   }
 
+  // Prefetch access to the pawns entry if the pawn structure has changed
+  if (st->pawnKey != st->previous->pawnKey)
+      Pawns::prefetch(*this);
+
   // Set capture piece
   st->capturedPiece = captured;
 
-  // Update the key with the final value
+  // Update the keys with the final value
   st->key = k;
+  st->polyKey = pk;
 
   // Calculate checkers bitboard (if move gives check)
   st->checkersBB = givesCheck ? attackers_to(square<KING>(them)) & pieces(us) : 0;
@@ -1709,15 +1763,21 @@ void Position::do_null_move(StateInfo& newSt) {
   assert(!checkers());
   assert(&newSt != st);
 
-  // Copia lo stato fino a key, escludendo le parti rimosse
-  std::memcpy(&newSt, st, sizeof(StateInfo));
+  // Copia lo stato fino all'accumulatore, che non serve alla valutazione classica
+  std::memcpy(&newSt, st, offsetof(StateInfo, accumulator));
 
   newSt.previous = st;
   st = &newSt;
 
+  // No piece has changed, the accumulator is taken from the previous state when needed
+  st->accumulator.computed[WHITE] = false;
+  st->accumulator.computed[BLACK] = false;
+  st->dirtyPiece.dirty_num = 0;
+
   // Gestisci l'en passant
   if (st->epSquare != SQ_NONE) {
       st->key ^= Zobrist::enpassant[file_of(st->epSquare)];
+      st->polyKey ^= Polyglot::enpassant[file_of(st->epSquare)];
       st->epSquare = SQ_NONE;
   }
 
@@ -1725,6 +1785,7 @@ void Position::do_null_move(StateInfo& newSt) {
   st->pliesFromNull = 0;
   sideToMove = ~sideToMove;
   st->key ^= Zobrist::side;
+  st->polyKey ^= Polyglot::turn;
 
   // Reimposta il contesto degli scacchi
   set_check_info();
@@ -29,6 +29,8 @@
 #include "psqt.h"
 #include "types.h"
 
+#include "nnue/nnue_accumulator.h"
+
 
 namespace Stockfish {
 
@@ -48,6 +50,7 @@ struct StateInfo {
 
     // Non copiati durante le mosse
     Key        key;
+    Key        polyKey;
     Bitboard   checkersBB;
     StateInfo* previous;
     Bitboard   blockersForKing[COLOR_NB];
@@ -55,6 +58,10 @@ struct StateInfo {
     Bitboard   checkSquares[PIECE_TYPE_NB];
     Piece      capturedPiece;
     int        repetition;
+
+    // Used by NNUE
+    Eval::NNUE::Accumulator accumulator;
+    Eval::NNUE::DirtyPiece  dirtyPiece;
 };
 
 /// start position to the position just before the search starts). Needed by
@@ -141,6 +148,7 @@ public:
   // Accessing hash keys
   Key key() const;
   Key key_after(Move m) const;
+  Key polyglot_key() const;
   Key material_key() const;
   Key pawn_key() const;
 
@@ -162,7 +170,7 @@ public:
 bool pos_is_ok() const;
 void flip();
 
- // StateInfo* state() const;
+  StateInfo* state() const;
 
 void put_piece(Piece pc, Square s);
 void remove_piece(Square s);
@@ -329,6 +337,14 @@ inline Key Position::adjust_key50(Key k) const
       ? k : k ^ make_key((st->rule50 - (14 - AfterMove)) / 8);
 }
 
+inline StateInfo* Position::state() const {
+  return st;
+}
+
+inline Key Position::polyglot_key() const {
+  return st->polyKey;
+}
+
 inline Key Position::pawn_key() const {
   return st->pawnKey;
 }
@@ -19,6 +19,7 @@
 #include <cassert>
 #include <cmath>
 #include <cstring>   // For std::memset
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <random>     // For std::mt19937 and std::uniform_int_distribution
@@ -38,8 +39,9 @@
 #include "thread.h"
 #include "timeman.h"
 #include "tt.h"
-
 #include "uci.h"
+#include "nnue/evaluate_nnue.h"
+#include "syzygy/tbprobe.h"
 #include "personalities/personality.h"
 
 namespace Stockfish {
@@ -50,17 +52,53 @@ namespace Stockfish {
 namespace Search {
 
   LimitsType Limits;
+  std::function<void(const Info&)> OnInfo;
+  std::function<void(Move, Move)> OnBestMove;
+}
+
+namespace Tablebases {
+
+  int Cardinality;
+  bool RootInTB;
+  bool UseRule50;
+  Depth ProbeDepth;
 }
 
+namespace TB = Tablebases;
+
 using std::string;
 using Eval::evaluate;
 using namespace Search;
 
+// With searchstats=yes the search counts the events listed in SearchEvent.
+// Otherwise the macros expand to nothing and the search is unchanged.
+#ifdef USE_SEARCH_STATS
+#define SEARCH_STAT(th, ev) (++(th)->stats.events[ev])
+#define SEARCH_STAT_STAGE(th, mp) (++(th)->stats.stages[(mp).stage_reached()])
+#else
+#define SEARCH_STAT(th, ev) ((void)0)
+#define SEARCH_STAT_STAGE(th, mp) ((void)0)
+#endif
+
 namespace {
 
   // Different node types, used as a template parameter
   enum NodeType { NonPV, PV, Root };
 
+  // A search stops with Threads.stop, or with the thread's own node limit
+  // when it is independent
+  bool stopped(const Thread* th) {
+    return Threads.stop.load(std::memory_order_relaxed) || th->stopAlone;
+  }
+
+  // percent() formats a percentage in its own stream, so that the format
+  // flags never stick to std::cout
+  std::string percent(double value, int precision, int width = 0) {
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(precision) << std::setw(width) << value << "%";
+    return ss.str();
+  }
+
   // Futility margin
   Value futility_margin(Depth d, bool improving) {
     return Value(140 * (d - improving));
@@ -111,7 +149,9 @@ namespace {
     Move best = MOVE_NONE;
   };
 
-  template <NodeType nodeType>
+  // 'expProbing' compiles the experience probing in or out of the node, see
+  // ExperienceProbing. It is the same for the whole tree of a search.
+  template <NodeType nodeType, bool expProbing>
   Value search(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth, bool cutNode);
 
   template <NodeType nodeType>
@@ -125,33 +165,247 @@ namespace {
   void update_all_stats(const Position& pos, Stack* ss, Move bestMove, Value bestValue, Value beta, Square prevSq,
                         Move* quietsSearched, int quietCount, Move* capturesSearched, int captureCount, Depth depth);
 
-// perft() is our utility to verify move generation. All the leaf nodes up
-// to the given depth are generated and counted, and the sum is returned.
-template<bool Root>
-uint64_t perft(Position& pos, Depth depth) {
+  // PvOutput holds the state of the PV output policy of the current search. It
+  // is only used by the main thread. With 'UCI PV Interval' the PV lines are
+  // sent at most that often, and with 'UCI PV Changed Only' a line is sent only
+  // if its depth, score, bound or moves changed since it was last sent.
+  struct PvOutput {
+    TimePoint lastTime;
+    bool pending;                  // An update was held back by the interval
+    std::vector<std::string> sent; // Unchanging part of each line last sent
+    std::string buffer, key;       // Reused to build the output
 
-    StateInfo st;
+    void reset() { lastTime = -1; pending = false; sent.clear(); }
+  } PvOut;
 
-    uint64_t cnt, nodes = 0;
-    const bool leaf = (depth == 2);
+  void send_pv(const Position& pos, Depth depth, bool force);
 
-    for (const auto& m : MoveList<LEGAL>(pos))
+  // Whether search() probes the experience at every node. It is switched off
+  // for a search whose TT has been prefilled from the experience instead.
+  // Thread::search() reads it once and calls the matching instantiation.
+  bool ExperienceProbing;
+
+  // Whether the strength set by 'Elo' comes from a smaller search rather than
+  // from a weakened choice after a full one, see apply_elo_budget().
+  bool EloBudget;
+
+  // apply_elo_budget() caps the nodes and the depth of the search for 'Elo' when
+  // 'Elo Node Budget' is set, so that weak play also costs little CPU. The node
+  // budget doubles every 120 Elo, from 64 nodes at the lowest level, and the
+  // search is not capped at the highest one. Limits set by the GUI that are
+  // lower are kept.
+  void apply_elo_budget(LimitsType& limits) {
+
+    int elo = int(Options["Elo"]);
+
+    EloBudget = Options["Elo Node Budget"] && elo < 3190;
+
+    if (!EloBudget)
+        return;
+
+    int64_t nodes = int64_t(64 * std::exp2((elo - 1320) / 120.0));
+    Depth depth = 1 + (elo - 1320) * 18 / (3190 - 1320);
+
+    limits.nodes = limits.nodes ? std::min(limits.nodes, nodes) : nodes;
+    limits.depth = limits.depth ? std::min(limits.depth, int(depth)) : depth;
+
+    sync_cout << "info string Elo " << elo << " budget: " << limits.nodes
+              << " nodes, depth " << limits.depth << sync_endl;
+  }
+
+  // AnalysisThread takes positions from a list shared with the other analysis
+  // threads and searches each one alone, as a single threaded search, until
+  // the list is exhausted. See Search::analyze().
+  struct AnalysisThread : public Thread {
+
+    AnalysisThread(size_t n) : Thread(n) { independent = true; }
+    void search() override;
+
+    const std::vector<std::string>* fens;
+    std::atomic<size_t>* next;
+    uint64_t totalNodes = 0;
+  };
+
+  // prefill_tt() walks the experience graph from 'pos' for 'plies' plies. The
+  // best move of every position that has experience at least 'minDepth' deep
+  // is saved to the TT, unless the TT already has a deeper entry, as search()
+  // would do when it reaches the position. At most 'budget' positions are
+  // visited. Returns the number of entries saved.
+  int prefill_tt(Position& pos, int plies, Depth minDepth, int& budget) {
+
+    if (budget <= 0)
+        return 0;
+
+    --budget;
+
+    const Experience::ExpMoves expMoves = Experience::probe(pos.key());
+    bool bestSaved = false;
+    int saved = 0;
+
+    // The moves come sorted by quality, so the first one is the best
+    for (const Experience::ExpMove& exp : expMoves)
     {
-        if (Root && depth <= 1)
-            cnt = 1, nodes++;
-        else
+        Move m = exp.move();
+
+        if (   exp.depth() < minDepth
+            || !pos.pseudo_legal(m)
+            || !pos.legal(m))
+            continue;
+
+        if (!bestSaved)
+        {
+            bool ttHit;
+            TTEntry* tte = TT.probe(pos.key(), ttHit);
+
+            if (!ttHit || exp.depth() > tte->depth())
+            {
+                tte->save(pos.key(), exp.value(), true, BOUND_EXACT, exp.depth(), m, VALUE_NONE);
+                ++saved;
+            }
+
+            bestSaved = true;
+        }
+
+        if (plies > 1)
         {
+            StateInfo st;
             pos.do_move(m, st);
-            cnt = leaf ? MoveList<LEGAL>(pos).size() : perft<false>(pos, depth - 1);
-            nodes += cnt;
+            saved += prefill_tt(pos, plies - 1, minDepth, budget);
             pos.undo_move(m);
         }
-        if (Root)
-            sync_cout << UCI::move(m, pos.is_chess960()) << ": " << cnt << sync_endl;
     }
+
+    return saved;
+  }
+
+  // PerftTable caches subtree counts keyed by position key and depth. It is
+  // shared by all threads and written without locks, so each entry stores the
+  // key xor'ed with the data and a torn write simply fails to verify. It is
+  // allocated next to the TT for the length of a "go perft" only, with the size
+  // of the 'Perft Hash' option, 0 to count without it.
+  struct PerftTable {
+
+    struct Entry {
+      uint64_t key, data; // data = nodes << 8 | depth
+    };
+
+    ~PerftTable() { aligned_large_pages_free(table); }
+
+    size_t size() const { return table ? (mask + 1) * sizeof(Entry) : 0; }
+
+    void resize(size_t mbSize) {
+
+      aligned_large_pages_free(table);
+      table = nullptr;
+      mask = 0;
+
+      if (!mbSize)
+          return;
+
+      size_t count = 1;
+      while (count * 2 * sizeof(Entry) <= mbSize * 1024 * 1024)
+          count *= 2;
+
+      table = static_cast<Entry*>(aligned_large_pages_alloc(count * sizeof(Entry)));
+      if (!table)
+      {
+          sync_cout << "info string Failed to allocate the perft hash, running without it" << sync_endl;
+          return;
+      }
+
+      std::memset(table, 0, count * sizeof(Entry));
+      mask = count - 1;
+    }
+
+    bool probe(Key key, Depth depth, uint64_t& nodes) const {
+
+      if (!table)
+          return false;
+
+      const Entry& e = table[key & mask];
+      uint64_t data = e.data;
+
+      if ((e.key ^ data) != key || Depth(data & 0xFF) != depth)
+          return false;
+
+      nodes = data >> 8;
+      return true;
+    }
+
+    void store(Key key, Depth depth, uint64_t nodes) {
+
+      if (!table)
+          return;
+
+      Entry& e = table[key & mask];
+      uint64_t data = (nodes << 8) | uint64_t(depth);
+
+      e.key = key ^ data;
+      e.data = data;
+    }
+
+  private:
+    Entry* table = nullptr;
+    size_t mask = 0;
+  };
+
+  PerftTable PerftHash;
+  std::atomic<size_t> PerftNextMove;
+  std::vector<uint64_t> PerftCounts;
+
+  // perft() is our utility to verify move generation. All the leaf nodes up
+  // to the given depth are counted and the sum is returned. The last ply is
+  // bulk counted from the size of the legal move list, and subtrees of depth
+  // 3 or more are looked up in the perft hash first.
+  uint64_t perft(Position& pos, Depth depth) {
+
+    if (depth == 1)
+        return MoveList<LEGAL>(pos).size();
+
+    uint64_t nodes = 0;
+
+    if (depth >= 3 && PerftHash.probe(pos.key(), depth, nodes))
+        return nodes;
+
+    StateInfo st;
+
+    for (const auto& m : MoveList<LEGAL>(pos))
+    {
+        pos.do_move(m, st);
+        nodes += perft(pos, depth - 1);
+        pos.undo_move(m);
+    }
+
+    if (depth >= 3)
+        PerftHash.store(pos.key(), depth, nodes);
+
     return nodes;
   }
 
+  // perft_root() is run by every thread during "go perft". Root moves are
+  // handed out one at a time, so that threads that finish their subtree early
+  // pick up the remaining ones.
+  void perft_root(Thread* th) {
+
+    StateInfo st;
+    size_t idx;
+
+    while ((idx = PerftNextMove++) < th->rootMoves.size())
+    {
+        Move m = th->rootMoves[idx].pv[0];
+        uint64_t cnt = 1;
+
+        if (Limits.perft > 1)
+        {
+            th->rootPos.do_move(m, st);
+            cnt = perft(th->rootPos, Limits.perft - 1);
+            th->rootPos.undo_move(m);
+        }
+
+        PerftCounts[idx] = cnt;
+    }
+  }
+
 } // namespace
 
 
@@ -164,6 +418,15 @@ void Search::init() {
 }
 
 
+/// Search::perft_hash_size() returns the size of the perft hash, allocated only
+/// while a "go perft" runs.
+
+size_t Search::perft_hash_size() {
+
+  return PerftHash.size();
+}
+
+
 /// Search::clear() resets search state to its initial value
 
 void Search::clear() {
@@ -173,11 +436,243 @@ void Search::clear() {
   Time.availableNodes = 0;
   TT.clear();
   Threads.clear();
+  Tablebases::init(Options["SyzygyPath"]); // Free mapped files
     Experience::save();
     Experience::resume_learning();
 }
 
 
+/// Search::print_stats() prints the search event counters of all threads,
+/// summed, together with the rates that matter for tuning. The counters are
+/// only compiled in with searchstats=yes.
+
+void Search::print_stats() {
+
+#ifdef USE_SEARCH_STATS
+
+  static constexpr const char* StageNames[MovePicker::STAGE_NB] = {
+    "main tt", "capture init", "good capture", "refutation", "quiet init", "quiet", "bad capture",
+    "evasion tt", "evasion init", "evasion",
+    "probcut tt", "probcut init", "probcut",
+    "qsearch tt", "qcapture init", "qcapture", "qcheck init", "qcheck"
+  };
+
+  Stats total = {};
+  for (Thread* th : Threads)
+  {
+      for (int i = 0; i < EV_NB; ++i)
+          total.events[i] += th->stats.events[i];
+      for (int i = 0; i < MovePicker::STAGE_NB; ++i)
+          total.stages[i] += th->stats.stages[i];
+  }
+
+  const uint64_t* e = total.events;
+  auto line = [](const char* name, uint64_t count, uint64_t base) {
+      sync_cout << "info string " << std::left << std::setw(20) << name << std::right
+                << std::setw(14) << count << "  "
+                << percent(base ? 100.0 * count / base : 0.0, 2, 6) << sync_endl;
+  };
+
+  line("nodes",              e[EV_NODE],            e[EV_NODE] + e[EV_QNODE]);
+  line("tt hit",             e[EV_TT_HIT],          e[EV_NODE]);
+  line("tt cut",             e[EV_TT_CUT],          e[EV_NODE]);
+  line("exp probe",          e[EV_EXP_PROBE],       e[EV_NODE]);
+  line("exp hit",            e[EV_EXP_HIT],         e[EV_EXP_PROBE]);
+  line("exp tt override",    e[EV_EXP_TT_OVERRIDE], e[EV_EXP_HIT]);
+  line("exp cut",            e[EV_EXP_CUT],         e[EV_TT_CUT]);
+  line("razor",              e[EV_RAZOR],           e[EV_NODE]);
+  line("futility cut",       e[EV_FUTILITY_CUT],    e[EV_NODE]);
+  line("null move try",      e[EV_NULL_TRY],        e[EV_NODE]);
+  line("null move cut",      e[EV_NULL_CUT],        e[EV_NULL_TRY]);
+  line("probcut",            e[EV_PROBCUT],         e[EV_NODE]);
+  line("futility prune",     e[EV_FUTILITY_PRUNE],  e[EV_NODE]);
+  line("see prune",          e[EV_SEE_PRUNE],       e[EV_NODE]);
+  line("lmr search",         e[EV_LMR],             e[EV_NODE]);
+  line("lmr research",       e[EV_LMR_RESEARCH],    e[EV_LMR]);
+  line("lmr fail high",      e[EV_LMR_FAIL_HIGH],   e[EV_LMR_RESEARCH]);
+  line("qnodes",             e[EV_QNODE],           e[EV_NODE] + e[EV_QNODE]);
+  line("qsearch tt hit",     e[EV_QTT_HIT],         e[EV_QNODE]);
+  line("qsearch tt cut",     e[EV_QTT_CUT],         e[EV_QNODE]);
+  line("qsearch futility",   e[EV_QFUTILITY_PRUNE], e[EV_QNODE]);
+
+  uint64_t loops = 0;
+  for (int i = 0; i < MovePicker::STAGE_NB; ++i)
+      loops += total.stages[i];
+
+  for (int i = 0; i < MovePicker::STAGE_NB; ++i)
+      if (total.stages[i])
+          line((std::string("stage ") + StageNames[i]).c_str(), total.stages[i], loops);
+
+#else
+
+  sync_cout << "info string Search stats are not available, build with searchstats=yes" << sync_endl;
+
+#endif
+}
+
+
+/// Search::clear_stats() resets the search event counters of all threads
+
+void Search::clear_stats() {
+
+#ifdef USE_SEARCH_STATS
+  for (Thread* th : Threads)
+      th->stats = {};
+#endif
+}
+
+
+/// AnalysisThread::search() prints one line per position with the result of
+/// the last completed iteration, in the order the searches finish.
+
+void AnalysisThread::search() {
+
+  for (size_t i; (i = (*next)++) < fens->size(); )
+  {
+      StateInfo st;
+      Position pos;
+
+      pos.set((*fens)[i], Options["UCI_Chess960"], &st, this);
+
+      TimePoint start = now();
+
+      search_alone(pos);
+
+      TimePoint elapsed = now() - start + 1;
+      std::ostringstream ss;
+
+      ss << "analysis " << i + 1 << " depth " << completedDepth;
+
+      if (rootMoves.empty())
+          ss << " score " << (rootPos.checkers() ? "mate 0" : "cp 0") << " bestmove (none)";
+      else
+      {
+          const RootMove& rm = rootMoves[0];
+          Value v = rm.score != -VALUE_INFINITE ? rm.uciScore : rm.previousScore;
+
+          ss << " seldepth " << rm.selDepth
+             << " score "    << UCI::value(v == -VALUE_INFINITE ? VALUE_ZERO : v)
+             << " nodes "    << nodes
+             << " nps "      << nodes * 1000 / elapsed
+             << " time "     << elapsed
+             << " bestmove " << UCI::move(rm.pv[0], rootPos.is_chess960())
+             << " pv";
+
+          for (Move m : rm.pv)
+              ss << " " << UCI::move(m, rootPos.is_chess960());
+      }
+
+      totalNodes += nodes;
+      sync_cout << ss.str() << sync_endl;
+  }
+}
+
+
+/// Thread::search_alone() searches 'pos' with this thread only, as set up by
+/// Search::prepare_independent(). The states before 'pos' are used for the
+/// repetition detection, so they must outlive the search.
+
+void Thread::search_alone(const Position& pos) {
+
+  assert(independent);
+
+  rootPos.set(pos.fen(), pos.is_chess960(), &rootState, this);
+  rootState = *pos.state();
+  rootMoves.clear();
+
+  for (const auto& m : MoveList<LEGAL>(pos))
+      rootMoves.emplace_back(m);
+
+  nodes = tbHits = nmpMinPly = bestMoveChanges = 0;
+  rootDepth = completedDepth = 0;
+  stopAlone = false;
+
+  if (Eval::NNUE::enabled())
+      Eval::NNUE::refresh(rootPos);
+
+  if (!rootMoves.empty())
+      Thread::search();
+}
+
+
+/// Search::prepare_independent() sets the limits of the searches of threads
+/// outside the pool, see Thread::search_alone(). Such a search has no main
+/// thread to stop it, so only Limits.depth and Limits.nodes are used. The depth
+/// is checked between iterations, and the nodes of the thread during the
+/// search. The threads of the pool must be idle.
+
+void Search::prepare_independent(const LimitsType& limits, bool probeExperience) {
+
+  Threads.main()->wait_for_search_finished();
+
+  Limits = limits;
+  Threads.stop = false;
+  Threads.increaseDepth = true;
+
+  // As Tablebases::rank_root_moves() does, but the positions are not ranked
+  // at the root, because RootInTB would be shared by all the searches.
+  TB::RootInTB = false;
+  TB::UseRule50 = bool(Options["Syzygy50MoveRule"]);
+  TB::ProbeDepth = int(Options["SyzygyProbeDepth"]);
+  TB::Cardinality = int(Options["SyzygyProbeLimit"]);
+
+  if (TB::Cardinality > Tablebases::MaxCardinality)
+  {
+      TB::Cardinality = Tablebases::MaxCardinality;
+      TB::ProbeDepth = 0;
+  }
+
+  ExperienceProbing = probeExperience;
+  EloBudget = false;
+  TT.new_search();
+}
+
+
+/// Search::analyze() searches every position of 'fens' to 'depth' with as many
+/// independent single threaded searches running at the same time as 'workers'.
+/// The threads of the pool are idle meanwhile, and the searches share the TT.
+
+void Search::analyze(const std::vector<std::string>& fens, Depth depth, size_t workers) {
+
+  LimitsType limits;
+  limits.depth = depth;
+  limits.startTime = now();
+
+  prepare_independent(limits, Experience::enabled());
+
+  std::atomic<size_t> next(0);
+  std::vector<AnalysisThread*> threads;
+  uint64_t nodes = 0;
+
+  for (size_t i = 0; i < std::max(workers, size_t(1)); ++i)
+  {
+      AnalysisThread* th = new AnalysisThread(i);
+      th->clear();
+      th->fens = &fens;
+      th->next = &next;
+      threads.push_back(th);
+  }
+
+  for (AnalysisThread* th : threads)
+      th->start_searching();
+
+  for (AnalysisThread* th : threads)
+  {
+      th->wait_for_search_finished();
+      nodes += th->totalNodes;
+      delete th;
+  }
+
+  TimePoint elapsed = now() - Limits.startTime + 1;
+
+  sync_cout << "info string analyze positions " << fens.size()
+            << " workers " << threads.size()
+            << " nodes " << nodes
+            << " time " << elapsed
+            << " nps " << nodes * 1000 / elapsed << sync_endl;
+}
+
+
 /// MainThread::search() is started when the program receives the UCI 'go'
 /// command. It searches from the root position and outputs the "bestmove".
 
@@ -185,16 +680,30 @@ void MainThread::search() {
 
   if (Limits.perft)
   {
-      nodes = perft<true>(rootPos, Limits.perft);
-      sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
+      PerftHash.resize(size_t(Options["Perft Hash"]));
+      PerftNextMove = 0;
+      PerftCounts.assign(rootMoves.size(), 0);
+
+      Threads.start_searching(); // start non-main threads
+      perft_root(this);
+      Threads.wait_for_search_finished();
+
+      uint64_t total = 0;
+      for (size_t i = 0; i < rootMoves.size(); ++i)
+      {
+          sync_cout << UCI::move(rootMoves[i].pv[0], rootPos.is_chess960()) << ": " << PerftCounts[i] << sync_endl;
+          total += PerftCounts[i];
+      }
+
+      PerftHash.resize(0);
+      sync_cout << "\nNodes searched: " << total << "\n" << sync_endl;
       return;
   }
 
-  //Make sure experience has finished loading
-  Experience::wait_for_loading_finished();
-
   Color us = rootPos.side_to_move();
+  apply_elo_budget(Limits);
   Time.init(Limits, us, rootPos.game_ply());
+  PvOut.reset();
 
     // Automatic TrainingMode based on Elo and time
     if (!Stockfish::activePersonality.TrainingMode) {
@@ -212,6 +721,7 @@ void MainThread::search() {
   TT.new_search();
 
   Move bookMove = MOVE_NONE;
+  probeTime = 0;
 
   if (rootMoves.empty())
   {
@@ -222,40 +732,43 @@ void MainThread::search() {
   }
   else
   {
+      TimePoint probeStart = now();
+
       if (!Limits.infinite && !Limits.mate)
       {
           //Check polyglot books first
-          if ((bool)Options["PersonalityBook"] && rootPos.game_ply() / 2 < (int)Options["Book Depth"])
-              bookMove = polybook[0].probe(rootPos, (int)Options["Book Width"]);
+          if ((bool)Options["PersonalityBook"])
+              bookMove = polybook[0].probe(rootPos, (int)Options["Book Width"], (int)Options["Book Depth"]);
 
           //Check experience book second
           if (bookMove == MOVE_NONE && (bool)Options["Experience Book"] && rootPos.game_ply() / 2 < (int)Options["Memory Max Moves"] && Experience::enabled())
           {
+              //Experience is probed while it is still loading unless the book should wait for it
+              if ((bool)Options["Experience Book Wait"])
+                  Experience::wait_for_loading_finished();
+
               Depth expBookMinDepth = (Depth)Options["Experience Book Min Depth"];
-              const Experience::ExpEntryEx* exp = Experience::probe(rootPos.key());
+              const Experience::ExpMoves expMoves = Experience::probe(rootPos.key());
 
-              if (exp)
+              if (!expMoves.empty())
               {
                   int evalImportance = (int)Options["Experience Book Eval Importance"];
-                  vector<pair<const Experience::ExpEntryEx*, int>> quality;
-                  const Experience::ExpEntryEx* temp = exp;
-                  while (temp)
+                  vector<pair<const Experience::ExpMove*, int>> quality;
+                  for (const Experience::ExpMove& temp : expMoves)
                   {
-                      if (temp->depth >= expBookMinDepth)
+                      if (temp.depth() >= expBookMinDepth)
                       {
-                          pair<int, bool> q = temp->quality(rootPos, evalImportance);
+                          pair<int, bool> q = temp.quality(rootPos, evalImportance);
                           if (q.first > 0 && !q.second)
-                              quality.emplace_back(temp, q.first);
+                              quality.emplace_back(&temp, q.first);
                       }
-
-                      temp = temp->next;
                   }
 
                   //Sort experience moves based on quality
                   stable_sort(
                       quality.begin(),
                       quality.end(),
-                      [](const pair<const Experience::ExpEntryEx*, int>& a, const pair<const Experience::ExpEntryEx*, int>& b)
+                      [](const pair<const Experience::ExpMove*, int>& a, const pair<const Experience::ExpMove*, int>& b)
                       {
                           return a.second > b.second;
                       });
@@ -266,7 +779,7 @@ void MainThread::search() {
                       stable_sort(
                           quality.begin(),
                           quality.end(),
-                          [](const pair<const Experience::ExpEntryEx*, int>& a, const pair<const Experience::ExpEntryEx*, int>& b)
+                          [](const pair<const Experience::ExpMove*, int>& a, const pair<const Experience::ExpMove*, int>& b)
                           {
                               return a.second > b.second;
                           });
@@ -279,15 +792,15 @@ void MainThread::search() {
 
                           sync_cout
                               << "info"
-                              << " depth "    << it->first->depth
-                              << " seldepth " << it->first->depth
+                              << " depth "    << it->first->depth()
+                              << " seldepth " << it->first->depth()
                               << " multipv 1"
-                              << " score "    << UCI::value(it->first->value)
+                              << " score "    << UCI::value(it->first->value())
                               << " nodes "    << expCount
                               << " nps 0"
                               << " tbhits 0"
                               << " time 0"
-                              << " pv " << UCI::move(it->first->move, rootPos.is_chess960())
+                              << " pv " << UCI::move(it->first->move(), rootPos.is_chess960())
                               << sync_endl;
                       }
 
@@ -297,11 +810,11 @@ void MainThread::search() {
                           static PRNG rng(now());
 
                           //Pick one move of the top 50%
-                          bookMove = quality[rng.rand<uint32_t>() % std::max<uint32_t>(quality.size() / 2, 2)].first->move;
+                          bookMove = quality[rng.rand<uint32_t>() % std::max<uint32_t>(quality.size() / 2, 2)].first->move();
                       }
                       else
                       {
-                          bookMove = quality.front().first->move;
+                          bookMove = quality.front().first->move();
                       }
                   }
               }
@@ -310,11 +823,32 @@ void MainThread::search() {
 
       if (bookMove != MOVE_NONE && std::find(rootMoves.begin(), rootMoves.end(), bookMove) != rootMoves.end())
       {
+          probeTime = now() - probeStart;
+
           for (Thread* th : Threads)
               std::swap(th->rootMoves[0], *std::find(th->rootMoves.begin(), th->rootMoves.end(), bookMove));
       }
       else
       {
+          // With 'Experience Prefill Depth' the experience near the root is saved
+          // to the TT in one batch, and search() does not probe it at every node
+          int prefillDepth = int(Options["Experience Prefill Depth"]);
+          ExperienceProbing = Experience::enabled();
+
+          if (ExperienceProbing && prefillDepth > 0)
+          {
+              Experience::wait_for_loading_finished();
+
+              int budget = 1 << 16;
+              int saved = prefill_tt(rootPos, prefillDepth, Depth(int(Options["Experience Book Min Depth"])), budget);
+              ExperienceProbing = false;
+
+              sync_cout << "info string Experience prefill: " << saved << " TT entries from "
+                        << (1 << 16) - budget << " positions" << sync_endl;
+          }
+
+          probeTime = now() - probeStart;
+
           Threads.start_searching(); // start non-main threads
           Thread::search();          // main thread start searching
       }
@@ -343,7 +877,9 @@ void MainThread::search() {
 
   Thread* bestThread = this;
   
-    // Random generator (only one declaration allowed)
+    // Random generator (only one declaration allowed). Only the main thread gets
+    // here, after all helper threads have stopped, so the personality parameters
+    // and the generator below are never shared with a running search.
     static std::random_device rd;
     static std::mt19937 rng(rd());
 
@@ -377,7 +913,7 @@ void MainThread::search() {
         lastElo = currentElo;  // Update lastElo with the new value
     }
 
-    Skill skill = Skill(Options["Skill Level"], currentElo);  // Use the current Elo value
+    Skill skill = Skill(Options["Skill Level"], EloBudget ? 0 : currentElo);  // Use the current Elo value
 
   if (   int(Options["MultiPV"]) == 1
       && !Limits.depth
@@ -390,6 +926,7 @@ void MainThread::search() {
       && !bestThread->rootPos.is_chess960()
       && !(bool)Options["Experience Readonly"]
 	  && !(bool)Options["UCI_LimitStrength"]
+	  && !EloBudget
 	  &&  bestThread->completedDepth >= EXP_MIN_DEPTH)
   {
       //Add best move
@@ -479,9 +1016,9 @@ if (randomMoveDepth > 0 && bestThread->completedDepth >= randomMoveDepth) {
     }
 }
 
-// Send again PV info if we have a new best thread
-if (bestThread != this)
-    sync_cout << UCI::pv(bestThread->rootPos, bestThread->completedDepth) << sync_endl;
+// Send again PV info if we have a new best thread, or if the last update was held back
+if (bestThread != this || PvOut.pending)
+    send_pv(bestThread->rootPos, bestThread->completedDepth, true);
 
 // Retrieve active personality parameters
 int imperfection     = int(Options["HumanImperfection"]);
@@ -538,6 +1075,15 @@ if (moveDelayMs > 0) {
 }
 
 // Output bestmove and optional ponder
+if (OnBestMove)
+{
+    RootMove& rm = bestThread->rootMoves[0];
+    bool hasPonder = rm.pv.size() > 1 || rm.extract_ponder_from_tt(rootPos);
+
+    OnBestMove(rm.pv[0], hasPonder ? rm.pv[1] : MOVE_NONE);
+    return;
+}
+
 sync_cout << "bestmove " << UCI::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
 
 if (bestThread->rootMoves[0].pv.size() > 1 || bestThread->rootMoves[0].extract_ponder_from_tt(rootPos))
@@ -552,6 +1098,12 @@ std::cout << sync_endl;
 
 void Thread::search() {
 
+  if (Limits.perft)
+  {
+      perft_root(this);
+      return;
+  }
+
   // To allow access to (ss-7) up to (ss+2), the stack must be oversized.
   // The former is needed to allow update_continuation_histories(ss-1, ...),
   // which accesses its argument at ss-6, also near the root.
@@ -591,7 +1143,7 @@ void Thread::search() {
   }
 
   size_t multiPV = size_t(Options["MultiPV"]);
-  Skill skill(Options["Skill Level"], Options["Personality"] ? int(Options["Elo"]) : 0);
+  Skill skill(Options["Skill Level"], Options["Personality"] && !EloBudget ? int(Options["Elo"]) : 0);
 
   // When playing with strength handicap enable MultiPV search that we will
   // use behind-the-scenes to retrieve a set of possible moves.
@@ -601,16 +1153,29 @@ void Thread::search() {
   multiPV = std::min(multiPV, rootMoves.size());
 
   int searchAgainCounter = 0;
+  int failLows = 0, failHighs = 0;
+  bool expProbing = ExperienceProbing;
+  bool iterationTiming = mainThread && Options["Iteration Timing"];
+
+  if (mainThread)
+  {
+      mainThread->iterations.clear();
+      mainThread->lastCheck = mainThread->maxCheckGap = 0;
+      mainThread->checks = 0;
+  }
 
   // Iterative deepening loop until requested to stop or the target depth is reached
   while (   ++rootDepth < MAX_PLY
-         && !Threads.stop
-         && !(Limits.depth && mainThread && rootDepth > Limits.depth))
+         && !stopped(this)
+         && !(Limits.depth && (mainThread || independent) && rootDepth > Limits.depth)
+         && !(Limits.nodes && independent && nodes >= uint64_t(Limits.nodes)))
   {
       // Age out PV variability metric
       if (mainThread)
           totBestMoveChanges /= 2;
 
+      failLows = failHighs = 0;
+
       // Save the last iteration's scores before the first PV line is searched and
       // all the move scores except the (new) PV are set to -VALUE_INFINITE.
       for (RootMove& rm : rootMoves)
@@ -623,7 +1188,7 @@ void Thread::search() {
           searchAgainCounter++;
 
       // MultiPV loop. We perform a full root search for each PV line
-      for (pvIdx = 0; pvIdx < multiPV && !Threads.stop; ++pvIdx)
+      for (pvIdx = 0; pvIdx < multiPV && !stopped(this); ++pvIdx)
       {
           if (pvIdx == pvLast)
           {
@@ -656,7 +1221,8 @@ void Thread::search() {
               // Adjust the effective depth searched, but ensure at least one effective increment for every
               // four searchAgain steps (see issue #2717).
               Depth adjustedDepth = std::max(1, rootDepth - failedHighCnt - 3 * (searchAgainCounter + 1) / 4);
-              bestValue = Stockfish::search<Root>(rootPos, ss, alpha, beta, adjustedDepth, false);
+              bestValue = expProbing ? Stockfish::search<Root, true >(rootPos, ss, alpha, beta, adjustedDepth, false)
+                                     : Stockfish::search<Root, false>(rootPos, ss, alpha, beta, adjustedDepth, false);
 
               // Bring the best move to the front. It is critical that sorting
               // is done with a stable algorithm because all the values but the
@@ -669,7 +1235,7 @@ void Thread::search() {
               // If search has been stopped, we break immediately. Sorting is
               // safe because RootMoves is still valid, although it refers to
               // the previous iteration.
-              if (Threads.stop)
+              if (stopped(this))
                   break;
 
               // When failing high/low give some update (without cluttering
@@ -678,7 +1244,7 @@ void Thread::search() {
                   && multiPV == 1
                   && (bestValue <= alpha || bestValue >= beta)
                   && Time.elapsed() > 3000)
-                  sync_cout << UCI::pv(rootPos, rootDepth) << sync_endl;
+                  send_pv(rootPos, rootDepth, false);
 
               // In case of failing low/high increase aspiration window and
               // re-search, otherwise exit the loop.
@@ -687,6 +1253,7 @@ void Thread::search() {
                   beta = (alpha + beta) / 2;
                   alpha = std::max(bestValue - delta, -VALUE_INFINITE);
 
+                  ++failLows;
                   failedHighCnt = 0;
                   if (mainThread)
                       mainThread->stopOnPonderhit = false;
@@ -695,6 +1262,7 @@ void Thread::search() {
               {
                   beta = std::min(bestValue + delta, VALUE_INFINITE);
                   ++failedHighCnt;
+                  ++failHighs;
               }
               else
                   break;
@@ -709,12 +1277,32 @@ void Thread::search() {
 
           if (    mainThread
               && (Threads.stop || pvIdx + 1 == multiPV || Time.elapsed() > 3000))
-              sync_cout << UCI::pv(rootPos, rootDepth) << sync_endl;
+              send_pv(rootPos, rootDepth, Threads.stop);
       }
 
-      if (!Threads.stop)
+      if (!stopped(this))
           completedDepth = rootDepth;
 
+      if (mainThread && !Threads.stop)
+      {
+          TimePoint elapsed = now() - Limits.startTime;
+          uint64_t nodesSearched = Threads.nodes_searched();
+          const MainThread::Iteration* last = mainThread->iterations.empty() ? nullptr : &mainThread->iterations.back();
+
+          if (iterationTiming)
+              sync_cout << "info string iteration depth " << rootDepth
+                        << " time " << elapsed << " (+" << elapsed - (last ? last->time : 0) << ") ms"
+                        << " nodes " << nodesSearched << " (+" << nodesSearched - (last ? last->nodes : 0) << ")"
+                        << " researches " << failLows + failHighs << " (fail low " << failLows << ", fail high " << failHighs << ")"
+                        << " timechecks " << mainThread->checks << " max gap " << mainThread->maxCheckGap << " ms"
+                        << " best move effort "
+                        << percent(rootMoves[0].effort * 100.0 / std::max(uint64_t(1), uint64_t(nodes)), 1) << sync_endl;
+
+          mainThread->iterations.push_back({ rootDepth, elapsed, nodesSearched, failLows + failHighs });
+          mainThread->checks = 0;
+          mainThread->maxCheckGap = 0;
+      }
+
       if (rootMoves[0].pv[0] != lastBestMove)
       {
           lastBestMove = rootMoves[0].pv[0];
@@ -762,8 +1350,23 @@ void Thread::search() {
           if (rootMoves.size() == 1)
               totalTime = std::min(500.0, totalTime);
 
+          // Stop the search when nearly all the effort went to the best move and
+          // most of the time is used anyway, the next iteration would not change it
+          double nodesEffort = rootMoves[0].effort * 100.0 / std::max(uint64_t(1), uint64_t(nodes));
+          if (   completedDepth >= 10
+              && nodesEffort >= 97
+              && Time.elapsed() > totalTime * 0.739
+              && !mainThread->ponder)
+          {
+              if (iterationTiming)
+                  sync_cout << "info string iteration stop early, best move effort "
+                            << percent(nodesEffort, 1) << sync_endl;
+
+              Threads.stop = true;
+          }
+
           // Stop the search if we have exceeded the totalTime
-          if (Time.elapsed() > totalTime)
+          else if (Time.elapsed() > totalTime)
           {
               // If we are allowed to ponder do not stop the search now but
               // keep pondering until the GUI sends "ponderhit" or "stop".
@@ -798,7 +1401,7 @@ namespace {
 
   // search<>() is the main search function for both PV and non-PV nodes
 
-  template <NodeType nodeType>
+  template <NodeType nodeType, bool expProbing>
   Value search(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth, bool cutNode) {
 
     constexpr bool PvNode = nodeType != NonPV;
@@ -851,6 +1454,12 @@ int moveCount, captureCount, quietCount, improvement;
     if (thisThread == Threads.main())
         static_cast<MainThread*>(thisThread)->check_time();
 
+    // An independent search has no main thread to stop it, it checks its own node limit
+    else if (   thisThread->independent
+             && Limits.nodes
+             && thisThread->nodes.load(std::memory_order_relaxed) >= uint64_t(Limits.nodes))
+        thisThread->stopAlone = true;
+
     // Used to send selDepth info to GUI (selDepth counts from 1, ply from 0)
     if (PvNode && thisThread->selDepth < ss->ply + 1)
         thisThread->selDepth = ss->ply + 1;
@@ -858,7 +1467,7 @@ int moveCount, captureCount, quietCount, improvement;
     if (!rootNode)
     {
         // Step 2. Check for aborted search and immediate draw
-        if (   Threads.stop.load(std::memory_order_relaxed)
+        if (   stopped(thisThread)
             || pos.is_draw(ss->ply)
             || ss->ply >= MAX_PLY)
             return (ss->ply >= MAX_PLY && !ss->inCheck) ? evaluate(pos)
@@ -892,6 +1501,9 @@ int moveCount, captureCount, quietCount, improvement;
     posKey = pos.key();
     tte = TT.probe(posKey, ss->ttHit);
     ttValue = ss->ttHit ? value_from_tt(tte->value(), ss->ply, pos.rule50_count()) : VALUE_NONE;
+    SEARCH_STAT(thisThread, EV_NODE);
+    if (ss->ttHit)
+        SEARCH_STAT(thisThread, EV_TT_HIT);
     ttMove =  rootNode ? thisThread->rootMoves[thisThread->pvIdx].pv[0]
             : ss->ttHit    ? tte->move() : MOVE_NONE;
     ttCapture = ttMove && pos.capture_stage(ttMove);
@@ -902,23 +1514,30 @@ int moveCount, captureCount, quietCount, improvement;
         ss->ttPv = PvNode || (ss->ttHit && tte->is_pv());
 
     //Probe experience data
-    const Experience::ExpEntryEx *expEx = excludedMove == MOVE_NONE && Experience::enabled() ? Experience::probe(pos.key()) : nullptr;
-    const Experience::ExpEntryEx* tempExp = expEx;
-    const Experience::ExpEntryEx* bestExp = nullptr;
+    const Experience::ExpMoves expMoves = expProbing && excludedMove == MOVE_NONE ? Experience::probe(pos.key()) : Experience::ExpMoves();
+    const Experience::ExpMove* bestExp = nullptr;
+
+    if (expProbing && excludedMove == MOVE_NONE)
+    {
+        SEARCH_STAT(thisThread, EV_EXP_PROBE);
+        if (!expMoves.empty())
+            SEARCH_STAT(thisThread, EV_EXP_HIT);
+    }
 
     //Update update quiet stats, continuation histories, and main history from experience data
-    while (tempExp)
+    for (const Experience::ExpMove& tempExp : expMoves)
     {
-        if (tempExp->depth >= depth)
+        if (tempExp.depth() >= depth)
         {
             //Got better experience entry than TT entry?
-            if (!bestExp && (!ss->ttHit || tempExp->depth > tte->depth()))
+            if (!bestExp && (!ss->ttHit || tempExp.depth() > tte->depth()))
             {
-                bestExp = tempExp;
+                bestExp = &tempExp;
+                SEARCH_STAT(thisThread, EV_EXP_TT_OVERRIDE);
 
                 ss->ttHit = true;
-                ttMove = bestExp->move;
-                ttValue = value_from_tt(bestExp->value, ss->ply, pos.rule50_count());
+                ttMove = bestExp->move();
+                ttValue = value_from_tt(bestExp->value(), ss->ply, pos.rule50_count());
                 ss->ttPv = true;
 
                 //Save to TT using 'posKey'
@@ -926,7 +1545,7 @@ int moveCount, captureCount, quietCount, improvement;
                     ttValue,
                     ss->ttPv,
                     ttValue >= beta ? BOUND_LOWER : BOUND_EXACT,
-                    bestExp->depth,
+                    bestExp->depth(),
                     ttMove,
                     VALUE_NONE);
 
@@ -937,27 +1556,25 @@ int moveCount, captureCount, quietCount, improvement;
 
             if (!PvNode)
             {
-                Value expValue = value_from_tt(tempExp->value, ss->ply, pos.rule50_count());
+                Value expValue = value_from_tt(tempExp.value(), ss->ply, pos.rule50_count());
                 if (expValue >= beta)
                 {
-                    if (!pos.capture(tempExp->move))
-                        update_quiet_stats(pos, ss, tempExp->move, stat_bonus(tempExp->depth));
+                    if (!pos.capture(tempExp.move()))
+                        update_quiet_stats(pos, ss, tempExp.move(), stat_bonus(tempExp.depth()));
 
                     // Extra penalty for early quiet moves of the previous ply
                     if (prevSq != SQ_NONE && (ss-1)->moveCount <= 2 && !priorCapture)
-                        update_continuation_histories(ss-1, pos.piece_on(prevSq), prevSq, -stat_bonus(tempExp->depth + 1));
+                        update_continuation_histories(ss-1, pos.piece_on(prevSq), prevSq, -stat_bonus(tempExp.depth() + 1));
                 }
-                // Penalty for a quiet tempExp->move() that fails low
-                else if (!pos.capture(tempExp->move))
+                // Penalty for a quiet tempExp.move() that fails low
+                else if (!pos.capture(tempExp.move()))
                 {
-                    int penalty = -stat_bonus(tempExp->depth);
-                    thisThread->mainHistory[us][from_to(tempExp->move)] << penalty;
-                    update_continuation_histories(ss, pos.moved_piece(tempExp->move), to_sq(tempExp->move), penalty);
+                    int penalty = -stat_bonus(tempExp.depth());
+                    thisThread->mainHistory[us][from_to(tempExp.move())] << penalty;
+                    update_continuation_histories(ss, pos.moved_piece(tempExp.move()), to_sq(tempExp.move()), penalty);
                 }
             }
         }
-
-        tempExp = tempExp->next;
     }
 
     // At non-PV nodes we check for an early TT cutoff
@@ -992,7 +1609,65 @@ int moveCount, captureCount, quietCount, improvement;
         // Partial workaround for the graph history interaction problem
         // For high rule50 counts don't produce transposition table cutoffs.
         if (pos.rule50_count() < 90)
+        {
+            SEARCH_STAT(thisThread, EV_TT_CUT);
+            if (bestExp)
+                SEARCH_STAT(thisThread, EV_EXP_CUT);
+
             return ttValue;
+        }
+    }
+
+    // Step 5. Tablebases probe
+    if (!rootNode && TB::Cardinality)
+    {
+        int piecesCount = pos.count<ALL_PIECES>();
+
+        if (    piecesCount <= TB::Cardinality
+            && (piecesCount <  TB::Cardinality || depth >= TB::ProbeDepth)
+            &&  pos.rule50_count() == 0
+            && !pos.can_castle(ANY_CASTLING))
+        {
+            TB::ProbeState err;
+            TB::WDLScore wdl = Tablebases::probe_wdl(pos, &err);
+
+            // Force check of time on the next occasion
+            if (thisThread == Threads.main())
+                static_cast<MainThread*>(thisThread)->callsCnt = 0;
+
+            if (err != TB::ProbeState::FAIL)
+            {
+                thisThread->tbHits.fetch_add(1, std::memory_order_relaxed);
+
+                int drawScore = TB::UseRule50 ? 1 : 0;
+
+                // use the range VALUE_MATE_IN_MAX_PLY to VALUE_TB_WIN_IN_MAX_PLY to score
+                value =  wdl < -drawScore ? VALUE_MATED_IN_MAX_PLY + ss->ply + 1
+                       : wdl >  drawScore ? VALUE_MATE_IN_MAX_PLY - ss->ply - 1
+                                          : VALUE_DRAW + 2 * wdl * drawScore;
+
+                Bound b =  wdl < -drawScore ? BOUND_UPPER
+                         : wdl >  drawScore ? BOUND_LOWER : BOUND_EXACT;
+
+                if (    b == BOUND_EXACT
+                    || (b == BOUND_LOWER ? value >= beta : value <= alpha))
+                {
+                    tte->save(posKey, value_to_tt(value, ss->ply), ss->ttPv, b,
+                              std::min(MAX_PLY - 1, depth + 6),
+                              MOVE_NONE, VALUE_NONE);
+
+                    return value;
+                }
+
+                if (PvNode)
+                {
+                    if (b == BOUND_LOWER)
+                        bestValue = value, alpha = std::max(alpha, bestValue);
+                    else
+                        maxValue = value;
+                }
+            }
+        }
     }
 
     CapturePieceToHistory& captureHistory = thisThread->captureHistory;
@@ -1052,7 +1727,10 @@ int moveCount, captureCount, quietCount, improvement;
     {
         value = qsearch<NonPV>(pos, ss, alpha - 1, alpha);
         if (value < alpha)
+        {
+            SEARCH_STAT(thisThread, EV_RAZOR);
             return value;
+        }
     }
 
     // Step 8. Futility pruning: child node (~40 Elo).
@@ -1062,7 +1740,10 @@ int moveCount, captureCount, quietCount, improvement;
         &&  eval - futility_margin(depth, improving) - (ss-1)->statScore / 306 >= beta
         &&  eval >= beta
         &&  eval < 24923) // larger than VALUE_KNOWN_WIN, but smaller than TB wins
+    {
+        SEARCH_STAT(thisThread, EV_FUTILITY_CUT);
         return eval;
+    }
 
     // Step 9. Null move search with verification search (~35 Elo)
     if (   !PvNode
@@ -1078,6 +1759,8 @@ int moveCount, captureCount, quietCount, improvement;
     {
         assert(eval - beta >= 0);
 
+        SEARCH_STAT(thisThread, EV_NULL_TRY);
+
         // Null move dynamic reduction based on depth and eval
         Depth R = std::min(int(eval - beta) / 173, 6) + depth / 3 + 4;
 
@@ -1086,7 +1769,7 @@ int moveCount, captureCount, quietCount, improvement;
 
         pos.do_null_move(st);
 
-        Value nullValue = -search<NonPV>(pos, ss+1, -beta, -beta+1, depth-R, !cutNode);
+        Value nullValue = -search<NonPV, expProbing>(pos, ss+1, -beta, -beta+1, depth-R, !cutNode);
 
         pos.undo_null_move();
 
@@ -1096,7 +1779,10 @@ int moveCount, captureCount, quietCount, improvement;
             nullValue = std::min(nullValue, VALUE_TB_WIN_IN_MAX_PLY-1);
 
             if (thisThread->nmpMinPly || depth < 14)
+            {
+                SEARCH_STAT(thisThread, EV_NULL_CUT);
                 return nullValue;
+            }
 
             assert(!thisThread->nmpMinPly); // Recursive verification is not allowed
 
@@ -1104,12 +1790,15 @@ int moveCount, captureCount, quietCount, improvement;
             // until ply exceeds nmpMinPly.
             thisThread->nmpMinPly = ss->ply + 3 * (depth-R) / 4;
 
-            Value v = search<NonPV>(pos, ss, beta-1, beta, depth-R, false);
+            Value v = search<NonPV, expProbing>(pos, ss, beta-1, beta, depth-R, false);
 
             thisThread->nmpMinPly = 0;
 
             if (v >= beta)
+            {
+                SEARCH_STAT(thisThread, EV_NULL_CUT);
                 return nullValue;
+            }
         }
     }
 
@@ -1149,8 +1838,9 @@ int moveCount, captureCount, quietCount, improvement;
         MovePicker mp(pos, ttMove, probCutBeta - ss->staticEval, &captureHistory);
 
         while ((move = mp.next_move()) != MOVE_NONE)
-            if (move != excludedMove && pos.legal(move))
+            if (move != excludedMove)
             {
+                assert(pos.legal(move));
                 assert(pos.capture_stage(move));
 
                 ss->currentMove = move;
@@ -1166,7 +1856,7 @@ int moveCount, captureCount, quietCount, improvement;
 
                 // If the qsearch held, perform the regular search
                 if (value >= probCutBeta)
-                    value = -search<NonPV>(pos, ss+1, -probCutBeta, -probCutBeta+1, depth - 4, !cutNode);
+                    value = -search<NonPV, expProbing>(pos, ss+1, -probCutBeta, -probCutBeta+1, depth - 4, !cutNode);
 
                 pos.undo_move(move);
 
@@ -1174,6 +1864,7 @@ int moveCount, captureCount, quietCount, improvement;
                 {
                     // Save ProbCut data into transposition table
                     tte->save(posKey, value_to_tt(value, ss->ply), ss->ttPv, BOUND_LOWER, depth - 3, move, ss->staticEval);
+                    SEARCH_STAT(thisThread, EV_PROBCUT);
                     return value;
                 }
             }
@@ -1215,7 +1906,7 @@ moves_loop: // When in check, search starts here
                          && (tte->bound() & BOUND_UPPER)
                          && tte->depth() >= depth;
 
-    // Step 13. Loop through all pseudo-legal moves until no moves remain
+    // Step 13. Loop through all legal moves until no moves remain
     // or a beta cutoff occurs.
     while ((move = mp.next_move(moveCountPruning)) != MOVE_NONE)
     {
@@ -1232,9 +1923,8 @@ moves_loop: // When in check, search starts here
                                   thisThread->rootMoves.begin() + thisThread->pvLast, move))
           continue;
 
-      // Check for legality
-      if (!rootNode && !pos.legal(move))
-          continue;
+      // MovePicker only returns legal moves
+      assert(pos.legal(move));
 
       ss->moveCount = ++moveCount;
 
@@ -1277,14 +1967,20 @@ moves_loop: // When in check, search starts here
                   && !ss->inCheck
                   && ss->staticEval + 197 + 248 * lmrDepth + PieceValue[EG][pos.piece_on(to_sq(move))]
                    + captureHistory[movedPiece][to_sq(move)][type_of(pos.piece_on(to_sq(move)))] / 7 < alpha)
+              {
+                  SEARCH_STAT(thisThread, EV_FUTILITY_PRUNE);
                   continue;
+              }
 
               Bitboard occupied;
               // SEE based pruning (~11 Elo)
-              if (!pos.see_ge(move, occupied, Value(-205) * depth))
+              if (!mp.see_ge(move, occupied, Value(-205) * depth))
               {
                  if (depth < 2 - capture)
+                 {
+                    SEARCH_STAT(thisThread, EV_SEE_PRUNE);
                     continue;
+                 }
                  // Don't prune the move if opponent Queen/Rook is under discovered attack after the exchanges
                  // Don't prune the move if opponent King is under discovered attack after or during the exchanges
                  Bitboard leftEnemies = (pos.pieces(~us, KING, QUEEN, ROOK)) & occupied;
@@ -1299,7 +1995,10 @@ moves_loop: // When in check, search starts here
                          attacks = 0;
                  }
                  if (!attacks)
+                 {
+                    SEARCH_STAT(thisThread, EV_SEE_PRUNE);
                     continue;
+                 }
               }
           }
           else
@@ -1322,13 +2021,19 @@ moves_loop: // When in check, search starts here
               if (   !ss->inCheck
                   && lmrDepth < 12
                   && ss->staticEval + 112 + 138 * lmrDepth <= alpha)
+              {
+                  SEARCH_STAT(thisThread, EV_FUTILITY_PRUNE);
                   continue;
+              }
 
               lmrDepth = std::max(lmrDepth, 0);
 
               // Prune moves with negative SEE (~4 Elo)
               if (!pos.see_ge(move, Value(-27 * lmrDepth * lmrDepth - 16 * lmrDepth)))
+              {
+                  SEARCH_STAT(thisThread, EV_SEE_PRUNE);
                   continue;
+              }
           }
       }
 
@@ -1357,7 +2062,7 @@ moves_loop: // When in check, search starts here
               Depth singularDepth = (depth - 1) / 2;
 
               ss->excludedMove = move;
-              value = search<NonPV>(pos, ss, singularBeta - 1, singularBeta, singularDepth, cutNode);
+              value = search<NonPV, expProbing>(pos, ss, singularBeta - 1, singularBeta, singularDepth, cutNode);
               ss->excludedMove = MOVE_NONE;
 
               if (value < singularBeta)
@@ -1417,8 +2122,12 @@ moves_loop: // When in check, search starts here
       newDepth += extension;
       ss->doubleExtensions = (ss-1)->doubleExtensions + (extension == 2);
 
-      // Speculative prefetch as early as possible
-      prefetch(TT.first_entry(pos.key_after(move)));
+      // Speculative prefetch as early as possible, the experience of the child is
+      // probed with the same key
+      Key keyAfter = pos.key_after(move);
+      prefetch(TT.first_entry(keyAfter));
+      if (expProbing)
+          Experience::prefetch(keyAfter);
 
       // Update the current move (this must be done after singular extension search)
       ss->currentMove = move;
@@ -1428,6 +2137,7 @@ moves_loop: // When in check, search starts here
                                                                 [to_sq(move)];
 
       // Step 16. Make the move
+      uint64_t nodeCount = rootNode ? uint64_t(thisThread->nodes) : 0;
       pos.do_move(move, st, givesCheck);
 
       // Decrease reduction if position is or has been on the PV
@@ -1488,11 +2198,14 @@ moves_loop: // When in check, search starts here
           // beyond the first move depth. This may lead to hidden double extensions.
           Depth d = std::clamp(newDepth - r, 1, newDepth + 1);
 
-          value = -search<NonPV>(pos, ss+1, -(alpha+1), -alpha, d, true);
+          value = -search<NonPV, expProbing>(pos, ss+1, -(alpha+1), -alpha, d, true);
+          SEARCH_STAT(thisThread, EV_LMR);
 
           // Do a full-depth search when reduced LMR search fails high
           if (value > alpha && d < newDepth)
           {
+              SEARCH_STAT(thisThread, EV_LMR_RESEARCH);
+
               // Adjust full-depth search based on LMR results - if the result
               // was good enough search deeper, if it was bad enough search shallower
               const bool doDeeperSearch = value > (bestValue + 64 + 11 * (newDepth - d));
@@ -1504,7 +2217,10 @@ moves_loop: // When in check, search starts here
               newDepth += doDeeperSearch - doShallowerSearch + doEvenDeeperSearch;
 
               if (newDepth > d)
-                  value = -search<NonPV>(pos, ss+1, -(alpha+1), -alpha, newDepth, !cutNode);
+                  value = -search<NonPV, expProbing>(pos, ss+1, -(alpha+1), -alpha, newDepth, !cutNode);
+
+              if (value > alpha)
+                  SEARCH_STAT(thisThread, EV_LMR_FAIL_HIGH);
 
               int bonus = value <= alpha ? -stat_bonus(newDepth)
                         : value >= beta  ?  stat_bonus(newDepth)
@@ -1521,7 +2237,7 @@ moves_loop: // When in check, search starts here
           if (!ttMove && cutNode)
               r += 2;
 
-          value = -search<NonPV>(pos, ss+1, -(alpha+1), -alpha, newDepth - (r > 3), !cutNode);
+          value = -search<NonPV, expProbing>(pos, ss+1, -(alpha+1), -alpha, newDepth - (r > 3), !cutNode);
       }
 
       // For PV nodes only, do a full PV search on the first move or after a fail
@@ -1532,7 +2248,7 @@ moves_loop: // When in check, search starts here
           (ss+1)->pv = pv;
           (ss+1)->pv[0] = MOVE_NONE;
 
-          value = -search<PV>(pos, ss+1, -beta, -alpha, newDepth, false);
+          value = -search<PV, expProbing>(pos, ss+1, -beta, -alpha, newDepth, false);
       }
 
       // Step 19. Undo move
@@ -1544,7 +2260,7 @@ moves_loop: // When in check, search starts here
       // Finished searching the move. If a stop occurred, the return value of
       // the search cannot be trusted, and we return immediately without
       // updating best move, PV and TT.
-      if (Threads.stop.load(std::memory_order_relaxed))
+      if (stopped(thisThread))
           return VALUE_ZERO;
 
       if (rootNode)
@@ -1552,6 +2268,8 @@ moves_loop: // When in check, search starts here
           RootMove& rm = *std::find(thisThread->rootMoves.begin(),
                                     thisThread->rootMoves.end(), move);
 
+          rm.effort += thisThread->nodes - nodeCount;
+
           rm.averageScore = rm.averageScore != -VALUE_INFINITE ? (2 * value + rm.averageScore) / 3 : value;
 
           // PV move or new best move?
@@ -1637,6 +2355,8 @@ moves_loop: // When in check, search starts here
       }
     }
 
+    SEARCH_STAT_STAGE(thisThread, mp);
+
     // The following condition would detect a stop only after move loop has been
     // completed. But in this case, bestValue is valid because we have fully
     // searched our subtree, and we can anyhow save the result in TT.
@@ -1745,13 +2465,19 @@ Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth) {
     ttValue = ss->ttHit ? value_from_tt(tte->value(), ss->ply, pos.rule50_count()) : VALUE_NONE;
     ttMove = ss->ttHit ? tte->move() : MOVE_NONE;
     pvHit = ss->ttHit && tte->is_pv();
+    SEARCH_STAT(thisThread, EV_QNODE);
+    if (ss->ttHit)
+        SEARCH_STAT(thisThread, EV_QTT_HIT);
 
     // At non-PV nodes we check for an early TT cutoff
     if (  !PvNode
         && tte->depth() >= ttDepth
         && ttValue != VALUE_NONE // Only in case of TT access race or if !ttHit
         && (tte->bound() & (ttValue >= beta ? BOUND_LOWER : BOUND_UPPER)))
+    {
+        SEARCH_STAT(thisThread, EV_QTT_CUT);
         return ttValue;
+    }
 
     // Step 4. Static evaluation of the position
     if (ss->inCheck)
@@ -1807,15 +2533,12 @@ Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth) {
 
     int quietCheckEvasions = 0;
 
-    // Step 5. Loop through all pseudo-legal moves until no moves remain
+    // Step 5. Loop through all legal moves until no moves remain
     // or a beta cutoff occurs.
     while ((move = mp.next_move()) != MOVE_NONE)
     {
         assert(is_ok(move));
-
-        // Check for legality
-        if (!pos.legal(move))
-            continue;
+        assert(pos.legal(move));
 
         givesCheck = pos.gives_check(move);
         capture = pos.capture_stage(move);
@@ -1839,12 +2562,14 @@ Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth) {
                 if (futilityValue <= alpha)
                 {
                     bestValue = std::max(bestValue, futilityValue);
+                    SEARCH_STAT(thisThread, EV_QFUTILITY_PRUNE);
                     continue;
                 }
 
-                if (futilityBase <= alpha && !pos.see_ge(move, VALUE_ZERO + 1))
+                if (futilityBase <= alpha && !mp.see_ge(move, VALUE_ZERO + 1))
                 {
                     bestValue = std::max(bestValue, futilityBase);
+                    SEARCH_STAT(thisThread, EV_QFUTILITY_PRUNE);
                     continue;
                 }
             }
@@ -1862,7 +2587,7 @@ Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth) {
                 continue;
 
             // Do not search moves with bad enough SEE values (~5 Elo)
-            if (!pos.see_ge(move, Value(-95)))
+            if (!mp.see_ge(move, Value(-95)))
                 continue;
         }
 
@@ -1905,6 +2630,8 @@ Value qsearch(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth) {
         }
     }
 
+    SEARCH_STAT_STAGE(thisThread, mp);
+
     // Step 9. Check for mate
     // All legal moves have been searched. A special case: if we're in check
     // and no legal moves were found, it is checkmate.
@@ -2124,6 +2851,11 @@ void MainThread::check_time() {
   TimePoint elapsed = Time.elapsed();
   TimePoint tick = Limits.startTime + elapsed;
 
+  TimePoint sinceStart = now() - Limits.startTime;
+  maxCheckGap = std::max(maxCheckGap, sinceStart - lastCheck);
+  lastCheck = sinceStart;
+  ++checks;
+
   if (tick - lastInfoTime >= 1000)
   {
       lastInfoTime = tick;
@@ -2141,17 +2873,105 @@ void MainThread::check_time() {
 }
 
 
+namespace {
+
+  // report_pv() is the counterpart of UCI::pv() for the embedding API. It hands
+  // every PV line to Search::OnInfo instead of formatting it.
+  void report_pv(const Position& pos, Depth depth) {
+
+    TimePoint elapsed = Time.elapsed() + 1;
+    const RootMoves& rootMoves = pos.this_thread()->rootMoves;
+    size_t pvIdx = pos.this_thread()->pvIdx;
+    size_t multiPV = std::min((size_t)Options["MultiPV"], rootMoves.size());
+    Info info;
+
+    info.nodes = Threads.nodes_searched();
+    info.nps = info.nodes * 1000 / elapsed;
+    info.tbHits = Threads.tb_hits() + (TB::RootInTB ? rootMoves.size() : 0);
+    info.hashfull = TT.hashfull();
+    info.time = elapsed;
+
+    for (size_t i = 0; i < multiPV; ++i)
+    {
+        bool updated = rootMoves[i].score != -VALUE_INFINITE;
+
+        if (depth == 1 && !updated && i > 0)
+            continue;
+
+        Value v = updated ? rootMoves[i].uciScore : rootMoves[i].previousScore;
+
+        if (v == -VALUE_INFINITE)
+            v = VALUE_ZERO;
+
+        bool tb = TB::RootInTB && abs(v) < VALUE_MATE_IN_MAX_PLY;
+
+        info.depth = updated ? depth : std::max(1, depth - 1);
+        info.selDepth = rootMoves[i].selDepth;
+        info.multiPV = int(i + 1);
+        info.score = tb ? rootMoves[i].tbScore : v;
+        info.bound =  tb || i != pvIdx || !updated ? BOUND_EXACT
+                    : rootMoves[i].scoreLowerbound ? BOUND_LOWER
+                    : rootMoves[i].scoreUpperbound ? BOUND_UPPER : BOUND_EXACT;
+        info.pv = rootMoves[i].pv;
+
+        OnInfo(info);
+    }
+  }
+
+  // send_pv() sends the PV lines to the GUI, unless they were sent less than
+  // 'UCI PV Interval' milliseconds ago. Forced updates, at the end of a search,
+  // are always sent.
+  void send_pv(const Position& pos, Depth depth, bool force) {
+
+    TimePoint elapsed = Time.elapsed();
+    TimePoint interval = int(Options["UCI PV Interval"]);
+
+    if (!force && PvOut.lastTime >= 0 && elapsed - PvOut.lastTime < interval)
+    {
+        PvOut.pending = true;
+        return;
+    }
+
+    if (OnInfo)
+        report_pv(pos, depth);
+    else
+    {
+        const std::string& lines = UCI::pv(pos, depth);
+
+        if (!lines.empty())
+            sync_cout << lines << sync_endl;
+    }
+
+    PvOut.lastTime = elapsed;
+    PvOut.pending = false;
+  }
+
+} // namespace
+
+
 /// UCI::pv() formats PV information according to the UCI protocol. UCI requires
 /// that all (if any) unsearched PV lines are sent using a previous search score.
+/// The lines are built into a buffer that is reused by the next call. With
+/// 'UCI PV Changed Only' the lines that are the same as last time are skipped.
 
-string UCI::pv(const Position& pos, Depth depth) {
+const std::string& UCI::pv(const Position& pos, Depth depth) {
 
-  std::stringstream ss;
+  std::string& out = PvOut.buffer;
+  std::string& key = PvOut.key;
   TimePoint elapsed = Time.elapsed() + 1;
   const RootMoves& rootMoves = pos.this_thread()->rootMoves;
   size_t pvIdx = pos.this_thread()->pvIdx;
   size_t multiPV = std::min((size_t)Options["MultiPV"], rootMoves.size());
   uint64_t nodesSearched = Threads.nodes_searched();
+  uint64_t tbHits = Threads.tb_hits() + (TB::RootInTB ? rootMoves.size() : 0);
+  bool showWDL = Options["UCI_ShowWDL"];
+  bool changedOnly = Options["UCI PV Changed Only"];
+  std::string counters;
+
+  out.clear();
+
+  if (PvOut.sent.size() < multiPV)
+      PvOut.sent.resize(multiPV);
 
   for (size_t i = 0; i < multiPV; ++i)
   {
@@ -2166,32 +2986,60 @@ string UCI::pv(const Position& pos, Depth depth) {
       if (v == -VALUE_INFINITE)
           v = VALUE_ZERO;
 
-      if (ss.rdbuf()->in_avail()) // Not at first line
-          ss << "\n";
+      bool tb = TB::RootInTB && abs(v) < VALUE_MATE_IN_MAX_PLY;
+      v = tb ? rootMoves[i].tbScore : v;
 
-      ss << "info"
-         << " depth "    << d
-         << " seldepth " << rootMoves[i].selDepth
-         << " multipv "  << i + 1
-         << " score "    << UCI::value(v);
+      // The line without the search counters, to tell whether it changed
+      key.clear();
+      key += " depth ";
+      key += std::to_string(d);
+      key += " seldepth ";
+      key += std::to_string(rootMoves[i].selDepth);
+      key += " multipv ";
+      key += std::to_string(i + 1);
+      key += " score ";
+      key += UCI::value(v);
 
-      if (Options["UCI_ShowWDL"])
-          ss << UCI::wdl(v, pos.game_ply());
+      if (showWDL)
+          key += UCI::wdl(v, pos.game_ply());
 
-      if (i == pvIdx && updated)
-         ss << (rootMoves[i].scoreLowerbound ? " lowerbound" : (rootMoves[i].scoreUpperbound ? " upperbound" : ""));
+      if (!tb && i == pvIdx && updated)
+          key += rootMoves[i].scoreLowerbound ? " lowerbound" : (rootMoves[i].scoreUpperbound ? " upperbound" : "");
 
-      ss << " nodes "    << nodesSearched
-         << " nps "      << nodesSearched * 1000 / elapsed
-         << " hashfull " << TT.hashfull()
-         << " time "     << elapsed
-         << " pv";
+      key += '|';
 
       for (Move m : rootMoves[i].pv)
-          ss << " " << UCI::move(m, pos.is_chess960());
+      {
+          key += ' ';
+          key += UCI::move(m, pos.is_chess960());
+      }
+
+      if (changedOnly && key == PvOut.sent[i])
+          continue;
+
+      PvOut.sent[i] = key;
+
+      // The counters are the same for all the lines
+      if (counters.empty())
+          counters =  " nodes "    + std::to_string(nodesSearched)
+                    + " nps "      + std::to_string(nodesSearched * 1000 / elapsed)
+                    + " hashfull " + std::to_string(TT.hashfull())
+                    + " tbhits "   + std::to_string(tbHits)
+                    + " time "     + std::to_string(elapsed)
+                    + " pv";
+
+      size_t split = key.find('|');
+
+      if (!out.empty()) // Not at first line
+          out += '\n';
+
+      out += "info";
+      out.append(key, 0, split);
+      out += counters;
+      out.append(key, split + 1, std::string::npos);
   }
 
-  return ss.str();
+  return out;
 }
 
 
@@ -2225,4 +3073,56 @@ bool RootMove::extract_ponder_from_tt(Position& pos) {
     return pv.size() > 1;
 }
 
+
+/// Tablebases::rank_root_moves() ranks the root moves with the DTZ tables, or
+/// with the WDL tables as a fallback, and sets the probing parameters used by
+/// the search from the Syzygy UCI options.
+
+void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
+
+    RootInTB = false;
+    UseRule50 = bool(Options["Syzygy50MoveRule"]);
+    ProbeDepth = int(Options["SyzygyProbeDepth"]);
+    Cardinality = int(Options["SyzygyProbeLimit"]);
+    bool dtz_available = true;
+
+    // Tables with fewer pieces than SyzygyProbeLimit are searched with
+    // ProbeDepth == DEPTH_ZERO
+    if (Cardinality > MaxCardinality)
+    {
+        Cardinality = MaxCardinality;
+        ProbeDepth = 0;
+    }
+
+    if (Cardinality >= popcount(pos.pieces()) && !pos.can_castle(ANY_CASTLING))
+    {
+        // Rank moves using DTZ tables
+        RootInTB = root_probe(pos, rootMoves);
+
+        if (!RootInTB)
+        {
+            // DTZ tables are missing; try to rank moves using WDL tables
+            dtz_available = false;
+            RootInTB = root_probe_wdl(pos, rootMoves);
+        }
+    }
+
+    if (RootInTB)
+    {
+        // Sort moves according to TB rank
+        std::stable_sort(rootMoves.begin(), rootMoves.end(),
+                  [](const RootMove &a, const RootMove &b) { return a.tbRank > b.tbRank; } );
+
+        // Probe during search only if DTZ is not available and we are winning
+        if (dtz_available || rootMoves[0].tbScore <= VALUE_DRAW)
+            Cardinality = 0;
+    }
+    else
+    {
+        // Clean up if root_probe() and root_probe_wdl() have failed
+        for (auto& m : rootMoves)
+            m.tbRank = 0;
+    }
+}
+
 } // namespace Stockfish
@@ -19,6 +19,8 @@
 #ifndef SEARCH_H_INCLUDED
 #define SEARCH_H_INCLUDED
 
+#include <functional>
+#include <string>
 #include <vector>
 
 #include "misc.h"
@@ -34,9 +36,10 @@ namespace Search {
 
 /// Stack struct keeps track of the information we need to remember from nodes
 /// shallower and deeper in the tree during the search. Each search thread has
-/// its own array of Stack objects, indexed by the current ply.
+/// its own array of Stack objects, indexed by the current ply. An element fills
+/// one cache line, so that a node touches only the lines of the plies it uses.
 
-struct Stack {
+struct alignas(64) Stack {
   Move* pv;
   PieceToHistory* continuationHistory;
   int ply;
@@ -53,6 +56,8 @@ struct Stack {
   int cutoffCnt;
 };
 
+static_assert(sizeof(Stack) == 64, "Stack should fill one cache line");
+
 
 /// RootMove struct is used for moves at the root of the tree. For each root move
 /// we store a score and a PV (really a refutation in the case of moves which
@@ -76,6 +81,7 @@ struct RootMove {
   bool scoreUpperbound = false;
   int selDepth = 0;
   int tbRank = 0;
+  uint64_t effort = 0; // Nodes spent searching the move, over all the iterations
   Value tbScore;
   std::vector<Move> pv;
 };
@@ -106,8 +112,57 @@ struct LimitsType {
 
 extern LimitsType Limits;
 
+
+/// Info struct holds one PV line of the search as data, with the fields of the
+/// "info ... pv" line. The score is in internal units from the side to move
+/// point of view, and the bound is BOUND_EXACT unless the line failed high
+/// (BOUND_LOWER) or low (BOUND_UPPER).
+
+struct Info {
+  Depth depth;
+  int selDepth, multiPV;
+  Value score;
+  Bound bound;
+  uint64_t nodes, nps, tbHits;
+  int hashfull;
+  TimePoint time;
+  std::vector<Move> pv;
+};
+
+/// When they are set, the main thread hands the PV lines and the best move to
+/// these instead of sending "info" and "bestmove" to the GUI, see engine.h.
+/// They are called from the main search thread.
+
+extern std::function<void(const Info&)> OnInfo;
+extern std::function<void(Move best, Move ponder)> OnBestMove;
+
+
+/// SearchEvent lists the per-node events counted by the search when the
+/// engine is built with searchstats=yes. Every thread owns a Stats object
+/// written only by itself, so counting needs no atomics, and the counters of
+/// all threads are summed when they are printed by the "searchstats" command.
+
+enum SearchEvent {
+  EV_NODE, EV_TT_HIT, EV_TT_CUT,
+  EV_EXP_PROBE, EV_EXP_HIT, EV_EXP_TT_OVERRIDE, EV_EXP_CUT,
+  EV_RAZOR, EV_FUTILITY_CUT, EV_NULL_TRY, EV_NULL_CUT, EV_PROBCUT,
+  EV_FUTILITY_PRUNE, EV_SEE_PRUNE, EV_LMR, EV_LMR_RESEARCH, EV_LMR_FAIL_HIGH,
+  EV_QNODE, EV_QTT_HIT, EV_QTT_CUT, EV_QFUTILITY_PRUNE,
+  EV_NB
+};
+
+struct Stats {
+  uint64_t events[EV_NB];
+  uint64_t stages[MovePicker::STAGE_NB]; // Last MovePicker stage reached per move loop
+};
+
 void init();
 void clear();
+void print_stats();
+void clear_stats();
+size_t perft_hash_size();
+void prepare_independent(const LimitsType& limits, bool probeExperience);
+void analyze(const std::vector<std::string>& fens, Depth depth, size_t workers);
 
 } // namespace Search
 
@@ -0,0 +1,580 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "movegen.h"
+#include "polybook.h"
+#include "position.h"
+#include "selfplay.h"
+#include "thread.h"
+#include "tt.h"
+#include "uci.h"
+
+namespace Stockfish::SelfPlay {
+
+namespace {
+
+  const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+  constexpr int BookWidth = 4;    // Book moves are picked among the best ones
+  constexpr int BookPlies = 16;
+  constexpr int MaxGamePly = 400; // Longer games are adjudicated as draws
+
+  // Writer collects the positions of the finished games and writes them to
+  // the file from a thread of its own, so that the players never wait for the
+  // disk. The positions of a game are handed over all at once.
+  class Writer {
+
+    std::ofstream out;
+    std::vector<PackedEntry> queue, buffer;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    std::thread thread;
+
+    void write_loop() {
+
+      std::unique_lock<std::mutex> lk(mutex);
+
+      while (true)
+      {
+          cv.wait(lk, [&]{ return done || !queue.empty(); });
+
+          if (queue.empty())
+              return;
+
+          std::swap(queue, buffer);
+          lk.unlock();
+
+          out.write(reinterpret_cast<const char*>(buffer.data()),
+                    std::streamsize(buffer.size() * sizeof(PackedEntry)));
+          buffer.clear();
+
+          lk.lock();
+      }
+    }
+
+  public:
+    explicit Writer(const std::string& file)
+      : out(file, std::ios::binary | std::ios::app), thread(&Writer::write_loop, this) {}
+
+    ~Writer() {
+      {
+          std::lock_guard<std::mutex> lk(mutex);
+          done = true;
+      }
+      cv.notify_one();
+      thread.join();
+    }
+
+    bool is_open() const { return out.is_open(); }
+
+    void push(const std::vector<PackedEntry>& entries) {
+      {
+          std::lock_guard<std::mutex> lk(mutex);
+          queue.insert(queue.end(), entries.begin(), entries.end());
+      }
+      cv.notify_one();
+    }
+  };
+
+  // play_opening() plays book moves, then 'randomPlies' random legal moves
+  void play_opening(Position& pos, StateListPtr& states, PRNG& rng, int randomPlies) {
+
+    Move m;
+
+    while (   pos.game_ply() < BookPlies
+           && (m = polybook[0].probe(pos, BookWidth)) != MOVE_NONE)
+    {
+        states->emplace_back();
+        pos.do_move(m, states->back());
+    }
+
+    for (int i = 0; i < randomPlies; ++i)
+    {
+        MoveList<LEGAL> moves(pos);
+
+        if (!moves.size())
+            break;
+
+        states->emplace_back();
+        pos.do_move(*(moves.begin() + rng.rand<uint32_t>() % moves.size()), states->back());
+    }
+  }
+
+  // PlayerThread plays games against itself until the requested number of
+  // games has been started by all the players together.
+  struct PlayerThread : public Thread {
+
+    PlayerThread(size_t n) : Thread(n), rng(now() ^ (n + 1) * 0x9E3779B97F4A7C15ULL) { independent = true; }
+    void search() override;
+
+    static PackedEntry pack(const Position& pos, Value v, Move m);
+
+    std::atomic<uint64_t>* next;
+    std::atomic<uint64_t>* finished;
+    std::atomic<uint64_t>* positions;
+    uint64_t games;
+    int randomPlies;
+    Writer* writer;
+    PRNG rng;
+  };
+
+  PackedEntry PlayerThread::pack(const Position& pos, Value v, Move m) {
+
+    PackedEntry e = {};
+    Bitboard b = pos.pieces();
+    int n = 0;
+
+    e.occupied = b;
+
+    while (b)
+    {
+        Piece pc = pos.piece_on(pop_lsb(b));
+        e.pieces[n / 2] |= uint8_t(pc << (4 * (n & 1)));
+        ++n;
+    }
+
+    e.flags = uint8_t(pos.side_to_move() | (pos.castling_rights(WHITE) | pos.castling_rights(BLACK)) << 1);
+    e.epSquare = uint8_t(pos.ep_square());
+    e.rule50 = uint8_t(std::min(pos.rule50_count(), 255));
+    e.score = int16_t(v);
+    e.move = uint16_t(m);
+
+    return e;
+  }
+
+  // PlayerThread::search() plays the games. Positions in check, and those
+  // where the best move is a capture, are not recorded, because their score
+  // is that of a tactic rather than of the position.
+  void PlayerThread::search() {
+
+    std::vector<PackedEntry> entries;
+
+    while ((*next)++ < games)
+    {
+        StateListPtr states(new std::deque<StateInfo>(1));
+        Position pos;
+        int result = 0; // From White's point of view
+
+        pos.set(StartFEN, false, &states->back(), this);
+        play_opening(pos, states, rng, randomPlies);
+        entries.clear();
+
+        while (true)
+        {
+            if (!MoveList<LEGAL>(pos).size())
+            {
+                result = !pos.checkers() ? 0 : pos.side_to_move() == WHITE ? -1 : 1;
+                break;
+            }
+
+            if (pos.is_draw(MAX_PLY) || pos.game_ply() >= MaxGamePly)
+                break;
+
+            // Every move is a new search for the replacement of the TT. The
+            // games run concurrently, so the table ages with the moves of all
+            // of them, as fast as they fill it.
+            TT.new_search();
+            search_alone(pos);
+
+            const Search::RootMove& rm = rootMoves[0];
+            Move m = rm.pv[0];
+
+            if (!pos.checkers() && !pos.capture(m))
+                entries.push_back(pack(pos, rm.score, m));
+
+            // A found mate or tablebase win decides the game
+            if (abs(rm.score) >= VALUE_TB_WIN_IN_MAX_PLY)
+            {
+                result = (rm.score > 0) == (pos.side_to_move() == WHITE) ? 1 : -1;
+                break;
+            }
+
+            states->emplace_back();
+            pos.do_move(m, states->back());
+        }
+
+        for (PackedEntry& e : entries)
+            e.result = int8_t((e.flags & 1) == WHITE ? result : -result);
+
+        writer->push(entries);
+        *positions += entries.size();
+        ++*finished;
+    }
+  }
+
+  // MatchThread plays the moves of one engine of a match in one game at a
+  // time, see SelfPlay::match().
+  struct MatchThread : public Thread {
+
+    MatchThread(size_t n) : Thread(n) { independent = true; }
+    void search() override { search_alone(*pos); }
+
+    const Position* pos;
+  };
+
+  // Game is one game of a match, 'result' is from the first engine's point of view
+  struct Game {
+    StateListPtr states;
+    Position pos;
+    bool counted = false; // It is one of the requested games
+    bool running = false;
+    int result = 0;
+  };
+
+  // GamePair is two games of the same opening with the colors reversed. The
+  // first engine has White in games[0] and Black in games[1].
+  struct GamePair {
+    Game games[2];
+    bool active = false;
+  };
+
+  // side_to_move() returns the engine to move in game 'g' of a pair, 0 or 1
+  int side_to_move(const Game& game, int g) {
+    return (game.pos.side_to_move() == WHITE) == (g == 0) ? 0 : 1;
+  }
+
+  // adjudicate() ends the game if it is over on the board, as in PlayerThread::search()
+  void adjudicate(Game& game, int g) {
+
+    if (!MoveList<LEGAL>(game.pos).size())
+    {
+        game.running = false;
+        game.result = !game.pos.checkers() ? 0 : side_to_move(game, g) == 0 ? -1 : 1;
+    }
+    else if (game.pos.is_draw(MAX_PLY) || game.pos.game_ply() >= MaxGamePly)
+        game.running = false, game.result = 0;
+  }
+
+  // Elo difference for a score fraction, which is clamped away from 0 and 1
+  double elo(double score) {
+    score = std::clamp(score, 1e-6, 1 - 1e-6);
+    return 400 * std::log10(score / (1 - score));
+  }
+
+} // namespace
+
+
+/// SelfPlay::generate() plays 'games' games of the engine against itself, with
+/// 'workers' independent single threaded games at a time. Every move is a
+/// search with the depth or nodes of 'limits', see Search::prepare_independent().
+/// Openings are taken from the book and then randomized, and the positions are
+/// appended to 'file' as PackedEntry records. The progress is printed once a
+/// second.
+
+void generate(const std::string& file, uint64_t games, const Search::LimitsType& limits,
+              size_t workers, int randomPlies) {
+
+  Writer writer(file);
+
+  if (!writer.is_open())
+  {
+      sync_cout << "info string Unable to open file " << file << sync_endl;
+      return;
+  }
+
+  Search::prepare_independent(limits, false);
+
+  std::atomic<uint64_t> next(0), finished(0), positions(0);
+  std::vector<PlayerThread*> threads;
+  TimePoint start = now();
+
+  for (size_t i = 0; i < std::max(workers, size_t(1)); ++i)
+  {
+      PlayerThread* th = new PlayerThread(i);
+      th->clear();
+      th->next = &next;
+      th->finished = &finished;
+      th->positions = &positions;
+      th->games = games;
+      th->randomPlies = randomPlies;
+      th->writer = &writer;
+      threads.push_back(th);
+  }
+
+  for (PlayerThread* th : threads)
+      th->start_searching();
+
+  auto report = [&]() {
+      TimePoint elapsed = now() - start + 1;
+
+      sync_cout << "info string selfplay games " << finished << "/" << games
+                << " positions " << positions
+                << " time " << elapsed
+                << " positions/second " << positions * 1000 / elapsed
+                << " per worker " << positions * 1000 / elapsed / threads.size() << sync_endl;
+  };
+
+  for (TimePoint lastReport = start; finished < games; )
+  {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+      if (now() - lastReport >= 1000 && finished < games)
+      {
+          report();
+          lastReport = now();
+      }
+  }
+
+  for (PlayerThread* th : threads)
+  {
+      th->wait_for_search_finished();
+      delete th;
+  }
+
+  report();
+}
+
+/// SelfPlay::match() plays 'games' games between two configurations of the
+/// engine, 'first' and 'second', the UCI options that each of them changes.
+/// The games are played in pairs, from the same book opening with the colors
+/// reversed, one game per worker at a time. The two engines move in turns:
+/// the first one searches in all the games where it is to move, then the
+/// options of the second are set and the same is done for it. Past the first
+/// move of a pair, the same engine is to move in both games, so all the
+/// workers search at once. Each engine has its own transposition table and
+/// its own search threads, so neither sees the entries or the histories of
+/// the other. The score of the first engine is
+/// printed once a second with a 95% confidence interval of the Elo difference.
+
+void match(uint64_t games, const Search::LimitsType& limits, size_t workers, int randomPlies,
+           const OptionSet& first, const OptionSet& second) {
+
+  // Both engines set all the options named by either of them, an option that
+  // only one of them changes keeps its current value for the other
+  OptionSet sides[2], original;
+
+  for (const OptionSet* set : { &first, &second })
+      for (const auto& [name, value] : *set)
+      {
+          if (!Options.count(name))
+          {
+              sync_cout << "info string Unknown option " << name << sync_endl;
+              return;
+          }
+
+          if (std::none_of(original.begin(), original.end(), [&](auto& o) { return o.first == name; }))
+              original.emplace_back(name, Options[name].current_value());
+      }
+
+  for (int side : { 0, 1 })
+  {
+      sides[side] = original;
+
+      for (const auto& [name, value] : side == 0 ? first : second)
+          for (auto& o : sides[side])
+              if (o.first == name)
+                  o.second = value;
+  }
+
+  auto apply = [](const OptionSet& set) {
+      for (const auto& [name, value] : set)
+          if (Options[name].current_value() != value)
+              Options[name] = value;
+  };
+
+  // Invalid values are left unchanged by the options, so check them all first
+  for (int side : { 0, 1 })
+  {
+      apply(sides[side]);
+
+      for (const auto& [name, value] : sides[side])
+          if (Options[name].current_value() != value)
+          {
+              sync_cout << "info string Invalid value " << value << " for option " << name << sync_endl;
+              apply(original);
+              return;
+          }
+  }
+
+  apply(original);
+
+  Search::prepare_independent(limits, false);
+
+  TranspositionTable secondTT{};
+  secondTT.resize(size_t(Options["Hash"]));
+
+  // Thread 2 * p + g of each engine plays in game g of pair p
+  std::vector<MatchThread*> threads[2];
+  std::vector<GamePair> pairs((std::max(workers, size_t(1)) + 1) / 2);
+  PRNG rng(now() ^ 0x9E3779B97F4A7C15ULL);
+  uint64_t started = 0, played = 0, wins = 0, draws = 0, losses = 0;
+  TimePoint start = now(), lastReport = start;
+
+  for (int side : { 0, 1 })
+      for (size_t i = 0; i < 2 * pairs.size(); ++i)
+      {
+          threads[side].push_back(new MatchThread(i));
+          threads[side].back()->clear();
+      }
+
+  // Starts the games of pair 'p', if any is left to play
+  auto start_pair = [&](size_t p) {
+
+      GamePair& pair = pairs[p];
+      pair.active = started < games;
+
+      if (!pair.active)
+          return;
+
+      for (int g : { 0, 1 })
+      {
+          Game& game = pair.games[g];
+
+          game.states = StateListPtr(new std::deque<StateInfo>(1));
+          game.counted = game.running = started < games;
+          game.result = 0;
+          started += game.counted;
+
+          if (g == 0)
+          {
+              game.pos.set(StartFEN, false, &game.states->back(), threads[0][2 * p]);
+              play_opening(game.pos, game.states, rng, randomPlies);
+          }
+          else
+              game.pos.set(pair.games[0].pos.fen(), false, &game.states->back(), threads[0][2 * p + 1]);
+
+          if (game.running)
+              adjudicate(game, g);
+      }
+  };
+
+  auto report = [&]() {
+
+      TimePoint elapsed = now() - start + 1;
+      double score = played ? (wins + draws / 2.0) / played : 0.5;
+      double variance = played ? (  wins   * (1 - score) * (1 - score)
+                                  + draws  * (0.5 - score) * (0.5 - score)
+                                  + losses * score * score) / played : 0;
+      double margin = 1.96 * std::sqrt(variance / std::max(played, uint64_t(1)));
+
+      std::stringstream ss;
+      ss << std::fixed << std::setprecision(1)
+         << "info string match games " << played << "/" << games
+         << " wins " << wins << " draws " << draws << " losses " << losses
+         << " score " << 100 * score << "%"
+         << " elo " << elo(score) << " +/- " << (elo(score + margin) - elo(score - margin)) / 2
+         << " time " << elapsed
+         << " games/second " << played * 1000.0 / elapsed;
+
+      sync_cout << ss.str() << sync_endl;
+  };
+
+  for (size_t p = 0; p < pairs.size(); ++p)
+      start_pair(p);
+
+  while (std::any_of(pairs.begin(), pairs.end(), [](const GamePair& p) { return p.active; }))
+  {
+      for (int side : { 0, 1 })
+      {
+          apply(sides[side]);
+
+          if (side == 1)
+              TT.swap(secondTT);
+
+          // The moves of all the games of an engine are one new search each for its TT
+          TT.new_search();
+
+          std::vector<std::pair<MatchThread*, Game*>> searches;
+
+          for (size_t p = 0; p < pairs.size(); ++p)
+              for (int g : { 0, 1 })
+              {
+                  Game& game = pairs[p].games[g];
+                  MatchThread* th = threads[side][2 * p + g];
+
+                  if (pairs[p].active && game.running && side_to_move(game, g) == side)
+                  {
+                      th->pos = &game.pos;
+                      th->start_searching();
+                      searches.emplace_back(th, &game);
+                  }
+              }
+
+          for (auto& [th, game] : searches)
+          {
+              th->wait_for_search_finished();
+
+              const Search::RootMove& rm = th->rootMoves[0];
+
+              // A found mate or tablebase win decides the game
+              if (abs(rm.score) >= VALUE_TB_WIN_IN_MAX_PLY)
+              {
+                  game->running = false;
+                  game->result = (rm.score > 0) == (side == 0) ? 1 : -1;
+                  continue;
+              }
+
+              game->states->emplace_back();
+              game->pos.do_move(rm.pv[0], game->states->back());
+              adjudicate(*game, int(th->id() % 2));
+          }
+
+          if (side == 1)
+              TT.swap(secondTT);
+      }
+
+      for (size_t p = 0; p < pairs.size(); ++p)
+      {
+          GamePair& pair = pairs[p];
+
+          if (!pair.active || pair.games[0].running || pair.games[1].running)
+              continue;
+
+          // The second game of the last pair is not played when 'games' is odd
+          for (const Game& game : pair.games)
+              if (game.counted)
+              {
+                  ++played;
+                  wins   += game.result > 0;
+                  draws  += game.result == 0;
+                  losses += game.result < 0;
+              }
+
+          start_pair(p);
+      }
+
+      if (now() - lastReport >= 1000)
+      {
+          report();
+          lastReport = now();
+      }
+  }
+
+  for (int side : { 0, 1 })
+      for (MatchThread* th : threads[side])
+          delete th;
+
+  apply(original);
+  report();
+}
+
+} // namespace Stockfish::SelfPlay
@@ -0,0 +1,63 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2023 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SELFPLAY_H_INCLUDED
+#define SELFPLAY_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "search.h"
+#include "types.h"
+
+namespace Stockfish::SelfPlay {
+
+/// PackedEntry is one training position written by the "selfplay" command. A
+/// file is a plain array of them, 32 bytes each, in the byte order of the
+/// machine. The pieces are listed in the order of the occupied squares, a1
+/// first, with the Piece codes of types.h.
+
+struct PackedEntry {
+  uint64_t occupied;   // Occupied squares, bit 0 is a1
+  uint8_t  pieces[16]; // Two pieces per byte, the first one in the low nibble
+  uint8_t  flags;      // Bit 0 the side to move, bits 1-4 the castling rights
+  uint8_t  epSquare;   // SQ_NONE if there is no en passant square
+  uint8_t  rule50;
+  int8_t   result;     // 1, 0 or -1: win, draw or loss for the side to move
+  int16_t  score;      // Search score for the side to move, in internal units
+  uint16_t move;       // Best move found by the search
+};
+
+static_assert(sizeof(PackedEntry) == 32, "PackedEntry must be 32 bytes");
+
+void generate(const std::string& file, uint64_t games, const Search::LimitsType& limits,
+              size_t workers, int randomPlies);
+
+/// OptionSet is the configuration of one engine of a match, as the names and
+/// values of the UCI options, tuned parameters included, that it changes.
+
+using OptionSet = std::vector<std::pair<std::string, std::string>>;
+
+void match(uint64_t games, const Search::LimitsType& limits, size_t workers, int randomPlies,
+           const OptionSet& first, const OptionSet& second);
+
+} // namespace Stockfish::SelfPlay
+
+#endif // #ifndef SELFPLAY_H_INCLUDED
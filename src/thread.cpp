@@ -21,10 +21,12 @@
 #include <algorithm> // For std::count
 #include "movegen.h"
 #include "search.h"
+#include "syzygy/tbprobe.h"
 #include "thread.h"
 #include "uci.h"
 
 #include "tt.h"
+#include "nnue/evaluate_nnue.h"
 
 namespace Stockfish {
 
@@ -53,10 +55,36 @@ Thread::~Thread() {
 }
 
 
-/// Thread::clear() reset histories, usually before a new game
+/// Thread::clear() reset histories, usually before a new game. With "History
+/// Warm Start" the histories of the previous game are kept instead, scaled
+/// down to the given percentage of their distance to the initial values, so
+/// that the first moves of the next game start with a useful move ordering.
 
 void Thread::clear() {
 
+  evalCache.resize(size_t(Options["Eval Cache"]));
+  pawnsTable.resize(size_t(Options["Pawn Hash"]));
+
+#ifdef USE_SEARCH_STATS
+  stats = {};
+#endif
+
+  int keep = historiesSet ? int(Options["History Warm Start"]) : 0;
+  historiesSet = true;
+
+  if (keep)
+  {
+      mainHistory.scale(keep, 0);
+      captureHistory.scale(keep, 0);
+
+      for (bool inCheck : { false, true })
+          for (StatsType c : { NoCaptures, Captures })
+              for (auto& to : continuationHistory[inCheck][c])
+                  for (auto& h : to)
+                      h->scale(keep, -71);
+      return;
+  }
+
   counterMoves.fill(MOVE_NONE);
   mainHistory.fill(0);
   captureHistory.fill(0);
@@ -79,6 +107,18 @@ void Thread::start_searching() {
 }
 
 
+/// Thread::start_clearing() wakes up the thread that will clear its own tables.
+/// The thread is bound like for a search, so on a first-touch system the pages
+/// it writes end up on its own node. Wait for it like for a search.
+
+void Thread::start_clearing() {
+  mutex.lock();
+  clearing = searching = true;
+  mutex.unlock();
+  cv.notify_one();
+}
+
+
 /// Thread::wait_for_search_finished() blocks on the condition variable
 /// until the thread has finished searching.
 
@@ -112,9 +152,14 @@ void Thread::idle_loop() {
       if (exit)
           return;
 
+      bool clearOnly = clearing;
+      clearing = false;
       lk.unlock();
 
-      search();
+      if (clearOnly)
+          clear();
+      else
+          search();
   }
 }
 
@@ -149,12 +194,16 @@ void ThreadPool::set(size_t requested) {
 }
 
 
-/// ThreadPool::clear() sets threadPool data to initial values
+/// ThreadPool::clear() sets threadPool data to initial values. Every thread
+/// clears its own histories and tables, all of them at the same time.
 
 void ThreadPool::clear() {
 
   for (Thread* th : threads)
-      th->clear();
+      th->start_clearing();
+
+  for (Thread* th : threads)
+      th->wait_for_search_finished();
 
   main()->callsCnt = 0;
   main()->bestPreviousScore = VALUE_INFINITE;
@@ -182,6 +231,9 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
           || std::count(limits.searchmoves.begin(), limits.searchmoves.end(), m))
           rootMoves.emplace_back(m);
 
+  if (!rootMoves.empty())
+      Tablebases::rank_root_moves(pos, rootMoves);
+
   // After ownership transfer 'states' becomes empty, so if we stop the search
   // and call 'go' again without setting a new position states.get() == nullptr.
   assert(states.get() || setupStates.get());
@@ -201,6 +253,11 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
       th->rootMoves = rootMoves;
       th->rootPos.set(pos.fen(), pos.is_chess960(), &th->rootState, th);
       th->rootState = setupStates->back();
+
+      // Searches never update the accumulators of states before the root,
+      // those are shared by all threads
+      if (Eval::NNUE::enabled())
+          Eval::NNUE::refresh(th->rootPos);
   }
 
   main()->start_searching();
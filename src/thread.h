@@ -45,6 +45,7 @@ class Thread {
   std::condition_variable cv;
   size_t idx;
   bool exit = false, searching = true; // Set before starting std::thread
+  bool clearing = false; // The wake up is for clear() rather than search()
   NativeThread stdThread;
 
 public:
@@ -54,25 +55,40 @@ public:
   void clear();
   void idle_loop();
   void start_searching();
+  void start_clearing();
   void wait_for_search_finished();
+  void search_alone(const Position& pos);
   size_t id() const { return idx; }
 
-  Pawns::Table pawnsTable;
-  Material::Table materialTable;
-  size_t pvIdx, pvLast;
-  std::atomic<uint64_t> nodes, tbHits, bestMoveChanges;
+  // The counters that other threads read while this one searches (and that the
+  // main thread resets) have a cache line of their own, so that reading them
+  // does not take away the line of the search state below.
+  alignas(64) std::atomic<uint64_t> nodes;
+  std::atomic<uint64_t> tbHits, bestMoveChanges;
+
+  alignas(64) size_t pvIdx;
+  size_t pvLast;
   int selDepth, nmpMinPly;
   Value bestValue, optimism[COLOR_NB];
+  Depth rootDepth, completedDepth;
+  Value rootDelta;
+  bool independent = false; // Searches alone, outside the pool
+  bool stopAlone = false;    // Set when an independent search reaches its node limit
 
   Position rootPos;
   StateInfo rootState;
   Search::RootMoves rootMoves;
-  Depth rootDepth, completedDepth;
-  Value rootDelta;
+  Pawns::Table pawnsTable;
+  Material::Table materialTable;
+  Eval::Cache evalCache;
+#ifdef USE_SEARCH_STATS
+  Search::Stats stats;
+#endif
   CounterMoveHistory counterMoves;
   ButterflyHistory mainHistory;
   CapturePieceToHistory captureHistory;
   ContinuationHistory continuationHistory[2][2];
+  bool historiesSet = false;
 };
 
 
@@ -90,8 +106,22 @@ struct MainThread : public Thread {
   Value bestPreviousAverageScore;
   Value iterValue[4];
   int callsCnt;
+  TimePoint probeTime; // Time spent probing the books at the root, in ms
   bool stopOnPonderhit;
   std::atomic_bool ponder;
+
+  // Completed iterations of the last search, see 'Iteration Timing'
+  struct Iteration {
+    Depth depth;
+    TimePoint time;   // Since the start of the search, in ms
+    uint64_t nodes;
+    int researches;   // Aspiration window fail lows and fail highs
+  };
+  std::vector<Iteration> iterations;
+
+  // Spacing of the time checks of the current iteration, in ms
+  TimePoint lastCheck, maxCheckGap;
+  uint64_t checks;
 };
 
 
@@ -112,6 +142,9 @@ struct ThreadPool {
   void start_searching();
   void wait_for_search_finished() const;
 
+  // The states of the position of the last search, handed over by start_thinking()
+  StateListPtr& setup_states() { return setupStates; }
+
   std::atomic_bool stop, increaseDepth;
 
   auto cbegin() const noexcept { return threads.cbegin(); }
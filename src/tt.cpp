@@ -16,7 +16,10 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <atomic>
 #include <cstring>   // For std::memset
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <thread>
 
@@ -30,6 +33,77 @@ namespace Stockfish {
 
 TranspositionTable TT; // Our global transposition table
 
+namespace {
+
+  // Header of a hash file written by TranspositionTable::save(). The clusters
+  // follow as they are laid out in memory.
+  struct HashFileHeader {
+    char     signature[8];
+    uint32_t clusterBytes;
+    uint32_t padding;
+    uint64_t clusterCount;
+    uint8_t  generation8;
+    uint8_t  reserved[7];
+  };
+
+  static_assert(sizeof(HashFileHeader) == 32, "Unexpected HashFileHeader size");
+
+  constexpr char HashFileSignature[8] = { 'H', 'M', 'T', 'T', '0', '0', '0', '1' };
+
+  // scale() returns (a * b - sub) / c without overflowing, for a * b >= sub
+  size_t scale(uint64_t a, uint64_t b, uint64_t c, uint64_t sub = 0) {
+#if defined(__GNUC__) && defined(IS_64BIT)
+    __extension__ using uint128 = unsigned __int128;
+    return size_t(((uint128)a * b - sub) / c);
+#else
+    return size_t(((long double)a * b - sub) / c);
+#endif
+  }
+
+  // for_each_chunk() splits the 'count' clusters of the table into one chunk
+  // per search thread and calls 'f' with the first cluster and the length of
+  // each chunk, in parallel. Each helper is bound like the search thread with
+  // the same index, so that on a first-touch system the pages of a chunk end
+  // up on the node of the thread that writes them. Returns the thread count.
+  size_t for_each_chunk(size_t count, size_t clusterBytes, const std::function<void(size_t, size_t)>& f) {
+
+    const size_t threadCount = std::max(size_t(Options["Threads"]), size_t(1));
+
+    // Chunk boundaries are rounded to whole pages, so no page is shared
+    // between two nodes
+    const size_t pageClusters = 4096 / clusterBytes;
+    const size_t stride = (count / threadCount) / pageClusters * pageClusters;
+
+    auto run_chunk = [&](size_t idx) {
+
+        // Thread binding gives faster search on systems with a first-touch policy.
+        // The helpers are not reported, they only live for one clear or resize
+        if (threadCount > 8)
+            WinProcGroup::bindThisThread(idx, false);
+
+        const size_t begin = stride * idx;
+        f(begin, idx != threadCount - 1 ? stride : count - begin);
+    };
+
+    std::vector<std::thread> threads;
+
+    for (size_t idx = 1; idx < threadCount; ++idx)
+        threads.emplace_back(run_chunk, idx);
+
+    // The calling thread does the first chunk itself, unless it would have
+    // to be bound, as the binding would then stick to the UCI thread
+    if (threadCount > 8)
+        threads.emplace_back(run_chunk, 0);
+    else
+        run_chunk(0);
+
+    for (std::thread& th : threads)
+        th.join();
+
+    return threadCount;
+  }
+}
+
 /// TTEntry::save() populates the TTEntry with a new node's data, possibly
 /// overwriting an old position. Update is not atomic and can be racy.
 
@@ -59,16 +133,27 @@ void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev)
 /// TranspositionTable::resize() sets the size of the transposition table,
 /// measured in megabytes. Transposition table consists of a power of 2 number
 /// of clusters and each cluster consists of ClusterSize number of TTEntry.
+/// The entries of the previous table, if any, are moved to the new one.
 
 void TranspositionTable::resize(size_t mbSize) {
 
   Threads.main()->wait_for_search_finished();
 
-  aligned_large_pages_free(table);
+  Cluster* oldTable = table;
+  size_t oldCount = clusterCount;
 
   clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
 
   table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+
+  // Without room for both tables the old one is given up
+  if (!table && oldTable)
+  {
+      aligned_large_pages_free(oldTable);
+      oldTable = nullptr;
+      table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+  }
+
   if (!table)
   {
       std::cerr << "Failed to allocate " << mbSize
@@ -76,37 +161,196 @@ void TranspositionTable::resize(size_t mbSize) {
       exit(EXIT_FAILURE);
   }
 
-  clear();
+  if (oldTable)
+  {
+      migrate(oldTable, oldCount);
+      aligned_large_pages_free(oldTable);
+  }
+  else
+      clear();
+
+  // The kernel may grant fewer huge pages than asked for, so tell what we got
+  // with 'Debug Hash'. The 'memory' command reports it as well.
+  std::string pages = Options["Debug Hash"] ? large_pages() : "";
+  if (!pages.empty())
+      sync_cout << "info string Hash " << mbSize << " MB: " << pages << sync_endl;
+}
+
+
+/// TranspositionTable::large_pages() tells which kind of pages back the table,
+/// it is empty where this can not be found out.
+
+std::string TranspositionTable::large_pages() const {
+
+  return LargePages::report(table, size());
 }
 
 
 /// TranspositionTable::clear() initializes the entire transposition table to zero,
-//  in a multi-threaded way.
+//  in a multi-threaded way. Each helper zeroes one contiguous chunk and is bound
+//  like the search thread with the same index, so that on a first-touch system
+//  the pages of a chunk end up on the node of the thread that clears them. The
+//  time taken is printed with 'Debug Hash' only.
 
 void TranspositionTable::clear() {
 
-  std::vector<std::thread> threads;
+  const TimePoint start = now();
+
+  size_t threadCount = for_each_chunk(clusterCount, sizeof(Cluster), [this](size_t begin, size_t len) {
+      std::memset(&table[begin], 0, len * sizeof(Cluster));
+  });
+
+  if (Options["Debug Hash"])
+      sync_cout << "info string Hash cleared: " << format_bytes(clusterCount * sizeof(Cluster), 0)
+                << " with " << threadCount << (threadCount > 1 ? " threads" : " thread")
+                << " in " << now() - start << " ms" << sync_endl;
+}
+
+
+/// TranspositionTable::migrate() fills the table with the entries of 'old', a
+/// table of 'oldCount' clusters. The positions of old cluster i have keys in
+/// [i, i + 1) * 2^64 / oldCount, and mul_hi64() maps them to the new clusters
+/// that cover that range. As only the low 16 bits of the key are stored, it is
+/// not known which of those clusters an entry belongs to. So every new cluster
+/// takes its most valuable entries, in the replacement order of probe(), from
+/// all the old clusters that overlap it. When the table shrinks the entries
+/// land where they belong, and when it grows they are copied to all the
+/// clusters they may belong to, of which only one will match them again. The
+/// entries kept and the time taken are printed with 'Debug Hash' only.
+
+void TranspositionTable::migrate(const Cluster* old, size_t oldCount) {
+
+  const TimePoint start = now();
+  std::atomic<uint64_t> kept(0);
+
+  auto value = [this](const TTEntry* e) {
+      return e->depth8 - ((GENERATION_CYCLE + generation8 - e->genBound8) & GENERATION_MASK);
+  };
+
+  size_t threadCount = for_each_chunk(clusterCount, sizeof(Cluster), [&](size_t begin, size_t len) {
+
+      uint64_t n = 0;
 
-  for (size_t idx = 0; idx < size_t(Options["Threads"]); ++idx)
+      for (size_t j = begin; j < begin + len; ++j)
+      {
+          const TTEntry* best[ClusterSize] = {};
+          size_t first = scale(j, oldCount, clusterCount),
+                 last  = scale(j + 1, oldCount, clusterCount, 1);
+
+          for (size_t i = first; i <= last; ++i)
+              for (const TTEntry& e : old[i].entry)
+              {
+                  if (!e.depth8)
+                      continue;
+
+                  // Keep 'best' sorted by decreasing value, empty slots last
+                  const TTEntry* c = &e;
+                  for (int k = 0; k < ClusterSize && c; ++k)
+                      if (!best[k] || value(c) > value(best[k]))
+                          std::swap(c, best[k]);
+              }
+
+          std::memset(&table[j], 0, sizeof(Cluster));
+
+          for (int k = 0; k < ClusterSize && best[k]; ++k, ++n)
+              table[j].entry[k] = *best[k];
+      }
+
+      kept += n;
+  });
+
+  if (Options["Debug Hash"])
+      sync_cout << "info string Hash resized from " << format_bytes(oldCount * sizeof(Cluster), 0)
+                << " to " << format_bytes(clusterCount * sizeof(Cluster), 0)
+                << ": " << kept << " entries kept, with " << threadCount
+                << (threadCount > 1 ? " threads" : " thread")
+                << " in " << now() - start << " ms" << sync_endl;
+}
+
+
+/// TranspositionTable::save() writes the whole table, together with the
+/// current generation, to a file that load() can read back in a later session
+
+bool TranspositionTable::save(const std::string& filename) const {
+
+  Threads.main()->wait_for_search_finished();
+
+  std::ofstream out(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out)
+  {
+      sync_cout << "info string Could not open hash file for writing: " << filename << sync_endl;
+      return false;
+  }
+
+  HashFileHeader header = {};
+  std::memcpy(header.signature, HashFileSignature, sizeof(header.signature));
+  header.clusterBytes = uint32_t(sizeof(Cluster));
+  header.clusterCount = clusterCount;
+  header.generation8  = generation8;
+
+  out.write((const char*)&header, sizeof(header));
+  out.write((const char*)table, std::streamsize(clusterCount * sizeof(Cluster)));
+
+  if (!out)
+  {
+      sync_cout << "info string Failed to write hash file: " << filename << sync_endl;
+      return false;
+  }
+
+  sync_cout << "info string Hash saved to " << filename << " ("
+            << format_bytes(sizeof(header) + clusterCount * sizeof(Cluster), 2) << ")" << sync_endl;
+
+  return true;
+}
+
+
+/// TranspositionTable::load() replaces the table with the contents of a file
+/// written by save(). The file must match the current table layout and size,
+/// otherwise the table is left untouched.
+
+bool TranspositionTable::load(const std::string& filename) {
+
+  Threads.main()->wait_for_search_finished();
+
+  Utility::FileMapping mapping;
+  if (!mapping.map(filename, false))
   {
-      threads.emplace_back([this, idx]() {
+      sync_cout << "info string Could not open hash file: " << filename << sync_endl;
+      return false;
+  }
 
-          // Thread binding gives faster search on systems with a first-touch policy
-          if (Options["Threads"] > 8)
-              WinProcGroup::bindThisThread(idx);
+  HashFileHeader header;
+  if (mapping.data_size() < sizeof(header))
+  {
+      sync_cout << "info string Invalid hash file: " << filename << sync_endl;
+      return false;
+  }
 
-          // Each thread will zero its part of the hash table
-          const size_t stride = size_t(clusterCount / Options["Threads"]),
-                       start  = size_t(stride * idx),
-                       len    = idx != size_t(Options["Threads"]) - 1 ?
-                                stride : clusterCount - start;
+  std::memcpy(&header, mapping.data(), sizeof(header));
 
-          std::memset(&table[start], 0, len * sizeof(Cluster));
-      });
+  if (   std::memcmp(header.signature, HashFileSignature, sizeof(header.signature))
+      || header.clusterBytes != sizeof(Cluster)
+      || (header.generation8 & (GENERATION_DELTA - 1))
+      || mapping.data_size() != sizeof(header) + header.clusterCount * sizeof(Cluster))
+  {
+      sync_cout << "info string Invalid hash file: " << filename << sync_endl;
+      return false;
   }
 
-  for (std::thread& th : threads)
-      th.join();
+  if (header.clusterCount != clusterCount)
+  {
+      sync_cout << "info string Hash file " << filename << " was saved with Hash "
+                << header.clusterCount * sizeof(Cluster) / (1024 * 1024) << " MB, current Hash is "
+                << clusterCount * sizeof(Cluster) / (1024 * 1024) << " MB" << sync_endl;
+      return false;
+  }
+
+  std::memcpy(table, mapping.data() + sizeof(header), clusterCount * sizeof(Cluster));
+  generation8 = header.generation8;
+
+  sync_cout << "info string Hash loaded from " << filename << " (hashfull " << hashfull() << ")" << sync_endl;
+
+  return true;
 }
 
 
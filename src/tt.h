@@ -19,6 +19,9 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <string>
+#include <utility>
+
 #include "misc.h"
 #include "types.h"
 
@@ -61,18 +64,25 @@ private:
 /// cluster consists of ClusterSize number of TTEntry. Each non-empty TTEntry
 /// contains information on exactly one position. The size of a Cluster should
 /// divide the size of a cache line for best performance, as the cacheline is
-/// prefetched when possible.
+/// prefetched when possible. Building with TT_CLUSTER_64 (make ttcluster=64)
+/// makes a cluster fill a whole cache line with 6 entries instead of 3.
 
 class TranspositionTable {
 
+#ifdef TT_CLUSTER_64
+  static constexpr int ClusterSize = 6;
+  static constexpr int ClusterBytes = 64;
+#else
   static constexpr int ClusterSize = 3;
+  static constexpr int ClusterBytes = 32;
+#endif
 
   struct Cluster {
     TTEntry entry[ClusterSize];
-    char padding[2]; // Pad to 32 bytes
+    char padding[ClusterBytes - ClusterSize * sizeof(TTEntry)]; // Pad to ClusterBytes
   };
 
-  static_assert(sizeof(Cluster) == 32, "Unexpected Cluster size");
+  static_assert(sizeof(Cluster) == ClusterBytes, "Unexpected Cluster size");
 
   // Constants used to refresh the hash table periodically
   static constexpr unsigned GENERATION_BITS  = 3;                                // nb of bits reserved for other things
@@ -87,6 +97,17 @@ public:
   int hashfull() const;
   void resize(size_t mbSize);
   void clear();
+  bool save(const std::string& filename) const;
+  bool load(const std::string& filename);
+  size_t size() const { return clusterCount * sizeof(Cluster); }
+  std::string large_pages() const;
+
+  // Exchanges the tables, so that searches can alternate between two of them
+  void swap(TranspositionTable& tt) {
+    std::swap(clusterCount, tt.clusterCount);
+    std::swap(table, tt.table);
+    std::swap(generation8, tt.generation8);
+  }
 
   TTEntry* first_entry(const Key key) const {
     return &table[mul_hi64(key, clusterCount)].entry[0];
@@ -95,6 +116,8 @@ public:
 private:
   friend struct TTEntry;
 
+  void migrate(const Cluster* old, size_t oldCount);
+
   size_t clusterCount;
   Cluster* table;
   uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
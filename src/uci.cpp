@@ -18,16 +18,26 @@
 
 #include <cassert>
 #include <cmath>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "benchmark.h"
 #include "evaluate.h"
 #include "experience.h"
+#include "material.h"
 #include "movegen.h"
+#include "movepick.h"
+#include "nnue/evaluate_nnue.h"
+#include "pawns.h"
+#include "polybook.h"
 #include "position.h"
 #include "search.h"
+#include "selfplay.h"
 #include "thread.h"
 #include "timeman.h"
 #include "tt.h"
@@ -43,10 +53,21 @@ namespace {
   const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
 
+  // The position set by the last "position" command, see position()
+  struct LastPosition {
+    string fen;
+    bool chess960 = false;
+    vector<string> moves; // The moves that were made
+    Key firstKey = 0, key = 0;
+  } LastPos;
+
   // position() is called when the engine receives the "position" UCI command.
   // It sets up the position that is described in the given FEN string ("fen") or
   // the initial position ("startpos") and then makes the moves given in the following
-  // move list ("moves").
+  // move list ("moves"). A GUI sends the whole game before every move, so when the
+  // move list extends the one of the previous command and the position has not
+  // changed since, only the new moves are made, into the same state list. After a
+  // "go" that list is owned by the thread pool and is taken back.
 
   void position(Position& pos, istringstream& is, StateListPtr& states) {
 
@@ -66,20 +87,47 @@ namespace {
     else
         return;
 
-    states = StateListPtr(new std::deque<StateInfo>(1)); // Drop the old state and create a new one
-    pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
+    vector<string> moves;
+    while (is >> token)
+        moves.push_back(token);
+
+    bool chess960 = Options["UCI_Chess960"];
+    StateListPtr& list = states ? states : Threads.setup_states();
+
+    // The position keeps the thread it was set up for, which "setoption name
+    // Threads" deletes
+    if (   list
+        && pos.this_thread() == Threads.main()
+        && fen == LastPos.fen
+        && chess960 == LastPos.chess960
+        && pos.state() == &list->back()
+        && pos.key() == LastPos.key
+        && moves.size() >= LastPos.moves.size()
+        && equal(LastPos.moves.begin(), LastPos.moves.end(), moves.begin()))
+    {
+        if (!states)
+            states = std::move(list);
+    }
+    else
+    {
+        states = StateListPtr(new std::deque<StateInfo>(1)); // Drop the old state and create a new one
+        pos.set(fen, chess960, &states->back(), Threads.main());
 
-    Key firstKey = pos.key();
+        LastPos = { fen, chess960, {}, pos.key(), 0 };
+    }
 
-    // Parse the move list, if any
-    while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
+    // Make the new moves, if any
+    for (size_t i = LastPos.moves.size(); i < moves.size() && (m = UCI::to_move(pos, moves[i])) != MOVE_NONE; ++i)
     {
         states->emplace_back();
         pos.do_move(m, states->back());
+        LastPos.moves.push_back(moves[i]);
     }
 
+    LastPos.key = pos.key();
+
     static constexpr Key StartPosKey = 0xB4D30CD15A43432D;
-    if (firstKey == StartPosKey && pos.game_ply() == 0)
+    if (LastPos.firstKey == StartPosKey && pos.game_ply() == 0)
         Experience::resume_learning();
   }
 
@@ -101,6 +149,8 @@ namespace {
 
   void setoption(istringstream& is) {
 
+    Threads.main()->wait_for_search_finished();
+
     string token, name, value;
 
     is >> token; // Consume the "name" token
@@ -120,6 +170,67 @@ namespace {
   }
 
 
+  // hash_file() is called when the engine receives the "savehash" or "loadhash"
+  // command. The file name defaults to the "Hash File" option.
+
+  void hash_file(istringstream& is, bool save) {
+
+    string filename;
+    getline(is >> ws, filename);
+
+    if (filename.empty())
+        filename = string(Options["Hash File"]);
+
+    if (Utility::is_empty_filename(filename))
+    {
+        sync_cout << "info string No hash file given" << sync_endl;
+        return;
+    }
+
+    filename = Utility::map_path(filename);
+    save ? TT.save(filename) : TT.load(filename);
+  }
+
+
+  // eval_cache_stats() returns the hit rate of the evaluation caches of all
+  // threads since they were last cleared
+
+  string eval_cache_stats() {
+
+    uint64_t hits = 0, probes = 0;
+    for (Thread* th : Threads)
+        hits += th->evalCache.hits, probes += th->evalCache.probes;
+
+    stringstream ss;
+    ss << "Eval cache: " << Threads.main()->evalCache.size_mb() << " MB per thread, "
+       << probes << " probes, " << hits << " hits ("
+       << fixed << setprecision(1) << (probes ? 100.0 * hits / probes : 0.0) << "%)";
+
+    return ss.str();
+  }
+
+
+  // pawn_hash_stats() returns the hit rates of the pawn hash tables of all
+  // threads, and of the shared one, since the tables were last resized
+
+  string pawn_hash_stats() {
+
+    uint64_t hits = 0, sharedHits = 0, probes = 0;
+    for (Thread* th : Threads)
+        hits += th->pawnsTable.hits, sharedHits += th->pawnsTable.sharedHits, probes += th->pawnsTable.probes;
+
+    stringstream ss;
+    ss << "Pawn hash: " << Utility::format_bytes(Threads.main()->pawnsTable.size(), 0) << " per thread, "
+       << Utility::format_bytes(Pawns::shared_size(), 0) << " shared, "
+       << probes << " probes, " << hits << " hits ("
+       << fixed << setprecision(1) << (probes ? 100.0 * hits / probes : 0.0) << "%), "
+       << sharedHits << " shared hits ("
+       << (probes ? 100.0 * sharedHits / probes : 0.0) << "%)";
+
+    return ss.str();
+  }
+
+
   // go() is called when the engine receives the "go" UCI command. The function
   // sets the thinking time and other parameters from the input string, then starts
   // with a search.
@@ -157,15 +268,31 @@ namespace {
   // bench() is called when the engine receives the "bench" command.
   // Firstly, a list of UCI commands is set up according to the bench
   // parameters, then it is run one by one, printing a summary at the end.
+  // With a trailing "json" or "csv" parameter the per-position statistics
+  // are also printed to stdout in that format.
 
   void bench(Position& pos, istream& args, StateListPtr& states) {
 
+    struct BenchStat {
+      string fen;
+      uint64_t nodes;
+      TimePoint time, probeTime;
+      int depth, selDepth, hashfull;
+      vector<MainThread::Iteration> iterations;
+    };
+
     string token;
     uint64_t num, nodes = 0, cnt = 1;
+    vector<BenchStat> stats;
 
     vector<string> list = setup_bench(pos, args);
+    string format = (args >> token) ? token : "text";
     num = count_if(list.begin(), list.end(), [](const string& s) { return s.find("go ") == 0 || s.find("eval") == 0; });
 
+    // Searches probe the experience while it loads, wait for it so that
+    // the node counts do not depend on how far loading has got.
+    Experience::wait_for_loading_finished();
+
     TimePoint elapsed = now();
 
     for (const auto& cmd : list)
@@ -178,9 +305,22 @@ namespace {
             cerr << "\nPosition: " << cnt++ << '/' << num << " (" << pos.fen() << ")" << endl;
             if (token == "go")
             {
+               string fen = pos.fen();
+               TimePoint start = now();
+
                go(pos, is, states);
                Threads.main()->wait_for_search_finished();
-               nodes += Threads.nodes_searched();
+
+               // The humanizing logic may reorder the root moves after the
+               // search, so take the deepest line rather than rootMoves[0].
+               MainThread* mainThread = Threads.main();
+               int selDepth = 0;
+               for (const auto& rm : mainThread->rootMoves)
+                   selDepth = std::max(selDepth, rm.selDepth);
+
+               stats.push_back({ fen, Threads.nodes_searched(), now() - start, mainThread->probeTime,
+                                 int(mainThread->completedDepth), selDepth, TT.hashfull(), mainThread->iterations });
+               nodes += stats.back().nodes;
             }
             else
                trace_eval(pos);
@@ -192,12 +332,394 @@ namespace {
 
     elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
 
+    TimePoint probeTime = 0;
+    for (const BenchStat& st : stats)
+        probeTime += st.probeTime;
+
+    // Time to depth: the time the positions took to complete each depth, summed
+    // over the positions that completed it. Positions answered by a book have none.
+    struct DepthStat {
+      int positions = 0;
+      TimePoint time = 0;
+      int researches = 0;
+    };
+
+    vector<DepthStat> ttd;
+    int researches = 0;
+    for (const BenchStat& st : stats)
+        for (const auto& it : st.iterations)
+        {
+            if (int(ttd.size()) <= it.depth)
+                ttd.resize(it.depth + 1);
+
+            ttd[it.depth].positions++;
+            ttd[it.depth].time += it.time;
+            ttd[it.depth].researches += it.researches;
+            researches += it.researches;
+        }
+
     dbg_print();
 
     cerr << "\n==========================="
          << "\nTotal time (ms) : " << elapsed
          << "\nNodes searched  : " << nodes
-         << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+         << "\nNodes/second    : " << 1000 * nodes / elapsed
+         << "\nProbe time (ms) : " << probeTime
+         << "\nRe-searches     : " << researches
+         << "\n" << eval_cache_stats()
+         << "\n" << pawn_hash_stats() << endl;
+
+    cerr << "\nTime to depth (ms, summed over the positions that completed the depth)" << endl;
+    for (size_t d = 1; d < ttd.size(); ++d)
+        if (ttd[d].positions)
+            cerr << "depth " << setw(3) << d << " : " << setw(8) << ttd[d].time
+                 << "  positions " << setw(3) << ttd[d].positions
+                 << "  re-searches " << ttd[d].researches << endl;
+
+    if (format == "csv")
+    {
+        cout << "position,fen,nodes,time_ms,search_ms,probe_ms,nps,depth,seldepth,hashfull\n";
+
+        for (size_t i = 0; i < stats.size(); ++i)
+        {
+            const BenchStat& st = stats[i];
+            cout << i + 1 << ",\"" << st.fen << "\"," << st.nodes << "," << st.time << ","
+                 << st.time - st.probeTime << "," << st.probeTime << ","
+                 << 1000 * st.nodes / (st.time + 1) << "," << st.depth << ","
+                 << st.selDepth << "," << st.hashfull << "\n";
+        }
+        cout << flush;
+    }
+    else if (format == "json")
+    {
+        cout << "{\"time_ms\":" << elapsed
+             << ",\"nodes\":" << nodes
+             << ",\"nps\":" << 1000 * nodes / elapsed
+             << ",\"probe_ms\":" << probeTime
+             << ",\"researches\":" << researches
+             << ",\"time_to_depth\":[";
+
+        bool first = true;
+        for (size_t d = 1; d < ttd.size(); ++d)
+            if (ttd[d].positions)
+            {
+                cout << (first ? "" : ",")
+                     << "{\"depth\":" << d
+                     << ",\"time_ms\":" << ttd[d].time
+                     << ",\"positions\":" << ttd[d].positions
+                     << ",\"researches\":" << ttd[d].researches << "}";
+                first = false;
+            }
+
+        cout << "],\"positions\":[";
+
+        for (size_t i = 0; i < stats.size(); ++i)
+        {
+            const BenchStat& st = stats[i];
+            cout << (i ? "," : "")
+                 << "{\"fen\":\"" << st.fen << "\""
+                 << ",\"nodes\":" << st.nodes
+                 << ",\"time_ms\":" << st.time
+                 << ",\"search_ms\":" << st.time - st.probeTime
+                 << ",\"probe_ms\":" << st.probeTime
+                 << ",\"nps\":" << 1000 * st.nodes / (st.time + 1)
+                 << ",\"depth\":" << st.depth
+                 << ",\"seldepth\":" << st.selDepth
+                 << ",\"hashfull\":" << st.hashfull << "}";
+        }
+        cout << "]}" << endl;
+    }
+  }
+
+  // movepick_bench() is called when the engine receives the "movepickbench"
+  // command. It times the MovePicker alone: the history tables are filled with
+  // random values, and for every bench position all the moves are picked at a
+  // few main search depths and in the quiescence search. The optional argument
+  // is the number of iterations per position. Of the bench setoption commands
+  // only UCI_Chess960 is applied, and it is restored at the end, so that the
+  // Threads and Hash set by the user are kept.
+
+  void movepick_bench(Position& pos, istream& args, StateListPtr& states) {
+
+    int iterations = 1000;
+    args >> iterations;
+
+    auto mainHistory    = make_unique<ButterflyHistory>();
+    auto captureHistory = make_unique<CapturePieceToHistory>();
+    auto contHistory    = make_unique<PieceToHistory[]>(6);
+
+    PRNG rng(1070372);
+    auto random = [&](int d) { return int16_t(int(rng.rand<uint32_t>() % (2 * d + 1)) - d); };
+
+    for (Color c : { WHITE, BLACK })
+        for (int i = 0; i < SQUARE_NB * SQUARE_NB; ++i)
+            (*mainHistory)[c][i] = random(7183);
+
+    for (Piece pc = NO_PIECE; pc < PIECE_NB; ++pc)
+        for (Square s = SQ_A1; s <= SQ_H8; ++s)
+        {
+            for (PieceType pt = NO_PIECE_TYPE; pt < PIECE_TYPE_NB; ++pt)
+                (*captureHistory)[pc][s][pt] = random(10692);
+
+            for (int k = 0; k < 6; ++k)
+                contHistory[k][pc][s] = random(29952);
+        }
+
+    const PieceToHistory* contHist[] = { &contHistory[0], &contHistory[1], &contHistory[2],
+                                         &contHistory[3], &contHistory[4], &contHistory[5] };
+    const Move killers[] = { MOVE_NONE, MOVE_NONE };
+
+    istringstream benchArgs("16 1 1 default depth");
+    vector<string> list = setup_bench(pos, benchArgs);
+    bool chess960 = Options["UCI_Chess960"];
+    uint64_t positions = 0, moves = 0;
+    TimePoint elapsed = 0;
+    string token;
+
+    for (const auto& cmd : list)
+    {
+        istringstream is(cmd);
+        is >> skipws >> token;
+
+        if (token == "setoption" && cmd.find("UCI_Chess960") != string::npos)
+            setoption(is);
+
+        else if (token == "position")
+        {
+            position(pos, is, states);
+            ++positions;
+
+            TimePoint start = now();
+
+            for (int i = 0; i < iterations; ++i)
+            {
+                for (Depth d : { 1, 4, 8, 16 })
+                {
+                    MovePicker mp(pos, MOVE_NONE, d, mainHistory.get(), captureHistory.get(),
+                                  contHist, MOVE_NONE, killers);
+                    while (mp.next_move() != MOVE_NONE)
+                        ++moves;
+                }
+
+                MovePicker mp(pos, MOVE_NONE, DEPTH_QS_CHECKS, mainHistory.get(), captureHistory.get(),
+                              contHist, SQ_NONE);
+                while (mp.next_move() != MOVE_NONE)
+                    ++moves;
+            }
+
+            elapsed += now() - start;
+        }
+    }
+
+    Options["UCI_Chess960"] = string(chess960 ? "true" : "false");
+
+    elapsed += 1; // Ensure positivity to avoid a 'divide by zero'
+
+    sync_cout << "info string movepick positions " << positions
+              << " iterations " << iterations
+              << " moves " << moves
+              << " time " << elapsed
+              << " moves/second " << 1000 * moves / elapsed << sync_endl;
+  }
+
+  // read_fens() reads the positions of a FEN or EPD file, returns false if the
+  // file can not be opened
+
+  bool read_fens(const string& file, vector<string>& fens) {
+
+    ifstream in(file);
+    string line;
+
+    if (!in.is_open())
+    {
+        sync_cout << "info string Unable to open file " << file << sync_endl;
+        return false;
+    }
+
+    // An EPD line has the first four FEN fields, then operations like "bm e4;"
+    while (getline(in, line))
+    {
+        istringstream ss(line);
+        string field, fen;
+        int fields = 0;
+
+        while (fields < 6 && ss >> field)
+        {
+            if (fields >= 4 && field.find_first_not_of("0123456789") != string::npos)
+                break;
+
+            fen += field + " ";
+            ++fields;
+        }
+
+        if (fields >= 4)
+            fens.push_back(fen);
+    }
+
+    return true;
+  }
+
+  // analyze() is called when the engine receives the "analyze" command. Every
+  // position of a FEN or EPD file is searched to a fixed depth by one of several
+  // single threaded searches running at the same time, one line per position.
+  // The optional arguments are the depth and the number of searches, by default
+  // one per hardware thread.
+
+  void analyze(istream& args) {
+
+    string file;
+    int depth = 12, workers = int(std::max(1u, std::thread::hardware_concurrency()));
+    vector<string> fens;
+
+    args >> file >> depth >> workers;
+
+    if (read_fens(file, fens))
+        Search::analyze(fens, Depth(depth), size_t(workers));
+  }
+
+  // evaltrace() is called when the engine receives the "evaltrace" command. The
+  // classical evaluation terms of every position of a FEN or EPD file are written
+  // to the output file as CSV, or as binary records with "bin". The optional last
+  // argument is the number of threads, by default one per hardware thread.
+
+  void evaltrace(istream& args) {
+
+    string file, output, format = "csv";
+    int workers = int(std::max(1u, std::thread::hardware_concurrency()));
+    vector<string> fens;
+
+    args >> file >> output >> format >> workers;
+
+    if (output.empty() || (format != "csv" && format != "bin"))
+    {
+        sync_cout << "info string Usage: evaltrace <file> <output> [csv|bin] [workers]" << sync_endl;
+        return;
+    }
+
+    if (read_fens(file, fens))
+        Eval::trace_batch(fens, output, format == "bin", size_t(workers));
+  }
+
+  // selfplay() is called when the engine receives the "selfplay" command, as in
+  // "selfplay data.bin games 1000 nodes 5000". It plays games of the engine
+  // against itself on all hardware threads and writes the positions, with their
+  // scores and the game results, to the file. The keywords are games, depth
+  // or nodes, workers, and random for the random plies after the book moves.
+
+  void selfplay(istream& args) {
+
+    Search::LimitsType limits;
+    string file, token;
+    uint64_t games = 100;
+    int workers = int(std::max(1u, std::thread::hardware_concurrency()));
+    int randomPlies = 8;
+
+    args >> file;
+
+    while (args >> token)
+        if (token == "games")        args >> games;
+        else if (token == "depth")   args >> limits.depth;
+        else if (token == "nodes")   args >> limits.nodes;
+        else if (token == "workers") args >> workers;
+        else if (token == "random")  args >> randomPlies;
+
+    if (!limits.depth && !limits.nodes)
+        limits.depth = 8;
+
+    limits.startTime = now();
+
+    SelfPlay::generate(file, games, limits, size_t(workers), randomPlies);
+  }
+
+  // match() is called when the engine receives the "match" command, as in
+  // "match games 1000 nodes 5000 first name NNUE Classical Blend value 20". It
+  // plays games between two configurations of the engine on all hardware
+  // threads, see SelfPlay::match(). After "first" and "second" come the options
+  // that each of them changes, as in "setoption": "name" and "value" repeated
+  // for every option, so names and values may contain spaces. The shorter
+  // "first Eval Cache=4, Pawn Hash=16" form is accepted as well. The other
+  // keywords are the same as for "selfplay".
+
+  void match(istream& args) {
+
+    Search::LimitsType limits;
+    SelfPlay::OptionSet sides[2];
+    string token;
+    uint64_t games = 100;
+    int workers = int(std::max(1u, std::thread::hardware_concurrency()));
+    int randomPlies = 8;
+
+    // Reads the options of a side up to the next keyword
+    auto read_options = [&](SelfPlay::OptionSet& set) {
+        vector<string> words;
+        while (args >> token && token != "first" && token != "second" && token != "games"
+               && token != "depth" && token != "nodes" && token != "workers" && token != "random")
+            words.push_back(token);
+
+        // "name <id> value <x>" pairs, as in setoption()
+        if (!words.empty() && words[0] == "name")
+        {
+            string* field = nullptr;
+            for (const string& w : words)
+            {
+                if (w == "name")
+                {
+                    set.emplace_back();
+                    field = &set.back().first;
+                }
+                else if (w == "value" && field == &set.back().first)
+                    field = &set.back().second;
+                else
+                    *field += (field->empty() ? "" : " ") + w;
+            }
+            return;
+        }
+
+        auto trim = [](string str) {
+            str.erase(0, str.find_first_not_of(' '));
+            str.erase(str.find_last_not_of(' ') + 1);
+            return str;
+        };
+
+        string list;
+        for (const string& w : words)
+            list += (list.empty() ? "" : " ") + w;
+
+        istringstream ls(list);
+        string item;
+        while (getline(ls, item, ','))
+        {
+            size_t eq = item.find('=');
+            if (eq != string::npos)
+                set.emplace_back(trim(item.substr(0, eq)), trim(item.substr(eq + 1)));
+        }
+    };
+
+    bool more = bool(args >> token);
+    while (more)
+    {
+        if (token == "first" || token == "second")
+        {
+            read_options(sides[token == "second"]);
+            more = !args.fail();
+            continue;
+        }
+
+        if (token == "games")        args >> games;
+        else if (token == "depth")   args >> limits.depth;
+        else if (token == "nodes")   args >> limits.nodes;
+        else if (token == "workers") args >> workers;
+        else if (token == "random")  args >> randomPlies;
+
+        more = bool(args >> token);
+    }
+
+    if (!limits.depth && !limits.nodes)
+        limits.nodes = 10000;
+
+    limits.startTime = now();
+
+    SelfPlay::match(games, limits, size_t(workers), randomPlies, sides[0], sides[1]);
   }
 
   // The win rate model returns the probability of winning (in per mille units) given an
@@ -225,6 +747,72 @@ namespace {
 } // namespace
 
 
+/// UCI::memory_report() prints the bytes used by each subsystem, followed by
+/// their sum and the kind of pages backing the transposition table, the only
+/// table allocated with large pages. The mapped book and experience files are
+/// counted although the kernel can share their pages with other processes. An
+/// experience file still loading is reported as such rather than waited for.
+
+void UCI::memory_report() {
+
+  std::vector<std::pair<string, size_t>> parts;
+
+  parts.emplace_back("hash", TT.size());
+
+  size_t histories = 0, pawns = 0, material = 0, evalCache = 0;
+  for (Thread* th : Threads)
+  {
+      histories +=  sizeof(th->counterMoves) + sizeof(th->mainHistory)
+                  + sizeof(th->captureHistory) + sizeof(th->continuationHistory);
+      pawns     += th->pawnsTable.size();
+      material  += th->materialTable.size();
+      evalCache += th->evalCache.size();
+  }
+  parts.emplace_back("histories", histories);
+  parts.emplace_back("pawn hash", pawns);
+  parts.emplace_back("pawn hash shared", Pawns::shared_size());
+  parts.emplace_back("material hash", material);
+  parts.emplace_back("material hash shared", Material::shared_size());
+  parts.emplace_back("eval cache", evalCache);
+  parts.emplace_back("perft hash", Search::perft_hash_size());
+
+  bool expLoading = Experience::loading();
+  if (!expLoading)
+      for (auto& [name, bytes] : Experience::memory())
+          parts.emplace_back("experience " + name, bytes);
+
+  for (int i = 0; i < 2; ++i)
+  {
+      auto [mapped, index] = polybook[i].memory();
+      parts.emplace_back("book" + std::to_string(i + 1) + " file", mapped);
+      parts.emplace_back("book" + std::to_string(i + 1) + " index", index);
+  }
+
+  parts.emplace_back("bitboards", Bitboards::memory());
+  parts.emplace_back("kpk bitbase", Bitbases::memory());
+  parts.emplace_back("nnue", Eval::NNUE::memory());
+
+  size_t total = 0;
+  stringstream ss;
+  for (auto& [name, bytes] : parts)
+  {
+      ss << "info string memory " << name << " " << bytes
+         << " (" << Utility::format_bytes(bytes, 1) << ")\n";
+      total += bytes;
+  }
+
+  if (expLoading)
+      ss << "info string memory experience loading, not counted\n";
+
+  string pages = TT.large_pages();
+  ss << "info string memory total " << total << " (" << Utility::format_bytes(total, 1) << ")"
+     << " with " << Threads.size() << (Threads.size() > 1 ? " threads" : " thread") << "\n"
+     << "info string memory hash pages: " << (pages.empty() ? "unknown" : pages);
+
+  sync_cout << ss.str() << sync_endl;
+}
+
+
 /// UCI::loop() waits for a command from the stdin, parses it and then calls the appropriate
 /// function. It also intercepts an end-of-file (EOF) indication from the stdin to ensure a
 /// graceful exit if the GUI dies unexpectedly. When called with some command-line arguments,
@@ -271,13 +859,7 @@ void UCI::loop(int argc, char* argv[]) {
       else if (token == "go")         go(pos, is, states);
       else if (token == "position")   position(pos, is, states);
       else if (token == "ucinewgame") Search::clear();
-      else if (token == "isready")
-      {
-          //Make sure experience has finished loading
-          Experience::wait_for_loading_finished();
-
-          sync_cout << "readyok" << sync_endl;
-      }
+      else if (token == "isready")    sync_cout << "readyok" << sync_endl;
 
       // Add custom non-UCI commands, mainly for debugging purposes.
       // These commands must not be used during a search!
@@ -286,10 +868,30 @@ void UCI::loop(int argc, char* argv[]) {
       else if (token == "d")        sync_cout << pos << sync_endl;
       else if (token == "eval")     trace_eval(pos);
       else if (token == "compiler") sync_cout << compiler_info() << sync_endl;
+      else if (token == "startup")  Startup::report();
+      else if (token == "numa")     sync_cout << WinProcGroup::topology() << sync_endl;
+      else if (token == "evalcache") sync_cout << "info string " << eval_cache_stats() << sync_endl;
+      else if (token == "movepickbench") movepick_bench(pos, is, states);
+      else if (token == "analyze")  analyze(is);
+      else if (token == "evaltrace") evaltrace(is);
+      else if (token == "selfplay") selfplay(is);
+      else if (token == "match")    match(is);
+      else if (token == "pawnhash") sync_cout << "info string " << pawn_hash_stats() << sync_endl;
+      else if (token == "memory")   memory_report();
+      else if (token == "searchstats")
+      {
+          if (is >> token && token == "clear")
+              Search::clear_stats();
+          else
+              Search::print_stats();
+      }
+      else if (token == "savehash") hash_file(is, true);
+      else if (token == "loadhash") hash_file(is, false);
       else if (argc > 2 && token == "defrag")   Experience::defrag(argc - 2, argv + 2);
       else if (argc > 2 && token == "merge")    Experience::merge(argc - 2, argv + 2);
       else if (token == "exp")                  Experience::show_exp(pos, false);
       else if (token == "expex")                Experience::show_exp(pos, true);
+      else if (token == "expbook")              Experience::export_book(pos, is);
       else if (argc > 2 && token == "convert_compact_pgn") Experience::convert_compact_pgn(argc - 2, argv + 2);
       else if (token == "--help" || token == "help" || token == "--license" || token == "license")
           sync_cout << "\nStockfish is a powerful chess engine for playing and analyzing."
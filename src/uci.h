@@ -57,6 +57,7 @@ public:
   operator int() const;
   operator std::string() const;
   bool operator==(const char*) const;
+  const std::string& current_value() const { return currentValue; }
 
 private:
   friend std::ostream& operator<<(std::ostream&, const OptionsMap&);
@@ -69,10 +70,11 @@ private:
 
 void init(OptionsMap&);
 void loop(int argc, char* argv[]);
+void memory_report();
 std::string value(Value v);
 std::string square(Square s);
 std::string move(Move m, bool chess960);
-std::string pv(const Position& pos, Depth depth);
+const std::string& pv(const Position& pos, Depth depth); // Valid until the next call
 std::string wdl(Value v, int ply);
 Move to_move(const Position& pos, std::string& str);
 
@@ -24,12 +24,15 @@
 #include "evaluate.h"
 #include "experience.h"
 #include "misc.h"
+#include "pawns.h"
 #include "search.h"
 #include "thread.h"
 #include "tt.h"
 #include "uci.h"
 #include "polybook.h"
+#include "syzygy/tbprobe.h"
 #include "personalities/personality.h"
+#include "nnue/evaluate_nnue.h"
 
 using std::string;
 
@@ -47,8 +50,39 @@ bool personalityChanged = true; // Global variable
 /// 'On change' actions, triggered by an option's value change
 static void on_clear_hash(const Option&) { Search::clear(); }
 static void on_hash_size(const Option& o) { TT.resize(size_t(o)); }
+static void on_large_pages(const Option& o) {
+    LargePages::set_mode(  o == "1GB" ? LargePages::Huge1GB
+                         : o == "2MB" ? LargePages::Huge2MB : LargePages::Transparent);
+    TT.resize(size_t(Options["Hash"]));
+}
+static void on_hash_file(const Option& o) {
+    std::string f = Utility::map_path(std::string(o));
+    if (!Utility::is_empty_filename(f) && Utility::file_exists(f))
+        TT.load(f);
+}
+static void on_memory_report(const Option& o) { if (o) memory_report(); }
 static void on_logger(const Option& o) { start_logger(o); }
+static void on_logger_format(const Option&) {
+    configure_logger(Options["Debug Log Timestamps"], Options["Debug Log Flush"]);
+}
+static void on_eval_cache(const Option& o) {
+    Threads.main()->wait_for_search_finished();
+    for (Thread* th : Threads)
+        th->evalCache.resize(size_t(o));
+}
+static void on_pawn_hash(const Option& o) {
+    Threads.main()->wait_for_search_finished();
+    for (Thread* th : Threads)
+        th->pawnsTable.resize(size_t(o));
+}
+static void on_pawn_hash_shared(const Option& o) {
+    Threads.main()->wait_for_search_finished();
+    Pawns::resize_shared(size_t(o));
+}
 static void on_threads(const Option& o) { Threads.set(size_t(o)); }
+static void on_eval_file(const Option& /*o*/) { Eval::NNUE::init(); }
+static void on_classical_blend(const Option& o) { Eval::ClassicalBlend = int(o); }
+static void on_tb_path(const Option& o) { Tablebases::init(o); }
 static void on_exp_enabled(const Option& /*o*/) { Experience::init(); }
 static void on_exp_file(const Option& /*o*/) { Experience::init(); }
 
@@ -59,8 +93,6 @@ static void on_book_file(const Option& o) {
     activePersonality.BookFile = newBookFile;
     polybook[0].init(newBookFile);
     previousBookFile = newBookFile;
-
-    std::cout << "info string Book loaded: " << newBookFile << std::endl;
 }
 
 void sync_uci_options() {
@@ -94,17 +126,38 @@ void init(OptionsMap& o) {
     activePersonality.PersonalityBook = true;
 
     o["Debug Log File"]        << Option("", on_logger);
-    o["Threads"]               << Option(1, 1, 1, on_threads);
+    o["Debug Log Timestamps"]  << Option(false, on_logger_format);
+    o["Debug Log Flush"]       << Option(0, 0, 60000, on_logger_format);
+    o["Debug Hash"]            << Option(false);
+    o["Threads"]               << Option(1, 1, 1024, on_threads);
     o["Hash"]                  << Option(16, 1, MaxHashMB, on_hash_size);
+    o["Large Pages"]           << Option("Transparent var Transparent var 2MB var 1GB", "Transparent", on_large_pages);
     o["Clear Hash"]            << Option(on_clear_hash);
+    o["History Warm Start"]    << Option(0, 0, 100);
+    o["Hash File"]             << Option(EMPTY, on_hash_file);
+    o["Eval Cache"]            << Option(0, 0, 1024, on_eval_cache);
+    o["Pawn Hash"]             << Option(12, 1, 1024, on_pawn_hash);
+    o["Pawn Hash Shared"]      << Option(0, 0, 4096, on_pawn_hash_shared);
+    o["Perft Hash"]            << Option(64, 0, 4096);
+    o["Memory Report"]         << Option(false, on_memory_report);
+    o["Use NNUE"]              << Option(false, on_eval_file);
+    o["EvalFile"]              << Option(EMPTY, on_eval_file);
+    o["NNUE Classical Blend"]  << Option(0, 0, 100, on_classical_blend);
     o["Ponder"]                << Option(false);
     o["MultiPV"]               << Option(1, 1, 500);
     o["Skill Level"]           << Option(20, 0, 20);
     o["Move Overhead"]         << Option(10, 0, 5000);
     o["Slow Mover"]            << Option(100, 10, 1000);
     o["nodestime"]             << Option(0, 0, 10000);
+    o["Iteration Timing"]      << Option(false);
     o["UCI_Chess960"]          << Option(false);
     o["UCI_ShowWDL"]           << Option(false);
+    o["UCI PV Interval"]       << Option(0, 0, 60000);
+    o["UCI PV Changed Only"]   << Option(false);
+    o["SyzygyPath"]            << Option("<empty>", on_tb_path);
+    o["SyzygyProbeDepth"]      << Option(1, 1, 100);
+    o["Syzygy50MoveRule"]      << Option(true);
+    o["SyzygyProbeLimit"]      << Option(7, 0, 7);
     o["Personality"]           << Option(false);
 
     o["Elo"] << Option(1320, 1320, 3190, [](const Option& v) {
@@ -141,6 +194,7 @@ void init(OptionsMap& o) {
             std::cout << "info string TrainingMode activated automatically for Elo <= 1600" << std::endl;
         }
     });
+    o["Elo Node Budget"]       << Option(false);
 
     // Book Options
     o["PersonalityBook"]   << Option(true, [](const Option& v) { activePersonality.PersonalityBook = bool(v); });
@@ -150,11 +204,16 @@ void init(OptionsMap& o) {
     o["Book Depth"]        << Option(1, 1, 30, [](const Option& v) { activePersonality.BookDepth = int(v); });
     o["Experience Enabled"]                  << Option(true, on_exp_enabled);
     o["Experience File"]                     << Option("HumanMind.exp", on_exp_file);
+    o["Experience Mmap"]                     << Option(false, on_exp_file);
+    o["Experience Shared"]                   << Option(false, on_exp_file);
+    o["Experience Journal"]                  << Option(false);
     o["Experience Book"]                     << Option(false);
+    o["Experience Book Wait"]                << Option(false);
     o["Experience Book Best Move"]           << Option(true);
     o["Experience Book Eval Importance"]     << Option(5, 0, 10);
     o["Experience Book Min Depth"]           << Option(27, EXP_MIN_DEPTH, 64);
     o["Experience Book Max Moves"]           << Option(100, 1, 100);
+    o["Experience Prefill Depth"]            << Option(0, 0, 20);
 
     // Human training options
     o["TrainingMode"]      << Option(false, [](const Option& v) { activePersonality.TrainingMode = bool(v); });
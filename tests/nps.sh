@@ -0,0 +1,139 @@
+#!/bin/bash
+# measure search speed and compare it to a stored baseline
+#
+# usage: nps.sh [--update]
+#
+# Runs bench and a fixed nodes suite RUNS times each, pinned to one CPU, and
+# reports the median nodes/second and its spread. The medians are compared to
+# the baseline stored for ARCH, and the test fails if one of them is more than
+# TOLERANCE percent slower. With --update the baseline of ARCH is replaced by
+# the medians just measured.
+#
+# environment:
+#   ENGINE     engine to run (default ./hypnos)
+#   ARCH       build the baseline is stored for (default x86-64-modern)
+#   RUNS       runs per suite (default 5)
+#   CPU        cpu to pin the engine to, empty to disable pinning (default 0)
+#   NODES      nodes per position of the fixed nodes suite (default 200000)
+#   TOLERANCE  allowed slowdown in percent (default 3)
+#   BASELINE   baseline file, one "arch suite nps" line per entry
+#              (default nps.baseline next to this script)
+#   EXPERIENCE experience file copied for every run, empty or missing to
+#              search with an empty one (default HumanMind.exp next to ENGINE)
+#   OPTIONS    commands sent before bench, separated by \n
+
+error()
+{
+  echo "nps testing failed on line $1"
+  exit 1
+}
+trap 'error ${LINENO}' ERR
+
+ENGINE=${ENGINE:-./hypnos}
+ARCH=${ARCH:-x86-64-modern}
+RUNS=${RUNS:-5}
+CPU=${CPU-0}
+NODES=${NODES:-200000}
+TOLERANCE=${TOLERANCE:-3}
+BASELINE=${BASELINE:-$(dirname "$0")/nps.baseline}
+
+EXPERIENCE=${EXPERIENCE-$(dirname "$ENGINE")/HumanMind.exp}
+OPTIONS=${OPTIONS:-}
+
+# Each run searches with a fresh copy of the experience file, the experience
+# learned by one run would change the search of the next ones. The engine
+# never learns into its own file, an empty one is used when there is nothing
+# to copy
+copy=`mktemp --suffix=.exp`
+OPTIONS="$OPTIONS\nsetoption name Experience File value $copy"
+
+update=no
+if [ "$1" == "--update" ]; then
+   update=yes
+fi
+
+pin=""
+if [ -n "$CPU" ] && command -v taskset > /dev/null; then
+   pin="taskset -c $CPU"
+fi
+
+echo "nps testing started ($ARCH, $RUNS runs per suite)"
+
+failed=no
+results=""
+
+# run_suite name bench-arguments...
+run_suite()
+{
+  name=$1
+  shift
+
+  speeds=""
+  signatures=""
+  for run in $(seq $RUNS); do
+     if [ -n "$EXPERIENCE" ] && [ -f "$EXPERIENCE" ]; then
+        cp "$EXPERIENCE" "$copy"
+     else
+        : > "$copy"
+     fi
+     # a crash is reported below, not by the ERR trap
+     output=`printf "$OPTIONS\nbench $*\nquit\n" | eval "$pin $WINE_PATH $ENGINE 2>&1"` || true
+     signature=`echo "$output" | grep "Nodes searched  : " | awk '{print $4}'` || true
+     speed=`echo "$output" | grep "Nodes/second    : " | awk '{print $3}'` || true
+     if [ -z "$speed" ]; then
+        echo "No speed obtained from bench. Code crashed or assert triggered ?"
+        exit 1
+     fi
+     speeds="$speeds $speed"
+     signatures="$signatures $signature"
+  done
+
+  median=`echo $speeds | tr ' ' '\n' | sort -n | awk '{ v[NR] = $1 } END { print (NR % 2) ? v[(NR + 1) / 2] : int((v[NR / 2] + v[NR / 2 + 1]) / 2) }'`
+  spread=`echo $speeds | tr ' ' '\n' | awk '{ s += $1; q += $1 * $1 } END { m = s / NR; v = q / NR - m * m; if (v < 0) v = 0; printf "%.1f", 100 * sqrt(v) / m }'`
+  distinct=`echo $signatures | tr ' ' '\n' | sort -u | wc -l`
+
+  line="$name: median $median nps, stddev $spread%, signature `echo $signatures | awk '{print $1}'`"
+  if [ "$distinct" -gt 1 ]; then
+     line="$line (signatures differ:$signatures)"
+  fi
+
+  reference=""
+  if [ -f "$BASELINE" ]; then
+     reference=`awk -v a="$ARCH" -v s="$name" '$1 == a && $2 == s { print $3 }' "$BASELINE"`
+  fi
+
+  if [ -n "$reference" ]; then
+     change=`awk -v m=$median -v r=$reference 'BEGIN { printf "%+.1f", 100 * (m - r) / r }'`
+     line="$line, baseline $reference ($change%)"
+     if awk -v m=$median -v r=$reference -v t=$TOLERANCE 'BEGIN { exit !(100 * m < (100 - t) * r) }'; then
+        line="$line SLOWER"
+        failed=yes
+     fi
+  else
+     line="$line, no baseline"
+  fi
+
+  echo "$line"
+  results="$results$ARCH $name $median\n"
+}
+
+run_suite bench
+run_suite nodes 16 1 $NODES default nodes
+
+rm -f "$copy"
+
+if [ "$update" == "yes" ]; then
+   touch "$BASELINE"
+   awk -v a="$ARCH" '$1 != a' "$BASELINE" > "$BASELINE.tmp"
+   printf "$results" >> "$BASELINE.tmp"
+   mv "$BASELINE.tmp" "$BASELINE"
+   echo "baseline for $ARCH updated in $BASELINE"
+   exit 0
+fi
+
+if [ "$failed" == "yes" ]; then
+   echo "nps testing failed: slower than the baseline by more than $TOLERANCE%"
+   exit 1
+fi
+
+echo "nps testing OK"
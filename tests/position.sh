@@ -0,0 +1,71 @@
+#!/bin/bash
+# verify the position command when it extends the previous one
+#
+# usage: position.sh
+#
+# A position command that only adds moves to the previous one makes just the
+# new moves. These sequences change the engine state between the two commands
+# and must neither crash nor leave a position that differs from one set up
+# from scratch.
+#
+# environment:
+#   ENGINE     engine to run (default ./hypnos)
+
+error()
+{
+  echo "position testing failed on line $1"
+  exit 1
+}
+trap 'error ${LINENO}' ERR
+
+ENGINE=${ENGINE:-./hypnos}
+
+echo "position testing started"
+
+# run_engine commands... prints the output of the engine, fails if it crashes
+run_engine()
+{
+  printf "%s\n" "$@" "quit" | eval "$WINE_PATH $ENGINE 2>&1"
+}
+
+# check name commands... runs the commands followed by a short search
+check()
+{
+  name=$1
+  shift
+
+  output=`run_engine "$@" "go depth 6" "isready"` || { echo "$name: engine exited with $?"; exit 1; }
+  if ! echo "$output" | grep -q "^bestmove"; then
+     echo "$name: no bestmove"
+     exit 1
+  fi
+  echo "$name OK"
+}
+
+# The threads are deleted and created again, the position must not keep the old one
+check "threads change" \
+      "position startpos moves e2e4" \
+      "setoption name Threads value 2" \
+      "position startpos moves e2e4 e7e5"
+
+check "threads change back" \
+      "setoption name Threads value 2" \
+      "position startpos moves e2e4" \
+      "setoption name Threads value 1" \
+      "position startpos moves e2e4 e7e5 g1f3"
+
+check "new game" \
+      "position startpos moves d2d4" \
+      "ucinewgame" \
+      "position startpos moves d2d4 d7d5"
+
+# The extended position is the one set up from scratch
+extended=`run_engine "position startpos moves e2e4" "position startpos moves e2e4 e7e5 g1f3" "d" | grep "^Fen"`
+fresh=`run_engine "position startpos moves e2e4 e7e5 g1f3" "d" | grep "^Fen"`
+if [ -z "$fresh" ] || [ "$extended" != "$fresh" ]; then
+   echo "extended position differs: '$extended' instead of '$fresh'"
+   exit 1
+fi
+echo "extended position OK"
+
+echo "position testing OK"